@@ -51,6 +51,7 @@
 #include <unistd.h>
 #include <limits.h>
 #include <netdb.h>
+#include <signal.h>
 #include <time.h>
 
 #include "xmalloc.h"
@@ -76,6 +77,8 @@
 #include "ssherr.h"
 #include "compat.h"
 #include "channels.h"
+#include "dnscache.h"
+#include "atomicio.h"
 
 /* import */
 extern ServerOptions options;
@@ -704,26 +707,12 @@ fakepw(void)
  */
 
 static char *
-remote_hostname(struct ssh *ssh)
+remote_hostname_resolve(struct sockaddr_storage *fromp, socklen_t fromlen,
+    const char *ntop)
 {
-	struct sockaddr_storage from;
-	socklen_t fromlen;
+	struct sockaddr_storage from = *fromp;
 	struct addrinfo hints, *ai, *aitop;
 	char name[NI_MAXHOST], ntop2[NI_MAXHOST];
-	const char *ntop = ssh_remote_ipaddr(ssh);
-
-	/* Get IP address of client. */
-	fromlen = sizeof(from);
-	memset(&from, 0, sizeof(from));
-	if (getpeername(ssh_packet_get_connection_in(ssh),
-	    (struct sockaddr *)&from, &fromlen) == -1) {
-		debug("getpeername failed: %.100s", strerror(errno));
-		return xstrdup(ntop);
-	}
-
-	ipv64_normalise_mapped(&from, &fromlen);
-	if (from.ss_family == AF_INET6)
-		fromlen = sizeof(struct sockaddr_in6);
 
 	debug3("Trying to reverse map address %.100s.", ntop);
 	/* Map the IP address to a host name. */
@@ -786,6 +775,94 @@ remote_hostname(struct ssh *ssh)
 	return xstrdup(name);
 }
 
+/*
+ * Resolve in a subprocess so that a slow resolver cannot hold up
+ * authentication for longer than DNSTimeout.
+ */
+static char *
+remote_hostname_timeout(struct sockaddr_storage *from, socklen_t fromlen,
+    const char *ntop, int timeout)
+{
+	char name[NI_MAXHOST], *cp;
+	int p[2], timeout_ms = timeout * 1000, status;
+	size_t len = 0;
+	ssize_t n;
+	pid_t pid;
+
+	if (pipe(p) == -1) {
+		error_f("pipe: %s", strerror(errno));
+		return remote_hostname_resolve(from, fromlen, ntop);
+	}
+	if ((pid = fork()) == -1) {
+		error_f("fork: %s", strerror(errno));
+		close(p[0]);
+		close(p[1]);
+		return remote_hostname_resolve(from, fromlen, ntop);
+	}
+	if (pid == 0) {
+		close(p[0]);
+		cp = remote_hostname_resolve(from, fromlen, ntop);
+		(void)atomicio(vwrite, p[1], cp, strlen(cp));
+		_exit(0);
+	}
+	close(p[1]);
+	while (len < sizeof(name) - 1) {
+		if (waitrfd(p[0], &timeout_ms) == -1) {
+			if (errno == ETIMEDOUT) {
+				logit("Reverse mapping of %.100s timed out "
+				    "after %d seconds", ntop, timeout);
+				kill(pid, SIGKILL);
+				len = 0;
+			}
+			break;
+		}
+		if ((n = read(p[0], name + len, sizeof(name) - 1 - len)) <= 0)
+			break;
+		len += n;
+	}
+	close(p[0]);
+	while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+		;
+	name[len] = '\0';
+	return xstrdup(len == 0 ? ntop : name);
+}
+
+static char *
+remote_hostname(struct ssh *ssh)
+{
+	struct sockaddr_storage from;
+	socklen_t fromlen;
+	const char *ntop = ssh_remote_ipaddr(ssh);
+	char *name;
+
+	/* The listener may already know the answer */
+	if (dnscache_lookup(ntop, &name)) {
+		debug3("Using cached reverse mapping for %.100s.", ntop);
+		return name == NULL ? xstrdup(ntop) : name;
+	}
+
+	/* Get IP address of client. */
+	fromlen = sizeof(from);
+	memset(&from, 0, sizeof(from));
+	if (getpeername(ssh_packet_get_connection_in(ssh),
+	    (struct sockaddr *)&from, &fromlen) == -1) {
+		debug("getpeername failed: %.100s", strerror(errno));
+		return xstrdup(ntop);
+	}
+
+	ipv64_normalise_mapped(&from, &fromlen);
+	if (from.ss_family == AF_INET6)
+		fromlen = sizeof(struct sockaddr_in6);
+
+	if (options.dns_timeout > 0)
+		name = remote_hostname_timeout(&from, fromlen, ntop,
+		    options.dns_timeout);
+	else
+		name = remote_hostname_resolve(&from, fromlen, ntop);
+	dnscache_report(ntop, strcmp(name, ntop) == 0 ? NULL : name);
+	return name;
+}
+
 /*
  * Return the canonical name of the host in the other side of the current
  * connection.  The host name is cached, so it is efficient to call this
@@ -210,6 +210,17 @@ int	 get_hostkey_index(struct sshkey *, int, struct ssh *);
 int	 sshd_hostkey_sign(struct ssh *, struct sshkey *, struct sshkey *,
     u_char **, size_t *, const u_char *, size_t, const char *);
 
+/* A single hostkeys-prove-00@openssh.com signature */
+struct hostkey_proof {
+	int		 ndx;		/* hostkey index */
+	char		*alg;		/* signature algorithm or NULL */
+	u_char		*sig;		/* filled in by signer */
+	size_t		 slen;
+};
+int	 sshd_hostkey_sign_proofs(struct ssh *, struct hostkey_proof *, u_int);
+int	 hostkey_sign_proofs(struct ssh *, const u_char *, size_t, u_int, int,
+    struct hostkey_proof *, u_int);
+
 /* Key / cert options linkage to auth layer */
 const struct sshauthopt *auth_options(struct ssh *);
 int	 auth_activate_options(struct ssh *, struct sshauthopt *);
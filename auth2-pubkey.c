@@ -614,8 +614,6 @@ check_authkey_line(struct ssh *ssh, struct passwd *pw, struct sshkey *key,
 		goto out;
 	}
 
-	/* XXX djm: peek at key type in line and skip if unwanted */
-
 	if (sshkey_read(found, &cp) != 0) {
 		/* no key?  check for options */
 		debug2("%s: check options: '%s'", loc, cp);
@@ -741,12 +739,23 @@ check_authkeys_file(struct ssh *ssh, struct passwd *pw, FILE *f,
 {
 	char *cp, *line = NULL, loc[256];
 	size_t linesize = 0;
-	int found_key = 0;
-	u_long linenum = 0, nonblank = 0;
+	int r, found_key = 0;
+	u_long linenum = 0, nonblank = 0, skipped = 0;
+	struct sshbuf *want, *blob;
 
 	if (authoptsp != NULL)
 		*authoptsp = NULL;
 
+	/*
+	 * Lines can only match the key itself or, for a certificate, its CA.
+	 * Compare their raw blobs first and only parse candidate keys.
+	 */
+	if ((want = sshbuf_new()) == NULL || (blob = sshbuf_new()) == NULL)
+		fatal_f("sshbuf_new failed");
+	if ((r = sshkey_putb(sshkey_is_cert(key) ?
+	    key->cert->signature_key : key, want)) != 0)
+		fatal_fr(r, "sshkey_putb");
+
 	while (getline(&line, &linesize, f) != -1) {
 		linenum++;
 		/* Always consume entire file */
@@ -760,12 +769,20 @@ check_authkeys_file(struct ssh *ssh, struct passwd *pw, FILE *f,
 			continue;
 
 		nonblank++;
+		if (sshkey_line_blob(cp, blob) == 0 &&
+		    !sshkey_blob_may_equal(blob, want)) {
+			skipped++;
+			continue;
+		}
 		snprintf(loc, sizeof(loc), "%.200s:%lu", file, linenum);
 		if (check_authkey_line(ssh, pw, key, cp, loc, authoptsp) == 0)
 			found_key = 1;
 	}
 	free(line);
-	debug2_f("%s: processed %lu/%lu lines", file, nonblank, linenum);
+	sshbuf_free(want);
+	sshbuf_free(blob);
+	debug2_f("%s: processed %lu/%lu lines, %lu skipped unparsed", file,
+	    nonblank, linenum, skipped);
 	return found_key;
 }
 
@@ -488,6 +488,23 @@ sshkey_advance_past_options(char **cpp)
 	return (*cp == '\0' && quoted) ? -1 : 0;
 }
 
+/*
+ * Decodes the key blob of an authorized_keys-format line, which may start
+ * with options, without constructing the key. See sshkey_read_blob().
+ */
+int
+sshkey_line_blob(char *cp, struct sshbuf *blob)
+{
+	if (sshkey_read_blob(blob, &cp) == 0)
+		return 0;
+	/* no key? Skip options */
+	if (sshkey_advance_past_options(&cp) != 0)
+		return SSH_ERR_INVALID_FORMAT;
+	for (; *cp == ' ' || *cp == '\t'; cp++)
+		;
+	return sshkey_read_blob(blob, &cp);
+}
+
 /* Save a public key */
 int
 sshkey_save_public(const struct sshkey *key, const char *path,
@@ -48,6 +48,7 @@ int sshkey_perm_ok(int, const char *);
 int sshkey_in_file(struct sshkey *, const char *, int, int);
 int sshkey_check_revoked(struct sshkey *key, const char *revoked_keys_file);
 int sshkey_advance_past_options(char **cpp);
+int sshkey_line_blob(char *, struct sshbuf *);
 int sshkey_save_public(const struct sshkey *key, const char *path,
     const char *comment);
 
@@ -0,0 +1,386 @@
+/*
+ * Copyright (c) 2026 Pittsburgh Supercomputing Center. All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Base64 as in RFC 4648, with the calling conventions of the resolver's
+ * b64_ntop() and b64_pton().
+ *
+ * The scalar paths use a 256-entry decoding table and handle a whole
+ * quantum of four characters at a time, so the common case has no
+ * strchr() and no per-character state machine. With AVX2, 24 bytes are
+ * encoded or decoded per step; a block that contains anything other
+ * than the 64 alphabet characters (whitespace, padding or garbage) is left
+ * to the scalar code, which reproduces the original behaviour exactly.
+ */
+
+#include "includes.h"
+
+#include <sys/types.h>
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(HAVE_IMMINTRIN_H) && defined(HAVE_CPUID_H) && \
+    defined(__x86_64__) && defined(__GNUC__)
+# define B64_AVX2
+# include <immintrin.h>
+# include <cpuid.h>
+#endif
+
+#include "b64.h"
+
+static const char b64_enc[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+#define B64_PAD	'='
+
+/* Decoding table: a 6-bit value, whitespace, or anything else */
+#define SP	0x40
+#define XX	0x80
+static const u_char b64_dec[256] = {
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, SP, SP, SP, SP, SP, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	SP, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, 62, XX, XX, XX, 63,
+	52, 53, 54, 55, 56, 57, 58, 59, 60, 61, XX, XX, XX, XX, XX, XX,
+	XX,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, XX, XX, XX, XX, XX,
+	XX, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+};
+#undef SP
+#undef XX
+#define B64_SPACE	0x40
+#define B64_BAD		0x80
+
+#ifdef B64_AVX2
+
+#define AVX2	__attribute__((__target__("avx2")))
+
+/* Returns nonzero if the CPU and OS support AVX2 */
+static int
+b64_avx2(void)
+{
+	static int avx2 = -1;
+	u_int a, b, c, d;
+
+	if (avx2 == -1) {
+		avx2 = 0;
+		if (__get_cpuid(1, &a, &b, &c, &d) && (c & bit_OSXSAVE) != 0 &&
+		    __get_cpuid_max(0, NULL) >= 7) {
+			/* the OS must preserve the YMM registers */
+			__asm__ volatile("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+			if ((a & 6) == 6) {
+				__cpuid_count(7, 0, a, b, c, d);
+				avx2 = (b & (1 << 5)) != 0;
+			}
+		}
+	}
+	return avx2;
+}
+
+/*
+ * Encode 24 bytes per step while at least 28 remain (each lane loads 16
+ * bytes but uses 12). Advances *ip and *op past what was done.
+ */
+static void AVX2
+enc_avx2(const u_char *src, size_t srclen, char *dst, size_t *ip, size_t *op)
+{
+	const __m256i shuf = _mm256_set_epi8(
+	    10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+	    10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+	const __m256i shift = _mm256_setr_epi8(
+	    'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+	    '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+	    '/' - 63, 'A', 0, 0,
+	    'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+	    '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+	    '/' - 63, 'A', 0, 0);
+	__m256i in, t0, t1, idx, res;
+	size_t i = *ip, o = *op;
+
+	for (; i + 28 <= srclen; i += 24, o += 32) {
+		in = _mm256_inserti128_si256(_mm256_castsi128_si256(
+		    _mm_loadu_si128((const __m128i *)(src + i))),
+		    _mm_loadu_si128((const __m128i *)(src + i + 12)), 1);
+		/* each 32-bit word: bytes b1 b0 b2 b1 of a 3-byte group */
+		in = _mm256_shuffle_epi8(in, shuf);
+		/* split into four 6-bit indices, one per byte */
+		t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+		t0 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+		t1 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+		t1 = _mm256_mullo_epi16(t1, _mm256_set1_epi32(0x01000010));
+		idx = _mm256_or_si256(t0, t1);
+		/* map each index range to the offset of its ASCII run */
+		res = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+		res = _mm256_or_si256(res, _mm256_and_si256(_mm256_cmpgt_epi8(
+		    _mm256_set1_epi8(26), idx), _mm256_set1_epi8(13)));
+		res = _mm256_add_epi8(_mm256_shuffle_epi8(shift, res), idx);
+		_mm256_storeu_si256((__m256i *)(dst + o), res);
+	}
+	*ip = i;
+	*op = o;
+}
+
+/*
+ * Decode 32 characters to 24 bytes per step, for as long as they are all
+ * in the alphabet and fit in 'dstlen'. Advances *ip and *op past what was
+ * done, and returns 0 if that was nothing.
+ */
+static int AVX2
+dec_avx2(const u_char *src, size_t srclen, u_char *dst, size_t dstlen,
+    size_t *ip, size_t *op)
+{
+	/* classify by nibbles; a nonzero AND of the two means invalid */
+	const __m256i lut_lo = _mm256_setr_epi8(
+	    0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	    0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+	    0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	    0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m256i lut_hi = _mm256_setr_epi8(
+	    0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+	    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+	    0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+	    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m256i lut_roll = _mm256_setr_epi8(
+	    0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+	    0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+	__m256i in, hi, lo, out;
+	size_t i = *ip, o = *op;
+
+	for (; i + 32 <= srclen && o + 24 <= dstlen; i += 32, o += 24) {
+		in = _mm256_loadu_si256((const __m256i *)(src + i));
+		hi = _mm256_and_si256(_mm256_srli_epi32(in, 4), mask_2f);
+		lo = _mm256_and_si256(in, mask_2f);
+		if (!_mm256_testz_si256(_mm256_shuffle_epi8(lut_lo, lo),
+		    _mm256_shuffle_epi8(lut_hi, hi)))
+			break;
+		in = _mm256_add_epi8(in, _mm256_shuffle_epi8(lut_roll,
+		    _mm256_add_epi8(_mm256_cmpeq_epi8(in, mask_2f), hi)));
+
+		/* pack four 6-bit values per word into three bytes */
+		out = _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+		out = _mm256_madd_epi16(out, _mm256_set1_epi32(0x00011000));
+		out = _mm256_shuffle_epi8(out, _mm256_setr_epi8(
+		    2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		    2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+		out = _mm256_permutevar8x32_epi32(out,
+		    _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1));
+		_mm_storeu_si128((__m128i *)(dst + o),
+		    _mm256_castsi256_si128(out));
+		_mm_storel_epi64((__m128i *)(dst + o + 16),
+		    _mm256_extracti128_si256(out, 1));
+	}
+	if (i == *ip)
+		return 0;
+	*ip = i;
+	*op = o;
+	return 1;
+}
+
+#endif /* B64_AVX2 */
+
+int
+ssh_b64_ntop(const u_char *src, size_t srclen, char *target, size_t targsize)
+{
+	size_t i = 0, o = 0, need;
+	u_int32_t w;
+
+	/* b64_ntop() fails without writing a usable result if short */
+	need = (srclen + 2) / 3 * 4;
+	if (need >= targsize || need > INT_MAX)
+		return -1;
+
+#ifdef B64_AVX2
+	if (srclen >= 28 && b64_avx2())
+		enc_avx2(src, srclen, target, &i, &o);
+#endif
+	for (; i + 3 <= srclen; i += 3) {
+		w = (u_int32_t)src[i] << 16 | (u_int32_t)src[i + 1] << 8 |
+		    src[i + 2];
+		target[o++] = b64_enc[w >> 18];
+		target[o++] = b64_enc[(w >> 12) & 0x3f];
+		target[o++] = b64_enc[(w >> 6) & 0x3f];
+		target[o++] = b64_enc[w & 0x3f];
+	}
+	if (i < srclen) {
+		w = (u_int32_t)src[i] << 16;
+		if (i + 1 < srclen)
+			w |= (u_int32_t)src[i + 1] << 8;
+		target[o++] = b64_enc[w >> 18];
+		target[o++] = b64_enc[(w >> 12) & 0x3f];
+		target[o++] = i + 1 < srclen ? b64_enc[(w >> 6) & 0x3f] :
+		    B64_PAD;
+		target[o++] = B64_PAD;
+	}
+	target[o] = '\0';
+	return (int)o;
+}
+
+/* Decode one full quantum into 3 bytes; returns 0 if it isn't all alphabet */
+static int
+dec_quantum(const u_char *s, u_char *dst)
+{
+	u_int a = b64_dec[s[0]], b = b64_dec[s[1]];
+	u_int c = b64_dec[s[2]], d = b64_dec[s[3]];
+	u_int32_t w;
+
+	if (((a | b | c | d) & (B64_SPACE|B64_BAD)) != 0)
+		return 0;
+	w = a << 18 | b << 12 | c << 6 | d;
+	dst[0] = w >> 16;
+	dst[1] = (w >> 8) & 0xff;
+	dst[2] = w & 0xff;
+	return 1;
+}
+
+int
+ssh_b64_pton(const char *src, u_char *target, size_t targsize)
+{
+	const u_char *s = (const u_char *)src;
+	size_t i = 0, len = strlen(src), tarindex = 0;
+	u_int state = 0, v;
+	int ch = 0;
+
+	while (i < len) {
+		/* fast paths, only at a quantum boundary */
+		if (state == 0 && target != NULL) {
+#ifdef B64_AVX2
+			if (len - i >= 32 && tarindex + 24 <= targsize &&
+			    b64_avx2() && dec_avx2(s, len, target, targsize,
+			    &i, &tarindex))
+				continue;
+#endif
+			if (len - i >= 4 && tarindex + 3 <= targsize &&
+			    dec_quantum(s + i, target + tarindex)) {
+				i += 4;
+				tarindex += 3;
+				continue;
+			}
+		}
+
+		ch = src[i++];
+		v = b64_dec[(u_char)ch];
+		if (v == B64_SPACE)
+			continue;
+		if (v == B64_BAD) {
+			if (ch == B64_PAD)
+				break;
+			/* whitespace beyond the C locale's */
+			if (isspace(ch))
+				continue;
+			return -1;
+		}
+
+		switch (state) {
+		case 0:
+			if (target) {
+				if (tarindex >= targsize)
+					return -1;
+				target[tarindex] = v << 2;
+			}
+			state = 1;
+			break;
+		case 1:
+			if (target) {
+				if (tarindex + 1 >= targsize)
+					return -1;
+				target[tarindex] |= v >> 4;
+				target[tarindex + 1] = (v & 0x0f) << 4;
+			}
+			tarindex++;
+			state = 2;
+			break;
+		case 2:
+			if (target) {
+				if (tarindex + 1 >= targsize)
+					return -1;
+				target[tarindex] |= v >> 2;
+				target[tarindex + 1] = (v & 0x03) << 6;
+			}
+			tarindex++;
+			state = 3;
+			break;
+		case 3:
+			if (target) {
+				if (tarindex >= targsize)
+					return -1;
+				target[tarindex] |= v;
+			}
+			tarindex++;
+			state = 0;
+			break;
+		}
+	}
+
+	/*
+	 * We are done decoding Base-64 chars.  Let's see if we ended
+	 * on a byte boundary, and/or with erroneous trailing characters.
+	 */
+	if (ch == B64_PAD) {		/* We got a pad char. */
+		ch = src[i++];		/* Skip it, get next. */
+		switch (state) {
+		case 0:		/* Invalid = in first position */
+		case 1:		/* Invalid = in second position */
+			return -1;
+		case 2:		/* Valid, means one byte of info */
+			/* Skip any number of spaces. */
+			for (; ch != '\0'; ch = src[i++])
+				if (!isspace(ch))
+					break;
+			/* Make sure there is another trailing = sign. */
+			if (ch != B64_PAD)
+				return -1;
+			ch = src[i++];		/* Skip the = */
+			/* Fall through to "single trailing =" case. */
+			/* FALLTHROUGH */
+		case 3:		/* Valid, means two bytes of info */
+			/*
+			 * We know this char is an =.  Is there anything but
+			 * whitespace after it?
+			 */
+			for (; ch != '\0'; ch = src[i++])
+				if (!isspace(ch))
+					return -1;
+
+			/*
+			 * Now make sure for cases 2 and 3 that the "extra"
+			 * bits that slopped past the last full byte were
+			 * zeros.  If we don't check them, they become a
+			 * subliminal channel.
+			 */
+			if (target && target[tarindex] != 0)
+				return -1;
+		}
+	} else {
+		/*
+		 * We ended by seeing the end of the string.  Make sure we
+		 * have no partial bytes lying around.
+		 */
+		if (state != 0)
+			return -1;
+	}
+
+	return (int)tarindex;
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2026 Pittsburgh Supercomputing Center. All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _B64_H
+#define _B64_H
+
+/*
+ * Base64 encoding and decoding, with the same results as b64_ntop(3) and
+ * b64_pton(3) including their handling of whitespace, padding and short
+ * output buffers, but table driven and vectorised where the CPU allows.
+ */
+int ssh_b64_ntop(const u_char *src, size_t srclen, char *target,
+    size_t targsize);
+int ssh_b64_pton(const char *src, u_char *target, size_t targsize);
+
+#endif /* _B64_H */
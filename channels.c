@@ -204,6 +204,13 @@ struct ssh_channels {
 
 	/* AF_UNSPEC or AF_INET or AF_INET6 */
 	int IPv4or6;
+
+	/* earliest time a channel holding back output wants to send it */
+	struct timespec coalesce_deadline;
+	int coalesce_pending;
+
+	/* Close open channels that moved no data for this many seconds */
+	u_int idle_timeout;
 };
 
 /* helper */
@@ -409,7 +416,9 @@ channel_new(struct ssh *ssh, char *ctype, int type, int rfd, int wfd, int efd,
 	c->ctype = ctype;
 	c->local_window = window;
 	c->local_window_max = window;
+	c->local_window_initial = window;
 	c->local_maxpacket = maxpack;
+	c->lastused = monotime();
 	c->dynamic_window = 0;
 	c->remote_name = xstrdup(remote_name);
 	c->ctl_chan = -1;
@@ -1087,6 +1096,8 @@ channel_set_fds(struct ssh *ssh, int id, int rfd, int wfd, int efd,
 	channel_register_fds(ssh, c, rfd, wfd, efd, extusage, nonblock, is_tty);
 	c->type = SSH_CHANNEL_OPEN;
 	c->local_window = c->local_window_max = window_max;
+	c->local_window_initial = window_max;
+	c->lastused = monotime();
 
 	if ((r = sshpkt_start(ssh, SSH2_MSG_CHANNEL_WINDOW_ADJUST)) != 0 ||
 	    (r = sshpkt_put_u32(ssh, c->remote_id)) != 0 ||
@@ -1095,6 +1106,59 @@ channel_set_fds(struct ssh *ssh, int id, int rfd, int wfd, int efd,
 		fatal_fr(r, "channel %i", c->self);
 }
 
+/*
+ * Activate a larval channel that is served by a function running in this
+ * process rather than by file descriptors. The function takes data
+ * received from the peer from c->output and leaves its replies in
+ * c->input; see channel_handle_inproc(). To avoid copying it may do so by
+ * exchanging either buffer for another of its own. It must not block:
+ * work that may is done elsewhere, which makes wakefd readable when the
+ * function has something new. The channel takes ownership of wakefd.
+ */
+void
+channel_set_inproc(struct ssh *ssh, int id, channel_inproc_fn *fn,
+    void *ctx, int wakefd, u_int window_max)
+{
+	Channel *c;
+
+	channel_set_fds(ssh, id, wakefd, -1, -1, CHAN_EXTENDED_IGNORE, 1, 0,
+	    window_max);
+	if ((c = channel_lookup(ssh, id)) == NULL)
+		fatal_f("channel %d: lost", id);
+	c->inproc = fn;
+	c->inproc_ctx = ctx;
+}
+
+/*
+ * Batch output read from the channel's rfd: reads shorter than size bytes
+ * that arrive within usec microseconds of the previous data packet are
+ * held back until the delay has passed or enough has accumulated.  Output
+ * following a quiet period (e.g. echo of a keystroke) is never delayed.
+ */
+void
+channel_set_coalesce(struct ssh *ssh, int id, size_t size, u_int usec)
+{
+	Channel *c;
+
+	if ((c = channel_lookup(ssh, id)) == NULL)
+		fatal_f("channel %d: lost", id);
+	c->coalesce_size = size;
+	c->coalesce_delay.tv_sec = usec / 1000000;
+	c->coalesce_delay.tv_nsec = (long)(usec % 1000000) * 1000;
+	debug2_f("channel %d: coalesce %zu bytes / %u usec", id, size, usec);
+}
+
+/*
+ * Close open channels that have not sent or received any data for
+ * timeout seconds. Zero disables the timeout.
+ */
+void
+channel_set_idle_timeout(struct ssh *ssh, u_int timeout)
+{
+	ssh->chanctxt->idle_timeout = timeout;
+	debug2_f("idle timeout %u seconds", timeout);
+}
+
 static void
 channel_pre_listener(struct ssh *ssh, Channel *c)
 {
@@ -2051,6 +2115,9 @@ channel_handle_wfd(struct ssh *ssh, Channel *c)
 				chan_write_failed(ssh, c);
 			return -1;
 		}
+		/* Filter has written and consumed the output itself */
+		if (!c->datagram && dlen == 0)
+			goto out;
 	} else if (c->datagram) {
 		if ((r = sshbuf_get_string(c->output, &data, &dlen)) != 0)
 			fatal_fr(r, "channel %i: get datagram", c->self);
@@ -2193,6 +2260,16 @@ channel_check_window(struct ssh *ssh, Channel *c)
 {
 	int r;
 
+	/*
+	 * The window was shrunk while the channel was idle, but the peer
+	 * may still use what it was granted before.  Let it use that up
+	 * without granting more, so the window really shrinks.
+	 */
+	if (c->local_window > c->local_window_max) {
+		c->local_consumed = 0;
+		return 1;
+	}
+
 	/* going back to a set denominator of 2. Prior versions had a
 	 * dynamic denominator based on the size of the buffer. This may
 	 * have been helpful in some situations but it isn't helping in
@@ -2230,6 +2307,11 @@ channel_check_window(struct ssh *ssh, Channel *c)
 		}
 		if (!c->have_remote_id)
 			fatal_f("channel %d: no remote id", c->self);
+		/* Data received before a shrink may be consumed after it */
+		if (c->local_consumed + addition >
+		    c->local_window_max - c->local_window)
+			c->local_consumed = c->local_window_max -
+			    c->local_window - addition;
 		if ((r = sshpkt_start(ssh,
 		    SSH2_MSG_CHANNEL_WINDOW_ADJUST)) != 0 ||
 		    (r = sshpkt_put_u32(ssh, c->remote_id)) != 0 ||
@@ -2249,6 +2331,16 @@ channel_check_window(struct ssh *ssh, Channel *c)
 static void
 channel_post_open(struct ssh *ssh, Channel *c)
 {
+	char buf[64];
+
+	/* rfd only wakes us; channel_output_poll() runs the service */
+	if (c->inproc != NULL) {
+		if ((c->io_ready & SSH_CHAN_IO_RFD) != 0) {
+			while (read(c->rfd, buf, sizeof(buf)) > 0)
+				;
+		}
+		return;
+	}
 	channel_handle_rfd(ssh, c);
 	channel_handle_wfd(ssh, c);
 	channel_handle_efd(ssh, c);
@@ -2457,6 +2549,77 @@ channel_garbage_collect(struct ssh *ssh, Channel *c)
 	channel_free(ssh, c);
 }
 
+/* Shut down both directions of an open channel; nchan sends the CLOSE */
+static void
+channel_force_close(struct ssh *ssh, Channel *c)
+{
+	debug3_f("channel %d: forcibly closing", c->self);
+	if (c->istate == CHAN_INPUT_OPEN)
+		chan_read_failed(ssh, c);
+	if (c->istate == CHAN_INPUT_WAIT_DRAIN) {
+		sshbuf_reset(c->input);
+		chan_ibuf_empty(ssh, c);
+	}
+	if (c->ostate == CHAN_OUTPUT_OPEN ||
+	    c->ostate == CHAN_OUTPUT_WAIT_DRAIN) {
+		sshbuf_reset(c->output);
+		chan_write_failed(ssh, c);
+	}
+	/* e.g. lets sshd release a session's pty so its shell gets SIGHUP */
+	if (c->detach_user != NULL)
+		c->detach_user(ssh, c->self, NULL);
+	if (c->efd != -1)
+		channel_close_fd(ssh, c, &c->efd);
+}
+
+/*
+ * A channel that has moved no data for CHAN_IDLE_SHRINK seconds gives
+ * back the memory its buffers grew to during a transfer and starts the
+ * next one from its initial window again. Channels idle for longer than
+ * the configured idle timeout are closed. Returns the number of seconds
+ * until the next of these is due for the channel, or 0 if none is.
+ */
+static time_t
+channel_check_idle(struct ssh *ssh, Channel *c, time_t now)
+{
+	struct ssh_channels *sc = ssh->chanctxt;
+	time_t idle = now - c->lastused, next = 0;
+
+	if (c->type != SSH_CHANNEL_OPEN ||
+	    (c->flags & (CHAN_CLOSE_SENT|CHAN_CLOSE_RCVD)) != 0 ||
+	    (c->istate == CHAN_INPUT_CLOSED &&
+	    c->ostate == CHAN_OUTPUT_CLOSED))
+		return 0;
+	if (sc->idle_timeout != 0 && idle >= (time_t)sc->idle_timeout) {
+		verbose("channel %d: closing after %lld seconds of inactivity",
+		    c->self, (long long)idle);
+		channel_force_close(ssh, c);
+		return 0;
+	}
+	if (c->idle_shrunk != c->lastused) {
+		if (idle < CHAN_IDLE_SHRINK)
+			next = CHAN_IDLE_SHRINK - idle;
+		else if (sshbuf_len(c->input) == 0 &&
+		    sshbuf_len(c->output) == 0 &&
+		    sshbuf_len(c->extended) == 0) {
+			debug2("channel %d: idle, shrinking buffers and "
+			    "window %u to %u", c->self, c->local_window_max,
+			    c->local_window_initial);
+			sshbuf_reset(c->input);
+			sshbuf_reset(c->output);
+			sshbuf_reset(c->extended);
+			c->input->window_max = c->output->window_max = 0;
+			/* channel_check_window() reclaims the excess */
+			c->local_window_max = c->local_window_initial;
+			c->idle_shrunk = c->lastused;
+		}
+	}
+	if (sc->idle_timeout != 0 &&
+	    (next == 0 || sc->idle_timeout - idle < next))
+		next = sc->idle_timeout - idle;
+	return next;
+}
+
 enum channel_table { CHAN_PRE, CHAN_POST };
 
 static void
@@ -2466,7 +2629,7 @@ channel_handler(struct ssh *ssh, int table, time_t *unpause_secs)
 	chan_fn **ftab = table == CHAN_PRE ? sc->channel_pre : sc->channel_post;
 	u_int i, oalloc;
 	Channel *c;
-	time_t now;
+	time_t now, idle;
 
 	now = monotime();
 	if (unpause_secs != NULL)
@@ -2475,6 +2638,11 @@ channel_handler(struct ssh *ssh, int table, time_t *unpause_secs)
 		c = sc->channels[i];
 		if (c == NULL)
 			continue;
+		if (table == CHAN_PRE &&
+		    (idle = channel_check_idle(ssh, c, now)) != 0 &&
+		    unpause_secs != NULL &&
+		    (*unpause_secs == 0 || idle < *unpause_secs))
+			*unpause_secs = idle;
 		if (c->delayed) {
 			if (table == CHAN_PRE)
 				c->delayed = 0;
@@ -2797,6 +2965,51 @@ channel_after_poll(struct ssh *ssh, struct pollfd *pfd, u_int npfd)
 	channel_handler(ssh, CHAN_POST, NULL);
 }
 
+/*
+ * Returns nonzero if len bytes of c->input should be held back to be
+ * sent together with output that is likely still to come.
+ */
+static int
+channel_coalesce_hold(struct ssh *ssh, Channel *c, size_t len)
+{
+	struct ssh_channels *sc = ssh->chanctxt;
+	struct timespec now, deadline;
+
+	if (c->istate != CHAN_INPUT_OPEN || len >= c->coalesce_size ||
+	    len >= c->remote_window || len >= c->remote_maxpacket)
+		return 0;
+	monotime_ts(&now);
+	timespecadd(&c->coalesce_last, &c->coalesce_delay, &deadline);
+	if (timespeccmp(&now, &deadline, >=))
+		return 0;
+	if (!sc->coalesce_pending ||
+	    timespeccmp(&deadline, &sc->coalesce_deadline, <))
+		sc->coalesce_deadline = deadline;
+	sc->coalesce_pending = 1;
+	return 1;
+}
+
+/*
+ * Returns nonzero and the time remaining in *remain if the last call to
+ * channel_output_poll() left output held back for coalescing.
+ */
+int
+channel_coalesce_timeout(struct ssh *ssh, struct timespec *remain)
+{
+	struct ssh_channels *sc = ssh->chanctxt;
+	struct timespec now;
+
+	if (!sc->coalesce_pending)
+		return 0;
+	sc->coalesce_pending = 0;
+	monotime_ts(&now);
+	if (timespeccmp(&now, &sc->coalesce_deadline, >=))
+		timespecclear(remain);
+	else
+		timespecsub(&sc->coalesce_deadline, &now, remain);
+	return 1;
+}
+
 /*
  * Enqueue data for channels with open or draining c->input.
  */
@@ -2849,9 +3062,12 @@ channel_output_poll_input_open(struct ssh *ssh, Channel *c)
 		    (r = sshpkt_send(ssh)) != 0)
 			fatal_fr(r, "channel %i: send datagram", c->self);
 		c->remote_window -= plen;
+		c->lastused = monotime();
 	}
 
 	/* Enqueue packet for buffered data. */
+	if (c->coalesce_size != 0 && channel_coalesce_hold(ssh, c, len))
+		return;
 	if (len > c->remote_window)
 		len = c->remote_window;
 	if (len > c->remote_maxpacket)
@@ -2866,6 +3082,9 @@ channel_output_poll_input_open(struct ssh *ssh, Channel *c)
 	if ((r = sshbuf_consume(c->input, len)) != 0)
 		fatal_fr(r, "channel %i: consume", c->self);
 	c->remote_window -= len;
+	c->lastused = monotime();
+	if (c->coalesce_size != 0)
+		monotime_ts(&c->coalesce_last);
 }
 
 /*
@@ -2899,9 +3118,37 @@ channel_output_poll_extended_read(struct ssh *ssh, Channel *c)
 	if ((r = sshbuf_consume(c->extended, len)) != 0)
 		fatal_fr(r, "channel %i: consume", c->self);
 	c->remote_window -= len;
+	c->lastused = monotime();
 	debug2("channel %d: sent ext data %zu", c->self, len);
 }
 
+/*
+ * Run the in-process service of a channel over whatever the peer has sent.
+ * It may produce replies until c->input holds as much as the peer's window
+ * allows. Once the service finishes the channel drains and sends EOF.
+ */
+static void
+channel_handle_inproc(struct ssh *ssh, Channel *c)
+{
+	size_t olen;
+	int eof;
+
+	if (c->istate != CHAN_INPUT_OPEN)
+		return;
+	olen = sshbuf_len(c->output);
+	eof = c->ostate != CHAN_OUTPUT_OPEN;
+	if (c->inproc(ssh, c->self, &c->output, &c->input, c->remote_window,
+	    eof, c->inproc_ctx) != 0) {
+		debug2("channel %d: in-process service done", c->self);
+		chan_read_failed(ssh, c);
+		sshbuf_reset(c->output);
+		if (c->ostate == CHAN_OUTPUT_OPEN)
+			chan_write_failed(ssh, c);
+	}
+	c->local_consumed += olen - sshbuf_len(c->output);
+	channel_check_window(ssh, c);
+}
+
 /* If there is data to send to the connection, enqueue some of it now. */
 void
 channel_output_poll(struct ssh *ssh)
@@ -2910,6 +3157,7 @@ channel_output_poll(struct ssh *ssh)
 	Channel *c;
 	u_int i;
 
+	sc->coalesce_pending = 0;
 	for (i = 0; i < sc->channels_alloc; i++) {
 		c = sc->channels[i];
 		if (c == NULL)
@@ -2928,6 +3176,9 @@ channel_output_poll(struct ssh *ssh)
 			continue;
 		}
 
+		if (c->inproc != NULL)
+			channel_handle_inproc(ssh, c);
+
 		/* Get the amount of buffered data for this channel. */
 		if (c->istate == CHAN_INPUT_OPEN ||
 		    c->istate == CHAN_INPUT_WAIT_DRAIN)
@@ -3267,6 +3518,7 @@ channel_input_data(int type, u_int32_t seq, struct ssh *ssh)
 	if ((r = sshpkt_get_string_direct(ssh, &data, &data_len)) != 0 ||
             (r = sshpkt_get_end(ssh)) != 0)
 		fatal_fr(r, "channel %i: get data", c->self);
+	c->lastused = monotime();
 
 	win_len = data_len;
 	if (c->datagram)
@@ -3350,6 +3602,7 @@ channel_input_extended_data(int type, u_int32_t seq, struct ssh *ssh)
 		return 0;
 	}
 	debug2("channel %d: rcvd ext data %zu", c->self, data_len);
+	c->lastused = monotime();
 	/* XXX sshpkt_getb? */
 	if ((r = sshbuf_put(c->extended, data, data_len)) != 0)
 		error_fr(r, "append");
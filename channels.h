@@ -93,6 +93,8 @@ typedef int channel_infilter_fn(struct ssh *, struct Channel *, char *, int);
 typedef void channel_filter_cleanup_fn(struct ssh *, int, void *);
 typedef u_char *channel_outfilter_fn(struct ssh *, struct Channel *,
     u_char **, size_t *);
+typedef int channel_inproc_fn(struct ssh *, int, struct sshbuf **,
+    struct sshbuf **, size_t, int, void *);
 
 /* Channel success/failure callbacks */
 typedef void channel_confirm_cb(struct ssh *, int, struct Channel *, void *);
@@ -192,6 +194,20 @@ struct Channel {
 	void			*filter_ctx;
 	channel_filter_cleanup_fn *filter_cleanup;
 
+	/* in-process service run on the channel buffers instead of fds */
+	channel_inproc_fn	*inproc;
+	void			*inproc_ctx;
+
+	/* hold back small reads, see channel_coalesce_hold() */
+	size_t			coalesce_size;
+	struct timespec		coalesce_delay;
+	struct timespec		coalesce_last;	/* last data packet sent */
+
+	/* idle tracking, see channel_check_idle() */
+	time_t			lastused;	/* last data sent or received */
+	time_t			idle_shrunk;	/* lastused when buffers shrunk */
+	u_int			local_window_initial;
+
 	/* keep boundaries */
 	int			datagram;
 
@@ -255,6 +271,9 @@ struct Channel {
 /* Maximum channel input buffer size */
 #define CHAN_INPUT_MAX	(16*1024*1024)
 
+/* seconds without data before an open channel's buffers are shrunk */
+#define CHAN_IDLE_SHRINK	30
+
 /* Hard limit on number of channels */
 #define CHANNELS_MAX_CHANNELS	(16*1024)
 
@@ -280,6 +299,10 @@ Channel *channel_new(struct ssh *, char *, int, int, int, int,
 	    u_int, u_int, int, char *, int);
 void	 channel_set_fds(struct ssh *, int, int, int, int, int,
 	    int, int, u_int);
+void	 channel_set_inproc(struct ssh *, int, channel_inproc_fn *, void *,
+	    int, u_int);
+void	 channel_set_coalesce(struct ssh *, int, size_t, u_int);
+void	 channel_set_idle_timeout(struct ssh *, u_int);
 void	 channel_free(struct ssh *, Channel *);
 void	 channel_free_all(struct ssh *);
 void	 channel_stop_listening(struct ssh *);
@@ -322,6 +345,7 @@ void	 channel_prepare_poll(struct ssh *, struct pollfd **,
 	    u_int *, u_int *, u_int, time_t *);
 void	 channel_after_poll(struct ssh *, struct pollfd *, u_int);
 void     channel_output_poll(struct ssh *);
+int	 channel_coalesce_timeout(struct ssh *, struct timespec *);
 
 int      channel_not_very_much_buffered_data(struct ssh *);
 void     channel_close_all(struct ssh *);
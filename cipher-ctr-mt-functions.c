@@ -34,6 +34,8 @@
 #include <unistd.h>
 #include "cipher-ctr-mt-functions.h"
 #include "log.h"
+#include "misc.h"
+#include "sshbuf.h"
 
 /* for provider error struct */
 #include "err.h"
@@ -58,16 +60,10 @@ int numkq = 8;
 /* how we increment the id the structs we create */
 int global_struct_id = 0;
 
-/* private functions */
-static void
-ssh_ctr_inc(u_char *ctr, size_t len)
-{
-	int i;
+/* set by sshd from MTAESMaxThreads, see cipher.c */
+extern int cipher_mt_limit;
 
-	for (i = len - 1; i >= 0; i--)
-		if (++ctr[i])	/* continue on overflow */
-			return;
-}
+/* private functions */
 
 /*
  * Add num to counter 'ctr'
@@ -86,70 +82,6 @@ ssh_ctr_add(u_char *ctr, uint32_t num, u_int len)
 	}
 }
 
-/*
- * Threads may be cancelled in a pthread_cond_wait, we must free the mutex
- */
-static void
-thread_loop_cleanup(void *x)
-{
-	pthread_mutex_unlock((pthread_mutex_t *)x);
-}
-
-#ifdef __APPLE__
-/* Check if we should exit, we are doing both cancel and exit condition
- * since on OSX threads seem to occasionally fail to notice when they have
- * been cancelled. We want to have a backup to make sure that we won't hang
- * when the main process join()-s the cancelled thread.
- */
-static void
-thread_loop_check_exit(struct aes_mt_ctx_st *aes_mt_ctx)
-{
-	int exit_flag;
-
-	pthread_rwlock_rdlock(&aes_mt_ctx->stop_lock);
-	exit_flag = aes_mt_ctx->exit_flag;
-	pthread_rwlock_unlock(&aes_mt_ctx->stop_lock);
-
-	if (exit_flag)
-		pthread_exit(NULL);
-}
-#else
-# define thread_loop_check_exit(s)
-#endif /* __APPLE__ */
-
-/*
- * Helper function to terminate the helper threads
- */
-static void
-stop_and_join_pregen_threads(struct aes_mt_ctx_st *aes_mt_ctx)
-{
-	int i;
-
-#ifdef __APPLE__
-	/* notify threads that they should exit */
-	pthread_rwlock_wrlock(&aes_mt_ctx->stop_lock);
-	aes_mt_ctx->exit_flag = TRUE;
-	pthread_rwlock_unlock(&aes_mt_ctx->stop_lock);
-#endif /* __APPLE__ */
-
-	/* Cancel pregen threads */
-	for (i = 0; i < cipher_threads; i++) {
-		debug_f ("Canceled %lu (%d,%d)", aes_mt_ctx->tid[i], aes_mt_ctx->struct_id,
-		       aes_mt_ctx->id[i]);
-		pthread_cancel(aes_mt_ctx->tid[i]);
-	}
-	for (i = 0; i < cipher_threads; i++) {
-		if (pthread_kill(aes_mt_ctx->tid[i], 0) != 0)
-			debug3("AES-CTR MT pthread_join failure: Invalid thread id %lu in %s",
-			       aes_mt_ctx->tid[i], __func__);
-		else {
-			debug_f ("Joining %lu (%d, %d)", aes_mt_ctx->tid[i], aes_mt_ctx->struct_id,
-			       aes_mt_ctx->id[i]);
-			pthread_join(aes_mt_ctx->tid[i], NULL);
-		}
-	}
-}
-
 /* get the number of cores in the system
  * peak performance seems to come with assigning half the number of
  * physical cores in the system. This was determined by interating
@@ -216,133 +148,298 @@ static int get_core_count() {
 }
 
 
+/*
+ * Keystream worker pool
+ *
+ * Every cipher context in the process (inbound and outbound, CTR and
+ * GCM, before and after a rekey) is served by the same pregen threads
+ * rather than starting its own. A context joins the pool once it has a
+ * key and an IV. An idle worker takes the next empty queue of whichever
+ * context is first in line and that context then goes to the back of
+ * the line, so a busy direction can't starve the other one. The number
+ * of workers follows the core count, not the number of contexts.
+ *
+ * The workers live as long as the process. A forked child (a session,
+ * ssh -f) gets the contexts but not the threads, the atfork handler
+ * starts a new pool generation and contexts from an older one set up
+ * their queues again the next time they need one.
+ */
+static struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	work; /* workers wait here for empty queues */
+	pthread_cond_t	done; /* consumers wait here for full queues */
+	TAILQ_HEAD(, ks_client) clients;
+	u_int		gen;
+	u_int		keyids;
+	int		nthreads;
+	pthread_t	tid[MAX_POOL_THREADS];
+} ks_pool;
+static pthread_once_t ks_pool_once = PTHREAD_ONCE_INIT;
+
+static void
+ks_pool_prepare(void)
+{
+	pthread_mutex_lock(&ks_pool.lock);
+}
+
+static void
+ks_pool_parent(void)
+{
+	pthread_mutex_unlock(&ks_pool.lock);
+}
+
+static void
+ks_pool_child(void)
+{
+	struct ks_client *client;
+
+	/* the conds may still count the parent's sleepers, start over */
+	pthread_cond_init(&ks_pool.work, NULL);
+	pthread_cond_init(&ks_pool.done, NULL);
+	ks_pool.gen++;
+	ks_pool.nthreads = 0;
+	TAILQ_FOREACH(client, &ks_pool.clients, next)
+		client->busy = 0;
+	pthread_mutex_unlock(&ks_pool.lock);
+}
+
+static void
+ks_pool_init(void)
+{
+	pthread_mutex_init(&ks_pool.lock, NULL);
+	pthread_cond_init(&ks_pool.work, NULL);
+	pthread_cond_init(&ks_pool.done, NULL);
+	TAILQ_INIT(&ks_pool.clients);
+	pthread_atfork(ks_pool_prepare, ks_pool_parent, ks_pool_child);
+}
+
+/* keylen in bytes */
+static const EVP_CIPHER *
+aes_ctr_cipher(int keylen)
+{
+	switch (keylen) {
+	case 32:
+		return EVP_aes_256_ctr();
+	case 24:
+		return EVP_aes_192_ctr();
+	case 16:
+		return EVP_aes_128_ctr();
+	}
+	fatal("Invalid key length of %d in AES MT. Exiting", keylen * 8);
+}
+
+/*
+ * Find a job for a worker, asking the contexts in line order.
+ * Pool lock held.
+ */
+static int
+ks_pool_claim(struct ks_job *job)
+{
+	struct ks_client *client;
+
+	TAILQ_FOREACH(client, &ks_pool.clients, next) {
+		if (client->gen != ks_pool.gen || !client->claim(client, job))
+			continue;
+		job->client = client;
+		job->keyid = client->keyid;
+		client->busy++;
+		/* back of the line */
+		TAILQ_REMOVE(&ks_pool.clients, client, next);
+		TAILQ_INSERT_TAIL(&ks_pool.clients, client, next);
+		return 1;
+	}
+	return 0;
+}
+
 /*
  * The life of a pregen thread:
- *    Find empty keystream queues and fill them using their counter.
- *    When done, update counter for the next fill.
+ *    Take the next job from the pool and fill its queue with the
+ *    keystream starting at the job's counter. Mark it full and signal
+ *    the consumers. Sleep when no context has an empty queue.
  */
 static void *
-thread_loop(void *job)
+ks_pool_worker(void *arg)
 {
 	EVP_CIPHER_CTX *evp_ctx;
-	struct aes_mt_ctx_st *aes_mt_ctx = job;
-	struct kq *q;
-	int i;
-	int qidx;
-	pthread_t first_tid;
+	struct ks_job job;
+	u_int keyid = 0;
 	int outlen;
-	u_char mynull[AES_BLOCK_SIZE];
-	memset(&mynull, 0, AES_BLOCK_SIZE);
-
-	/* get the thread id to see if this is the first one */
-	pthread_rwlock_rdlock(&aes_mt_ctx->tid_lock);
-	first_tid = aes_mt_ctx->tid[0];
-	pthread_rwlock_unlock(&aes_mt_ctx->tid_lock);
-
-	/* create the context for this thread */
-	evp_ctx = EVP_CIPHER_CTX_new();
-
-	/* initialize the cipher ctx with the key provided
-	 * determinbe which cipher to use based on the key size */
-	if (aes_mt_ctx->keylen == 256)
-		EVP_EncryptInit_ex(evp_ctx, EVP_aes_256_ctr(), NULL, aes_mt_ctx->orig_key, NULL);
-	else if (aes_mt_ctx->keylen == 128)
-		EVP_EncryptInit_ex(evp_ctx, EVP_aes_128_ctr(), NULL, aes_mt_ctx->orig_key, NULL);
-	else if (aes_mt_ctx->keylen == 192)
-		EVP_EncryptInit_ex(evp_ctx, EVP_aes_192_ctr(), NULL, aes_mt_ctx->orig_key, NULL);
-	else {
-		fatal("Invalid key length of %d in AES CTR MT. Exiting", aes_mt_ctx->keylen);
+
+	if ((evp_ctx = EVP_CIPHER_CTX_new()) == NULL)
+		fatal_f("AES MT could not allocate the keystream cipher");
+
+	for (;;) {
+		pthread_mutex_lock(&ks_pool.lock);
+		while (!ks_pool_claim(&job))
+			pthread_cond_wait(&ks_pool.work, &ks_pool.lock);
+		pthread_mutex_unlock(&ks_pool.lock);
+
+		/* only redo the key schedule when the key changes */
+		if (job.keyid != keyid) {
+			EVP_EncryptInit_ex(evp_ctx, job.cipher, NULL, job.key,
+			    job.ctr);
+			keyid = job.keyid;
+		} else
+			EVP_EncryptInit_ex(evp_ctx, NULL, NULL, NULL, job.ctr);
+		/* encrypting zeros in place leaves the keystream */
+		memset(job.out, 0, job.nblocks * AES_BLOCK_SIZE);
+		EVP_EncryptUpdate(evp_ctx, job.out, &outlen, job.out,
+		    job.nblocks * AES_BLOCK_SIZE);
+
+		/* mark full and signal consumer */
+		pthread_mutex_lock(&ks_pool.lock);
+		*job.qstate = KQFULL;
+		job.client->busy--;
+		pthread_cond_broadcast(&ks_pool.done);
+		pthread_mutex_unlock(&ks_pool.lock);
 	}
 
-	/*
-	 * Handle the special case of startup, one thread must fill
-	 * the first KQ then mark it as draining. Lock held throughout.
-	 */
-	if (pthread_equal(pthread_self(), first_tid)) {
-		/* get the first element of the key queue struct */
-		q = &aes_mt_ctx->q[0];
-		pthread_mutex_lock(&q->lock);
-		/* if we are in the INIT state then fill the queue */
-		if (q->qstate == KQINIT) {
-			/* set the initial counter */
-			EVP_EncryptInit_ex(evp_ctx, NULL, NULL, NULL, q->ctr);
-			for (i = 0; i < KQLEN; i++) {
-				/* encypher a block sized null string (mynull) with the key. This
-				 * returns the keystream because xoring the keystream
-				 * against null returns the keystream. Store that in the appropriate queue */
-				EVP_EncryptUpdate(evp_ctx, q->keys[i], &outlen, mynull, AES_BLOCK_SIZE);
-				/* increment the counter */
-				ssh_ctr_inc(q->ctr, AES_BLOCK_SIZE);
-			}
-			ssh_ctr_add(q->ctr, KQLEN * (numkq - 1), AES_BLOCK_SIZE);
-			q->qstate = KQDRAINING;
-			pthread_cond_broadcast(&q->cond);
-		}
-		pthread_mutex_unlock(&q->lock);
+	return NULL;
+}
+
+/* Pool lock held */
+static void
+ks_pool_start_workers(void)
+{
+	int n = MINIMUM(cipher_threads * 2, MAX_POOL_THREADS);
+
+	if (cipher_mt_limit > 0 && n > cipher_mt_limit)
+		n = cipher_mt_limit;
+	while (ks_pool.nthreads < n) {
+		if (pthread_create(&ks_pool.tid[ks_pool.nthreads], NULL,
+		    ks_pool_worker, NULL) != 0)
+			fatal_f("AES MT could not create a pool thread");
+		pthread_detach(ks_pool.tid[ks_pool.nthreads]);
+		debug_f("AES MT pool spawned a thread with id %lu (%d)",
+		    ks_pool.tid[ks_pool.nthreads], ks_pool.nthreads);
+		ks_pool.nthreads++;
 	}
+}
 
-	/*
-	 * Normal case is to find empty queues and fill them, skipping over
-	 * queues already filled by other threads and stopping to wait for
-	 * a draining queue to become empty.
-	 *
-	 * Multiple threads may be waiting on a draining queue and awoken
-	 * when empty.  The first thread to wake will mark it as filling,
-	 * others will move on to fill, skip, or wait on the next queue.
-	 */
-	for (qidx = 1;; qidx = (qidx + 1) % numkq) {
-		/* Check if I was cancelled, also checked in cond_wait */
-		pthread_testcancel();
-
-		/* Check if we should exit as well */
-		thread_loop_check_exit(c);
-
-		/* Lock queue and block if its draining */
-		q = &aes_mt_ctx->q[qidx];
-		pthread_mutex_lock(&q->lock);
-		pthread_cleanup_push(thread_loop_cleanup, &q->lock);
-		while (q->qstate == KQDRAINING || q->qstate == KQINIT) {
-			thread_loop_check_exit(c);
-			pthread_cond_wait(&q->cond, &q->lock);
-		}
-		pthread_cleanup_pop(0);
+/* Threads the pool starts when nothing limits it */
+int
+cipher_mt_pool_size(void)
+{
+	get_core_count();
+	return MINIMUM(cipher_threads * 2, MAX_POOL_THREADS);
+}
 
-		/* If filling or full, somebody else got it, skip */
-		if (q->qstate != KQEMPTY) {
-			pthread_mutex_unlock(&q->lock);
-			continue;
-		}
+/*
+ * Put a context in line for the workers. The caller has set all of its
+ * queues up as empty for the current key.
+ */
+static void
+ks_pool_join(struct ks_client *client)
+{
+	pthread_once(&ks_pool_once, ks_pool_init);
+
+	pthread_mutex_lock(&ks_pool.lock);
+	if (!client->joined)
+		TAILQ_INSERT_TAIL(&ks_pool.clients, client, next);
+	client->joined = 1;
+	client->gen = ks_pool.gen;
+	client->keyid = ++ks_pool.keyids;
+	ks_pool_start_workers();
+	pthread_cond_broadcast(&ks_pool.work);
+	pthread_mutex_unlock(&ks_pool.lock);
+}
+
+/*
+ * Take a context out of line and wait for its jobs in flight. After
+ * this the workers don't touch its key or queues.
+ */
+static void
+ks_pool_leave(struct ks_client *client)
+{
+	if (!client->joined)
+		return;
+
+	pthread_mutex_lock(&ks_pool.lock);
+	TAILQ_REMOVE(&ks_pool.clients, client, next);
+	client->joined = 0;
+	while (client->busy > 0)
+		pthread_cond_wait(&ks_pool.done, &ks_pool.lock);
+	pthread_mutex_unlock(&ks_pool.lock);
+}
+
+/*
+ * Hand the queue behind oldstate (if any) back to the workers and wait
+ * for the queue behind newstate to fill. It is draining on return.
+ * Returns 0 if the queues were set up before a fork and have to be
+ * set up again.
+ */
+static int
+ks_pool_swap(struct ks_client *client, int *oldstate, int *newstate)
+{
+	pthread_mutex_lock(&ks_pool.lock);
+	if (client->gen != ks_pool.gen) {
+		pthread_mutex_unlock(&ks_pool.lock);
+		return 0;
+	}
+	if (oldstate != NULL) {
+		*oldstate = KQEMPTY;
+		pthread_cond_broadcast(&ks_pool.work);
+	}
+	while (*newstate != KQFULL)
+		pthread_cond_wait(&ks_pool.done, &ks_pool.lock);
+	*newstate = KQDRAINING;
+	pthread_mutex_unlock(&ks_pool.lock);
+	return 1;
+}
 
-		/*
-		 * Empty, let's fill it.
-		 * Queue lock is relinquished while we do this so others
-		 * can see that it's being filled.
-		 */
+/*
+ * Pool lock held. Claim the empty queue the consumer will reach first.
+ * qidx is only advanced by the consumer, a stale value just changes
+ * which queue gets filled first.
+ */
+static int
+ctr_claim(struct ks_client *client, struct ks_job *job)
+{
+	struct aes_mt_ctx_st *aes_mt_ctx = client->ctx;
+	struct kq *q;
+	int i;
+
+	for (i = 0; i < numkq; i++) {
+		q = &aes_mt_ctx->q[(aes_mt_ctx->qidx + i) % numkq];
+		if (q->qstate != KQEMPTY)
+			continue;
 		q->qstate = KQFILLING;
-		pthread_cond_broadcast(&q->cond);
-		pthread_mutex_unlock(&q->lock);
+		job->cipher = aes_ctr_cipher(aes_mt_ctx->keylen / 8);
+		job->key = aes_mt_ctx->key;
+		memcpy(job->ctr, q->ctr, AES_BLOCK_SIZE);
+		job->out = q->keys[0];
+		job->nblocks = KQLEN;
+		job->qstate = &q->qstate;
+		return 1;
+	}
+	return 0;
+}
 
-		/* set the initial counter */
-		EVP_EncryptInit_ex(evp_ctx, NULL, NULL, NULL, q->ctr);
+/*
+ * (Re)start the queues at aes_mt_ctx->aes_counter.
+ * Returns with q[0] draining.
+ */
+static void
+ctr_start_queues(struct aes_mt_ctx_st *aes_mt_ctx)
+{
+	int i;
 
-		/* see coresponding block above for useful comments */
-		for (i = 0; i < KQLEN; i++) {
-			EVP_EncryptUpdate(evp_ctx, q->keys[i], &outlen, mynull, AES_BLOCK_SIZE);
-			ssh_ctr_inc(q->ctr, AES_BLOCK_SIZE);
-		}
+	ks_pool_leave(&aes_mt_ctx->client);
 
-		/* Re-lock, mark full and signal consumer */
-		pthread_mutex_lock(&q->lock);
-		ssh_ctr_add(q->ctr, KQLEN * (numkq - 1), AES_BLOCK_SIZE);
-		q->qstate = KQFULL;
-		pthread_cond_broadcast(&q->cond);
-		pthread_mutex_unlock(&q->lock);
+	/* for each of the queues set the first counter to the
+	 * counter and then add the size of the preceding queues */
+	for (i = 0; i < numkq; i++) {
+		memcpy(aes_mt_ctx->q[i].ctr, aes_mt_ctx->aes_counter, AES_BLOCK_SIZE);
+		ssh_ctr_add(aes_mt_ctx->q[i].ctr, i * KQLEN, AES_BLOCK_SIZE);
+		aes_mt_ctx->q[i].qstate = KQEMPTY;
 	}
+	aes_mt_ctx->qidx = 0;
+	aes_mt_ctx->ridx = 0;
 
-	return NULL;
+	ks_pool_join(&aes_mt_ctx->client);
+	ks_pool_swap(&aes_mt_ctx->client, NULL, &aes_mt_ctx->q[0].qstate);
 }
 
-
 /* Our version of the EVP functions
  * these are public as they are used by the provider */
 
@@ -364,24 +461,15 @@ thread_loop(void *job)
  * -cjr 09/08/2022 */
 void *aes_mt_newctx_256(void *provctx)
 {
-	struct aes_mt_ctx_st *aes_mt_ctx = malloc(sizeof(*aes_mt_ctx));
+	struct aes_mt_ctx_st *aes_mt_ctx = calloc(1, sizeof(*aes_mt_ctx));
 	EVP_CIPHER_CTX *evp_ctx = EVP_CIPHER_CTX_new();
 
 	if ((aes_mt_ctx != NULL) && (evp_ctx != NULL)) {
 		get_core_count(); /* update cipher_threads and numkq */
-		pthread_rwlock_init(&aes_mt_ctx->tid_lock, NULL);
-#ifdef __APPLE__
-		pthread_rwlock_init(&aes_mt_ctx->stop_lock, NULL);
-		aes_mt_ctx->exit_flag = FALSE;
-#endif /* __APPLE__ */
 
 		aes_mt_ctx->state = HAVE_NONE;
-
-		/* initialize the mutexs and conditions for each lock in our struct */
-		for (int i = 0; i < numkq; i++) {
-			pthread_mutex_init(&aes_mt_ctx->q[i].lock, NULL);
-			pthread_cond_init(&aes_mt_ctx->q[i].cond, NULL);
-		}
+		aes_mt_ctx->client.claim = ctr_claim;
+		aes_mt_ctx->client.ctx = aes_mt_ctx;
 		aes_mt_ctx->provctx = provctx;
 		EVP_CipherInit(evp_ctx, EVP_aes_256_ctr(), NULL, NULL, 0);
 		EVP_CIPHER_CTX_set_app_data(evp_ctx, aes_mt_ctx);
@@ -392,24 +480,15 @@ void *aes_mt_newctx_256(void *provctx)
 
 void *aes_mt_newctx_192(void *provctx)
 {
-	struct aes_mt_ctx_st *aes_mt_ctx = malloc(sizeof(*aes_mt_ctx));
+	struct aes_mt_ctx_st *aes_mt_ctx = calloc(1, sizeof(*aes_mt_ctx));
 	EVP_CIPHER_CTX *evp_ctx = EVP_CIPHER_CTX_new();
 
 	if ((aes_mt_ctx != NULL) && (evp_ctx != NULL)) {
 		get_core_count(); /* update cipher_threads and numkq */
-		pthread_rwlock_init(&aes_mt_ctx->tid_lock, NULL);
-#ifdef __APPLE__
-		pthread_rwlock_init(&aes_mt_ctx->stop_lock, NULL);
-		aes_mt_ctx->exit_flag = FALSE;
-#endif /* __APPLE__ */
 
 		aes_mt_ctx->state = HAVE_NONE;
-
-		/* initialize the mutexs and conditions for each lock in our struct */
-		for (int i = 0; i < numkq; i++) {
-			pthread_mutex_init(&aes_mt_ctx->q[i].lock, NULL);
-			pthread_cond_init(&aes_mt_ctx->q[i].cond, NULL);
-		}
+		aes_mt_ctx->client.claim = ctr_claim;
+		aes_mt_ctx->client.ctx = aes_mt_ctx;
 		aes_mt_ctx->provctx = provctx;
 		EVP_CipherInit(evp_ctx, EVP_aes_192_ctr(), NULL, NULL, 0);
 		EVP_CIPHER_CTX_set_app_data(evp_ctx, aes_mt_ctx);
@@ -420,24 +499,15 @@ void *aes_mt_newctx_192(void *provctx)
 
 void *aes_mt_newctx_128(void *provctx)
 {
-	struct aes_mt_ctx_st *aes_mt_ctx = malloc(sizeof(*aes_mt_ctx));
+	struct aes_mt_ctx_st *aes_mt_ctx = calloc(1, sizeof(*aes_mt_ctx));
 	EVP_CIPHER_CTX *evp_ctx = EVP_CIPHER_CTX_new();
 
 	if ((aes_mt_ctx != NULL) && (evp_ctx != NULL)) {
 		get_core_count(); /* update cipher_threads and numkq */
-		pthread_rwlock_init(&aes_mt_ctx->tid_lock, NULL);
-#ifdef __APPLE__
-		pthread_rwlock_init(&aes_mt_ctx->stop_lock, NULL);
-		aes_mt_ctx->exit_flag = FALSE;
-#endif /* __APPLE__ */
 
 		aes_mt_ctx->state = HAVE_NONE;
-
-		/* initialize the mutexs and conditions for each lock in our struct */
-		for (int i = 0; i < numkq; i++) {
-			pthread_mutex_init(&aes_mt_ctx->q[i].lock, NULL);
-			pthread_cond_init(&aes_mt_ctx->q[i].cond, NULL);
-		}
+		aes_mt_ctx->client.claim = ctr_claim;
+		aes_mt_ctx->client.ctx = aes_mt_ctx;
 		aes_mt_ctx->provctx = provctx;
 		EVP_CipherInit(evp_ctx, EVP_aes_128_ctr(), NULL, NULL, 0);
 		EVP_CIPHER_CTX_set_app_data(evp_ctx, aes_mt_ctx);
@@ -455,7 +525,7 @@ void aes_mt_freectx(void *vevp_ctx)
 	struct aes_mt_ctx_st *aes_mt_ctx;
 
 	if ((aes_mt_ctx = EVP_CIPHER_CTX_get_app_data(evp_ctx)) != NULL) {
-		stop_and_join_pregen_threads(aes_mt_ctx);
+		ks_pool_leave(&aes_mt_ctx->client);
 
 		memset(aes_mt_ctx, 0, sizeof(*aes_mt_ctx));
 		free(aes_mt_ctx);
@@ -464,7 +534,7 @@ void aes_mt_freectx(void *vevp_ctx)
 }
 
 /* this function takes the EVP context, gets the AES context
- * and starts the various threads we need */
+ * and puts it in line for the keystream pool */
 int aes_mt_start_threads(void *vevp_ctx, const u_char *key,
 			 size_t keylen, const u_char *iv,
 			 size_t ivlen, const OSSL_PARAM *ossl_params)
@@ -482,13 +552,8 @@ int aes_mt_start_threads(void *vevp_ctx, const u_char *key,
 	 * has an IV and key so we want to kill the existing key data
 	 * and start over. This is important when we need to rekey the data stream */
 	if (aes_mt_ctx->state == (HAVE_KEY | HAVE_IV)) {
-		/* tell the pregen threads to exit */
-		stop_and_join_pregen_threads(aes_mt_ctx);
-
-#ifdef __APPLE__
-		/* reset the exit flag */
-		aes_mt_ctx->exit_flag = FALSE;
-#endif /* __APPLE__ */
+		/* keep the pool away from the old key and queues */
+		ks_pool_leave(&aes_mt_ctx->client);
 
 		/* Start over getting key & iv */
 		aes_mt_ctx->state = HAVE_NONE;
@@ -497,7 +562,7 @@ int aes_mt_start_threads(void *vevp_ctx, const u_char *key,
 	/* set the initial key for this key stream queue */
 	if (key != NULL) {
 		aes_mt_ctx->keylen = EVP_CIPHER_CTX_key_length(evp_ctx) * 8;
-		aes_mt_ctx->orig_key = key;
+		memcpy(aes_mt_ctx->key, key, aes_mt_ctx->keylen / 8);
 		aes_mt_ctx->state |= HAVE_KEY;
 	}
 
@@ -509,41 +574,9 @@ int aes_mt_start_threads(void *vevp_ctx, const u_char *key,
 	}
 
 	if (aes_mt_ctx->state == (HAVE_KEY | HAVE_IV)) {
-		/* Clear queues */
-		/* set the first key in the key queue to the current counter */
-		memcpy(aes_mt_ctx->q[0].ctr, aes_mt_ctx->aes_counter, AES_BLOCK_SIZE);
-		/* indicate that it needs to be initialized */
-		aes_mt_ctx->q[0].qstate = KQINIT;
-		/* for each of the remaining queues set the first counter to the
-		 * counter and then add the size of the queue to the counter */
-		for (int i = 1; i < numkq; i++) {
-			memcpy(aes_mt_ctx->q[i].ctr, aes_mt_ctx->aes_counter, AES_BLOCK_SIZE);
-			ssh_ctr_add(aes_mt_ctx->q[i].ctr, i * KQLEN, AES_BLOCK_SIZE);
-			aes_mt_ctx->q[i].qstate = KQEMPTY;
-		}
-		aes_mt_ctx->qidx = 0;
-		aes_mt_ctx->ridx = 0;
-
-		/* Start threads */
-		for (int i = 0; i < cipher_threads; i++) {
-			pthread_rwlock_wrlock(&aes_mt_ctx->tid_lock);
-			if (pthread_create(&aes_mt_ctx->tid[i], NULL, thread_loop, aes_mt_ctx) != 0)
-				fatal ("AES-CTR MT Could not create thread in %s", __func__);
-			else {
-				if (!aes_mt_ctx->struct_id)
-					aes_mt_ctx->struct_id = global_struct_id++;
-				aes_mt_ctx->id[i] = i;
-				debug_f ("AES-CTR MT spawned a thread with id %lu (%d, %d)",
-					 aes_mt_ctx->tid[i], aes_mt_ctx->struct_id,
-					 aes_mt_ctx->id[i]);
-			}
-			pthread_rwlock_unlock(&aes_mt_ctx->tid_lock);
-		}
-		pthread_mutex_lock(&aes_mt_ctx->q[0].lock);
-		// wait for all of the threads to be initialized
-		while (aes_mt_ctx->q[0].qstate == KQINIT)
-			pthread_cond_wait(&aes_mt_ctx->q[0].cond, &aes_mt_ctx->q[0].lock);
-		pthread_mutex_unlock(&aes_mt_ctx->q[0].lock);
+		if (!aes_mt_ctx->struct_id)
+			aes_mt_ctx->struct_id = global_struct_id++;
+		ctr_start_queues(aes_mt_ctx);
 	}
 	return 1;
 }
@@ -574,7 +607,7 @@ int aes_mt_do_cipher(void *vevp_ctx,
 	struct aes_mt_ctx_st *aes_mt_ctx;
 	struct kq *q, *oldq;
 	int ridx;
-	u_char *buf;
+	u_char *buf, ctr[AES_BLOCK_SIZE];
 	EVP_CIPHER_CTX *evp_ctx = vevp_ctx;
 
 	if (len == 0)
@@ -633,28 +666,430 @@ int aes_mt_do_cipher(void *vevp_ctx,
 		/* Increment read index, switch queues on rollover */
 		if ((ridx = (ridx + 1) % KQLEN) == 0) {
 			oldq = q;
-
-			/* Mark next queue draining, may need to wait */
+			/* counter of the block following this queue */
+			memcpy(ctr, oldq->ctr, AES_BLOCK_SIZE);
+			ssh_ctr_add(ctr, KQLEN, AES_BLOCK_SIZE);
+			/* the queue's next fill is numkq queues further on */
+			ssh_ctr_add(oldq->ctr, KQLEN * numkq, AES_BLOCK_SIZE);
+
+			/* Mark consumed queue empty and next queue draining,
+			 * may need to wait */
 			aes_mt_ctx->qidx = (aes_mt_ctx->qidx + 1) % numkq;
 			q = &aes_mt_ctx->q[aes_mt_ctx->qidx];
-			pthread_mutex_lock(&q->lock);
-			while (q->qstate != KQFULL) {
-				pthread_cond_wait(&q->cond, &q->lock);
+			if (!ks_pool_swap(&aes_mt_ctx->client, &oldq->qstate,
+			    &q->qstate)) {
+				/* we were forked, nobody fills the old queues */
+				memcpy(aes_mt_ctx->aes_counter, ctr,
+				    AES_BLOCK_SIZE);
+				ctr_start_queues(aes_mt_ctx);
+				q = &aes_mt_ctx->q[0];
 			}
-			q->qstate = KQDRAINING;
-			pthread_cond_broadcast(&q->cond);
-			pthread_mutex_unlock(&q->lock);
-
-			/* Mark consumed queue empty and signal producers */
-			pthread_mutex_lock(&oldq->lock);
-			oldq->qstate = KQEMPTY;
-			pthread_cond_broadcast(&oldq->cond);
-			pthread_mutex_unlock(&oldq->lock);
 		}
 	} while (len -= AES_BLOCK_SIZE);
 	aes_mt_ctx->ridx = ridx;
 	return 1;
 }
 
+/*
+ * Multi-threaded AES-GCM
+ *
+ * aes*-gcm@openssh.com uses a fresh 96 bit nonce for every packet. The
+ * nonce is a fixed field followed by a 64 bit invocation counter that is
+ * incremented once per packet (RFC 5647 section 7.1) so the nonce, and with
+ * it the CTR keystream, of every future packet is known in advance.
+ * The pregen threads fill one keystream queue per future packet and the
+ * consumer only has to xor. GHASH is left to libcrypto's gcm128 code
+ * which uses the aggregated CLMUL/PMULL implementations where available.
+ * Queues are sized to the recent packets so keystrokes don't cost a full
+ * GCM_KQLEN of keystream each. Anything the queues can't supply (packets
+ * larger than the queue or a nonce we didn't predict) is generated
+ * inline so the output always matches EVP.
+ */
+
+/*
+ * Add num to the 64 bit invocation counter of a GCM nonce
+ */
+static void
+gcm_iv_add(u_char *iv, uint64_t num)
+{
+	int i;
+
+	for (i = GCM_IVLEN - 1; i >= GCM_IVLEN - 8 && num; i--) {
+		num += iv[i];
+		iv[i] = num & 0xff;
+		num >>= 8;
+	}
+}
+
+static const EVP_CIPHER *
+gcm_ecb_cipher(int keylen)
+{
+	return keylen == 32 ? EVP_aes_256_ecb() : EVP_aes_128_ecb();
+}
+
+/*
+ * Pool lock held. Claim the empty queue the consumer will reach first,
+ * see ctr_claim().
+ */
+static int
+gcm_claim(struct ks_client *client, struct ks_job *job)
+{
+	struct aes_mt_gcm_ctx_st *gcm_ctx = client->ctx;
+	struct gcm_kq *q;
+	int i;
+
+	for (i = 0; i < numkq; i++) {
+		q = &gcm_ctx->q[(gcm_ctx->qidx + i) % numkq];
+		if (q->qstate != KQEMPTY)
+			continue;
+		q->qstate = KQFILLING;
+		/* counter 1 is reserved for the tag */
+		job->cipher = aes_ctr_cipher(gcm_ctx->keylen);
+		job->key = gcm_ctx->key;
+		memcpy(job->ctr, q->iv, GCM_IVLEN);
+		POKE_U32(job->ctr + GCM_IVLEN, 2);
+		job->out = q->keys[0];
+		job->nblocks = q->nblocks;
+		job->qstate = &q->qstate;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * (Re)start the queues with queue 0 holding the keystream for the
+ * packet using nonce gcm_ctx->iv. Returns with q[0] draining.
+ */
+static void
+gcm_start_queues(struct aes_mt_gcm_ctx_st *gcm_ctx)
+{
+	int i;
+
+	ks_pool_leave(&gcm_ctx->client);
+
+	for (i = 0; i < numkq; i++) {
+		memcpy(gcm_ctx->q[i].iv, gcm_ctx->iv, GCM_IVLEN);
+		gcm_iv_add(gcm_ctx->q[i].iv, i);
+		gcm_ctx->q[i].nblocks = gcm_ctx->kq_fill;
+		gcm_ctx->q[i].qstate = KQEMPTY;
+	}
+	gcm_ctx->qidx = 0;
+	gcm_ctx->kq_used = 0;
+
+	if (!gcm_ctx->struct_id)
+		gcm_ctx->struct_id = global_struct_id++;
+	ks_pool_join(&gcm_ctx->client);
+	ks_pool_swap(&gcm_ctx->client, NULL, &gcm_ctx->q[0].qstate);
+}
+
+/*
+ * Fill the queues for the largest recent packet: grow at once to the
+ * size of the packet just done, shrink by an eighth of the difference
+ * per packet after that.
+ */
+static void
+gcm_kq_resize(struct aes_mt_gcm_ctx_st *gcm_ctx)
+{
+	u_int fill = gcm_ctx->kq_fill, want = gcm_ctx->pkt_blocks;
+
+	if (want >= fill)
+		fill = want;
+	else
+		fill -= (fill - want + 7) / 8;
+	gcm_ctx->kq_fill = MINIMUM(MAXIMUM(fill, GCM_KQMIN), GCM_KQLEN);
+	gcm_ctx->pkt_blocks = 0;
+}
+
+/*
+ * Hand the keystream queue for the packet using nonce gcm_ctx->iv to the
+ * consumer. The queue used by the previous packet is released back to
+ * the pool.
+ */
+static void
+gcm_next_kq(struct aes_mt_gcm_ctx_st *gcm_ctx)
+{
+	struct gcm_kq *q, *oldq;
+
+	if (gcm_ctx->kq_used) {
+		gcm_kq_resize(gcm_ctx);
+		oldq = &gcm_ctx->q[gcm_ctx->qidx];
+		gcm_iv_add(oldq->iv, numkq);
+		oldq->nblocks = gcm_ctx->kq_fill;
+		gcm_ctx->qidx = (gcm_ctx->qidx + 1) % numkq;
+		q = &gcm_ctx->q[gcm_ctx->qidx];
+		if (!ks_pool_swap(&gcm_ctx->client, &oldq->qstate,
+		    &q->qstate)) {
+			/* we were forked, nobody fills the old queues */
+			gcm_start_queues(gcm_ctx);
+		}
+	}
+	/*
+	 * A nonce was consumed outside of a packet (e.g. the IV was
+	 * exported and set again) so the queues are out of step.
+	 * Start them over.
+	 */
+	if (memcmp(gcm_ctx->q[gcm_ctx->qidx].iv, gcm_ctx->iv, GCM_IVLEN) != 0) {
+		debug3_f("AES-GCM MT resynchronizing keystream queues");
+		gcm_start_queues(gcm_ctx);
+	}
+	gcm_ctx->kq_used = 1;
+}
+
+/* block128_f for libcrypto's gcm128: used for H and EK0 */
+static void
+gcm_block(const u_char in[16], u_char out[16], const void *key)
+{
+	const struct aes_mt_gcm_ctx_st *gcm_ctx = key;
+	int outlen;
+
+	EVP_EncryptUpdate(gcm_ctx->ecb_ctx, out, &outlen, in, AES_BLOCK_SIZE);
+}
+
+/*
+ * ctr128_f for libcrypto's gcm128. Serves the keystream out of the
+ * current queue and falls back to an inline CTR for whatever it doesn't
+ * cover. The 32 bit block counter never wraps within an SSH packet so
+ * a plain 128 bit CTR produces the same keystream.
+ */
+static void
+gcm_ctr32_encrypt(const u_char *in, u_char *out, size_t blocks,
+    const void *key, const u_char ivec[16])
+{
+	const struct aes_mt_gcm_ctx_st *gcm_ctx = key;
+	const struct gcm_kq *q = &gcm_ctx->q[gcm_ctx->qidx];
+	u_char ctr[AES_BLOCK_SIZE];
+	uint64_t a, b;
+	size_t i, n, off;
+	int outlen;
+
+	off = (uint32_t)(PEEK_U32(ivec + GCM_IVLEN) - 2);
+	if (gcm_ctx->kq_used && off < q->nblocks &&
+	    memcmp(ivec, q->iv, GCM_IVLEN) == 0) {
+		n = MINIMUM(blocks, q->nblocks - off);
+		for (i = 0; i < n * AES_BLOCK_SIZE; i += sizeof(a)) {
+			memcpy(&a, in + i, sizeof(a));
+			memcpy(&b, q->keys[off] + i, sizeof(b));
+			a ^= b;
+			memcpy(out + i, &a, sizeof(a));
+		}
+		in += n * AES_BLOCK_SIZE;
+		out += n * AES_BLOCK_SIZE;
+		blocks -= n;
+		off += n;
+	}
+	if (blocks == 0)
+		return;
+
+	memcpy(ctr, ivec, GCM_IVLEN);
+	POKE_U32(ctr + GCM_IVLEN, off + 2);
+	EVP_EncryptInit_ex(gcm_ctx->ctr_ctx, NULL, NULL, NULL, ctr);
+	EVP_EncryptUpdate(gcm_ctx->ctr_ctx, out, &outlen, in,
+	    blocks * AES_BLOCK_SIZE);
+}
+
+static void *
+gcm_newctx(void *provctx, int keylen)
+{
+	struct aes_mt_gcm_ctx_st *gcm_ctx;
+
+	if ((gcm_ctx = calloc(1, sizeof(*gcm_ctx))) == NULL)
+		return NULL;
+	if ((gcm_ctx->ecb_ctx = EVP_CIPHER_CTX_new()) == NULL ||
+	    (gcm_ctx->ctr_ctx = EVP_CIPHER_CTX_new()) == NULL) {
+		EVP_CIPHER_CTX_free(gcm_ctx->ecb_ctx);
+		free(gcm_ctx);
+		return NULL;
+	}
+	get_core_count(); /* update cipher_threads and numkq */
+	gcm_ctx->client.claim = gcm_claim;
+	gcm_ctx->client.ctx = gcm_ctx;
+	gcm_ctx->provctx = provctx;
+	gcm_ctx->keylen = keylen;
+	gcm_ctx->state = HAVE_NONE;
+	gcm_ctx->taglen = -1;
+	gcm_ctx->kq_fill = GCM_KQLEN;
+	return gcm_ctx;
+}
+
+void *aes_mt_gcm_newctx_256(void *provctx)
+{
+	return gcm_newctx(provctx, 32);
+}
+
+void *aes_mt_gcm_newctx_128(void *provctx)
+{
+	return gcm_newctx(provctx, 16);
+}
+
+void aes_mt_gcm_freectx(void *vctx)
+{
+	struct aes_mt_gcm_ctx_st *gcm_ctx = vctx;
+
+	if (gcm_ctx == NULL)
+		return;
+	ks_pool_leave(&gcm_ctx->client);
+	if (gcm_ctx->gcm != NULL)
+		CRYPTO_gcm128_release(gcm_ctx->gcm);
+	EVP_CIPHER_CTX_free(gcm_ctx->ecb_ctx);
+	EVP_CIPHER_CTX_free(gcm_ctx->ctr_ctx);
+	freezero(gcm_ctx, sizeof(*gcm_ctx));
+}
+
+static int
+gcm_init(struct aes_mt_gcm_ctx_st *gcm_ctx, const u_char *key, size_t keylen,
+    const u_char *iv, size_t ivlen, int encrypt)
+{
+	gcm_ctx->encrypt = encrypt;
+	if (key != NULL) {
+		if (keylen != (size_t)gcm_ctx->keylen)
+			return 0;
+		/* keep the pool away from the old key */
+		ks_pool_leave(&gcm_ctx->client);
+		memcpy(gcm_ctx->key, key, keylen);
+		if (EVP_EncryptInit_ex(gcm_ctx->ecb_ctx,
+		    gcm_ecb_cipher(gcm_ctx->keylen), NULL, key, NULL) != 1 ||
+		    EVP_CIPHER_CTX_set_padding(gcm_ctx->ecb_ctx, 0) != 1 ||
+		    EVP_EncryptInit_ex(gcm_ctx->ctr_ctx,
+		    aes_ctr_cipher(gcm_ctx->keylen), NULL, key, NULL) != 1)
+			return 0;
+		if (gcm_ctx->gcm == NULL)
+			gcm_ctx->gcm = CRYPTO_gcm128_new(gcm_ctx, gcm_block);
+		else
+			CRYPTO_gcm128_init(gcm_ctx->gcm, gcm_ctx, gcm_block);
+		if (gcm_ctx->gcm == NULL)
+			return 0;
+		gcm_ctx->state |= HAVE_KEY;
+	}
+	if (iv != NULL) {
+		if (ivlen != GCM_IVLEN)
+			return 0;
+		memcpy(gcm_ctx->iv, iv, GCM_IVLEN);
+		gcm_ctx->state |= HAVE_IV;
+	}
+	if ((key != NULL || iv != NULL) &&
+	    gcm_ctx->state == (HAVE_KEY | HAVE_IV))
+		gcm_start_queues(gcm_ctx);
+	return 1;
+}
+
+int aes_mt_gcm_encrypt_init(void *vctx, const u_char *key, size_t keylen,
+			    const u_char *iv, size_t ivlen,
+			    const OSSL_PARAM *ossl_params)
+{
+	return gcm_init(vctx, key, keylen, iv, ivlen, 1);
+}
+
+int aes_mt_gcm_decrypt_init(void *vctx, const u_char *key, size_t keylen,
+			    const u_char *iv, size_t ivlen,
+			    const OSSL_PARAM *ossl_params)
+{
+	return gcm_init(vctx, key, keylen, iv, ivlen, 0);
+}
+
+/*
+ * EVP_CTRL_GCM_SET_IV_FIXED. cipher.c always hands us the whole nonce
+ * (len == -1), the TLS style partial fixed field isn't supported.
+ */
+int
+aes_mt_gcm_set_iv_fixed(struct aes_mt_gcm_ctx_st *gcm_ctx, const u_char *iv,
+    size_t len)
+{
+	if (len != (size_t)-1 && len != GCM_IVLEN)
+		return 0;
+	memcpy(gcm_ctx->iv, iv, GCM_IVLEN);
+	gcm_ctx->state |= HAVE_IV;
+	if (gcm_ctx->state == (HAVE_KEY | HAVE_IV))
+		gcm_start_queues(gcm_ctx);
+	return 1;
+}
+
+/*
+ * EVP_CTRL_GCM_IV_GEN. Called once before every packet: set up the
+ * nonce, copy the last len bytes of it out and advance the invocation
+ * counter for the next packet.
+ */
+int
+aes_mt_gcm_iv_gen(struct aes_mt_gcm_ctx_st *gcm_ctx, u_char *out, size_t len)
+{
+	if (gcm_ctx->state != (HAVE_KEY | HAVE_IV))
+		return 0;
+	if (len == 0 || len > GCM_IVLEN)
+		len = GCM_IVLEN;
+	gcm_next_kq(gcm_ctx);
+	CRYPTO_gcm128_setiv(gcm_ctx->gcm, gcm_ctx->iv, GCM_IVLEN);
+	memcpy(out, gcm_ctx->iv + GCM_IVLEN - len, len);
+	gcm_iv_add(gcm_ctx->iv, 1);
+	gcm_ctx->taglen = -1;
+	return 1;
+}
+
+/* this corresponds to OSSL_FUNC_cipher_cipher so EVP_Cipher() maps
+ * straight onto it:
+ *   src == NULL    finish the packet, compute or verify the tag
+ *   dest == NULL   src is additional authenticated data
+ *   otherwise      en/decrypt len bytes of src into dest
+ */
+int aes_mt_gcm_do_cipher(void *vctx,
+			 u_char *dest, size_t *destlen, size_t destsize,
+			 const u_char *src, size_t len)
+{
+	struct aes_mt_gcm_ctx_st *gcm_ctx = vctx;
+
+	*destlen = 0;
+	if (gcm_ctx->state != (HAVE_KEY | HAVE_IV))
+		return 0;
+
+	if (src == NULL) {
+		if (gcm_ctx->encrypt) {
+			CRYPTO_gcm128_tag(gcm_ctx->gcm, gcm_ctx->tag,
+			    GCM_TAGLEN);
+			gcm_ctx->taglen = GCM_TAGLEN;
+			return 1;
+		}
+		if (gcm_ctx->taglen <= 0 ||
+		    CRYPTO_gcm128_finish(gcm_ctx->gcm, gcm_ctx->tag,
+		    gcm_ctx->taglen) != 0)
+			return 0;
+		gcm_ctx->taglen = -1;
+		return 1;
+	}
+
+	if (dest != NULL)
+		gcm_ctx->pkt_blocks += (len + AES_BLOCK_SIZE - 1) /
+		    AES_BLOCK_SIZE;
+	if (dest == NULL) {
+		if (CRYPTO_gcm128_aad(gcm_ctx->gcm, src, len) != 0)
+			return 0;
+	} else if (gcm_ctx->encrypt) {
+		if (destsize < len ||
+		    CRYPTO_gcm128_encrypt_ctr32(gcm_ctx->gcm, src, dest, len,
+		    gcm_ctr32_encrypt) != 0)
+			return 0;
+	} else {
+		if (destsize < len ||
+		    CRYPTO_gcm128_decrypt_ctr32(gcm_ctx->gcm, src, dest, len,
+		    gcm_ctr32_encrypt) != 0)
+			return 0;
+	}
+	*destlen = len;
+	return 1;
+}
+
+/* libcrypto insists on an update/final pair as well */
+int aes_mt_gcm_update(void *vctx,
+		      u_char *dest, size_t *destlen, size_t destsize,
+		      const u_char *src, size_t len)
+{
+	if (src == NULL)
+		return 0;
+	return aes_mt_gcm_do_cipher(vctx, dest, destlen, destsize, src, len);
+}
+
+int aes_mt_gcm_final(void *vctx, u_char *dest, size_t *destlen,
+		     size_t destsize)
+{
+	return aes_mt_gcm_do_cipher(vctx, dest, destlen, destsize, NULL, 0);
+}
+
 #endif /*OPENSSL_VERSION_NUMBER */
 #endif /*WITH_OPENSSL*/
@@ -29,11 +29,14 @@
 #include "includes.h" /* needed to get version number */
 #include <sys/types.h>
 #include <pthread.h>
+#include "openbsd-compat/sys-queue.h"
 #include "cipher-aesctr.h"
 
 #ifndef USE_BUILTIN_RIJNDAEL
 #include <openssl/aes.h>
 #endif
+#include <openssl/evp.h>
+#include <openssl/modes.h>
 
 #ifdef WITH_OPENSSL
 /* only for systems with OSSL 3 */
@@ -44,12 +47,29 @@
 #define MAX_THREADS      6
 #define MAX_NUMKQ        (MAX_THREADS * 4)
 
+/* the keystream worker pool is shared by every cipher context in the
+ * process. Size it for one connection's worth of contexts (in and out) */
+#define MAX_POOL_THREADS (MAX_THREADS * 2)
+
 /* one queue holds 64KB of key data
  * being that the queues are destroyed after a rekey
  * and at leats one has to be fully filled prior to
  * enciphering data we don't want this to be too large */
 #define KQLEN 8192
 
+/* one GCM keystream queue holds the keystream for a single packet.
+ * 2080 blocks covers a full 32KB channel packet plus the packet
+ * framing. Anything beyond that is generated inline. */
+#define GCM_KQLEN 2080
+
+/* queues are only filled as far as recent packets needed, but at
+ * least this many blocks, see gcm_kq_resize() */
+#define GCM_KQMIN 8
+
+/* GCM nonce and tag lengths as used by aes*-gcm@openssh.com (RFC 5647) */
+#define GCM_IVLEN  12
+#define GCM_TAGLEN 16
+
 /* Processor cacheline length */
 #define CACHELINE_LEN	64
 
@@ -86,15 +106,42 @@ struct provider_ctx_st {
 	struct proverr_functions_st *proverr_handle;
 };
 
-/* Keystream Queue struct */
+/* One keystream fill handed to a pool worker.
+ * The worker encrypts nblocks of zeros starting at counter ctr into out
+ * and marks *qstate full when it is done */
+struct ks_job {
+	struct ks_client *client;
+	const EVP_CIPHER *cipher;
+	const u_char	*key;
+	u_int		keyid;
+	u_char		ctr[AES_BLOCK_SIZE]; /* 16B */
+	u_char		*out;
+	size_t		nblocks;
+	int		*qstate;
+};
+
+/* A cipher context as seen by the keystream worker pool.
+ * claim() is called with the pool lock held and sets up a job for the
+ * queue the context will need first. All fields are protected by the
+ * pool lock */
+struct ks_client {
+	TAILQ_ENTRY(ks_client) next;
+	int		(*claim)(struct ks_client *, struct ks_job *);
+	void		*ctx;
+	u_int		keyid; /* changes with every key */
+	u_int		gen; /* pool generation the queues were set up in */
+	int		busy; /* jobs in flight */
+	int		joined;
+};
+
+/* Keystream Queue struct
+ * ctr is the counter of the first block held in the queue.
+ * Queue state is protected by the pool lock */
 struct kq {
 	u_char		keys[KQLEN][AES_BLOCK_SIZE]; /* 8192 x 16B */
 	u_char		ctr[AES_BLOCK_SIZE]; /* 16B */
-	u_char          pad0[CACHELINE_LEN];
-	pthread_mutex_t	lock;
-	pthread_cond_t	cond;
 	int             qstate;
-	u_char          pad1[CACHELINE_LEN];
+	u_char          pad0[CACHELINE_LEN];
 };
 
 /* AES MT context struct */
@@ -105,20 +152,46 @@ struct aes_mt_ctx_st {
 	int		state;
 	int		qidx;
 	int		ridx;
-	int             id[MAX_THREADS]; /* 6 */
-	AES_KEY         aes_key;
-	const u_char    *orig_key;
+	u_char		key[32];
 	u_char		aes_counter[AES_BLOCK_SIZE]; /* 16B */
-	pthread_t	tid[MAX_THREADS]; /* 6 */
-	pthread_rwlock_t tid_lock;
+	struct ks_client client;
 	struct kq	q[MAX_NUMKQ]; /* 24 */
-#ifdef __APPLE__
-	pthread_rwlock_t stop_lock;
-	int		exit_flag;
-#endif /* __APPLE__ */
 	int             ongoing; /* possibly not needed */
 };
 
+/* GCM Keystream Queue struct
+ * Each queue holds the CTR keystream for the packet using nonce iv.
+ * Queue state is protected by the pool lock */
+struct gcm_kq {
+	u_char		keys[GCM_KQLEN][AES_BLOCK_SIZE]; /* 2080 x 16B */
+	u_char		iv[GCM_IVLEN]; /* 12B */
+	u_int		nblocks; /* of keys[] filled */
+	int             qstate;
+	u_char          pad0[CACHELINE_LEN];
+};
+
+/* AES GCM MT context struct */
+struct aes_mt_gcm_ctx_st {
+	struct provider_ctx_st *provctx;
+	int             struct_id;
+	int             keylen; /* in bytes */
+	int		state;
+	int		qidx;
+	int		kq_used; /* q[qidx] has been handed to a packet */
+	u_int		kq_fill; /* blocks to fill the next queues with */
+	u_int		pkt_blocks; /* en/decrypted in the current packet */
+	int		encrypt;
+	int		taglen;
+	u_char		key[32];
+	u_char		iv[GCM_IVLEN]; /* nonce of the next packet */
+	u_char		tag[GCM_TAGLEN];
+	EVP_CIPHER_CTX	*ecb_ctx; /* single blocks for GHASH key and EK0 */
+	EVP_CIPHER_CTX	*ctr_ctx; /* keystream not found in the queues */
+	GCM128_CONTEXT	*gcm;
+	struct ks_client client;
+	struct gcm_kq	q[MAX_NUMKQ]; /* 24 */
+};
+
 int aes_mt_do_cipher(void *, u_char *, size_t *, size_t, const u_char *, size_t);
 int aes_mt_start_threads(void *, const u_char *, size_t, const u_char *, size_t, const OSSL_PARAM *);
 void aes_mt_freectx(void *);
@@ -126,6 +199,17 @@ void *aes_mt_newctx_256(void *);
 void *aes_mt_newctx_192(void *);
 void *aes_mt_newctx_128(void *);
 
+int aes_mt_gcm_encrypt_init(void *, const u_char *, size_t, const u_char *, size_t, const OSSL_PARAM *);
+int aes_mt_gcm_decrypt_init(void *, const u_char *, size_t, const u_char *, size_t, const OSSL_PARAM *);
+int aes_mt_gcm_do_cipher(void *, u_char *, size_t *, size_t, const u_char *, size_t);
+int aes_mt_gcm_update(void *, u_char *, size_t *, size_t, const u_char *, size_t);
+int aes_mt_gcm_final(void *, u_char *, size_t *, size_t);
+int aes_mt_gcm_iv_gen(struct aes_mt_gcm_ctx_st *, u_char *, size_t);
+int aes_mt_gcm_set_iv_fixed(struct aes_mt_gcm_ctx_st *, const u_char *, size_t);
+void aes_mt_gcm_freectx(void *);
+void *aes_mt_gcm_newctx_256(void *);
+void *aes_mt_gcm_newctx_128(void *);
+
 #endif /* VERSION NUMBER */
 #endif /* WITH OPENSSL */
 #endif /* CTR_MT_FUNCS */
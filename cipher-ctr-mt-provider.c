@@ -32,7 +32,9 @@
 #include <openssl/core_dispatch.h>
 #include <openssl/core_names.h>
 #include <openssl/err.h>
+#include <openssl/evp.h>
 #include "xmalloc.h"
+#include "misc.h"
 #include "err.h"
 #include "num.h"
 #include "cipher-ctr-mt-functions.h"
@@ -61,6 +63,23 @@ OSSL_FUNC_cipher_encrypt_init_fn aes_mt_start_threads;
 OSSL_FUNC_cipher_decrypt_init_fn aes_mt_start_threads;
 OSSL_FUNC_cipher_update_fn aes_mt_do_cipher;
 
+/* AES GCM functions */
+OSSL_FUNC_cipher_newctx_fn aes_mt_gcm_newctx_256;
+OSSL_FUNC_cipher_newctx_fn aes_mt_gcm_newctx_128;
+OSSL_FUNC_cipher_freectx_fn aes_mt_gcm_freectx;
+OSSL_FUNC_cipher_encrypt_init_fn aes_mt_gcm_encrypt_init;
+OSSL_FUNC_cipher_decrypt_init_fn aes_mt_gcm_decrypt_init;
+OSSL_FUNC_cipher_cipher_fn aes_mt_gcm_do_cipher;
+OSSL_FUNC_cipher_update_fn aes_mt_gcm_update;
+OSSL_FUNC_cipher_final_fn aes_mt_gcm_final;
+static OSSL_FUNC_cipher_get_params_fn aes_mt_gcm_get_params_256;
+static OSSL_FUNC_cipher_get_params_fn aes_mt_gcm_get_params_128;
+static OSSL_FUNC_cipher_gettable_params_fn aes_mt_gcm_gettable_params;
+static OSSL_FUNC_cipher_get_ctx_params_fn aes_mt_gcm_get_ctx_params;
+static OSSL_FUNC_cipher_set_ctx_params_fn aes_mt_gcm_set_ctx_params;
+static OSSL_FUNC_cipher_gettable_ctx_params_fn aes_mt_gcm_gettable_ctx_params;
+static OSSL_FUNC_cipher_settable_ctx_params_fn aes_mt_gcm_settable_ctx_params;
+
 /* provider context */
 static OSSL_FUNC_provider_query_operation_fn aes_mt_prov_query;
 static OSSL_FUNC_provider_get_reason_strings_fn aes_mt_prov_reasons;
@@ -146,11 +165,56 @@ const OSSL_DISPATCH aes_mt_funcs_128[] = {
 	{ 0, NULL }
 };
 
+/* function mapping for the 256|128 GCM ciphers
+ * EVP_Cipher() prefers OSSL_FUNC_CIPHER_CIPHER which is the only
+ * path that lets us report tag failures to cipher_crypt() */
+const OSSL_DISPATCH aes_mt_gcm_funcs_256[] = {
+	{ OSSL_FUNC_CIPHER_NEWCTX, (fptr_t)aes_mt_gcm_newctx_256 } ,
+	{ OSSL_FUNC_CIPHER_FREECTX, (fptr_t)aes_mt_gcm_freectx },
+	{ OSSL_FUNC_CIPHER_ENCRYPT_INIT, (fptr_t)aes_mt_gcm_encrypt_init },
+	{ OSSL_FUNC_CIPHER_DECRYPT_INIT, (fptr_t)aes_mt_gcm_decrypt_init },
+	{ OSSL_FUNC_CIPHER_UPDATE, (fptr_t)aes_mt_gcm_update },
+	{ OSSL_FUNC_CIPHER_FINAL, (fptr_t)aes_mt_gcm_final },
+	{ OSSL_FUNC_CIPHER_CIPHER, (fptr_t)aes_mt_gcm_do_cipher },
+	{ OSSL_FUNC_CIPHER_GET_PARAMS, (fptr_t)aes_mt_gcm_get_params_256 },
+	{ OSSL_FUNC_CIPHER_GETTABLE_PARAMS,
+	  (fptr_t)aes_mt_gcm_gettable_params },
+	{ OSSL_FUNC_CIPHER_GET_CTX_PARAMS, (fptr_t)aes_mt_gcm_get_ctx_params },
+	{ OSSL_FUNC_CIPHER_GETTABLE_CTX_PARAMS,
+	  (fptr_t)aes_mt_gcm_gettable_ctx_params },
+	{ OSSL_FUNC_CIPHER_SET_CTX_PARAMS, (fptr_t)aes_mt_gcm_set_ctx_params },
+	{ OSSL_FUNC_CIPHER_SETTABLE_CTX_PARAMS,
+	  (fptr_t)aes_mt_gcm_settable_ctx_params },
+	{ 0, NULL }
+};
+
+const OSSL_DISPATCH aes_mt_gcm_funcs_128[] = {
+	{ OSSL_FUNC_CIPHER_NEWCTX, (fptr_t)aes_mt_gcm_newctx_128 } ,
+	{ OSSL_FUNC_CIPHER_FREECTX, (fptr_t)aes_mt_gcm_freectx },
+	{ OSSL_FUNC_CIPHER_ENCRYPT_INIT, (fptr_t)aes_mt_gcm_encrypt_init },
+	{ OSSL_FUNC_CIPHER_DECRYPT_INIT, (fptr_t)aes_mt_gcm_decrypt_init },
+	{ OSSL_FUNC_CIPHER_UPDATE, (fptr_t)aes_mt_gcm_update },
+	{ OSSL_FUNC_CIPHER_FINAL, (fptr_t)aes_mt_gcm_final },
+	{ OSSL_FUNC_CIPHER_CIPHER, (fptr_t)aes_mt_gcm_do_cipher },
+	{ OSSL_FUNC_CIPHER_GET_PARAMS, (fptr_t)aes_mt_gcm_get_params_128 },
+	{ OSSL_FUNC_CIPHER_GETTABLE_PARAMS,
+	  (fptr_t)aes_mt_gcm_gettable_params },
+	{ OSSL_FUNC_CIPHER_GET_CTX_PARAMS, (fptr_t)aes_mt_gcm_get_ctx_params },
+	{ OSSL_FUNC_CIPHER_GETTABLE_CTX_PARAMS,
+	  (fptr_t)aes_mt_gcm_gettable_ctx_params },
+	{ OSSL_FUNC_CIPHER_SET_CTX_PARAMS, (fptr_t)aes_mt_gcm_set_ctx_params },
+	{ OSSL_FUNC_CIPHER_SETTABLE_CTX_PARAMS,
+	  (fptr_t)aes_mt_gcm_settable_ctx_params },
+	{ 0, NULL }
+};
+
 /* the ciphers found in this provider */
 const OSSL_ALGORITHM aes_mt_ciphers[] = {
 	{ "aes_ctr_mt_256", "provider=hpnssh", aes_mt_funcs_256 },
 	{ "aes_ctr_mt_192", "provider=hpnssh", aes_mt_funcs_192 },
 	{ "aes_ctr_mt_128", "provider=hpnssh", aes_mt_funcs_128 },
+	{ "aes_gcm_mt_256", "provider=hpnssh", aes_mt_gcm_funcs_256 },
+	{ "aes_gcm_mt_128", "provider=hpnssh", aes_mt_gcm_funcs_128 },
 	{ NULL, NULL, NULL }
 };
 
@@ -179,6 +243,30 @@ static const OSSL_PARAM cipher_set_param_table[] = {
 	{ NULL, 0, NULL, 0, 0 },
 };
 
+static const OSSL_PARAM gcm_get_param_table[] = {
+	{ "blocksize", OSSL_PARAM_UNSIGNED_INTEGER, NULL, sizeof(size_t), 0 },
+	{ "keylen", OSSL_PARAM_UNSIGNED_INTEGER, NULL, sizeof(size_t), 0 },
+	{ "ivlen", OSSL_PARAM_UNSIGNED_INTEGER, NULL, sizeof(size_t), 0 },
+	{ "mode", OSSL_PARAM_UNSIGNED_INTEGER, NULL, sizeof(unsigned int), 0 },
+	{ "aead", OSSL_PARAM_INTEGER, NULL, sizeof(int), 0 },
+	{ NULL, 0, NULL, 0, 0 },
+};
+
+static const OSSL_PARAM gcm_ctx_get_param_table[] = {
+	{ "keylen", OSSL_PARAM_UNSIGNED_INTEGER, NULL, sizeof(size_t), 0 },
+	{ "ivlen", OSSL_PARAM_UNSIGNED_INTEGER, NULL, sizeof(size_t), 0 },
+	{ "taglen", OSSL_PARAM_UNSIGNED_INTEGER, NULL, sizeof(size_t), 0 },
+	{ "tag", OSSL_PARAM_OCTET_STRING, NULL, 0, 0 },
+	{ "tlsivgen", OSSL_PARAM_OCTET_STRING, NULL, 0, 0 },
+	{ NULL, 0, NULL, 0, 0 },
+};
+
+static const OSSL_PARAM gcm_ctx_set_param_table[] = {
+	{ "tag", OSSL_PARAM_OCTET_STRING, NULL, 0, 0 },
+	{ "tlsivfixed", OSSL_PARAM_OCTET_STRING, NULL, 0, 0 },
+	{ NULL, 0, NULL, 0, 0 },
+};
+
 
 /* provider functions start here */
 
@@ -388,5 +476,128 @@ static int aes_mt_set_ctx_params(void *vctx, const OSSL_PARAM params[])
     return ok;
 }
 
+/* parameter functions for the 256|128 bit GCM ciphers */
+static int aes_mt_gcm_get_params(OSSL_PARAM params[], size_t keyl)
+{
+	OSSL_PARAM *p;
+	int ok = 1;
+
+	for (p = params; p->key != NULL; p++) {
+		if (strcasecmp(p->key, "blocksize") == 0 &&
+		    provnum_set_size_t(p, 1) < 0)
+			ok = 0;
+		else if (strcasecmp(p->key, "keylen") == 0 &&
+		    provnum_set_size_t(p, keyl) < 0)
+			ok = 0;
+		else if (strcasecmp(p->key, "ivlen") == 0 &&
+		    provnum_set_size_t(p, GCM_IVLEN) < 0)
+			ok = 0;
+		else if (strcasecmp(p->key, "mode") == 0 &&
+		    provnum_set_size_t(p, EVP_CIPH_GCM_MODE) < 0)
+			ok = 0;
+		else if (strcasecmp(p->key, "aead") == 0 &&
+		    provnum_set_size_t(p, 1) < 0)
+			ok = 0;
+	}
+	return ok;
+}
+
+static int aes_mt_gcm_get_params_256(OSSL_PARAM params[])
+{
+	return aes_mt_gcm_get_params(params, 32);
+}
+
+static int aes_mt_gcm_get_params_128(OSSL_PARAM params[])
+{
+	return aes_mt_gcm_get_params(params, 16);
+}
+
+static const OSSL_PARAM *aes_mt_gcm_gettable_params(void *provctx)
+{
+	return gcm_get_param_table;
+}
+
+static const OSSL_PARAM *aes_mt_gcm_gettable_ctx_params(void *cctx,
+    void *provctx)
+{
+	return gcm_ctx_get_param_table;
+}
+
+static const OSSL_PARAM *aes_mt_gcm_settable_ctx_params(void *cctx,
+    void *provctx)
+{
+	return gcm_ctx_set_param_table;
+}
+
+static int aes_mt_gcm_get_ctx_params(void *vctx, OSSL_PARAM params[])
+{
+	struct aes_mt_gcm_ctx_st *ctx = vctx;
+	OSSL_PARAM *p;
+	int ok = 1;
+
+	for (p = params; p->key != NULL; p++) {
+		if (strcasecmp(p->key, "keylen") == 0) {
+			if (provnum_set_size_t(p, ctx->keylen) < 0)
+				ok = 0;
+		} else if (strcasecmp(p->key, "ivlen") == 0) {
+			if (provnum_set_size_t(p, GCM_IVLEN) < 0)
+				ok = 0;
+		} else if (strcasecmp(p->key, "taglen") == 0) {
+			if (provnum_set_size_t(p, GCM_TAGLEN) < 0)
+				ok = 0;
+		} else if (strcasecmp(p->key, "tag") == 0) {
+			/* only valid once an encryption has been finished */
+			if (p->data_type != OSSL_PARAM_OCTET_STRING ||
+			    !ctx->encrypt || ctx->taglen <= 0 ||
+			    p->data_size == 0 || p->data_size > GCM_TAGLEN) {
+				ok = 0;
+				continue;
+			}
+			memcpy(p->data, ctx->tag, p->data_size);
+			p->return_size = p->data_size;
+		} else if (strcasecmp(p->key, "tlsivgen") == 0) {
+			if (p->data_type != OSSL_PARAM_OCTET_STRING ||
+			    !aes_mt_gcm_iv_gen(ctx, p->data, p->data_size)) {
+				ok = 0;
+				continue;
+			}
+			p->return_size = MINIMUM(p->data_size, GCM_IVLEN);
+		}
+	}
+	return ok;
+}
+
+static int aes_mt_gcm_set_ctx_params(void *vctx, const OSSL_PARAM params[])
+{
+	struct aes_mt_gcm_ctx_st *ctx = vctx;
+	const OSSL_PARAM *p;
+	int ok = 1;
+
+	if (params == NULL)
+		return 1;
+	for (p = params; p->key != NULL; p++) {
+		if (strcasecmp(p->key, "tag") == 0) {
+			/* expected tag, only valid when decrypting */
+			if (p->data_type != OSSL_PARAM_OCTET_STRING ||
+			    ctx->encrypt || p->data == NULL ||
+			    p->data_size == 0 || p->data_size > GCM_TAGLEN) {
+				ok = 0;
+				continue;
+			}
+			memcpy(ctx->tag, p->data, p->data_size);
+			ctx->taglen = p->data_size;
+		} else if (strcasecmp(p->key, "tlsivfixed") == 0) {
+			if (p->data_type != OSSL_PARAM_OCTET_STRING ||
+			    p->data == NULL ||
+			    !aes_mt_gcm_set_iv_fixed(ctx, p->data,
+			    p->data_size)) {
+				ok = 0;
+				continue;
+			}
+		}
+	}
+	return ok;
+}
+
 #endif /*OPENSSL_VERSION_NUMBER */
 #endif /*WITH_OPENSSL*/
@@ -68,6 +68,9 @@ int cipher_threads = 2;
  * is a default and the actual value is determined in init*/
 int numkq = 8;
 
+/* set by sshd from MTAESMaxThreads, see cipher.c */
+extern int cipher_mt_limit;
+
 /* Length of a keystream queue */
 /* one queue holds 64KB of key data
  * being that the queues are destroyed after a rekey
@@ -529,6 +532,10 @@ ssh_aes_ctr_init(EVP_CIPHER_CTX *ctx, const u_char *key, const u_char *iv,
 	if (cipher_threads > MAX_THREADS)
 		cipher_threads = MAX_THREADS;
 
+	/* each direction starts its own threads */
+	if (cipher_mt_limit > 0 && cipher_threads * 2 > cipher_mt_limit)
+		cipher_threads = MAXIMUM(1, cipher_mt_limit / 2);
+
 	/* set the number of keystream queues. 4 for each thread
 	 * this seems to reduce waiting in the cipher process for queues
 	 * to fill up */
@@ -660,6 +667,16 @@ ssh_aes_ctr_cleanup(EVP_CIPHER_CTX *ctx)
  * in LSSL 3.7. So we have a hole were we can't support this in
  * LibreSSL. */
 
+/*
+ * Threads a connection may start when nothing limits it. Both directions
+ * count the cores when their key is set, so this is the most they start.
+ */
+int
+cipher_mt_pool_size(void)
+{
+	return MAX_THREADS * 2;
+}
+
 const EVP_CIPHER *
 evp_aes_ctr_mt(void)
 {
@@ -66,6 +66,14 @@
 extern const EVP_CIPHER *evp_aes_ctr_mt(void);
 #endif
 
+/*
+ * Keystream threads the multithreaded AES ciphers may start in this
+ * process; -1 for as many as the core count suggests, 0 for none, in which
+ * case the stock ciphers are used. sshd hands each connection its share
+ * of MTAESMaxThreads.
+ */
+int cipher_mt_limit = -1;
+
 struct sshcipher_ctx {
 	int	plaintext;
 	int	encrypt;
@@ -198,6 +206,12 @@ cipher_ctx_name(const struct sshcipher_ctx *cc)
 /* } */
 /* #endif /\*WITH_OPENSSL*\/ */
 
+void
+cipher_set_mt_limit(int n)
+{
+	cipher_mt_limit = n;
+}
+
 u_int
 cipher_blocksize(const struct sshcipher *c)
 {
@@ -345,39 +359,45 @@ cipher_init(struct sshcipher_ctx **ccp, const struct sshcipher *cipher,
 	 * if we are using the ctr cipher and we are post-auth then
 	 * start the threaded cipher. If OSSL supports providers (OSSL 3.0+) then
 	 * we load our hpnssh provider. If it doesn't (OSSL < 1.1) then we use the
-	 * _meth_new process found in cipher-ctr-mt.c */
-	if (strstr(cc->cipher->name, "ctr") && post_auth) {
+	 * _meth_new process found in cipher-ctr-mt.c
+	 * With providers the aes-gcm ciphers have a threaded version as well */
 #if OPENSSL_VERSION_NUMBER >= 0x30000000UL
+	if ((strstr(cc->cipher->name, "ctr") ||
+	     strstr(cc->cipher->name, "gcm")) && post_auth &&
+	    cipher_mt_limit != 0) {
 		/* this version of openssl uses providers */
 		OSSL_LIB_CTX *aes_lib = NULL; /* probably not needed */
 		OSSL_PROVIDER *aes_mt_provider = NULL;
+		const char *mode = strstr(cc->cipher->name, "gcm") ?
+		    "gcm" : "ctr";
+		char name[32];
 
 		if (OSSL_PROVIDER_add_builtin(aes_lib, "hpnssh",
 					      OSSL_provider_init) != 1) {
-			fatal("Failed to add HPNSSH provider for AES-CTR");
+			fatal("Failed to add HPNSSH provider for AES-%s", mode);
 		}
 		aes_mt_provider = OSSL_PROVIDER_load(aes_lib, "hpnssh");
 
 		if (aes_mt_provider != NULL) {
 			/* use the previous key length to determine which cipher to load */
-			if (cipher->key_len == 32)
-				type = EVP_CIPHER_fetch(aes_lib, "aes_ctr_mt_256", NULL);
-			if (cipher->key_len == 24)
-				type = EVP_CIPHER_fetch(aes_lib, "aes_ctr_mt_192", NULL);
-			if (cipher->key_len == 16)
-				type = EVP_CIPHER_fetch(aes_lib, "aes_ctr_mt_128", NULL);
+			snprintf(name, sizeof(name), "aes_%s_mt_%u", mode,
+			    cipher->key_len * 8);
+			type = EVP_CIPHER_fetch(aes_lib, name, NULL);
 			if (type == NULL) {
 				ERR_print_errors_fp(stderr);
-				fatal("FAILED TO LOAD aes_ctr_mt");
+				fatal("FAILED TO LOAD %s", name);
 			} else {
-				debug("LOADED aes_ctr_mt");
+				debug("LOADED %s", name);
 			}
 		}
 		else {
 			ERR_print_errors_fp(stderr);
-			fatal("Failed to load HPN-SSH AES-CTR-MT provider.");
+			fatal("Failed to load HPN-SSH AES-MT provider.");
 		}
+	} /* if (strstr()) */
 #else
+	if (strstr(cc->cipher->name, "ctr") && post_auth &&
+	    cipher_mt_limit != 0) {
 		/* this version doesn't so check to see if we are in the
 		 * LibreSSL hole that doesn't support this at all  otherwise
 		 * load the MT cipher */
@@ -388,8 +408,8 @@ cipher_init(struct sshcipher_ctx **ccp, const struct sshcipher *cipher,
 #else
 		type = (*evp_aes_ctr_mt)(); /* see cipher-ctr-mt.c */
 #endif
-#endif /* OPENSSL_VERSION_NUMBER */
 	} /* if (strstr()) */
+#endif /* OPENSSL_VERSION_NUMBER */
 	if (EVP_CipherInit(cc->evp, type, NULL, (u_char *)iv,
 	    (do_encrypt == CIPHER_ENCRYPT)) == 0) {
 		ret = SSH_ERR_LIBCRYPTO_ERROR;
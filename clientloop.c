@@ -114,6 +114,8 @@
 #include "msg.h"
 #include "ssherr.h"
 #include "hostfile.h"
+#include "timing.h"
+#include "resume.h"
 
 /* Permitted RSA signature algorithms for UpdateHostkeys proofs */
 #define HOSTKEY_PROOF_RSA_ALGS	"rsa-sha2-512,rsa-sha2-256"
@@ -164,10 +166,35 @@ static time_t server_alive_time;	/* Time to do server_alive_check */
 static void client_init_dispatch(struct ssh *ssh);
 int	session_ident = -1;
 
+/* Predictive local echo, see client_predict_input() */
+#define PREDICT_MAX		64	/* typed bytes awaiting their echo */
+#define PREDICT_TRUST		2	/* echoes seen before drawing input */
+#define PREDICT_MIN_RTT		0.03	/* seconds, for PredictiveEcho=yes */
+#define PREDICT_SETTLE		0.05	/* seconds, see client_predict_input() */
+
+struct echo_prediction {
+	u_char ch;
+	int shown;		/* drawn on the local terminal */
+	double when;		/* time typed */
+};
+
+struct echo_predict {
+	int mode;		/* PREDICTIVE_ECHO_* */
+	int confirmed;		/* keystrokes echoed back as typed */
+	int blind;		/* typed input whose echo we cannot predict */
+	double blind_since;
+	double rtt;		/* smoothed keystroke to echo delay */
+	struct echo_prediction pending[PREDICT_MAX];
+	u_int npending;
+	struct sshbuf *out;	/* reconciled output not yet written */
+	size_t examined;	/* bytes of c->output represented in out */
+};
+
 /* Track escape per proto2 channel */
 struct escape_filter_ctx {
 	int escape_pending;
 	int escape_char;
+	struct echo_predict *predict;
 };
 
 /* Context for channel confirmation replies */
@@ -495,6 +522,11 @@ server_alive_check(struct ssh *ssh)
 
 	if (ssh_packet_inc_alive_timeouts(ssh) > options.server_alive_count_max) {
 		logit("Timeout, server %s not responding.", host);
+		if (ssh_packet_resume_armed(ssh)) {
+			ssh_packet_detach(ssh);
+			schedule_server_alive_check();
+			return;
+		}
 		cleanup_exit(255);
 	}
 	if ((r = sshpkt_start(ssh, SSH2_MSG_GLOBAL_REQUEST)) != 0 ||
@@ -629,6 +661,17 @@ client_suspend_self(struct sshbuf *bin, struct sshbuf *bout, struct sshbuf *berr
 	enter_raw_mode(options.request_tty == REQUEST_TTY_FORCE);
 }
 
+/* Reply to our request to make the session resumable */
+static void
+client_resume_confirm(struct ssh *ssh, int type, u_int32_t seq, void *ctx)
+{
+	if (type != SSH2_MSG_REQUEST_SUCCESS) {
+		debug("Server declined to make the session resumable");
+		ssh_packet_resume_disarm(ssh);
+	} else if (resume_client_start(ssh, options.resume_timeout) != 0)
+		ssh_packet_resume_disarm(ssh);
+}
+
 static void
 client_process_net_input(struct ssh *ssh)
 {
@@ -1180,21 +1223,207 @@ client_new_escape_filter_ctx(int escape_char)
 	return (void *)ret;
 }
 
+static struct echo_predict *
+client_predict_new(int mode)
+{
+	struct echo_predict *ep;
+
+	ep = xcalloc(1, sizeof(*ep));
+	ep->mode = mode;
+	if ((ep->out = sshbuf_new()) == NULL)
+		fatal_f("sshbuf_new failed");
+	return ep;
+}
+
 /* Free the escape filter context on channel free */
 void
 client_filter_cleanup(struct ssh *ssh, int cid, void *ctx)
 {
+	struct escape_filter_ctx *efc = (struct escape_filter_ctx *)ctx;
+
+	if (efc != NULL && efc->predict != NULL) {
+		sshbuf_free(efc->predict->out);
+		free(efc->predict);
+	}
 	free(ctx);
 }
 
+/*
+ * Predictive local echo: keystrokes the server has recently been echoing
+ * verbatim are drawn on the terminal as soon as they are typed, and the
+ * echo is removed from the server's output when it arrives.  If the server
+ * sends anything else the predictions are erased and prediction stops until
+ * the server is seen echoing again.  Control characters (Return, ESC, ^C)
+ * often change what the remote side does with input, e.g. a password
+ * prompt, so after one the next keystroke must be confirmed before anything
+ * is drawn.
+ */
+static void
+client_predict_input(Channel *c, struct echo_predict *ep,
+    const u_char *p, size_t len)
+{
+	u_char show[PREDICT_MAX];
+	struct echo_prediction *pr;
+	size_t i, nshow = 0;
+	ssize_t w;
+	double now = monotime_double();
+	int display;
+
+	/*
+	 * Only draw once everything before the prediction has reached the
+	 * terminal, so the local cursor is where the server thinks it is.
+	 */
+	display = ep->confirmed >= PREDICT_TRUST &&
+	    (ep->mode == PREDICTIVE_ECHO_ALWAYS || ep->rtt >= PREDICT_MIN_RTT) &&
+	    sshbuf_len(c->output) == 0 && c->wfd != -1 &&
+	    (ep->npending == 0 || ep->pending[ep->npending - 1].shown);
+	for (i = 0; i < len; i++) {
+		if (p[i] < 0x20 || p[i] > 0x7e || ep->npending >= PREDICT_MAX) {
+			ep->blind = 1;
+			ep->blind_since = now;
+			ep->confirmed = MINIMUM(ep->confirmed, PREDICT_TRUST - 1);
+			display = 0;
+			continue;
+		}
+		if (ep->blind) {
+			/*
+			 * Output for unpredicted input may still be on its
+			 * way; resume once it should have arrived.
+			 */
+			if (ep->npending != 0 ||
+			    now - ep->blind_since < 2 * ep->rtt + PREDICT_SETTLE) {
+				ep->blind_since = now;
+				continue;
+			}
+			ep->blind = 0;
+		}
+		pr = &ep->pending[ep->npending++];
+		pr->ch = p[i];
+		pr->shown = display;
+		pr->when = now;
+		if (display)
+			show[nshow++] = p[i];
+	}
+	if (nshow == 0)
+		return;
+	if ((w = write(c->wfd, show, nshow)) < 0)
+		w = 0;
+	debug3_f("drew %zd of %zu predicted bytes", w, nshow);
+	/* Whatever did not reach the terminal stays unshown */
+	for (i = ep->npending - (nshow - w); i < ep->npending; i++)
+		ep->pending[i].shown = 0;
+}
+
+/*
+ * Match output from the server against pending predictions and append what
+ * should be written to the terminal to ep->out.
+ */
+static void
+client_predict_reconcile(struct echo_predict *ep, const u_char *p, size_t len)
+{
+	struct echo_prediction *pr;
+	double sample, now = monotime_double();
+	size_t i;
+	u_int n;
+	int r;
+
+	for (i = 0; i < len && ep->npending > 0; i++) {
+		pr = &ep->pending[0];
+		if (p[i] != pr->ch) {
+			/* Not an echo of what was typed; undo predictions */
+			for (n = 0; n < ep->npending; n++) {
+				if (ep->pending[n].shown &&
+				    (r = sshbuf_put(ep->out, "\b \b", 3)) != 0)
+					fatal_fr(r, "sshbuf_put");
+			}
+			debug3_f("mismatch, dropping %u predictions",
+			    ep->npending);
+			ep->npending = 0;
+			ep->confirmed = 0;
+			break;
+		}
+		if (!pr->shown && (r = sshbuf_put_u8(ep->out, p[i])) != 0)
+			fatal_fr(r, "sshbuf_put_u8");
+		if (ep->confirmed < PREDICT_TRUST)
+			ep->confirmed++;
+		sample = now - pr->when;
+		ep->rtt = ep->rtt == 0 ? sample : (7 * ep->rtt + sample) / 8;
+		memmove(ep->pending, ep->pending + 1,
+		    --ep->npending * sizeof(*ep->pending));
+	}
+	if ((r = sshbuf_put(ep->out, p + i, len - i)) != 0)
+		fatal_fr(r, "sshbuf_put");
+}
+
+/*
+ * Output filter for sessions with predictive echo.  Writes to the terminal
+ * itself: c->output is only consumed once its reconciled form in ep->out
+ * has been written completely, which keeps flow control and polling on the
+ * channel buffer.
+ */
+static u_char *
+client_predict_output_filter(struct ssh *ssh, Channel *c, u_char **data,
+    size_t *dlen)
+{
+	struct escape_filter_ctx *efc = (struct escape_filter_ctx *)c->filter_ctx;
+	struct echo_predict *ep = efc->predict;
+	struct sshbuf *b;
+	size_t len;
+	ssize_t w;
+	int r;
+
+	*data = NULL;
+	*dlen = 0;
+	for (;;) {
+		if (sshbuf_len(ep->out) == 0) {
+			if ((r = sshbuf_consume(c->output, ep->examined)) != 0)
+				fatal_fr(r, "consume");
+			ep->examined = 0;
+			if (sshbuf_len(c->output) == 0)
+				break;
+			if (ep->npending != 0) {
+				client_predict_reconcile(ep,
+				    sshbuf_ptr(c->output),
+				    sshbuf_len(c->output));
+				ep->examined = sshbuf_len(c->output);
+				continue;
+			}
+			/* Nothing predicted: write straight from the channel */
+			b = c->output;
+		} else
+			b = ep->out;
+		len = sshbuf_len(b);
+		if ((w = write(c->wfd, sshbuf_ptr(b), len)) == -1) {
+			if (errno == EINTR || errno == EAGAIN ||
+			    errno == EWOULDBLOCK)
+				break;
+			return NULL;
+		}
+		if ((r = sshbuf_consume(b, w)) != 0)
+			fatal_fr(r, "consume");
+		if ((size_t)w < len)
+			break;
+	}
+	return sshbuf_mutable_ptr(ep->out);
+}
+
 int
 client_simple_escape_filter(struct ssh *ssh, Channel *c, char *buf, int len)
 {
+	struct escape_filter_ctx *efc = (struct escape_filter_ctx *)c->filter_ctx;
+	size_t olen = sshbuf_len(c->input);
+	int ret;
+
 	if (c->extended_usage != CHAN_EXTENDED_WRITE)
 		return 0;
 
-	return process_escapes(ssh, c, c->input, c->output, c->extended,
+	ret = process_escapes(ssh, c, c->input, c->output, c->extended,
 	    buf, len);
+	if (efc != NULL && efc->predict != NULL &&
+	    sshbuf_len(c->input) > olen)
+		client_predict_input(c, efc->predict,
+		    sshbuf_ptr(c->input) + olen, sshbuf_len(c->input) - olen);
+	return ret;
 }
 
 static void
@@ -1216,9 +1445,10 @@ client_loop(struct ssh *ssh, int have_pty, int escape_char_arg,
     int ssh2_chan_id)
 {
 	struct pollfd *pfd = NULL;
+	struct escape_filter_ctx *efc;
 	u_int npfd_alloc = 0, npfd_active = 0;
 	double start_time, total_time;
-	int r, len;
+	int r, len, predict;
 	u_int64_t ibytes, obytes;
 	int conn_in_ready, conn_out_ready;
 
@@ -1271,6 +1501,9 @@ client_loop(struct ssh *ssh, int have_pty, int escape_char_arg,
 
 	client_init_dispatch(ssh);
 
+	if (options.resume_timeout > 0 && resume_client_request(ssh) == 0)
+		client_register_global_confirm(client_resume_confirm, NULL);
+
 	/*
 	 * Set signal handlers, (e.g. to restore non-blocking mode)
 	 * but don't overwrite SIG_IGN, matches behaviour from rsh(1)
@@ -1290,12 +1523,19 @@ client_loop(struct ssh *ssh, int have_pty, int escape_char_arg,
 
 	session_ident = ssh2_chan_id;
 	if (session_ident != -1) {
-		if (escape_char_arg != SSH_ESCAPECHAR_NONE) {
+		predict = have_pty &&
+		    options.predictive_echo != PREDICTIVE_ECHO_NO;
+		if (escape_char_arg != SSH_ESCAPECHAR_NONE || predict) {
+			efc = client_new_escape_filter_ctx(escape_char_arg);
+			if (predict) {
+				debug("Enabling predictive local echo");
+				efc->predict =
+				    client_predict_new(options.predictive_echo);
+			}
 			channel_register_filter(ssh, session_ident,
-			    client_simple_escape_filter, NULL,
-			    client_filter_cleanup,
-			    client_new_escape_filter_ctx(
-			    escape_char_arg));
+			    client_simple_escape_filter,
+			    predict ? client_predict_output_filter : NULL,
+			    client_filter_cleanup, efc);
 		}
 		channel_register_cleanup(ssh, session_ident,
 		    client_channel_closed, 0);
@@ -1325,6 +1565,7 @@ client_loop(struct ssh *ssh, int have_pty, int escape_char_arg,
 			 */
 			if (ssh_packet_not_very_much_data_to_write(ssh))
 				channel_output_poll(ssh);
+			resume_poll(ssh);
 
 			/*
 			 * Check if the window size has changed, and buffer a
@@ -1335,6 +1576,17 @@ client_loop(struct ssh *ssh, int have_pty, int escape_char_arg,
 			if (quit_pending)
 				break;
 		}
+		/* Reconnect if a resumable session lost its transport */
+		if (ssh_packet_is_detached(ssh)) {
+			if (resume_client_reconnect(ssh) != 0) {
+				quit_message("Connection to %s lost.", host);
+				break;
+			}
+			connection_in = ssh_packet_get_connection_in(ssh);
+			connection_out = ssh_packet_get_connection_out(ssh);
+			schedule_server_alive_check();
+		}
+
 		/*
 		 * Wait until we have something to do (something becomes
 		 * available on one of the descriptors).
@@ -2436,6 +2688,9 @@ client_input_global_request(int type, u_int32_t seq, struct ssh *ssh)
 	    rtype, want_reply);
 	if (strcmp(rtype, "hostkeys-00@openssh.com") == 0)
 		success = client_input_hostkeys(ssh);
+	else if (strcmp(rtype, "resume-ack@hpnssh.org") == 0 &&
+	    (r = resume_input_ack(ssh)) != 0)
+		goto out;
 	if (want_reply) {
 		if ((r = sshpkt_start(ssh, success ? SSH2_MSG_REQUEST_SUCCESS :
 		    SSH2_MSG_REQUEST_FAILURE)) != 0 ||
@@ -2625,5 +2880,6 @@ cleanup_exit(int i)
 	if (options.control_path != NULL && muxserver_sock != -1)
 		unlink(options.control_path);
 	ssh_kill_proxy_command();
+	timing_report(0);
 	_exit(i);
 }
@@ -79,6 +79,7 @@ void client_expect_confirm(struct ssh *, int, const char *,
 
 void	muxserver_listen(struct ssh *);
 int	muxclient(const char *);
+u_int	muxclient_master_pid(const char *);
 void	mux_exit_message(struct ssh *, Channel *, int);
 void	mux_tty_alloc_failed(struct ssh *ssh, Channel *);
 
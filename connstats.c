@@ -0,0 +1,516 @@
+/*
+ * Copyright (c) 2026 Pittsburgh Supercomputing Center. All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Connection statistics kept by the listening sshd.
+ *
+ * Children report how long their key exchange and each authentication
+ * attempt took as records on their startup pipe, much as dnscache.c does
+ * for name lookups. The listener adds its own accept-to-fork times,
+ * MaxStartups drops and counts of connections in progress, and serves
+ * them from a Unix domain socket (StatsSocket) as text in the Prometheus
+ * exposition format or as JSON. Only the listener updates them and it is
+ * single threaded, so the histograms are plain arrays of counters.
+ */
+
+#include "includes.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "atomicio.h"
+#include "connstats.h"
+#include "kex.h"
+#include "log.h"
+#include "misc.h"
+#include "sshbuf.h"
+#include "ssherr.h"
+#include "xmalloc.h"
+
+/* Marks a timing record on the startup pipe; terminated by '\n' */
+#define CONNSTATS_REPORT	'T'
+/* dnscache.c's records, which may contain anything and are skipped */
+#define CONNSTATS_DNSCACHE	'H'
+
+/* Longest record, and most distinct label sets kept */
+#define CONNSTATS_MAX_RECORD	256
+#define CONNSTATS_MAX_HIST	64
+
+/* Characters allowed in labels; never CONNSTATS_DNSCACHE or '"' */
+#define CONNSTATS_LABEL_CHARS	"abcdefghijklmnopqrstuvwxyz0123456789@._+-"
+
+/* Upper bounds of the histogram buckets, in seconds, before +Inf */
+static const double bounds[] = {
+	0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+	0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+#define NBOUNDS	(sizeof(bounds) / sizeof(*bounds))
+
+enum { HIST_ACCEPT, HIST_HANDSHAKE, HIST_AUTH, HIST_FAMILIES };
+
+static const struct family {
+	const char *name;
+	const char *help;
+	const char *label[2];
+} families[HIST_FAMILIES] = {
+	{ "sshd_accept_to_fork_seconds",
+	    "Time from accepting a connection until its child is forked.",
+	    { NULL, NULL } },
+	{ "sshd_handshake_seconds",
+	    "Time from a child starting until key exchange completes.",
+	    { "kex", NULL } },
+	{ "sshd_auth_seconds",
+	    "Time the monitor spent deciding each authentication attempt.",
+	    { "method", "result" } },
+};
+
+static struct histogram {
+	int family;
+	char *label[2];
+	u_int64_t bucket[NBOUNDS + 1];	/* not cumulative; last is +Inf */
+	u_int64_t count;
+	double sum;
+} *hists;
+static u_int nhists;
+
+static struct {
+	const char *reason;
+	u_int64_t count;
+} drops[] = {
+	{ "startups", 0 },	/* MaxStartups */
+	{ "source", 0 },	/* PerSourceMaxStartups and penalties */
+	{ "ident", 0 },		/* IdentScreenTime */
+};
+
+static u_int64_t connections;
+static int stats_sock = -1, stats_json, stats_pollidx = -1;
+static char *stats_path;
+
+/* Connection side state */
+static int report_fd = -1;
+static double report_start;
+
+static struct histogram *
+hist_lookup(int family, const char *l0, const char *l1)
+{
+	struct histogram *h;
+	u_int i;
+
+	for (i = 0; i < nhists; i++) {
+		h = &hists[i];
+		if (h->family == family &&
+		    (l0 == NULL || strcmp(h->label[0], l0) == 0) &&
+		    (l1 == NULL || strcmp(h->label[1], l1) == 0))
+			return h;
+	}
+	if (nhists >= CONNSTATS_MAX_HIST) {
+		debug_f("too many histograms; ignoring %s %s",
+		    families[family].name, l0 == NULL ? "" : l0);
+		return NULL;
+	}
+	hists = xrecallocarray(hists, nhists, nhists + 1, sizeof(*hists));
+	h = &hists[nhists++];
+	h->family = family;
+	h->label[0] = l0 == NULL ? NULL : xstrdup(l0);
+	h->label[1] = l1 == NULL ? NULL : xstrdup(l1);
+	return h;
+}
+
+static void
+hist_add(int family, const char *l0, const char *l1, double secs)
+{
+	struct histogram *h;
+	u_int i;
+
+	if ((h = hist_lookup(family, l0, l1)) == NULL)
+		return;
+	for (i = 0; i < NBOUNDS && secs > bounds[i]; i++)
+		;
+	h->bucket[i]++;
+	h->count++;
+	h->sum += secs;
+}
+
+/* spec is a socket path, optionally prefixed by "text:" or "json:" */
+void
+connstats_init(const char *spec)
+{
+	mode_t omask;
+
+	if (spec == NULL)
+		return;
+	if (strncmp(spec, "json:", 5) == 0) {
+		stats_json = 1;
+		spec += 5;
+	} else if (strncmp(spec, "text:", 5) == 0)
+		spec += 5;
+	stats_path = xstrdup(spec);
+	omask = umask(0177);
+	stats_sock = unix_listener(stats_path, 8, 1);
+	umask(omask);
+	if (stats_sock == -1) {
+		error("StatsSocket %s unavailable", stats_path);
+		return;
+	}
+	set_nonblock(stats_sock);
+	/* Always present, even before the first connection */
+	(void)hist_lookup(HIST_ACCEPT, NULL, NULL);
+	debug_f("serving %s statistics on %s",
+	    stats_json ? "JSON" : "text", stats_path);
+}
+
+/* Appends the stats socket to pfd; returns how many were added */
+int
+connstats_pollfds(struct pollfd *pfd)
+{
+	stats_pollidx = -1;
+	if (stats_sock == -1)
+		return 0;
+	pfd[0].fd = stats_sock;
+	pfd[0].events = POLLIN;
+	stats_pollidx = 0;
+	return 1;
+}
+
+static int
+put_labels(struct sshbuf *b, const struct histogram *h, const char *le)
+{
+	const struct family *f = &families[h->family];
+	const char *sep = "";
+	int i, r;
+
+	if (h->label[0] == NULL && le == NULL)
+		return 0;
+	if ((r = sshbuf_put_u8(b, '{')) != 0)
+		return r;
+	for (i = 0; i < 2 && h->label[i] != NULL; i++) {
+		if ((r = sshbuf_putf(b, "%s%s=\"%s\"", sep,
+		    f->label[i], h->label[i])) != 0)
+			return r;
+		sep = ",";
+	}
+	if (le != NULL && (r = sshbuf_putf(b, "%sle=\"%s\"", sep, le)) != 0)
+		return r;
+	return sshbuf_put_u8(b, '}');
+}
+
+static int
+format_text(struct sshbuf *b, int startups, int sessions)
+{
+	const struct histogram *h;
+	char le[32];
+	u_int64_t n;
+	u_int i, j, k;
+	int r;
+
+	if ((r = sshbuf_putf(b, "# HELP sshd_connections_total "
+	    "Connections accepted and passed to a child.\n"
+	    "# TYPE sshd_connections_total counter\n"
+	    "sshd_connections_total %llu\n"
+	    "# HELP sshd_dropped_total Connections dropped by the listener.\n"
+	    "# TYPE sshd_dropped_total counter\n",
+	    (unsigned long long)connections)) != 0)
+		return r;
+	for (i = 0; i < sizeof(drops) / sizeof(*drops); i++) {
+		if ((r = sshbuf_putf(b, "sshd_dropped_total{reason=\"%s\"} "
+		    "%llu\n", drops[i].reason,
+		    (unsigned long long)drops[i].count)) != 0)
+			return r;
+	}
+	if ((r = sshbuf_putf(b, "# HELP sshd_startups "
+	    "Connections not yet authenticated.\n"
+	    "# TYPE sshd_startups gauge\n"
+	    "sshd_startups %d\n"
+	    "# HELP sshd_sessions Authenticated connections.\n"
+	    "# TYPE sshd_sessions gauge\n"
+	    "sshd_sessions %d\n", startups, sessions)) != 0)
+		return r;
+	for (k = 0; k < HIST_FAMILIES; k++) {
+		if ((r = sshbuf_putf(b, "# HELP %s %s\n# TYPE %s histogram\n",
+		    families[k].name, families[k].help,
+		    families[k].name)) != 0)
+			return r;
+		for (i = 0; i < nhists; i++) {
+			h = &hists[i];
+			if (h->family != (int)k)
+				continue;
+			for (j = 0, n = 0; j <= NBOUNDS; j++) {
+				n += h->bucket[j];
+				if (j < NBOUNDS)
+					snprintf(le, sizeof(le), "%g",
+					    bounds[j]);
+				else
+					strlcpy(le, "+Inf", sizeof(le));
+				if ((r = sshbuf_putf(b, "%s_bucket",
+				    families[k].name)) != 0 ||
+				    (r = put_labels(b, h, le)) != 0 ||
+				    (r = sshbuf_putf(b, " %llu\n",
+				    (unsigned long long)n)) != 0)
+					return r;
+			}
+			if ((r = sshbuf_putf(b, "%s_sum",
+			    families[k].name)) != 0 ||
+			    (r = put_labels(b, h, NULL)) != 0 ||
+			    (r = sshbuf_putf(b, " %.6f\n%s_count",
+			    h->sum, families[k].name)) != 0 ||
+			    (r = put_labels(b, h, NULL)) != 0 ||
+			    (r = sshbuf_putf(b, " %llu\n",
+			    (unsigned long long)h->count)) != 0)
+				return r;
+		}
+	}
+	return 0;
+}
+
+static int
+format_json(struct sshbuf *b, int startups, int sessions)
+{
+	const struct histogram *h;
+	u_int64_t n;
+	u_int i, j;
+	int r;
+
+	if ((r = sshbuf_putf(b, "{\"connections\":%llu,\"startups\":%d,"
+	    "\"sessions\":%d,\"dropped\":{", (unsigned long long)connections,
+	    startups, sessions)) != 0)
+		return r;
+	for (i = 0; i < sizeof(drops) / sizeof(*drops); i++) {
+		if ((r = sshbuf_putf(b, "%s\"%s\":%llu", i == 0 ? "" : ",",
+		    drops[i].reason, (unsigned long long)drops[i].count)) != 0)
+			return r;
+	}
+	if ((r = sshbuf_putf(b, "},\"histograms\":[")) != 0)
+		return r;
+	for (i = 0; i < nhists; i++) {
+		h = &hists[i];
+		if ((r = sshbuf_putf(b, "%s{\"name\":\"%s\",\"labels\":{",
+		    i == 0 ? "" : ",", families[h->family].name)) != 0)
+			return r;
+		for (j = 0; j < 2 && h->label[j] != NULL; j++) {
+			if ((r = sshbuf_putf(b, "%s\"%s\":\"%s\"",
+			    j == 0 ? "" : ",", families[h->family].label[j],
+			    h->label[j])) != 0)
+				return r;
+		}
+		if ((r = sshbuf_putf(b, "},\"buckets\":[")) != 0)
+			return r;
+		for (j = 0, n = 0; j <= NBOUNDS; j++) {
+			n += h->bucket[j];
+			if (j < NBOUNDS)
+				r = sshbuf_putf(b, "%s{\"le\":%g,"
+				    "\"count\":%llu}", j == 0 ? "" : ",",
+				    bounds[j], (unsigned long long)n);
+			else
+				r = sshbuf_putf(b, ",{\"le\":\"+Inf\","
+				    "\"count\":%llu}", (unsigned long long)n);
+			if (r != 0)
+				return r;
+		}
+		if ((r = sshbuf_putf(b, "],\"sum\":%.6f,\"count\":%llu}",
+		    h->sum, (unsigned long long)h->count)) != 0)
+			return r;
+	}
+	return sshbuf_put(b, "]}\n", 3);
+}
+
+/*
+ * Answers a client of the stats socket, if poll() found one waiting.
+ * The statistics are written in one go and the connection closed, so a
+ * slow reader can't hold up the listener.
+ */
+void
+connstats_check(const struct pollfd *pfd, int startups, int sessions)
+{
+	struct sshbuf *b;
+	ssize_t len;
+	int fd, r;
+
+	if (stats_pollidx == -1 || !(pfd[stats_pollidx].revents & POLLIN))
+		return;
+	if ((fd = accept(stats_sock, NULL, NULL)) == -1) {
+		if (errno != EINTR && errno != EWOULDBLOCK &&
+		    errno != ECONNABORTED && errno != EAGAIN)
+			error_f("accept: %s", strerror(errno));
+		return;
+	}
+	set_nonblock(fd);
+	if ((b = sshbuf_new()) == NULL)
+		fatal_f("sshbuf_new failed");
+	if ((r = stats_json ? format_json(b, startups, sessions) :
+	    format_text(b, startups, sessions)) != 0)
+		fatal_fr(r, "format");
+	if ((len = write(fd, sshbuf_ptr(b), sshbuf_len(b))) == -1 ||
+	    (size_t)len != sshbuf_len(b))
+		debug_f("short write to stats client");
+	close(fd);
+	sshbuf_free(b);
+}
+
+/* Called once the listener has forked a child for a connection */
+void
+connstats_accepted(double start)
+{
+	if (stats_sock == -1)
+		return;
+	connections++;
+	hist_add(HIST_ACCEPT, NULL, NULL, monotime_double() - start);
+}
+
+void
+connstats_drop(const char *reason)
+{
+	u_int i;
+
+	for (i = 0; i < sizeof(drops) / sizeof(*drops); i++) {
+		if (strcmp(drops[i].reason, reason) == 0) {
+			drops[i].count++;
+			return;
+		}
+	}
+	fatal_f("unknown reason \"%s\"", reason);
+}
+
+static int
+valid_label(const char *s)
+{
+	return *s != '\0' && strspn(s, CONNSTATS_LABEL_CHARS) == strlen(s);
+}
+
+/*
+ * Handles one record: "kex <name> <usec>" or
+ * "auth <method> <result> <usec>". The key exchange reports come from
+ * the monitor (MONITOR_REQ_KEXDONE), but the algorithm name in them is
+ * the unprivileged child's, so is checked against the algorithms we know.
+ */
+static void
+child_record(char *rec)
+{
+	char *av[4];
+	const char *errstr;
+	long long usec;
+	int ac = 0;
+
+	while (ac < 4 && (av[ac] = strsep(&rec, " ")) != NULL)
+		ac++;
+	if (rec != NULL || ac < 3)
+		return;
+	usec = strtonum(av[ac - 1], 0, 86400LL * 1000000, &errstr);
+	if (errstr != NULL)
+		return;
+	if (ac == 3 && strcmp(av[0], "kex") == 0 &&
+	    strchr(av[1], ',') == NULL && kex_names_valid(av[1]))
+		hist_add(HIST_HANDSHAKE, av[1], NULL, usec / 1000000.0);
+	else if (ac == 4 && strcmp(av[0], "auth") == 0 &&
+	    valid_label(av[1]) && valid_label(av[2]))
+		hist_add(HIST_AUTH, av[1], av[2], usec / 1000000.0);
+}
+
+/* Process bytes read from a child's startup pipe */
+void
+connstats_child_report(const char *buf, size_t len)
+{
+	const char *cp, *ep, *end = buf + len;
+	char rec[CONNSTATS_MAX_RECORD];
+
+	if (stats_sock == -1)
+		return;
+	for (cp = buf; cp < end; cp++) {
+		if (*cp != CONNSTATS_REPORT && *cp != CONNSTATS_DNSCACHE)
+			continue;
+		if ((ep = memchr(cp, '\n', end - cp)) == NULL)
+			return;
+		if (*cp == CONNSTATS_REPORT &&
+		    ep - cp <= (ptrdiff_t)sizeof(rec)) {
+			memcpy(rec, cp + 1, ep - cp - 1);
+			rec[ep - cp - 1] = '\0';
+			child_record(rec);
+		}
+		cp = ep;
+	}
+}
+
+/*
+ * Closes the stats socket: in a new child, or with unlink_path set when
+ * the listener is exiting or restarting.
+ */
+void
+connstats_close(int unlink_path)
+{
+	if (stats_sock == -1)
+		return;
+	close(stats_sock);
+	stats_sock = -1;
+	if (unlink_path)
+		unlink(stats_path);
+}
+
+/*
+ * Sets where a connection's reports go; handshake times are measured
+ * from here.
+ */
+void
+connstats_set_report_fd(int fd)
+{
+	report_fd = fd;
+	report_start = monotime_double();
+}
+
+static void
+report(const char *kind, const char *l0, const char *l1, double secs)
+{
+	char *msg, *cp;
+	int len;
+
+	if (report_fd == -1)
+		return;
+	len = xasprintf(&msg, "%c%s %s%s%s %lld\n", CONNSTATS_REPORT, kind,
+	    l0, l1 == NULL ? "" : " ", l1 == NULL ? "" : l1,
+	    (long long)(secs * 1000000));
+	/* Keep names within what the listener accepts */
+	for (cp = msg + 1 + strlen(kind) + 1; *cp != ' '; cp++) {
+		if (strchr(CONNSTATS_LABEL_CHARS, *cp) == NULL)
+			*cp = '_';
+	}
+	if (len > CONNSTATS_MAX_RECORD)
+		debug_f("record too long");
+	else if (atomicio(vwrite, report_fd, msg, len) != (size_t)len)
+		debug_f("write: %s", strerror(errno));
+	free(msg);
+}
+
+/* Reports the end of key exchange, from the monitor */
+void
+connstats_report_kex(const char *kex)
+{
+	report("kex", kex, NULL, monotime_double() - report_start);
+}
+
+/* Reports an authentication attempt, from the monitor */
+void
+connstats_report_auth(const char *method, const char *result, double secs)
+{
+	report("auth", method, result, secs);
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2026 Pittsburgh Supercomputing Center. All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Listener side */
+void	connstats_init(const char *);
+int	connstats_pollfds(struct pollfd *);
+void	connstats_check(const struct pollfd *, int, int);
+void	connstats_accepted(double);
+void	connstats_drop(const char *);
+void	connstats_child_report(const char *, size_t);
+void	connstats_close(int);
+
+/* Connection side */
+void	connstats_set_report_fd(int);
+void	connstats_report_kex(const char *);
+void	connstats_report_auth(const char *, const char *, double);
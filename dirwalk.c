@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2026 Pittsburgh Supercomputing Center. All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/* Threaded read-ahead of a local directory tree */
+
+#include "includes.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "openbsd-compat/sys-queue.h"
+
+#include "log.h"
+#include "xmalloc.h"
+#include "dirwalk.h"
+
+#define DIRWALK_THREADS	4
+#define DIRWALK_AHEAD	64	/* listings read but not yet asked for */
+
+enum { DW_QUEUED, DW_SCANNING, DW_READY };
+
+struct listing {
+	char *path;
+	int state;
+	int readahead;		/* claimed by a thread, counted in 'ahead' */
+	int dead;		/* pruned while a thread was reading it */
+	int err;
+	struct dirwalk_ent *ents;
+	size_t nents;
+	TAILQ_ENTRY(listing) next;
+};
+TAILQ_HEAD(listings, listing);
+
+struct dirwalk {
+	struct listings dirs;	/* in the order they will be visited */
+	u_int ahead;
+	int stop;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t tids[DIRWALK_THREADS];
+	u_int nthreads;
+};
+
+static char *
+join_path(const char *dir, const char *name)
+{
+	char *ret;
+	size_t len = strlen(dir);
+
+	xasprintf(&ret, "%s%s%s", dir,
+	    (len == 0 || dir[len - 1] == '/') ? "" : "/", name);
+	return ret;
+}
+
+/* List and lstat a directory.  Returns 0 or an errno */
+static int
+read_dir(const char *path, struct dirwalk_ent **entsp, size_t *nentsp)
+{
+	DIR *dirp;
+	struct dirent *dp;
+	struct dirwalk_ent *ents = NULL, *e;
+	size_t nents = 0, nalloc = 0;
+
+	*entsp = NULL;
+	*nentsp = 0;
+	if ((dirp = opendir(path)) == NULL)
+		return errno;
+	while ((dp = readdir(dirp)) != NULL) {
+		if (dp->d_ino == 0 || strcmp(dp->d_name, ".") == 0 ||
+		    strcmp(dp->d_name, "..") == 0)
+			continue;
+		if (nents >= nalloc) {
+			ents = xrecallocarray(ents, nalloc,
+			    nalloc == 0 ? 64 : nalloc * 2, sizeof(*ents));
+			nalloc = nalloc == 0 ? 64 : nalloc * 2;
+		}
+		e = &ents[nents++];
+		e->name = xstrdup(dp->d_name);
+		e->path = join_path(path, dp->d_name);
+		/* Relative to the open directory saves a path lookup */
+#if defined(HAVE_DIRFD) && defined(AT_SYMLINK_NOFOLLOW)
+		if (fstatat(dirfd(dirp), e->name, &e->st,
+		    AT_SYMLINK_NOFOLLOW) == -1)
+#else
+		if (lstat(e->path, &e->st) == -1)
+#endif
+			e->err = errno;
+	}
+	closedir(dirp);
+	*entsp = ents;
+	*nentsp = nents;
+	return 0;
+}
+
+static struct listing *
+listing_new(const char *path)
+{
+	struct listing *l;
+
+	l = xcalloc(1, sizeof(*l));
+	l->path = xstrdup(path);
+	l->state = DW_QUEUED;
+	return l;
+}
+
+static void
+listing_free(struct listing *l)
+{
+	dirwalk_free_ents(l->ents, l->nents);
+	free(l->path);
+	free(l);
+}
+
+/* Called locked: remove a listing that won't be handed out */
+static void
+listing_drop(struct dirwalk *w, struct listing *l)
+{
+	TAILQ_REMOVE(&w->dirs, l, next);
+	if (l->readahead)
+		w->ahead--;
+	listing_free(l);
+}
+
+/*
+ * Called locked: a listing has been read.  Queue its subdirectories right
+ * behind it, as a depth first walk will visit them next.
+ */
+static void
+listing_done(struct dirwalk *w, struct listing *l, int err,
+    struct dirwalk_ent *ents, size_t nents)
+{
+	struct listing *pos, *sub;
+	size_t i;
+
+	l->err = err;
+	l->ents = ents;
+	l->nents = nents;
+	l->state = DW_READY;
+	if (l->dead) {
+		listing_drop(w, l);
+		pthread_cond_broadcast(&w->cond);
+		return;
+	}
+	for (pos = l, i = 0; i < nents; i++) {
+		if (ents[i].err != 0 || !S_ISDIR(ents[i].st.st_mode))
+			continue;
+		sub = listing_new(ents[i].path);
+		TAILQ_INSERT_AFTER(&w->dirs, pos, sub, next);
+		pos = sub;
+	}
+	pthread_cond_broadcast(&w->cond);
+}
+
+static struct listing *
+next_queued(struct dirwalk *w)
+{
+	struct listing *l;
+
+	TAILQ_FOREACH(l, &w->dirs, next) {
+		if (l->state == DW_QUEUED)
+			return l;
+	}
+	return NULL;
+}
+
+static void *
+walk_thread(void *arg)
+{
+	struct dirwalk *w = arg;
+	struct listing *l;
+	struct dirwalk_ent *ents;
+	size_t nents;
+	int err;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (!w->stop && (w->ahead >= DIRWALK_AHEAD ||
+		    (l = next_queued(w)) == NULL))
+			pthread_cond_wait(&w->cond, &w->lock);
+		if (w->stop)
+			break;
+		l->state = DW_SCANNING;
+		l->readahead = 1;
+		w->ahead++;
+		pthread_mutex_unlock(&w->lock);
+		err = read_dir(l->path, &ents, &nents);
+		pthread_mutex_lock(&w->lock);
+		listing_done(w, l, err, ents, nents);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+struct dirwalk *
+dirwalk_open(const char *root)
+{
+	struct dirwalk *w;
+	struct listing *l;
+	sigset_t all, old;
+	u_int i;
+	int r;
+
+	w = xcalloc(1, sizeof(*w));
+	TAILQ_INIT(&w->dirs);
+	l = listing_new(root);
+	TAILQ_INSERT_HEAD(&w->dirs, l, next);
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+
+	/* Signals are for the main loop */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	for (i = 0; i < DIRWALK_THREADS; i++) {
+		if ((r = pthread_create(&w->tids[w->nthreads], NULL,
+		    walk_thread, w)) != 0) {
+			debug_f("pthread_create: %s", strerror(r));
+			break;
+		}
+		w->nthreads++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return w;
+}
+
+int
+dirwalk_readdir(struct dirwalk *w, const char *path,
+    struct dirwalk_ent **entsp, size_t *nentsp)
+{
+	struct listing *l;
+	struct dirwalk_ent *ents;
+	size_t nents;
+	int err;
+
+	pthread_mutex_lock(&w->lock);
+	TAILQ_FOREACH(l, &w->dirs, next) {
+		if (!l->dead && strcmp(l->path, path) == 0)
+			break;
+	}
+	if (l == NULL) {
+		l = listing_new(path);
+		TAILQ_INSERT_HEAD(&w->dirs, l, next);
+	}
+	if (l->state == DW_QUEUED) {
+		/* Not reached by the threads yet, so read it here */
+		debug3_f("reading \"%s\" on demand", path);
+		l->state = DW_SCANNING;
+		pthread_mutex_unlock(&w->lock);
+		err = read_dir(path, &ents, &nents);
+		pthread_mutex_lock(&w->lock);
+		listing_done(w, l, err, ents, nents);
+	}
+	while (l->state != DW_READY)
+		pthread_cond_wait(&w->cond, &w->lock);
+
+	*entsp = l->ents;
+	*nentsp = l->nents;
+	err = l->err;
+	l->ents = NULL;
+	l->nents = 0;
+	listing_drop(w, l);
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+void
+dirwalk_free_ents(struct dirwalk_ent *ents, size_t nents)
+{
+	size_t i;
+
+	for (i = 0; i < nents; i++) {
+		free(ents[i].name);
+		free(ents[i].path);
+	}
+	free(ents);
+}
+
+void
+dirwalk_prune(struct dirwalk *w, const char *path)
+{
+	struct listing *l, *tmp;
+	size_t len = strlen(path);
+
+	pthread_mutex_lock(&w->lock);
+	TAILQ_FOREACH_SAFE(l, &w->dirs, next, tmp) {
+		if (strncmp(l->path, path, len) != 0 ||
+		    (l->path[len] != '\0' && l->path[len] != '/' &&
+		    (len == 0 || path[len - 1] != '/')))
+			continue;
+		if (l->state == DW_SCANNING)
+			l->dead = 1;
+		else
+			listing_drop(w, l);
+	}
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+void
+dirwalk_close(struct dirwalk *w)
+{
+	struct listing *l;
+	u_int i;
+
+	if (w == NULL)
+		return;
+	pthread_mutex_lock(&w->lock);
+	w->stop = 1;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	for (i = 0; i < w->nthreads; i++)
+		pthread_join(w->tids[i], NULL);
+	while ((l = TAILQ_FIRST(&w->dirs)) != NULL) {
+		TAILQ_REMOVE(&w->dirs, l, next);
+		listing_free(l);
+	}
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	free(w);
+}
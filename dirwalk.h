@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2026 Pittsburgh Supercomputing Center. All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef _DIRWALK_H
+#define _DIRWALK_H
+
+/*
+ * Walks a local directory tree with a pool of threads, listing and
+ * lstat()ing directories ahead of a caller that is visiting the tree
+ * depth first, e.g. to upload it.  The caller asks for each directory's
+ * listing in turn; one that hasn't been read ahead yet is read on demand.
+ */
+struct dirwalk;
+
+struct dirwalk_ent {
+	char *name;		/* file name within the directory */
+	char *path;		/* directory path joined with name */
+	struct stat st;		/* from lstat(), valid if err == 0 */
+	int err;		/* errno from lstat() */
+};
+
+/* Start reading ahead from directory 'root' */
+struct dirwalk *dirwalk_open(const char *root);
+
+/*
+ * Get the entries of directory 'path', without "." and "..".  Paths of
+ * subdirectories should be passed exactly as returned in their entries.
+ * Returns 0, or -1 with errno set if the directory couldn't be read.
+ */
+int dirwalk_readdir(struct dirwalk *, const char *path,
+    struct dirwalk_ent **entsp, size_t *nentsp);
+void dirwalk_free_ents(struct dirwalk_ent *, size_t);
+
+/* Drop anything read ahead for 'path' and below, as it won't be visited */
+void dirwalk_prune(struct dirwalk *, const char *path);
+
+/* Stop the threads and free everything; NULL-safe */
+void dirwalk_close(struct dirwalk *);
+
+#endif /* _DIRWALK_H */
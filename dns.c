@@ -29,12 +29,17 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 
+#include <errno.h>
 #include <netdb.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "xmalloc.h"
 #include "sshkey.h"
@@ -42,6 +47,23 @@
 #include "dns.h"
 #include "log.h"
 #include "digest.h"
+#include "misc.h"
+
+/* Upper bound on how long a cached SSHFP answer is trusted, in seconds */
+#define SSHFP_CACHE_MAX_TTL	(24 * 60 * 60)
+
+/* SSHFP answers are cached here, if set */
+static char *sshfp_cache_path;
+
+/* An SSHFP lookup started ahead of host key verification */
+static struct {
+	pthread_t tid;
+	pid_t pid;
+	char *hostname;
+	int running;
+	int result;
+	struct rrsetinfo *rrset;
+} sshfp_prefetch;
 
 static const char * const errset_text[] = {
 	"success",		/* 0 ERRSET_SUCCESS */
@@ -188,6 +210,228 @@ is_numeric_hostname(const char *hostname)
 	return 0;
 }
 
+void
+dns_set_sshfp_cache(const char *path)
+{
+	free(sshfp_cache_path);
+	sshfp_cache_path = path == NULL ? NULL : xstrdup(path);
+}
+
+static int
+sshfp_cacheable_name(const char *hostname)
+{
+	return *hostname != '\0' && strlen(hostname) < NI_MAXHOST &&
+	    hostname[strcspn(hostname, " \t\r\n#")] == '\0';
+}
+
+/*
+ * Look up unexpired cache entries for hostname. Each line of the cache is
+ * "host expiry validated algorithm fptype hex-fingerprint". A hit is only
+ * returned as a validated rrset if every entry was DNSSEC-validated when
+ * stored, and the cache is ignored unless only the user can write it.
+ * Returns 0 on a hit, -1 otherwise.
+ */
+int
+sshfp_cache_lookup(const char *hostname, struct rrsetinfo **rrsetp)
+{
+	FILE *f;
+	char *line = NULL, name[NI_MAXHOST], hex[256];
+	size_t linesize = 0, i, len;
+	long long expiry;
+	u_int alg, fptype, hi, validated, all_validated = 1;
+	struct rrsetinfo *rrset = NULL;
+	struct rdatainfo *rdi;
+	struct stat st;
+	time_t now = time(NULL);
+
+	*rrsetp = NULL;
+	if (sshfp_cache_path == NULL || !sshfp_cacheable_name(hostname))
+		return -1;
+	if ((f = fopen(sshfp_cache_path, "r")) == NULL)
+		return -1;
+	if (fstat(fileno(f), &st) == -1 || !S_ISREG(st.st_mode) ||
+	    st.st_uid != getuid() || (st.st_mode & 022) != 0) {
+		debug_f("ignoring %s: not a file writable only by us",
+		    sshfp_cache_path);
+		fclose(f);
+		return -1;
+	}
+	while (getline(&line, &linesize, f) != -1) {
+		if (sscanf(line, "%1024s %lld %u %u %u %255s", name, &expiry,
+		    &validated, &alg, &fptype, hex) != 6 ||
+		    strcasecmp(name, hostname) != 0 || expiry <= now ||
+		    validated > 1 || alg > 255 || fptype > 255 ||
+		    (len = strlen(hex)) % 2 != 0)
+			continue;
+		if (!validated)
+			all_validated = 0;
+		if (rrset == NULL) {
+			rrset = xcalloc(1, sizeof(*rrset));
+			rrset->rri_rdclass = DNS_RDATACLASS_IN;
+			rrset->rri_rdtype = DNS_RDATATYPE_SSHFP;
+			rrset->rri_ttl = (u_int)(expiry - now);
+			rrset->rri_name = xstrdup(hostname);
+		}
+		rrset->rri_rdatas = xrecallocarray(rrset->rri_rdatas,
+		    rrset->rri_nrdatas, rrset->rri_nrdatas + 1,
+		    sizeof(*rrset->rri_rdatas));
+		rdi = &rrset->rri_rdatas[rrset->rri_nrdatas++];
+		rdi->rdi_length = 2 + len / 2;
+		rdi->rdi_data = xmalloc(rdi->rdi_length);
+		rdi->rdi_data[0] = alg;
+		rdi->rdi_data[1] = fptype;
+		for (i = 0; i < len / 2; i++) {
+			if (sscanf(hex + i * 2, "%2x", &hi) != 1)
+				break;
+			rdi->rdi_data[2 + i] = hi;
+		}
+		if (i != len / 2) {
+			free(rdi->rdi_data);
+			rrset->rri_nrdatas--;
+		}
+	}
+	free(line);
+	fclose(f);
+	if (rrset == NULL)
+		return -1;
+	if (rrset->rri_nrdatas == 0) {
+		freerrset(rrset);
+		return -1;
+	}
+	if (all_validated)
+		rrset->rri_flags |= RRSET_VALIDATED;
+	debug3_f("%u cached SSHFP records for %s%s", rrset->rri_nrdatas,
+	    hostname, all_validated ? " (validated)" : "");
+	*rrsetp = rrset;
+	return 0;
+}
+
+/*
+ * Record an answer and whether it was DNSSEC-validated, replacing any
+ * previous entries for the host and dropping expired ones. Failures are
+ * not fatal; the cache is only an optimisation.
+ */
+void
+sshfp_cache_store(const char *hostname, const struct rrsetinfo *rrset)
+{
+	FILE *in, *out = NULL;
+	char *line = NULL, *tmp = NULL, name[NI_MAXHOST];
+	size_t linesize = 0;
+	long long expiry;
+	u_int i, j, ttl, validated;
+	int fd, oerrno;
+	time_t now = time(NULL);
+
+	if (sshfp_cache_path == NULL || !sshfp_cacheable_name(hostname) ||
+	    rrset->rri_nrdatas == 0 || (ttl = rrset->rri_ttl) == 0)
+		return;
+	ttl = MINIMUM(ttl, SSHFP_CACHE_MAX_TTL);
+	validated = (rrset->rri_flags & RRSET_VALIDATED) != 0;
+
+	xasprintf(&tmp, "%s.XXXXXXXXXX", sshfp_cache_path);
+	if ((fd = mkstemp(tmp)) == -1 || (out = fdopen(fd, "w")) == NULL) {
+		oerrno = errno;
+		debug_f("mkstemp %s: %s", tmp, strerror(oerrno));
+		if (fd != -1) {
+			close(fd);
+			unlink(tmp);
+		}
+		free(tmp);
+		return;
+	}
+	if ((in = fopen(sshfp_cache_path, "r")) != NULL) {
+		while (getline(&line, &linesize, in) != -1) {
+			if (sscanf(line, "%1024s %lld", name, &expiry) != 2 ||
+			    strcasecmp(name, hostname) == 0 || expiry <= now)
+				continue;
+			fputs(line, out);
+		}
+		free(line);
+		fclose(in);
+	}
+	for (i = 0; i < rrset->rri_nrdatas; i++) {
+		if (rrset->rri_rdatas[i].rdi_length < 2)
+			continue;
+		fprintf(out, "%s %lld %u %u %u ", hostname,
+		    (long long)now + ttl, validated,
+		    rrset->rri_rdatas[i].rdi_data[0],
+		    rrset->rri_rdatas[i].rdi_data[1]);
+		for (j = 2; j < rrset->rri_rdatas[i].rdi_length; j++)
+			fprintf(out, "%02x", rrset->rri_rdatas[i].rdi_data[j]);
+		fputc('\n', out);
+	}
+	if (fclose(out) != 0 || rename(tmp, sshfp_cache_path) == -1) {
+		debug_f("update %s: %s", sshfp_cache_path, strerror(errno));
+		unlink(tmp);
+	}
+	free(tmp);
+}
+
+static void *
+sshfp_prefetch_thread(void *arg)
+{
+	sshfp_prefetch.result = getrrsetbyname(sshfp_prefetch.hostname,
+	    DNS_RDATACLASS_IN, DNS_RDATATYPE_SSHFP, 0, &sshfp_prefetch.rrset);
+	return NULL;
+}
+
+/*
+ * Start the SSHFP query for hostname in the background so that it runs
+ * concurrently with the TCP connect and key exchange. The answer is
+ * collected by verify_host_key_dns().
+ */
+void
+dns_prefetch_sshfp(const char *hostname)
+{
+	struct rrsetinfo *rrset;
+
+	if (sshfp_prefetch.running || is_numeric_hostname(hostname))
+		return;
+	if (sshfp_cache_lookup(hostname, &rrset) == 0) {
+		freerrset(rrset);
+		return;
+	}
+	sshfp_prefetch.hostname = xstrdup(hostname);
+	sshfp_prefetch.pid = getpid();
+	if (pthread_create(&sshfp_prefetch.tid, NULL,
+	    sshfp_prefetch_thread, NULL) != 0) {
+		debug_f("pthread_create failed, will look up on demand");
+		free(sshfp_prefetch.hostname);
+		sshfp_prefetch.hostname = NULL;
+		return;
+	}
+	sshfp_prefetch.running = 1;
+	debug3_f("started SSHFP lookup for %s", hostname);
+}
+
+/*
+ * Obtain the SSHFP rrset for hostname from the cache, a prefetch started
+ * earlier or, failing those, a synchronous query.
+ */
+static int
+dns_lookup_sshfp(const char *hostname, struct rrsetinfo **rrsetp)
+{
+	int result;
+
+	if (sshfp_cache_lookup(hostname, rrsetp) == 0)
+		return ERRSET_SUCCESS;
+	if (sshfp_prefetch.running && sshfp_prefetch.pid == getpid() &&
+	    strcasecmp(sshfp_prefetch.hostname, hostname) == 0) {
+		debug3_f("waiting for SSHFP lookup");
+		pthread_join(sshfp_prefetch.tid, NULL);
+		sshfp_prefetch.running = 0;
+		result = sshfp_prefetch.result;
+		*rrsetp = sshfp_prefetch.rrset;
+		sshfp_prefetch.rrset = NULL;
+	} else {
+		result = getrrsetbyname(hostname, DNS_RDATACLASS_IN,
+		    DNS_RDATATYPE_SSHFP, 0, rrsetp);
+	}
+	if (result == ERRSET_SUCCESS)
+		sshfp_cache_store(hostname, *rrsetp);
+	return result;
+}
+
 /*
  * Verify the given hostname, address and host key using DNS.
  * Returns 0 if lookup succeeds, -1 otherwise
@@ -220,8 +464,7 @@ verify_host_key_dns(const char *hostname, struct sockaddr *address,
 		return -1;
 	}
 
-	result = getrrsetbyname(hostname, DNS_RDATACLASS_IN,
-	    DNS_RDATATYPE_SSHFP, 0, &fingerprints);
+	result = dns_lookup_sshfp(hostname, &fingerprints);
 	if (result) {
 		verbose("DNS lookup error: %s", dns_result_totext(result));
 		return -1;
@@ -52,8 +52,14 @@ enum sshfp_hashes {
 #define DNS_VERIFY_SECURE	0x00000004
 #define DNS_VERIFY_FAILED	0x00000008
 
+struct rrsetinfo;
+
 int	verify_host_key_dns(const char *, struct sockaddr *,
     struct sshkey *, int *);
 int	export_dns_rr(const char *, struct sshkey *, FILE *, int);
+void	dns_set_sshfp_cache(const char *);
+void	dns_prefetch_sshfp(const char *);
+int	sshfp_cache_lookup(const char *, struct rrsetinfo **);
+void	sshfp_cache_store(const char *, const struct rrsetinfo *);
 
 #endif /* DNS_H */
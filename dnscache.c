@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2026 Pittsburgh Supercomputing Center. All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Cache of UseDNS results kept by the listening sshd.
+ *
+ * The listener looks up the peer address of each accepted connection
+ * and hands any cached answer to the child, either through inherited
+ * memory or, when re-executing, in the rexec state. When a connection's
+ * monitor has to resolve the address itself it reports the result back
+ * over the startup pipe, so that later connections from the same address
+ * can reuse it. The unprivileged child closes its copy of the pipe: the
+ * listener must not take names from it.
+ * Failed lookups are cached too, normally for a shorter time.
+ */
+
+#include "includes.h"
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "atomicio.h"
+#include "canohost.h"
+#include "dnscache.h"
+#include "log.h"
+#include "misc.h"
+#include "xmalloc.h"
+
+#define DNSCACHE_SLOTS	1024
+
+/* Marks a result record on the startup pipe; terminated by '\n' */
+#define DNSCACHE_REPORT	'H'
+
+static int cache_ttl, negative_ttl, max_children;
+
+/* Direct-mapped cache of address -> name; name is NULL for failures */
+static struct dnscache_entry {
+	char *addr;
+	char *name;
+	time_t expires;
+} *cache;
+
+/* Address of each unauthenticated child, by startup pipe */
+static struct child_info {
+	int id;
+	char *addr;
+} *child;
+
+/* Connection side state */
+static char *hint_addr, *hint_name;
+static int have_hint, report_fd = -1;
+
+static u_int
+dnscache_slot(const char *addr)
+{
+	u_int h = 2166136261U;
+
+	for (; *addr != '\0'; addr++)
+		h = (h ^ (u_char)*addr) * 16777619U;
+	return h % DNSCACHE_SLOTS;
+}
+
+static void
+dnscache_insert(const char *addr, const char *name)
+{
+	struct dnscache_entry *e;
+	int ttl = name == NULL ? negative_ttl : cache_ttl;
+
+	if (cache == NULL || ttl <= 0)
+		return;
+	e = &cache[dnscache_slot(addr)];
+	free(e->addr);
+	free(e->name);
+	e->addr = xstrdup(addr);
+	e->name = name == NULL ? NULL : xstrdup(name);
+	e->expires = monotime() + ttl;
+	debug3_f("%s -> %s for %ds", addr, name == NULL ? "(none)" : name,
+	    ttl);
+}
+
+/*
+ * Looks up addr in the cache. Returns 1 on a hit, with *namep set to
+ * a copy of the cached name or NULL if the lookup previously failed.
+ */
+static int
+dnscache_get(const char *addr, char **namep)
+{
+	struct dnscache_entry *e;
+
+	*namep = NULL;
+	if (cache == NULL)
+		return 0;
+	e = &cache[dnscache_slot(addr)];
+	if (e->addr == NULL || strcmp(e->addr, addr) != 0 ||
+	    e->expires <= monotime())
+		return 0;
+	*namep = e->name == NULL ? NULL : xstrdup(e->name);
+	return 1;
+}
+
+void
+dnscache_init(int max, int ttl, int negttl)
+{
+	int i;
+
+	cache_ttl = ttl;
+	negative_ttl = negttl;
+	if (cache_ttl <= 0 && negative_ttl <= 0)
+		return;
+	debug_f("cache time %d, negative %d", cache_ttl, negative_ttl);
+	if (max <= 0)
+		fatal_f("invalid number of sockets: %d", max);
+	max_children = max;
+	cache = xcalloc(DNSCACHE_SLOTS, sizeof(*cache));
+	child = xcalloc(max_children, sizeof(*child));
+	for (i = 0; i < max_children; i++)
+		child[i].id = -1;
+}
+
+/*
+ * Called by the listener for each accepted connection. Remembers the
+ * peer address against id and returns 1 if the cache has an answer for
+ * it, with *addrp and *namep set as for dnscache_get().
+ */
+int
+dnscache_accept(int sock, int id, char **addrp, char **namep)
+{
+	struct sockaddr_storage from;
+	socklen_t fromlen = sizeof(from);
+	char ntop[NI_MAXHOST];
+	int i;
+
+	*addrp = *namep = NULL;
+	if (child == NULL)
+		return 0;
+	memset(&from, 0, sizeof(from));
+	if (getpeername(sock, (struct sockaddr *)&from, &fromlen) != 0)
+		return 0;
+	ipv64_normalise_mapped(&from, &fromlen);
+	if (from.ss_family == AF_INET6)
+		fromlen = sizeof(struct sockaddr_in6);
+	if (getnameinfo((struct sockaddr *)&from, fromlen, ntop, sizeof(ntop),
+	    NULL, 0, NI_NUMERICHOST) != 0)
+		return 0;
+	for (i = 0; i < max_children; i++) {
+		if (child[i].id == -1) {
+			child[i].id = id;
+			child[i].addr = xstrdup(ntop);
+			break;
+		}
+	}
+	if (!dnscache_get(ntop, namep))
+		return 0;
+	*addrp = xstrdup(ntop);
+	debug3_f("cached %s -> %s", ntop, *namep == NULL ? "(none)" : *namep);
+	return 1;
+}
+
+/* Process bytes read from the startup pipe of child id */
+void
+dnscache_child_report(int id, const char *buf, size_t len)
+{
+	const char *cp, *ep;
+	char *name;
+	int i;
+
+	for (i = 0; child != NULL && i < max_children; i++)
+		if (child[i].id == id)
+			break;
+	if (child == NULL || i >= max_children || child[i].addr == NULL)
+		return;
+	for (cp = buf; cp < buf + len; cp++) {
+		if (*cp != DNSCACHE_REPORT)
+			continue;
+		if ((ep = memchr(cp, '\n', buf + len - cp)) == NULL ||
+		    ep - cp - 1 >= NI_MAXHOST)
+			return;
+		name = NULL;
+		if (ep - cp > 1) {
+			name = xmalloc(ep - cp);
+			memcpy(name, cp + 1, ep - cp - 1);
+			name[ep - cp - 1] = '\0';
+		}
+		dnscache_insert(child[i].addr, name);
+		free(name);
+		cp = ep;
+	}
+}
+
+void
+dnscache_done(int id)
+{
+	int i;
+
+	for (i = 0; child != NULL && i < max_children; i++) {
+		if (child[i].id == id) {
+			child[i].id = -1;
+			free(child[i].addr);
+			child[i].addr = NULL;
+			return;
+		}
+	}
+}
+
+/* Records the listener's cached answer for this connection's address */
+void
+dnscache_set_hint(const char *addr, const char *name)
+{
+	free(hint_addr);
+	free(hint_name);
+	hint_addr = xstrdup(addr);
+	hint_name = name == NULL ? NULL : xstrdup(name);
+	have_hint = 1;
+}
+
+void
+dnscache_set_report_fd(int fd)
+{
+	report_fd = fd;
+}
+
+/*
+ * Connection side lookup: checks the hint from the listener and any
+ * cache inherited from it. Returns 1 on a hit as for dnscache_get().
+ */
+int
+dnscache_lookup(const char *addr, char **namep)
+{
+	*namep = NULL;
+	if (have_hint && strcmp(hint_addr, addr) == 0) {
+		*namep = hint_name == NULL ? NULL : xstrdup(hint_name);
+		return 1;
+	}
+	return dnscache_get(addr, namep);
+}
+
+/* Sends the result of resolving addr back to the listener */
+void
+dnscache_report(const char *addr, const char *name)
+{
+	char *msg;
+
+	if (report_fd == -1)
+		return;
+	debug3_f("%s -> %s", addr, name == NULL ? "(none)" : name);
+	xasprintf(&msg, "%c%s\n", DNSCACHE_REPORT, name == NULL ? "" : name);
+	if (atomicio(vwrite, report_fd, msg, strlen(msg)) != strlen(msg))
+		debug_f("write: %s", strerror(errno));
+	free(msg);
+}
@@ -42,5 +42,6 @@ sshfatal(const char *file, const char *func, int line, int showfunc,
 	va_start(args, fmt);
 	sshlogv(file, func, line, showfunc, level, suffix, fmt, args);
 	va_end(args);
+	log_thread_exit();
 	cleanup_exit(255);
 }
@@ -0,0 +1,555 @@
+/*
+ * Copyright (c) 2026 Pittsburgh Supercomputing Center. All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Multi-buffer HMAC-SHA2.
+ *
+ * A single SHA-2 stream is a long chain of dependent operations, so one
+ * message at a time leaves most of a vector unit idle. Here each 32 or 64
+ * bit lane of an AVX2 register carries a different message: eight
+ * SHA-256 or four SHA-512 computations advance together, one block per
+ * step. Messages of different lengths simply drop out of the step mask
+ * when they are done.
+ *
+ * All messages share one key, and the states after the key ^ ipad and
+ * key ^ opad blocks are computed once by ssh_hmac_mb_init(). The outer
+ * hash of every message is then exactly one block.
+ */
+
+#include "includes.h"
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(HAVE_IMMINTRIN_H) && defined(HAVE_CPUID_H) && \
+    defined(__x86_64__) && defined(__GNUC__)
+# define HMAC_MB_AVX2
+# include <immintrin.h>
+# include <cpuid.h>
+#endif
+
+#include "sshbuf.h"
+#include "digest.h"
+#include "hmac.h"
+#include "misc.h"
+
+#ifdef HMAC_MB_AVX2
+
+#define AVX2	__attribute__((__target__("avx2")))
+
+#define MB_MAX_BLOCK	128
+
+struct ssh_hmac_mb_ctx {
+	int		alg;
+	int		wide;		/* 64-bit words (SHA-512) */
+	u_int		lanes;
+	size_t		block_len;
+	size_t		digest_len;
+	u_int64_t	istate[8];	/* after key ^ ipad */
+	u_int64_t	ostate[8];	/* after key ^ opad */
+};
+
+/* Where each block of a lane's message comes from */
+struct mb_lane {
+	const u_char	*data;
+	size_t		 nfull;		/* blocks taken whole from the job */
+	size_t		 nblocks;
+	u_char		 first[MB_MAX_BLOCK];	/* head || start of data */
+	u_char		 tail[2 * MB_MAX_BLOCK];	/* rest, padding, length */
+};
+
+static const u_int32_t sha256_iv[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const u_int32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const u_int64_t sha512_iv[8] = {
+	0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+	0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+	0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+	0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+static const u_int64_t sha512_k[80] = {
+	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
+	0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+	0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+	0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+	0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+	0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
+	0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+	0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+	0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+	0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
+	0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
+	0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+	0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+	0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+	0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
+	0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
+	0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+	0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+	0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+	0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
+	0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+	0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+	0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+	0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+	0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
+	0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
+	0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+	0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+	0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+	0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+	0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
+	0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+	0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+	0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+static const u_char zero_block[MB_MAX_BLOCK];
+
+/*
+ * Returns nonzero if the CPU and OS support AVX2. SHA-256 is left to
+ * libcrypto on CPUs with the SHA extensions, which are faster
+ * than eight AVX2 lanes.
+ */
+static int
+hmac_mb_cpu(int alg)
+{
+	static int avx2 = -1, sha = 0;
+	u_int a, b, c, d;
+
+	if (avx2 == -1) {
+		avx2 = 0;
+		if (__get_cpuid(1, &a, &b, &c, &d) && (c & bit_OSXSAVE) != 0 &&
+		    __get_cpuid_max(0, NULL) >= 7) {
+			/* the OS must preserve the YMM registers */
+			__asm__ volatile("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+			if ((a & 6) == 6) {
+				__cpuid_count(7, 0, a, b, c, d);
+				avx2 = (b & (1 << 5)) != 0;
+				sha = (b & (1 << 29)) != 0;
+			}
+		}
+	}
+	if (alg == SSH_DIGEST_SHA256 && sha)
+		return 0;
+	return avx2;
+}
+
+#define ADD32(a, b)	_mm256_add_epi32((a), (b))
+#define ROR32(x, n)	_mm256_or_si256(_mm256_srli_epi32((x), (n)), \
+			    _mm256_slli_epi32((x), 32 - (n)))
+#define ADD64(a, b)	_mm256_add_epi64((a), (b))
+#define ROR64(x, n)	_mm256_or_si256(_mm256_srli_epi64((x), (n)), \
+			    _mm256_slli_epi64((x), 64 - (n)))
+#define XOR(a, b)	_mm256_xor_si256((a), (b))
+#define XOR3(a, b, c)	XOR(XOR((a), (b)), (c))
+#define CH(e, f, g)	XOR(_mm256_and_si256((e), (f)), \
+			    _mm256_andnot_si256((e), (g)))
+#define MAJ(a, b, c)	_mm256_or_si256(_mm256_and_si256((a), (b)), \
+			    _mm256_and_si256((c), _mm256_or_si256((a), (b))))
+
+/* One SHA-256 block in each of eight lanes; inactive lanes are unchanged */
+static void AVX2
+sha256x8_block(__m256i st[8], const u_char *const blk[8], __m256i active)
+{
+	__m256i w[16], v[8], t1, t2, x, y;
+	u_int i, j;
+
+	for (i = 0; i < 16; i++) {
+		w[i] = _mm256_set_epi32(
+		    PEEK_U32(blk[7] + 4 * i), PEEK_U32(blk[6] + 4 * i),
+		    PEEK_U32(blk[5] + 4 * i), PEEK_U32(blk[4] + 4 * i),
+		    PEEK_U32(blk[3] + 4 * i), PEEK_U32(blk[2] + 4 * i),
+		    PEEK_U32(blk[1] + 4 * i), PEEK_U32(blk[0] + 4 * i));
+	}
+	for (j = 0; j < 8; j++)
+		v[j] = st[j];
+	for (i = 0; i < 64; i++) {
+		if (i >= 16) {
+			x = w[(i - 15) & 15];
+			y = w[(i - 2) & 15];
+			x = XOR3(ROR32(x, 7), ROR32(x, 18),
+			    _mm256_srli_epi32(x, 3));
+			y = XOR3(ROR32(y, 17), ROR32(y, 19),
+			    _mm256_srli_epi32(y, 10));
+			w[i & 15] = ADD32(ADD32(w[i & 15], x),
+			    ADD32(w[(i - 7) & 15], y));
+		}
+		t1 = ADD32(ADD32(v[7], XOR3(ROR32(v[4], 6), ROR32(v[4], 11),
+		    ROR32(v[4], 25))), ADD32(CH(v[4], v[5], v[6]),
+		    ADD32(_mm256_set1_epi32(sha256_k[i]), w[i & 15])));
+		t2 = ADD32(XOR3(ROR32(v[0], 2), ROR32(v[0], 13),
+		    ROR32(v[0], 22)), MAJ(v[0], v[1], v[2]));
+		v[7] = v[6];
+		v[6] = v[5];
+		v[5] = v[4];
+		v[4] = ADD32(v[3], t1);
+		v[3] = v[2];
+		v[2] = v[1];
+		v[1] = v[0];
+		v[0] = ADD32(t1, t2);
+	}
+	for (j = 0; j < 8; j++)
+		st[j] = _mm256_blendv_epi8(st[j], ADD32(st[j], v[j]), active);
+}
+
+/* One SHA-512 block in each of four lanes; inactive lanes are unchanged */
+static void AVX2
+sha512x4_block(__m256i st[8], const u_char *const blk[4], __m256i active)
+{
+	__m256i w[16], v[8], t1, t2, x, y;
+	u_int i, j;
+
+	for (i = 0; i < 16; i++) {
+		w[i] = _mm256_set_epi64x(
+		    PEEK_U64(blk[3] + 8 * i), PEEK_U64(blk[2] + 8 * i),
+		    PEEK_U64(blk[1] + 8 * i), PEEK_U64(blk[0] + 8 * i));
+	}
+	for (j = 0; j < 8; j++)
+		v[j] = st[j];
+	for (i = 0; i < 80; i++) {
+		if (i >= 16) {
+			x = w[(i - 15) & 15];
+			y = w[(i - 2) & 15];
+			x = XOR3(ROR64(x, 1), ROR64(x, 8),
+			    _mm256_srli_epi64(x, 7));
+			y = XOR3(ROR64(y, 19), ROR64(y, 61),
+			    _mm256_srli_epi64(y, 6));
+			w[i & 15] = ADD64(ADD64(w[i & 15], x),
+			    ADD64(w[(i - 7) & 15], y));
+		}
+		t1 = ADD64(ADD64(v[7], XOR3(ROR64(v[4], 14), ROR64(v[4], 18),
+		    ROR64(v[4], 41))), ADD64(CH(v[4], v[5], v[6]),
+		    ADD64(_mm256_set1_epi64x(sha512_k[i]), w[i & 15])));
+		t2 = ADD64(XOR3(ROR64(v[0], 28), ROR64(v[0], 34),
+		    ROR64(v[0], 39)), MAJ(v[0], v[1], v[2]));
+		v[7] = v[6];
+		v[6] = v[5];
+		v[5] = v[4];
+		v[4] = ADD64(v[3], t1);
+		v[3] = v[2];
+		v[2] = v[1];
+		v[1] = v[0];
+		v[0] = ADD64(t1, t2);
+	}
+	for (j = 0; j < 8; j++)
+		st[j] = _mm256_blendv_epi8(st[j], ADD64(st[j], v[j]), active);
+}
+
+static void AVX2
+mb_block(const struct ssh_hmac_mb_ctx *ctx, __m256i st[8],
+    const u_char *const *blk, __m256i active)
+{
+	if (ctx->wide)
+		sha512x4_block(st, blk, active);
+	else
+		sha256x8_block(st, blk, active);
+}
+
+static void AVX2
+mb_broadcast(const struct ssh_hmac_mb_ctx *ctx, __m256i st[8],
+    const u_int64_t h[8])
+{
+	u_int j;
+
+	for (j = 0; j < 8; j++) {
+		st[j] = ctx->wide ? _mm256_set1_epi64x(h[j]) :
+		    _mm256_set1_epi32((u_int32_t)h[j]);
+	}
+}
+
+/* Store the big-endian digest of each lane */
+static void AVX2
+mb_extract(const struct ssh_hmac_mb_ctx *ctx, __m256i st[8],
+    u_char out[][SSH_DIGEST_MAX_LENGTH])
+{
+	union {
+		u_int32_t w32[8];
+		u_int64_t w64[4];
+	} u;
+	u_int j, l;
+
+	for (j = 0; j < 8; j++) {
+		_mm256_storeu_si256((__m256i *)&u, st[j]);
+		for (l = 0; l < ctx->lanes; l++) {
+			if (ctx->wide)
+				POKE_U64(out[l] + 8 * j, u.w64[l]);
+			else
+				POKE_U32(out[l] + 4 * j, u.w32[l]);
+		}
+	}
+}
+
+static __m256i AVX2
+mb_mask(const struct ssh_hmac_mb_ctx *ctx, u_int bits)
+{
+	if (ctx->wide) {
+		return _mm256_set_epi64x(
+		    (bits & 8) ? -1 : 0, (bits & 4) ? -1 : 0,
+		    (bits & 2) ? -1 : 0, (bits & 1) ? -1 : 0);
+	}
+	return _mm256_set_epi32(
+	    (bits & 128) ? -1 : 0, (bits & 64) ? -1 : 0,
+	    (bits & 32) ? -1 : 0, (bits & 16) ? -1 : 0,
+	    (bits & 8) ? -1 : 0, (bits & 4) ? -1 : 0,
+	    (bits & 2) ? -1 : 0, (bits & 1) ? -1 : 0);
+}
+
+/* Hash one block from the IV in every lane, e.g. the key ^ pad blocks */
+static void AVX2
+mb_pad_state(const struct ssh_hmac_mb_ctx *ctx, const u_char *blk,
+    u_int64_t h[8])
+{
+	const u_char *blks[8];
+	u_char out[8][SSH_DIGEST_MAX_LENGTH];
+	__m256i st[8];
+	u_int64_t iv[8];
+	u_int j;
+
+	for (j = 0; j < 8; j++) {
+		blks[j] = blk;
+		iv[j] = ctx->wide ? sha512_iv[j] : sha256_iv[j];
+	}
+	mb_broadcast(ctx, st, iv);
+	mb_block(ctx, st, blks, mb_mask(ctx, 0xff));
+	mb_extract(ctx, st, out);
+	for (j = 0; j < 8; j++) {
+		h[j] = ctx->wide ? PEEK_U64(out[0] + 8 * j) :
+		    PEEK_U32(out[0] + 4 * j);
+	}
+	explicit_bzero(out, sizeof(out));
+}
+
+static void
+mb_lane_setup(const struct ssh_hmac_mb_ctx *ctx, struct mb_lane *l,
+    const struct ssh_hmac_mb_job *job)
+{
+	size_t blen = ctx->block_len, total = 4 + job->len, rem, ntail;
+
+	l->data = job->data;
+	l->nfull = total / blen;
+	rem = total - l->nfull * blen;
+	memset(l->tail, 0, sizeof(l->tail));
+	if (l->nfull > 0) {
+		memcpy(l->first, job->head, 4);
+		memcpy(l->first + 4, job->data, blen - 4);
+		if (rem > 0)
+			memcpy(l->tail, job->data + job->len - rem, rem);
+	} else {
+		memcpy(l->tail, job->head, 4);
+		if (job->len > 0)
+			memcpy(l->tail + 4, job->data, job->len);
+	}
+	l->tail[rem] = 0x80;
+	/* length field is 8 (SHA-256) or 16 (SHA-512) bytes */
+	ntail = rem + 1 + (ctx->wide ? 16 : 8) <= blen ? 1 : 2;
+	/* bit count includes the key block */
+	POKE_U64(l->tail + ntail * blen - 8, (u_int64_t)(blen + total) * 8);
+	l->nblocks = l->nfull + ntail;
+}
+
+static const u_char *
+mb_lane_block(const struct ssh_hmac_mb_ctx *ctx, const struct mb_lane *l,
+    size_t k)
+{
+	if (k == 0 && l->nfull > 0)
+		return l->first;
+	if (k < l->nfull)
+		return l->data + k * ctx->block_len - 4;
+	return l->tail + (k - l->nfull) * ctx->block_len;
+}
+
+/* HMAC up to ctx->lanes jobs at once */
+static void AVX2
+mb_compute_lanes(const struct ssh_hmac_mb_ctx *ctx,
+    struct ssh_hmac_mb_job *jobs, u_int n)
+{
+	struct mb_lane lanes[8];
+	const u_char *blk[8];
+	u_char out[8][SSH_DIGEST_MAX_LENGTH];
+	u_char outer[8][MB_MAX_BLOCK];
+	__m256i st[8];
+	size_t k, maxblocks = 0;
+	u_int l, bits;
+
+	for (l = 0; l < n; l++) {
+		mb_lane_setup(ctx, &lanes[l], &jobs[l]);
+		maxblocks = MAXIMUM(maxblocks, lanes[l].nblocks);
+	}
+	/* inner hash: key ^ ipad || head || data */
+	mb_broadcast(ctx, st, ctx->istate);
+	for (k = 0; k < maxblocks; k++) {
+		bits = 0;
+		for (l = 0; l < ctx->lanes; l++) {
+			if (l < n && k < lanes[l].nblocks) {
+				blk[l] = mb_lane_block(ctx, &lanes[l], k);
+				bits |= 1 << l;
+			} else
+				blk[l] = zero_block;
+		}
+		mb_block(ctx, st, blk, mb_mask(ctx, bits));
+	}
+	mb_extract(ctx, st, out);
+
+	/* outer hash: key ^ opad || inner digest, always one block */
+	memset(outer, 0, sizeof(outer));
+	for (l = 0; l < ctx->lanes; l++) {
+		memcpy(outer[l], out[l], ctx->digest_len);
+		outer[l][ctx->digest_len] = 0x80;
+		POKE_U64(outer[l] + ctx->block_len - 8,
+		    (u_int64_t)(ctx->block_len + ctx->digest_len) * 8);
+		blk[l] = outer[l];
+	}
+	mb_broadcast(ctx, st, ctx->ostate);
+	mb_block(ctx, st, blk, mb_mask(ctx, (1 << n) - 1));
+	mb_extract(ctx, st, out);
+	for (l = 0; l < n; l++) {
+		memcpy(jobs[l].out, out[l],
+		    MINIMUM(jobs[l].outlen, ctx->digest_len));
+	}
+	explicit_bzero(out, sizeof(out));
+	explicit_bzero(outer, sizeof(outer));
+}
+
+struct ssh_hmac_mb_ctx *
+ssh_hmac_mb_start(int alg)
+{
+	struct ssh_hmac_mb_ctx *ret;
+
+	if ((alg != SSH_DIGEST_SHA256 && alg != SSH_DIGEST_SHA512) ||
+	    !hmac_mb_cpu(alg))
+		return NULL;
+	if ((ret = calloc(1, sizeof(*ret))) == NULL)
+		return NULL;
+	ret->alg = alg;
+	ret->wide = alg == SSH_DIGEST_SHA512;
+	ret->lanes = ret->wide ? 4 : 8;
+	ret->block_len = ret->wide ? 128 : 64;
+	ret->digest_len = ssh_digest_bytes(alg);
+	return ret;
+}
+
+int
+ssh_hmac_mb_init(struct ssh_hmac_mb_ctx *ctx, const void *key, size_t klen)
+{
+	u_char pad[MB_MAX_BLOCK];
+	size_t i;
+
+	memset(pad, 0, sizeof(pad));
+	/* truncate long keys */
+	if (klen <= ctx->block_len)
+		memcpy(pad, key, klen);
+	else if (ssh_digest_memory(ctx->alg, key, klen, pad,
+	    ctx->block_len) < 0)
+		return -1;
+	for (i = 0; i < ctx->block_len; i++)
+		pad[i] ^= 0x36;
+	mb_pad_state(ctx, pad, ctx->istate);
+	for (i = 0; i < ctx->block_len; i++)
+		pad[i] ^= 0x36 ^ 0x5c;
+	mb_pad_state(ctx, pad, ctx->ostate);
+	explicit_bzero(pad, sizeof(pad));
+	return 0;
+}
+
+u_int
+ssh_hmac_mb_lanes(const struct ssh_hmac_mb_ctx *ctx)
+{
+	return ctx->lanes;
+}
+
+int
+ssh_hmac_mb_compute(struct ssh_hmac_mb_ctx *ctx,
+    struct ssh_hmac_mb_job *jobs, u_int njobs)
+{
+	u_int i, n;
+
+	for (i = 0; i < njobs; i += n) {
+		n = MINIMUM(njobs - i, ctx->lanes);
+		mb_compute_lanes(ctx, jobs + i, n);
+	}
+	return 0;
+}
+
+void
+ssh_hmac_mb_free(struct ssh_hmac_mb_ctx *ctx)
+{
+	freezero(ctx, sizeof(*ctx));
+}
+
+#else /* HMAC_MB_AVX2 */
+
+struct ssh_hmac_mb_ctx *
+ssh_hmac_mb_start(int alg)
+{
+	return NULL;
+}
+
+int
+ssh_hmac_mb_init(struct ssh_hmac_mb_ctx *ctx, const void *key, size_t klen)
+{
+	return -1;
+}
+
+u_int
+ssh_hmac_mb_lanes(const struct ssh_hmac_mb_ctx *ctx)
+{
+	return 1;
+}
+
+int
+ssh_hmac_mb_compute(struct ssh_hmac_mb_ctx *ctx,
+    struct ssh_hmac_mb_job *jobs, u_int njobs)
+{
+	return -1;
+}
+
+void
+ssh_hmac_mb_free(struct ssh_hmac_mb_ctx *ctx)
+{
+}
+
+#endif /* HMAC_MB_AVX2 */
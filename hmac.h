@@ -35,4 +35,24 @@ int ssh_hmac_final(struct ssh_hmac_ctx *ctx, u_char *d, size_t dlen)
 	__attribute__((__bounded__(__buffer__, 2, 3)));
 void ssh_hmac_free(struct ssh_hmac_ctx *ctx);
 
+/*
+ * Multi-buffer HMAC-SHA256/512 over several messages under one key.
+ * ssh_hmac_mb_start() returns NULL if the algorithm or CPU is unsupported.
+ */
+struct ssh_hmac_mb_ctx;
+struct ssh_hmac_mb_job {
+	u_char		 head[4];	/* hashed before data, e.g. seqnr */
+	const u_char	*data;
+	size_t		 len;
+	u_char		*out;
+	size_t		 outlen;
+};
+struct ssh_hmac_mb_ctx *ssh_hmac_mb_start(int alg);
+int ssh_hmac_mb_init(struct ssh_hmac_mb_ctx *ctx, const void *key, size_t klen)
+	__attribute__((__bounded__(__buffer__, 2, 3)));
+u_int ssh_hmac_mb_lanes(const struct ssh_hmac_mb_ctx *ctx);
+int ssh_hmac_mb_compute(struct ssh_hmac_mb_ctx *ctx,
+    struct ssh_hmac_mb_job *jobs, u_int njobs);
+void ssh_hmac_mb_free(struct ssh_hmac_mb_ctx *ctx);
+
 #endif /* _HMAC_H */
@@ -52,6 +52,7 @@
 #include <unistd.h>
 
 #include "xmalloc.h"
+#include "b64.h"
 #include "match.h"
 #include "sshkey.h"
 #include "hostfile.h"
@@ -97,7 +98,7 @@ extract_salt(const char *s, u_int l, u_char *salt, size_t salt_len)
 	memcpy(b64salt, s, b64len);
 	b64salt[b64len] = '\0';
 
-	ret = __b64_pton(b64salt, salt, salt_len);
+	ret = ssh_b64_pton(b64salt, salt, salt_len);
 	free(b64salt);
 	if (ret == -1) {
 		debug2("extract_salt: salt decode error");
@@ -140,9 +141,9 @@ host_hash(const char *host, const char *name_from_hostfile, u_int src_len)
 		fatal_f("ssh_hmac failed");
 	ssh_hmac_free(ctx);
 
-	if (__b64_ntop(salt, len, uu_salt, sizeof(uu_salt)) == -1 ||
-	    __b64_ntop(result, len, uu_result, sizeof(uu_result)) == -1)
-		fatal_f("__b64_ntop failed");
+	if (ssh_b64_ntop(salt, len, uu_salt, sizeof(uu_salt)) == -1 ||
+	    ssh_b64_ntop(result, len, uu_result, sizeof(uu_result)) == -1)
+		fatal_f("ssh_b64_ntop failed");
 	xasprintf(&encoded, "%s%s%c%s", HASH_MAGIC, uu_salt, HASH_DELIM,
 	    uu_result);
 
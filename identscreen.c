@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2026 Pittsburgh Supercomputing Center. All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Screening of new connections by the listening sshd, before it forks.
+ *
+ * Port scanners and bots that connect and then send nothing, or send
+ * something other than an SSH identification string, would otherwise each
+ * cost a fork (and usually an exec) of a whole child. Instead the listener
+ * holds on to each accepted socket until the client's first bytes show
+ * that it speaks SSH. They are only peeked at, so the child still reads
+ * the identification itself. Connections that close, send garbage or stay
+ * silent past the deadline are dropped without a child ever existing.
+ */
+
+#include "includes.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <errno.h>
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "canohost.h"
+#include "connstats.h"
+#include "identscreen.h"
+#include "log.h"
+#include "misc.h"
+#include "xmalloc.h"
+
+/* Enough to see the start of an identification, and whether it ends */
+#define IDENTSCREEN_PEEK	256
+
+static int screen_time, max_held, num_held;
+
+static struct held_conn {
+	int fd;
+	int pollidx;		/* index in the listener's pollfds, or -1 */
+	int ready;		/* passed; waiting for the listener to fork */
+	double deadline;
+} *held;
+
+void
+identscreen_init(int max, int timeout)
+{
+	int i;
+
+	if ((screen_time = timeout) <= 0)
+		return;
+	debug_f("identification deadline %ds, at most %d held", timeout, max);
+	if (max <= 0)
+		fatal_f("invalid number of sockets: %d", max);
+	max_held = max;
+	held = xcalloc(max_held, sizeof(*held));
+	for (i = 0; i < max_held; i++)
+		held[i].fd = -1;
+}
+
+/*
+ * Holds a newly accepted socket until the client identifies itself.
+ * Returns 0 if screening is off or full, in which case the caller should
+ * go ahead with the connection straight away.
+ */
+int
+identscreen_add(int fd)
+{
+	int i;
+
+	if (held == NULL || num_held >= max_held)
+		return 0;
+	for (i = 0; i < max_held; i++) {
+		if (held[i].fd != -1)
+			continue;
+		held[i].fd = fd;
+		held[i].pollidx = -1;
+		held[i].ready = 0;
+		held[i].deadline = monotime_double() + screen_time;
+		num_held++;
+		return 1;
+	}
+	return 0;
+}
+
+static void
+release(struct held_conn *h)
+{
+	h->fd = -1;
+	h->pollidx = -1;
+	h->ready = 0;
+	num_held--;
+}
+
+static void
+drop(struct held_conn *h, const char *reason)
+{
+	char *addr = get_peer_ipaddr(h->fd);
+
+	verbose("Dropped connection from %s port %d before identification: "
+	    "%s", addr, get_peer_port(h->fd), reason);
+	free(addr);
+	close(h->fd);
+	release(h);
+	connstats_drop("ident");
+}
+
+/*
+ * Appends the held sockets still waiting for data to pfd.
+ * Returns how many were added.
+ */
+int
+identscreen_pollfds(struct pollfd *pfd)
+{
+	int i, n = 0;
+
+	for (i = 0; held != NULL && i < max_held; i++) {
+		held[i].pollidx = -1;
+		if (held[i].fd == -1 || held[i].ready)
+			continue;
+		pfd[n].fd = held[i].fd;
+		pfd[n].events = POLLIN;
+		held[i].pollidx = n++;
+	}
+	return n;
+}
+
+/* Milliseconds until the next deadline, or -1 if nothing is held */
+int
+identscreen_timeout(void)
+{
+	double now, next = -1;
+	int i;
+
+	if (num_held == 0)
+		return -1;
+	for (i = 0; i < max_held; i++) {
+		if (held[i].fd == -1 || held[i].ready)
+			continue;
+		if (next < 0 || held[i].deadline < next)
+			next = held[i].deadline;
+	}
+	if (next < 0)
+		return 0;	/* some are ready to go */
+	now = monotime_double();
+	return next <= now ? 0 : (int)((next - now) * 1000) + 1;
+}
+
+/*
+ * Why what the client has sent so far can't start an identification
+ * string, or NULL if it can. Only the first line matters: before it the
+ * server accepts nothing else.
+ */
+static const char *
+ident_problem(const u_char *buf, size_t len)
+{
+	const u_char *nl;
+
+	if (memcmp(buf, "SSH-", MINIMUM(len, 4)) != 0)
+		return "not an SSH client";
+	if ((nl = memchr(buf, '\n', len)) != NULL)
+		len = nl - buf;
+	if (memchr(buf, '\0', len) != NULL)
+		return "invalid characters";
+	return NULL;
+}
+
+/*
+ * Looks at the sockets that poll() (given the pfd passed to
+ * identscreen_pollfds()) found readable, and at the deadlines.
+ */
+void
+identscreen_check(const struct pollfd *pfd)
+{
+	u_char buf[IDENTSCREEN_PEEK];
+	const char *problem;
+	double now = monotime_double();
+	ssize_t n;
+	int i;
+
+	for (i = 0; held != NULL && i < max_held; i++) {
+		if (held[i].fd == -1 || held[i].ready)
+			continue;
+		if (held[i].pollidx == -1 || (pfd[held[i].pollidx].revents &
+		    (POLLIN|POLLHUP|POLLERR)) == 0) {
+			if (held[i].deadline <= now)
+				drop(&held[i], "timed out");
+			continue;
+		}
+		if ((n = recv(held[i].fd, buf, sizeof(buf), MSG_PEEK)) == -1) {
+			if (errno == EINTR || errno == EAGAIN ||
+			    errno == EWOULDBLOCK)
+				continue;
+			drop(&held[i], strerror(errno));
+		} else if (n == 0)
+			drop(&held[i], "connection closed");
+		else if ((problem = ident_problem(buf, n)) != NULL)
+			drop(&held[i], problem);
+		else
+			held[i].ready = 1;
+	}
+}
+
+/* Returns a socket that has passed screening, or -1 if there are none */
+int
+identscreen_next(void)
+{
+	int i, fd;
+
+	for (i = 0; held != NULL && i < max_held; i++) {
+		if (held[i].fd == -1 || !held[i].ready)
+			continue;
+		fd = held[i].fd;
+		release(&held[i]);
+		return fd;
+	}
+	return -1;
+}
+
+/* Closes all held sockets, e.g. in a child or before a restart */
+void
+identscreen_close(void)
+{
+	int i;
+
+	for (i = 0; held != NULL && i < max_held; i++) {
+		if (held[i].fd != -1) {
+			close(held[i].fd);
+			release(&held[i]);
+		}
+	}
+}
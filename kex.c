@@ -26,6 +26,7 @@
 #include "includes.h"
 
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <errno.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -543,8 +544,7 @@ kex_input_newkeys(int type, u_int32_t seq, struct ssh *ssh)
 	sshbuf_reset(kex->peer);
 	/* sshbuf_reset(kex->my); */
 	kex->flags &= ~KEX_INIT_SENT;
-	free(kex->name);
-	kex->name = NULL;
+	/* kex->name stays, so callers can see what was negotiated */
 	return 0;
 }
 
@@ -702,6 +702,7 @@ kex_free(struct kex *kex)
 	if (kex == NULL)
 		return;
 
+	kex_gen_pregen_free(kex);
 #ifdef WITH_OPENSSL
 	DH_free(kex->dh);
 #ifdef OPENSSL_HAS_ECC
@@ -843,6 +844,7 @@ choose_kex(struct kex *k, char *client, char *server)
 {
 	const struct kexalg *kexalg;
 
+	free(k->name);
 	k->name = match_list(client, server, NULL);
 
 	debug("kex: algorithm: %s", k->name ? k->name : "(no match)");
@@ -1240,6 +1242,89 @@ send_error(struct ssh *ssh, char *msg)
 		error_f("write: %.100s", strerror(errno));
 }
 
+/*
+ * Wait up to *timeout_ms (if positive, otherwise indefinitely) for the
+ * peer's identification to be readable, deducting the time waited.
+ */
+static int
+wait_ident(struct ssh *ssh, int fd, int *timeout_ms)
+{
+	struct pollfd pfd;
+	int r, oerrno;
+
+	if (*timeout_ms <= 0) {
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		(void)poll(&pfd, 1, -1);
+		return 0;
+	}
+	r = waitrfd(fd, timeout_ms);
+	if (r == -1 && errno == ETIMEDOUT) {
+		send_error(ssh, "Timed out waiting for SSH "
+		    "identification string.");
+		error("Connection timed out during banner exchange");
+		return SSH_ERR_CONN_TIMEOUT;
+	} else if (r == -1) {
+		oerrno = errno;
+		error_f("%s", strerror(errno));
+		errno = oerrno;
+		return SSH_ERR_SYSTEM_ERROR;
+	}
+	return 0;
+}
+
+/*
+ * Wait up to *timeout_ms (if positive) for the next part of the peer's
+ * identification and read it into buf: up to and including a newline but
+ * no further, so that whatever follows is left for the packet layer. A
+ * socket is peeked at first, so a whole line usually takes one read;
+ * anything else (e.g. a ProxyCommand pipe) is read a byte at a time and
+ * *peekp is cleared to say so.
+ */
+static int
+read_ident(struct ssh *ssh, int *timeout_ms, int *peekp, u_char *buf,
+    size_t len, size_t *lenp)
+{
+	int r, oerrno, fd = ssh_packet_get_connection_in(ssh);
+	ssize_t n = 1;
+	u_char *nl;
+
+	*lenp = 0;
+	if (*timeout_ms > 0 && (r = wait_ident(ssh, fd, timeout_ms)) != 0)
+		return r;
+	while (*peekp) {
+		if ((n = recv(fd, buf, len, MSG_PEEK)) > 0)
+			break;
+		if (n == 0)
+			goto closed;
+		if (errno == EINTR)
+			continue;
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			if ((r = wait_ident(ssh, fd, timeout_ms)) != 0)
+				return r;
+			continue;
+		}
+		if (errno != ENOTSOCK)
+			goto fail;
+		*peekp = 0;
+		n = 1;
+	}
+	if ((nl = memchr(buf, '\n', n)) != NULL)
+		n = nl - buf + 1;
+	if ((*lenp = atomicio(read, fd, buf, n)) != 0)
+		return 0;
+	if (errno != EPIPE)
+		goto fail;
+ closed:
+	error_f("Connection closed by remote host");
+	return SSH_ERR_CONN_CLOSED;
+ fail:
+	oerrno = errno;
+	error_f("read: %.100s", strerror(errno));
+	errno = oerrno;
+	return SSH_ERR_SYSTEM_ERROR;
+}
+
 /*
  * Sends our identification string and waits for the peer's. Will block for
  * up to timeout_ms (or indefinitely if timeout_ms <= 0).
@@ -1250,9 +1335,9 @@ kex_exchange_identification(struct ssh *ssh, int timeout_ms,
     const char *version_addendum)
 {
 	int remote_major, remote_minor, mismatch, oerrno = 0;
-	size_t len, i, n;
-	int r, expect_nl;
-	u_char c;
+	size_t i, n, off = 0, avail = 0;
+	int r, expect_nl, peek = 1;
+	u_char c, ibuf[256];
 	struct sshbuf *our_version = ssh->kex->server ?
 	    ssh->kex->server_version : ssh->kex->client_version;
 	struct sshbuf *peer_version = ssh->kex->server ?
@@ -1307,36 +1392,15 @@ kex_exchange_identification(struct ssh *ssh, int timeout_ms,
 		sshbuf_reset(peer_version);
 		expect_nl = 0;
 		for (i = 0; ; i++) {
-			if (timeout_ms > 0) {
-				r = waitrfd(ssh_packet_get_connection_in(ssh),
-				    &timeout_ms);
-				if (r == -1 && errno == ETIMEDOUT) {
-					send_error(ssh, "Timed out waiting "
-					    "for SSH identification string.");
-					error("Connection timed out during "
-					    "banner exchange");
-					r = SSH_ERR_CONN_TIMEOUT;
-					goto out;
-				} else if (r == -1) {
+			if (off == avail) {
+				if ((r = read_ident(ssh, &timeout_ms, &peek,
+				    ibuf, sizeof(ibuf), &avail)) != 0) {
 					oerrno = errno;
-					error_f("%s", strerror(errno));
-					r = SSH_ERR_SYSTEM_ERROR;
 					goto out;
 				}
+				off = 0;
 			}
-
-			len = atomicio(read, ssh_packet_get_connection_in(ssh),
-			    &c, 1);
-			if (len != 1 && errno == EPIPE) {
-				error_f("Connection closed by remote host");
-				r = SSH_ERR_CONN_CLOSED;
-				goto out;
-			} else if (len != 1) {
-				oerrno = errno;
-				error_f("read: %.100s", strerror(errno));
-				r = SSH_ERR_SYSTEM_ERROR;
-				goto out;
-			}
+			c = ibuf[off++];
 			if (c == '\r') {
 				expect_nl = 1;
 				continue;
@@ -134,6 +134,7 @@ struct newkeys {
 };
 
 struct ssh;
+struct kex_pregen;
 struct sshbuf;
 
 struct kex {
@@ -176,6 +177,7 @@ struct kex {
 	u_char c25519_client_pubkey[CURVE25519_SIZE]; /* 25519 */
 	u_char sntrup761_client_key[crypto_kem_sntrup761_SECRETKEYBYTES]; /* KEM */
 	struct sshbuf *client_pub;
+	struct kex_pregen *pregen;	/* ephemeral keys for the next KEX */
 };
 
 int	 kex_names_valid(const char *);
@@ -204,6 +206,8 @@ int	 kex_protocol_error(int, u_int32_t, struct ssh *);
 int	 kex_derive_keys(struct ssh *, u_char *, u_int, const struct sshbuf *);
 int	 kex_send_newkeys(struct ssh *);
 int	 kex_start_rekex(struct ssh *);
+void	 kex_gen_pregen_start(struct kex *);
+void	 kex_gen_pregen_free(struct kex *);
 
 int	 kexgex_client(struct ssh *);
 int	 kexgex_server(struct ssh *);
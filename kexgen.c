@@ -29,8 +29,11 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "sshkey.h"
 #include "kex.h"
@@ -44,6 +47,149 @@
 static int input_kex_gen_init(int, u_int32_t, struct ssh *);
 static int input_kex_gen_reply(int type, u_int32_t seq, struct ssh *ssh);
 
+static int
+kex_gen_keypair(struct kex *kex)
+{
+	switch (kex->kex_type) {
+#ifdef WITH_OPENSSL
+	case KEX_DH_GRP1_SHA1:
+	case KEX_DH_GRP14_SHA1:
+	case KEX_DH_GRP14_SHA256:
+	case KEX_DH_GRP16_SHA512:
+	case KEX_DH_GRP18_SHA512:
+		return kex_dh_keypair(kex);
+	case KEX_ECDH_SHA2:
+		return kex_ecdh_keypair(kex);
+#endif
+	case KEX_C25519_SHA256:
+		return kex_c25519_keypair(kex);
+	case KEX_KEM_SNTRUP761X25519_SHA512:
+		return kex_kem_sntrup761x25519_keypair(kex);
+	default:
+		return SSH_ERR_INVALID_ARGUMENT;
+	}
+}
+
+/*
+ * The ephemeral keys don't depend on anything the peer sends, so once a
+ * key exchange is done the keys for the next one (i.e. the rekey) are
+ * generated on a helper thread. When the rekey comes the dispatch loop
+ * only has to do the half that needs the peer's value: the shared secret,
+ * the exchange hash and the signature. sntrup761 and the large DH groups
+ * make this worthwhile on the client. DH, ECDH and curve25519 are
+ * symmetric so the server uses a pregenerated keypair as its side of the
+ * exchange; the sntrup761 server encapsulates to the client's key and
+ * has nothing to do ahead of time.
+ */
+struct kex_pregen {
+	pthread_t	tid;
+	pid_t		pid;	/* a forked child doesn't have the thread */
+	int		r;
+	struct kex	kex;	/* kex_type and ec_nid in, keys out */
+};
+
+static void *
+kex_gen_pregen_thread(void *arg)
+{
+	struct kex_pregen *pregen = arg;
+
+	pregen->r = kex_gen_keypair(&pregen->kex);
+	return NULL;
+}
+
+void
+kex_gen_pregen_start(struct kex *kex)
+{
+	struct kex_pregen *pregen;
+
+	kex_gen_pregen_free(kex);
+	if (kex->server && kex->kex_type == KEX_KEM_SNTRUP761X25519_SHA512)
+		return;
+	if ((pregen = calloc(1, sizeof(*pregen))) == NULL)
+		return;
+	pregen->pid = getpid();
+	pregen->kex.kex_type = kex->kex_type;
+	pregen->kex.ec_nid = kex->ec_nid;
+	if (pthread_create(&pregen->tid, NULL, kex_gen_pregen_thread,
+	    pregen) != 0) {
+		free(pregen);
+		return;
+	}
+	kex->pregen = pregen;
+}
+
+static void
+kex_gen_pregen_clear(struct kex *kex)
+{
+#ifdef WITH_OPENSSL
+	DH_free(kex->dh);
+#ifdef OPENSSL_HAS_ECC
+	EC_KEY_free(kex->ec_client_key);
+#endif /* OPENSSL_HAS_ECC */
+#endif /* WITH_OPENSSL */
+	explicit_bzero(kex->c25519_client_key, sizeof(kex->c25519_client_key));
+	explicit_bzero(kex->sntrup761_client_key,
+	    sizeof(kex->sntrup761_client_key));
+	sshbuf_free(kex->client_pub);
+}
+
+/*
+ * Move the pregenerated keys into kex. Returns 0 on success or -1 if
+ * there are none for this kex method and they have to be made now.
+ */
+static int
+kex_gen_pregen_take(struct kex *kex)
+{
+	struct kex_pregen *pregen = kex->pregen;
+
+	if (pregen == NULL || pregen->pid != getpid())
+		return -1;
+	pthread_join(pregen->tid, NULL);
+	pregen->pid = -1;
+	if (pregen->r != 0 || pregen->kex.kex_type != kex->kex_type ||
+	    pregen->kex.ec_nid != kex->ec_nid) {
+		kex_gen_pregen_free(kex);
+		return -1;
+	}
+	debug3_f("using pregenerated keys");
+#ifdef WITH_OPENSSL
+	kex->dh = pregen->kex.dh;
+	pregen->kex.dh = NULL;
+#ifdef OPENSSL_HAS_ECC
+	kex->ec_client_key = pregen->kex.ec_client_key;
+	kex->ec_group = pregen->kex.ec_group;
+	pregen->kex.ec_client_key = NULL;
+#endif /* OPENSSL_HAS_ECC */
+#endif /* WITH_OPENSSL */
+	memcpy(kex->c25519_client_key, pregen->kex.c25519_client_key,
+	    sizeof(kex->c25519_client_key));
+	memcpy(kex->sntrup761_client_key, pregen->kex.sntrup761_client_key,
+	    sizeof(kex->sntrup761_client_key));
+	sshbuf_free(kex->client_pub);
+	kex->client_pub = pregen->kex.client_pub;
+	pregen->kex.client_pub = NULL;
+	kex_gen_pregen_free(kex);
+	return 0;
+}
+
+void
+kex_gen_pregen_free(struct kex *kex)
+{
+	struct kex_pregen *pregen = kex->pregen;
+
+	if (pregen == NULL)
+		return;
+	kex->pregen = NULL;
+	if (pregen->pid != -1 && pregen->pid != getpid()) {
+		/* the thread stayed with our parent, its state is unknown */
+		return;
+	}
+	if (pregen->pid != -1)
+		pthread_join(pregen->tid, NULL);
+	kex_gen_pregen_clear(&pregen->kex);
+	freezero(pregen, sizeof(*pregen));
+}
+
 static int
 kex_gen_hash(
     int hash_alg,
@@ -101,30 +247,8 @@ kex_gen_client(struct ssh *ssh)
 	struct kex *kex = ssh->kex;
 	int r;
 
-	switch (kex->kex_type) {
-#ifdef WITH_OPENSSL
-	case KEX_DH_GRP1_SHA1:
-	case KEX_DH_GRP14_SHA1:
-	case KEX_DH_GRP14_SHA256:
-	case KEX_DH_GRP16_SHA512:
-	case KEX_DH_GRP18_SHA512:
-		r = kex_dh_keypair(kex);
-		break;
-	case KEX_ECDH_SHA2:
-		r = kex_ecdh_keypair(kex);
-		break;
-#endif
-	case KEX_C25519_SHA256:
-		r = kex_c25519_keypair(kex);
-		break;
-	case KEX_KEM_SNTRUP761X25519_SHA512:
-		r = kex_kem_sntrup761x25519_keypair(kex);
-		break;
-	default:
-		r = SSH_ERR_INVALID_ARGUMENT;
-		break;
-	}
-	if (r != 0)
+	if (kex_gen_pregen_take(kex) != 0 &&
+	    (r = kex_gen_keypair(kex)) != 0)
 		return r;
 	if ((r = sshpkt_start(ssh, SSH2_MSG_KEX_ECDH_INIT)) != 0 ||
 	    (r = sshpkt_put_stringb(ssh, kex->client_pub)) != 0 ||
@@ -237,6 +361,8 @@ input_kex_gen_reply(int type, u_int32_t seq, struct ssh *ssh)
 		kex->initial_hostkey = server_host_key;
 		server_host_key = NULL;
 	}
+	/* get the keys for the next rekey going */
+	kex_gen_pregen_start(kex);
 	/* success */
 out:
 	explicit_bzero(hash, sizeof(hash));
@@ -273,7 +399,7 @@ input_kex_gen_init(int type, u_int32_t seq, struct ssh *ssh)
 	struct sshbuf *server_host_key_blob = NULL;
 	u_char *signature = NULL, hash[SSH_DIGEST_MAX_LENGTH];
 	size_t slen, hashlen;
-	int r;
+	int r, pregen = 0;
 
 	debug("SSH2_MSG_KEX_ECDH_INIT received");
 	ssh_dispatch_set(ssh, SSH2_MSG_KEX_ECDH_INIT, &kex_protocol_error);
@@ -286,6 +412,13 @@ input_kex_gen_init(int type, u_int32_t seq, struct ssh *ssh)
 	    (r = sshpkt_get_end(ssh)) != 0)
 		goto out;
 
+	/* pregenerated keys stand in for the server side of DH/ECDH/25519 */
+	if (kex_gen_pregen_take(kex) == 0) {
+		server_pubkey = kex->client_pub;
+		kex->client_pub = NULL;
+		pregen = 1;
+	}
+
 	/* compute shared secret */
 	switch (kex->kex_type) {
 #ifdef WITH_OPENSSL
@@ -294,17 +427,26 @@ input_kex_gen_init(int type, u_int32_t seq, struct ssh *ssh)
 	case KEX_DH_GRP14_SHA256:
 	case KEX_DH_GRP16_SHA512:
 	case KEX_DH_GRP18_SHA512:
-		r = kex_dh_enc(kex, client_pubkey, &server_pubkey,
-		    &shared_secret);
+		if (pregen)
+			r = kex_dh_dec(kex, client_pubkey, &shared_secret);
+		else
+			r = kex_dh_enc(kex, client_pubkey, &server_pubkey,
+			    &shared_secret);
 		break;
 	case KEX_ECDH_SHA2:
-		r = kex_ecdh_enc(kex, client_pubkey, &server_pubkey,
-		    &shared_secret);
+		if (pregen)
+			r = kex_ecdh_dec(kex, client_pubkey, &shared_secret);
+		else
+			r = kex_ecdh_enc(kex, client_pubkey, &server_pubkey,
+			    &shared_secret);
 		break;
 #endif
 	case KEX_C25519_SHA256:
-		r = kex_c25519_enc(kex, client_pubkey, &server_pubkey,
-		    &shared_secret);
+		if (pregen)
+			r = kex_c25519_dec(kex, client_pubkey, &shared_secret);
+		else
+			r = kex_c25519_enc(kex, client_pubkey, &server_pubkey,
+			    &shared_secret);
 		break;
 	case KEX_KEM_SNTRUP761X25519_SHA512:
 		r = kex_kem_sntrup761x25519_enc(kex, client_pubkey,
@@ -359,9 +501,13 @@ input_kex_gen_init(int type, u_int32_t seq, struct ssh *ssh)
 	    (r = sshkey_from_private(server_host_public,
 	    &kex->initial_hostkey)) != 0)
 		goto out;
+	/* the preauth child is sandboxed, it can't start threads */
+	if (packet_authentication_state(ssh))
+		kex_gen_pregen_start(kex);
 	/* success */
 out:
 	explicit_bzero(hash, sizeof(hash));
+	explicit_bzero(kex->c25519_client_key, sizeof(kex->c25519_client_key));
 	sshbuf_free(server_host_key_blob);
 	free(signature);
 	sshbuf_free(shared_secret);
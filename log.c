@@ -39,6 +39,7 @@
 #include <sys/types.h>
 
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -68,6 +69,11 @@ static void *log_handler_ctx;
 static char **log_verbose;
 static size_t nlog_verbose;
 
+/* Per-thread log levels and fatal handlers, see log_thread_level() */
+static pthread_once_t log_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t log_key, log_fatal_key;
+static int log_key_ready;
+
 extern char *__progname;
 
 extern struct ssh *active_state;
@@ -121,6 +127,46 @@ log_level_get(void)
 	return log_level;
 }
 
+static void
+log_key_init(void)
+{
+	log_key_ready = pthread_key_create(&log_key, NULL) == 0 &&
+	    pthread_key_create(&log_fatal_key, NULL) == 0;
+}
+
+/*
+ * Log at *level rather than the global level on the calling thread, e.g.
+ * sshd's in-process sftp-server. NULL restores the global level.
+ */
+void
+log_thread_level(const LogLevel *level)
+{
+	if (log_key_ready)
+		pthread_setspecific(log_key, level);
+}
+
+/*
+ * Have fatal errors on the calling thread run fn, which must not return,
+ * rather than exit the process. NULL restores the default.
+ */
+void
+log_thread_fatal(log_fatal_fn *fn)
+{
+	if (log_key_ready)
+		pthread_setspecific(log_fatal_key, (void *)fn);
+}
+
+/* Called by sshfatal(): runs the calling thread's fatal handler, if any */
+void
+log_thread_exit(void)
+{
+	log_fatal_fn *fn;
+
+	if (log_key_ready &&
+	    (fn = (log_fatal_fn *)pthread_getspecific(log_fatal_key)) != NULL)
+		fn();
+}
+
 SyslogFacility
 log_facility_number(char *name)
 {
@@ -206,6 +252,8 @@ log_init(const char *av0, LogLevel level, SyslogFacility facility,
 #endif
 
 	argv0 = av0;
+	/* Before there are any threads to race with */
+	pthread_once(&log_key_once, log_key_init);
 
 	if (log_change_level(level) != 0) {
 		fprintf(stderr, "Unrecognized internal syslog level code %d\n",
@@ -354,8 +402,12 @@ do_log(LogLevel level, int force, const char *suffix, const char *fmt,
 	int saved_errno = errno;
 	log_handler_fn *tmp_handler;
 	const char *progname = argv0 != NULL ? argv0 : __progname;
+	const LogLevel *tlevel;
 
-	if (!force && level > log_level)
+	if (log_key_ready && (tlevel = pthread_getspecific(log_key)) != NULL) {
+		if (!force && level > *tlevel)
+			return;
+	} else if (!force && level > log_level)
 		return;
 
 	switch (level) {
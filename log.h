@@ -50,10 +50,14 @@ typedef enum {
 }       LogLevel;
 
 typedef void (log_handler_fn)(LogLevel, int, const char *, void *);
+typedef void (log_fatal_fn)(void);
 
 void     log_init(const char *, LogLevel, SyslogFacility, int);
 LogLevel log_level_get(void);
 int      log_change_level(LogLevel);
+void     log_thread_level(const LogLevel *);
+void     log_thread_fatal(log_fatal_fn *);
+void     log_thread_exit(void);
 int      log_is_on_stderr(void);
 void     log_redirect_stderr_to(const char *);
 void	 log_verbose_add(const char *);
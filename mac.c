@@ -110,6 +110,8 @@ mac_setup_by_alg(struct sshmac *mac, const struct macalg *macalg)
 	if (mac->type == SSH_DIGEST) {
 		if ((mac->hmac_ctx = ssh_hmac_start(macalg->alg)) == NULL)
 			return SSH_ERR_ALLOC_FAIL;
+		/* optional, NULL if the CPU has no suitable vector unit */
+		mac->hmac_mb_ctx = ssh_hmac_mb_start(macalg->alg);
 		mac->key_len = mac->mac_len = ssh_hmac_bytes(macalg->alg);
 	} else {
 		mac->mac_len = macalg->len / 8;
@@ -147,6 +149,12 @@ mac_init(struct sshmac *mac)
 		if (mac->hmac_ctx == NULL ||
 		    ssh_hmac_init(mac->hmac_ctx, mac->key, mac->key_len) < 0)
 			return SSH_ERR_INVALID_ARGUMENT;
+		if (mac->hmac_mb_ctx != NULL &&
+		    ssh_hmac_mb_init(mac->hmac_mb_ctx, mac->key,
+		    mac->key_len) < 0) {
+			ssh_hmac_mb_free(mac->hmac_mb_ctx);
+			mac->hmac_mb_ctx = NULL;
+		}
 		return 0;
 	case SSH_UMAC:
 		if ((mac->umac_ctx = umac_new(mac->key)) == NULL)
@@ -225,6 +233,51 @@ mac_check(struct sshmac *mac, u_int32_t seqno,
 	return 0;
 }
 
+/*
+ * Returns how many MACs mac_compute_batch() can compute for about the cost
+ * of one, i.e. the batch size worth waiting for.
+ */
+u_int
+mac_batch_size(const struct sshmac *mac)
+{
+	if (mac->type == SSH_DIGEST && mac->hmac_mb_ctx != NULL)
+		return ssh_hmac_mb_lanes(mac->hmac_mb_ctx);
+	return 1;
+}
+
+int
+mac_compute_batch(struct sshmac *mac, struct sshmac_job *jobs, u_int njobs)
+{
+	struct ssh_hmac_mb_job mb[MAC_BATCH_MAX];
+	u_int i, n;
+	int r;
+
+	if (mac->type != SSH_DIGEST || mac->hmac_mb_ctx == NULL) {
+		for (i = 0; i < njobs; i++) {
+			if (jobs[i].len > INT_MAX)
+				return SSH_ERR_INVALID_ARGUMENT;
+			if ((r = mac_compute(mac, jobs[i].seqno, jobs[i].data,
+			    (int)jobs[i].len, jobs[i].digest,
+			    mac->mac_len)) != 0)
+				return r;
+		}
+		return 0;
+	}
+	for (; njobs > 0; jobs += n, njobs -= n) {
+		n = MINIMUM(njobs, MAC_BATCH_MAX);
+		for (i = 0; i < n; i++) {
+			put_u32(mb[i].head, jobs[i].seqno);
+			mb[i].data = jobs[i].data;
+			mb[i].len = jobs[i].len;
+			mb[i].out = jobs[i].digest;
+			mb[i].outlen = mac->mac_len;
+		}
+		if (ssh_hmac_mb_compute(mac->hmac_mb_ctx, mb, n) != 0)
+			return SSH_ERR_LIBCRYPTO_ERROR;
+	}
+	return 0;
+}
+
 void
 mac_clear(struct sshmac *mac)
 {
@@ -236,7 +289,10 @@ mac_clear(struct sshmac *mac)
 			umac128_delete(mac->umac_ctx);
 	} else if (mac->hmac_ctx != NULL)
 		ssh_hmac_free(mac->hmac_ctx);
+	if (mac->hmac_mb_ctx != NULL)
+		ssh_hmac_mb_free(mac->hmac_mb_ctx);
 	mac->hmac_ctx = NULL;
+	mac->hmac_mb_ctx = NULL;
 	mac->umac_ctx = NULL;
 }
 
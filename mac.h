@@ -37,9 +37,20 @@ struct sshmac {
 	int	type;
 	int	etm;		/* Encrypt-then-MAC */
 	struct ssh_hmac_ctx	*hmac_ctx;
+	struct ssh_hmac_mb_ctx	*hmac_mb_ctx;	/* for mac_compute_batch() */
 	struct umac_ctx		*umac_ctx;
 };
 
+#define MAC_BATCH_MAX	16
+
+/* One MAC for mac_compute_batch() */
+struct sshmac_job {
+	u_int32_t	 seqno;
+	const u_char	*data;
+	size_t		 len;
+	u_char		*digest;	/* mac_len bytes */
+};
+
 int	 mac_valid(const char *);
 char	*mac_alg_list(char);
 int	 mac_setup(struct sshmac *, char *);
@@ -48,6 +59,8 @@ int	 mac_compute(struct sshmac *, u_int32_t, const u_char *, int,
     u_char *, size_t);
 int	 mac_check(struct sshmac *, u_int32_t, const u_char *, size_t,
     const u_char *, size_t);
+u_int	 mac_batch_size(const struct sshmac *);
+int	 mac_compute_batch(struct sshmac *, struct sshmac_job *, u_int);
 void	 mac_clear(struct sshmac *);
 
 #endif /* SSHMAC_H */
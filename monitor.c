@@ -96,6 +96,7 @@
 #include "match.h"
 #include "ssherr.h"
 #include "sk-api.h"
+#include "connstats.h"
 
 #ifdef GSSAPI
 static Gssctxt *gsscontext = NULL;
@@ -114,9 +115,11 @@ static struct sshbuf *child_state;
 
 int mm_answer_moduli(struct ssh *, int, struct sshbuf *);
 int mm_answer_sign(struct ssh *, int, struct sshbuf *);
+int mm_answer_sign_proofs(struct ssh *, int, struct sshbuf *);
 int mm_answer_pwnamallow(struct ssh *, int, struct sshbuf *);
 int mm_answer_auth2_read_banner(struct ssh *, int, struct sshbuf *);
 int mm_answer_authserv(struct ssh *, int, struct sshbuf *);
+int mm_answer_kexdone(struct ssh *, int, struct sshbuf *);
 int mm_answer_authpassword(struct ssh *, int, struct sshbuf *);
 int mm_answer_bsdauthquery(struct ssh *, int, struct sshbuf *);
 int mm_answer_bsdauthrespond(struct ssh *, int, struct sshbuf *);
@@ -167,6 +170,10 @@ static u_int session_id2_len = 0;
 static u_char *session_id2 = NULL;
 static pid_t monitor_child_pid;
 
+/* time spent answering requests since the last authentication decision */
+static double request_time;
+static int key_refused;		/* failed attempt logged by keyallowed */
+
 struct mon_table {
 	enum monitor_reqtype type;
 	int flags;
@@ -191,6 +198,7 @@ struct mon_table mon_dispatch_proto20[] = {
     {MONITOR_REQ_MODULI, MON_ONCE, mm_answer_moduli},
 #endif
     {MONITOR_REQ_SIGN, MON_ONCE, mm_answer_sign},
+    {MONITOR_REQ_KEXDONE, MON_ONCE, mm_answer_kexdone},
     {MONITOR_REQ_PWNAM, MON_ONCE, mm_answer_pwnamallow},
     {MONITOR_REQ_AUTHSERV, MON_ONCE, mm_answer_authserv},
     {MONITOR_REQ_AUTH2_READ_BANNER, MON_ONCE, mm_answer_auth2_read_banner},
@@ -226,6 +234,7 @@ struct mon_table mon_dispatch_postauth20[] = {
     {MONITOR_REQ_MODULI, 0, mm_answer_moduli},
 #endif
     {MONITOR_REQ_SIGN, 0, mm_answer_sign},
+    {MONITOR_REQ_SIGN_PROOFS, 0, mm_answer_sign_proofs},
     {MONITOR_REQ_PTY, 0, mm_answer_pty},
     {MONITOR_REQ_PTYCLEANUP, 0, mm_answer_pty_cleanup},
     {MONITOR_REQ_TERM, 0, mm_answer_term},
@@ -290,6 +299,7 @@ monitor_child_preauth(struct ssh *ssh, struct monitor *pmonitor)
 	/* Permit requests for moduli and signatures */
 	monitor_permit(mon_dispatch, MONITOR_REQ_MODULI, 1);
 	monitor_permit(mon_dispatch, MONITOR_REQ_SIGN, 1);
+	monitor_permit(mon_dispatch, MONITOR_REQ_KEXDONE, 1);
 
 	/* The first few requests do not require asynchronous access */
 	while (!authenticated) {
@@ -300,6 +310,10 @@ monitor_child_preauth(struct ssh *ssh, struct monitor *pmonitor)
 
 		authenticated = (monitor_read(ssh, pmonitor,
 		    mon_dispatch, &ent) == 1);
+		/* Key exchange requests aren't part of any attempt */
+		if (ent->type == MONITOR_REQ_MODULI ||
+		    ent->type == MONITOR_REQ_SIGN)
+			request_time = 0;
 
 		/* Special handling for multiple required authentications */
 		if (options.num_auth_methods != 0) {
@@ -338,12 +352,21 @@ monitor_child_preauth(struct ssh *ssh, struct monitor *pmonitor)
 		if (ent->flags & (MON_AUTHDECIDE|MON_ALOG)) {
 			auth_log(ssh, authenticated, partial,
 			    auth_method, auth_submethod);
+			connstats_report_auth(auth_method, authenticated ?
+			    "success" : partial ? "partial" : "failure",
+			    request_time);
+			request_time = 0;
 			if (!partial && !authenticated)
 				authctxt->failures++;
 			if (authenticated || partial) {
 				auth2_update_session_info(authctxt,
 				    auth_method, auth_submethod);
 			}
+		} else if (key_refused) {
+			connstats_report_auth(auth_method, "failure",
+			    request_time);
+			request_time = 0;
+			key_refused = 0;
 		}
 	}
 
@@ -471,6 +494,7 @@ monitor_read(struct ssh *ssh, struct monitor *pmonitor, struct mon_table *ent,
 	int r, ret;
 	u_char type;
 	struct pollfd pfd[2];
+	double start;
 
 	for (;;) {
 		memset(&pfd, 0, sizeof(pfd));
@@ -513,7 +537,9 @@ monitor_read(struct ssh *ssh, struct monitor *pmonitor, struct mon_table *ent,
 	if (ent->f != NULL) {
 		if (!(ent->flags & MON_PERMIT))
 			fatal_f("unpermitted request %d", type);
+		start = monotime_double();
 		ret = (*ent->f)(ssh, pmonitor->m_sendfd, m);
+		request_time += monotime_double() - start;
 		sshbuf_free(m);
 
 		/* The child may use this request only once, disable it */
@@ -698,6 +724,58 @@ mm_answer_sign(struct ssh *ssh, int sock, struct sshbuf *m)
 	return (0);
 }
 
+/*
+ * Sign a batch of hostkey proofs. Unlike MONITOR_REQ_SIGN, the child
+ * sends only key indexes and algorithms; the signed data is rebuilt
+ * here from the session ID.
+ */
+int
+mm_answer_sign_proofs(struct ssh *ssh, int sock, struct sshbuf *m)
+{
+	extern int auth_sock;			/* XXX move to state struct? */
+	struct hostkey_proof *proofs;
+	u_int i, keyid, compat, nproofs;
+	int r;
+
+	debug3_f("entering");
+
+	if (session_id2_len == 0)
+		fatal_f("no session ID");
+	if ((r = sshbuf_get_u32(m, &compat)) != 0 ||
+	    (r = sshbuf_get_u32(m, &nproofs)) != 0)
+		fatal_fr(r, "parse");
+	if (nproofs == 0 || nproofs > options.num_host_key_files)
+		fatal_f("bad proof count %u", nproofs);
+	proofs = xcalloc(nproofs, sizeof(*proofs));
+	for (i = 0; i < nproofs; i++) {
+		if ((r = sshbuf_get_u32(m, &keyid)) != 0 ||
+		    (r = sshbuf_get_cstring(m, &proofs[i].alg, NULL)) != 0)
+			fatal_fr(r, "parse proof");
+		if (keyid > INT_MAX)
+			fatal_f("invalid key ID");
+		proofs[i].ndx = (int)keyid;
+	}
+
+	if ((r = hostkey_sign_proofs(ssh, session_id2, session_id2_len,
+	    compat, auth_sock > 0 ? auth_sock : -1, proofs, nproofs)) != 0)
+		fatal_fr(r, "sign proofs");
+
+	sshbuf_reset(m);
+	for (i = 0; i < nproofs; i++) {
+		if ((r = sshbuf_put_string(m, proofs[i].sig,
+		    proofs[i].slen)) != 0)
+			fatal_fr(r, "assemble");
+		free(proofs[i].alg);
+		free(proofs[i].sig);
+	}
+	free(proofs);
+	debug3_f("signed %u hostkey proofs", nproofs);
+
+	mm_request_send(sock, MONITOR_ANS_SIGN_PROOFS, m);
+
+	return (0);
+}
+
 #define PUTPW(b, id) \
 	do { \
 		if ((r = sshbuf_put_string(b, \
@@ -823,6 +901,21 @@ int mm_answer_auth2_read_banner(struct ssh *ssh, int sock, struct sshbuf *m)
 	return (0);
 }
 
+/* The child has finished key exchange; report it to the listener */
+int
+mm_answer_kexdone(struct ssh *ssh, int sock, struct sshbuf *m)
+{
+	char *kex;
+	int r;
+
+	if ((r = sshbuf_get_cstring(m, &kex, NULL)) != 0)
+		fatal_fr(r, "parse");
+	connstats_report_kex(kex);
+	free(kex);
+
+	return (0);
+}
+
 int
 mm_answer_authserv(struct ssh *ssh, int sock, struct sshbuf *m)
 {
@@ -1221,6 +1314,7 @@ mm_answer_keyallowed(struct ssh *ssh, int sock, struct sshbuf *m)
 	} else {
 		/* Log failed attempt */
 		auth_log(ssh, 0, 0, auth_method, NULL);
+		key_refused = 1;
 		free(cuser);
 		free(chost);
 	}
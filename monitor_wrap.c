@@ -243,6 +243,41 @@ mm_sshkey_sign(struct ssh *ssh, struct sshkey *key, u_char **sigp, size_t *lenp,
 	return (0);
 }
 
+int
+mm_sshkey_sign_proofs(struct ssh *ssh, struct hostkey_proof *proofs,
+    u_int nproofs)
+{
+	struct sshbuf *m;
+	u_int i;
+	int r;
+
+	debug3_f("entering");
+	if ((m = sshbuf_new()) == NULL)
+		fatal_f("sshbuf_new failed");
+	if ((r = sshbuf_put_u32(m, ssh->compat)) != 0 ||
+	    (r = sshbuf_put_u32(m, nproofs)) != 0)
+		fatal_fr(r, "assemble");
+	for (i = 0; i < nproofs; i++) {
+		if ((r = sshbuf_put_u32(m, proofs[i].ndx)) != 0 ||
+		    (r = sshbuf_put_cstring(m, proofs[i].alg)) != 0)
+			fatal_fr(r, "assemble proof");
+	}
+
+	mm_request_send(pmonitor->m_recvfd, MONITOR_REQ_SIGN_PROOFS, m);
+
+	debug3_f("waiting for MONITOR_ANS_SIGN_PROOFS");
+	mm_request_receive_expect(pmonitor->m_recvfd,
+	    MONITOR_ANS_SIGN_PROOFS, m);
+	for (i = 0; i < nproofs; i++) {
+		if ((r = sshbuf_get_string(m, &proofs[i].sig,
+		    &proofs[i].slen)) != 0)
+			fatal_fr(r, "parse");
+	}
+	sshbuf_free(m);
+
+	return (0);
+}
+
 #define GETPW(b, id) \
 	do { \
 		if ((r = sshbuf_get_string_direct(b, &p, &len)) != 0) \
@@ -395,6 +430,25 @@ mm_inform_authserv(char *service, char *style)
 	sshbuf_free(m);
 }
 
+/* Tell the monitor key exchange is done, for connection statistics */
+void
+mm_inform_kexdone(const char *kex)
+{
+	struct sshbuf *m;
+	int r;
+
+	debug3_f("entering");
+
+	if ((m = sshbuf_new()) == NULL)
+		fatal_f("sshbuf_new failed");
+	if ((r = sshbuf_put_cstring(m, kex)) != 0)
+		fatal_fr(r, "assemble");
+
+	mm_request_send(pmonitor->m_recvfd, MONITOR_REQ_KEXDONE, m);
+
+	sshbuf_free(m);
+}
+
 /* Do the password authentication */
 int
 mm_auth_password(struct ssh *ssh, char *password)
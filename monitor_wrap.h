@@ -39,6 +39,7 @@ struct Authctxt;
 struct sshkey;
 struct sshauthopt;
 struct sshkey_sig_details;
+struct hostkey_proof;
 
 void mm_log_handler(LogLevel, int, const char *, void *);
 int mm_is_monitor(void);
@@ -48,7 +49,9 @@ DH *mm_choose_dh(int, int, int);
 int mm_sshkey_sign(struct ssh *, struct sshkey *, u_char **, size_t *,
     const u_char *, size_t, const char *, const char *,
     const char *, u_int compat);
+int mm_sshkey_sign_proofs(struct ssh *, struct hostkey_proof *, u_int);
 void mm_inform_authserv(char *, char *);
+void mm_inform_kexdone(const char *);
 struct passwd *mm_getpwnamallow(struct ssh *, const char *);
 char *mm_auth2_read_banner(void);
 int mm_auth_password(struct ssh *, char *);
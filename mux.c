@@ -2233,6 +2233,38 @@ mux_client_request_stop_listening(int fd)
 	muxclient_request_id++;
 }
 
+/*
+ * Returns the pid of a master already listening at path, or 0 if there
+ * is none.  Unlike "ssh -O check", a missing master is not an error.
+ */
+u_int
+muxclient_master_pid(const char *path)
+{
+	struct sockaddr_un addr;
+	int sock;
+	u_int pid;
+
+	memset(&addr, '\0', sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlcpy(addr.sun_path, path,
+	    sizeof(addr.sun_path)) >= sizeof(addr.sun_path))
+		fatal("ControlPath too long ('%s' >= %u bytes)", path,
+		    (unsigned int)sizeof(addr.sun_path));
+
+	if ((sock = socket(PF_UNIX, SOCK_STREAM, 0)) == -1)
+		fatal_f("socket(): %s", strerror(errno));
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		close(sock);
+		return 0;
+	}
+	set_nonblock(sock);
+	pid = 0;
+	if (mux_client_hello_exchange(sock) == 0)
+		pid = mux_client_request_alive(sock);
+	close(sock);
+	return pid;
+}
+
 /* Multiplex client main loop. */
 int
 muxclient(const char *path)
@@ -29,6 +29,7 @@
 #include <sys/types.h>
 
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -57,9 +58,37 @@
 #define inline
 #endif				/* !__GNUC__ */
 
-/* OpenSSH isn't multithreaded */
-#define _ARC4_LOCK()
-#define _ARC4_UNLOCK()
+/*
+ * kexgen.c generates the next KEX keys on a helper thread. The lock is
+ * held across fork() so a child never inherits it locked.
+ */
+static pthread_mutex_t arc4_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t arc4_atfork_once = PTHREAD_ONCE_INIT;
+
+static void
+_arc4_atfork_prepare(void)
+{
+	pthread_mutex_lock(&arc4_lock);
+}
+
+static void
+_arc4_atfork_release(void)
+{
+	pthread_mutex_unlock(&arc4_lock);
+}
+
+static void
+_arc4_atfork_init(void)
+{
+	pthread_atfork(_arc4_atfork_prepare, _arc4_atfork_release,
+	    _arc4_atfork_release);
+}
+
+#define _ARC4_LOCK()	do { \
+		pthread_once(&arc4_atfork_once, _arc4_atfork_init); \
+		pthread_mutex_lock(&arc4_lock); \
+	} while (0)
+#define _ARC4_UNLOCK()	pthread_mutex_unlock(&arc4_lock)
 
 #define KEYSZ	32
 #define IVSZ	8
@@ -193,6 +193,11 @@ struct session_state {
 	u_int32_t rekey_interval;	/* how often in seconds */
 	time_t rekey_time;	/* time of last rekeying */
 
+	/* Proactive rekeying, see ssh_packet_rekey_soon() */
+	double kex_start;	/* when our KEXINIT was sent */
+	double kex_duration;	/* how long the last KEX held up output */
+	double keyed_at;	/* when our NEWKEYS was sent */
+
 	/* roundup current message to extra_pad bytes */
 	u_char extra_pad;
 
@@ -219,6 +224,24 @@ struct session_state {
 	/* One-off warning about weak ciphers */
 	int cipher_warning_done;
 
+	/* EtM MACs reserved in output but not yet computed */
+	struct {
+		size_t off, len;
+		u_int32_t seqnr;
+	} mac_pending[MAC_BATCH_MAX];
+	u_int mac_npending;
+
+	/*
+	 * Session resumption: raw bytes read from and written to the peer
+	 * since the banners, and the written bytes the peer has not yet
+	 * acknowledged, starting at stream offset replay_off.
+	 */
+	u_int64_t stream_rx, stream_tx;
+	struct sshbuf *replay;
+	u_int64_t replay_off;
+	size_t replay_max;
+	int detached;
+
 	/* Hook for fuzzing inbound packets */
 	ssh_packet_hook_fn *hook_in;
 	void *hook_in_ctx;
@@ -602,6 +625,8 @@ ssh_packet_close_internal(struct ssh *ssh, int do_close)
 	sshbuf_free(state->output);
 	sshbuf_free(state->outgoing_packet);
 	sshbuf_free(state->incoming_packet);
+	sshbuf_free(state->replay);
+	state->replay = NULL;
 	for (mode = 0; mode < MODE_MAX; mode++) {
 		kex_free_newkeys(state->newkeys[mode]);	/* current keys */
 		state->newkeys[mode] = NULL;
@@ -860,6 +885,38 @@ ssh_clear_newkeys(struct ssh *ssh, int mode)
 	}
 }
 
+/*
+ * Computes the EtM MACs deferred by ssh_packet_send2_wrapped(). Must be
+ * called before the output buffer is read or the outgoing keys change.
+ */
+static int
+ssh_packet_flush_macs(struct ssh *ssh)
+{
+	struct session_state *state = ssh->state;
+	struct sshmac_job jobs[MAC_BATCH_MAX];
+	u_char *cp;
+	u_int i;
+	int r;
+
+	if (state->mac_npending == 0)
+		return 0;
+	if (state->newkeys[MODE_OUT] == NULL ||
+	    (cp = sshbuf_mutable_ptr(state->output)) == NULL)
+		return SSH_ERR_INTERNAL_ERROR;
+	for (i = 0; i < state->mac_npending; i++) {
+		jobs[i].seqno = state->mac_pending[i].seqnr;
+		jobs[i].data = cp + state->mac_pending[i].off;
+		jobs[i].len = state->mac_pending[i].len;
+		jobs[i].digest = cp + state->mac_pending[i].off +
+		    state->mac_pending[i].len;
+	}
+	r = mac_compute_batch(&state->newkeys[MODE_OUT]->mac, jobs,
+	    state->mac_npending);
+	DBG(debug("done calc %u MAC(EtM) out", state->mac_npending));
+	state->mac_npending = 0;
+	return r;
+}
+
 int
 ssh_set_newkeys(struct ssh *ssh, int mode)
 {
@@ -881,6 +938,8 @@ ssh_set_newkeys(struct ssh *ssh, int mode)
 		crypt_type = CIPHER_ENCRYPT;
 		ps = &state->p_send;
 		max_blocks = &state->max_blocks_out;
+		if ((r = ssh_packet_flush_macs(ssh)) != 0)
+			return r;
 	} else {
 		ccp = &state->receive_context;
 		crypt_type = CIPHER_DECRYPT;
@@ -985,6 +1044,62 @@ packet_authentication_state(const struct ssh *ssh)
 	return state->after_authentication;
 }
 
+/*
+ * Start rekeying this many KEX durations before a limit would be
+ * reached at the current rate.
+ */
+#define REKEY_LEAD	4
+
+static int
+rekey_volume_soon(u_int64_t blocks, u_int64_t max_blocks, double elapsed,
+    double lead)
+{
+	/* don't trust the rate until half of the volume is used */
+	if (max_blocks == 0 || blocks < max_blocks / 2)
+		return 0;
+	/* seconds left at the average rate since the last KEX */
+	return (double)(max_blocks - blocks) * elapsed / blocks < lead;
+}
+
+/*
+ * Outgoing data is queued for as long as a KEX runs. Rather than
+ * waiting for a limit to force a rekey in the middle of a burst, start
+ * it when the measured throughput says the limit is about to be reached
+ * so the new keys are in place in time.
+ */
+static int
+ssh_packet_rekey_soon(struct ssh *ssh)
+{
+	struct session_state *state = ssh->state;
+	double now, elapsed, lead;
+
+	/* nothing measured yet */
+	if (state->kex_duration <= 0 || state->keyed_at <= 0)
+		return 0;
+	lead = state->kex_duration * REKEY_LEAD;
+	if (state->rekey_interval == 0 &&
+	    state->p_send.blocks < state->max_blocks_out / 2 &&
+	    state->p_read.blocks < state->max_blocks_in / 2)
+		return 0;
+	now = monotime_double();
+	if (state->rekey_interval != 0 &&
+	    state->keyed_at + state->rekey_interval - lead <= now) {
+		debug3_f("rekey interval is %.3fs away", state->keyed_at +
+		    state->rekey_interval - now);
+		return 1;
+	}
+	if ((elapsed = now - state->keyed_at) <= 0)
+		return 0;
+	if (rekey_volume_soon(state->p_send.blocks, state->max_blocks_out,
+	    elapsed, lead) ||
+	    rekey_volume_soon(state->p_read.blocks, state->max_blocks_in,
+	    elapsed, lead)) {
+		debug3_f("rekey limit is less than %.3fs away", lead);
+		return 1;
+	}
+	return 0;
+}
+
 #define MAX_PACKETS	(1U<<31)
 static int
 ssh_packet_need_rekeying(struct ssh *ssh, u_int outbound_packet_len)
@@ -1034,10 +1149,14 @@ ssh_packet_need_rekeying(struct ssh *ssh, u_int outbound_packet_len)
 	/* Rekey after (cipher-specific) maximum blocks */
 	out_blocks = ROUNDUP(outbound_packet_len,
 	    state->newkeys[MODE_OUT]->enc.block_size);
-	return (state->max_blocks_out &&
+	if ((state->max_blocks_out &&
 	    (state->p_send.blocks + out_blocks > state->max_blocks_out)) ||
 	    (state->max_blocks_in &&
-	    (state->p_read.blocks > state->max_blocks_in));
+	    (state->p_read.blocks > state->max_blocks_in)))
+		return 1;
+
+	/* or a little earlier if a limit is coming up fast */
+	return ssh_packet_rekey_soon(ssh);
 }
 
 int
@@ -1226,7 +1345,25 @@ ssh_packet_send2_wrapped(struct ssh *ssh)
 	    len - aadlen, aadlen, authlen)) != 0)
 		goto out;
 	/* append unencrypted MAC */
-	if (mac && mac->enabled) {
+	if (mac && mac->enabled && mac->etm && mac_batch_size(mac) > 1) {
+		/*
+		 * EtM MACs cover only the ciphertext already in the output
+		 * buffer, so reserve room for the MAC and compute several
+		 * at once in ssh_packet_flush_macs().
+		 */
+		state->mac_pending[state->mac_npending].off =
+		    sshbuf_len(state->output) - len;
+		state->mac_pending[state->mac_npending].len = len;
+		state->mac_pending[state->mac_npending].seqnr =
+		    state->p_send.seqnr;
+		state->mac_npending++;
+		if ((r = sshbuf_reserve(state->output, mac->mac_len,
+		    NULL)) != 0)
+			goto out;
+		if (state->mac_npending >= mac_batch_size(mac) &&
+		    (r = ssh_packet_flush_macs(ssh)) != 0)
+			goto out;
+	} else if (mac && mac->enabled) {
 		if (mac->etm) {
 			/* EtM: compute mac over aadlen + cipher text */
 			if ((r = mac_compute(mac, state->p_send.seqnr,
@@ -1317,8 +1454,10 @@ ssh_packet_send2(struct ssh *ssh)
 	}
 
 	/* rekeying starts with sending KEXINIT */
-	if (type == SSH2_MSG_KEXINIT)
+	if (type == SSH2_MSG_KEXINIT) {
 		state->rekeying = 1;
+		state->kex_start = monotime_double();
+	}
 
 	if ((r = ssh_packet_send2_wrapped(ssh)) != 0)
 		return r;
@@ -1327,6 +1466,10 @@ ssh_packet_send2(struct ssh *ssh)
 	if (type == SSH2_MSG_NEWKEYS) {
 		state->rekeying = 0;
 		state->rekey_time = monotime();
+		state->keyed_at = monotime_double();
+		if (state->kex_start > 0)
+			state->kex_duration = state->keyed_at -
+			    state->kex_start;
 		while ((p = TAILQ_FIRST(&state->outgoing))) {
 			type = p->type;
 			/*
@@ -1807,6 +1950,7 @@ ssh_packet_process_incoming(struct ssh *ssh, const char *buf, u_int len)
 	struct session_state *state = ssh->state;
 	int r;
 
+	state->stream_rx += len;
 	if (state->packet_discard) {
 		state->keep_alive_timeouts = 0; /* ?? */
 		if (len >= state->packet_discard) {
@@ -1830,8 +1974,24 @@ ssh_packet_process_read(struct ssh *ssh, int fd)
 	int r;
 	size_t rlen;
 
-	if ((r = sshbuf_read(fd, state->input, PACKET_MAX_SIZE, &rlen)) != 0)
+	if (state->detached)
+		return 0;
+	if ((r = sshbuf_read(fd, state->input, PACKET_MAX_SIZE, &rlen)) != 0) {
+		if (r == SSH_ERR_SYSTEM_ERROR && (errno == EAGAIN ||
+		    errno == EINTR || errno == EWOULDBLOCK))
+			return r;
+		/* A resumable session outlives its transport */
+		if (state->replay != NULL) {
+			if (r == SSH_ERR_SYSTEM_ERROR && errno == EPIPE)
+				r = SSH_ERR_CONN_CLOSED;
+			debug_f("read: %s; detaching", r == SSH_ERR_SYSTEM_ERROR ?
+			    strerror(errno) : ssh_err(r));
+			ssh_packet_detach(ssh);
+			return 0;
+		}
 		return r;
+	}
+	state->stream_rx += rlen;
 
 	if (state->packet_discard) {
 		if ((r = sshbuf_consume_end(state->input, rlen)) != 0)
@@ -2036,20 +2196,33 @@ int
 ssh_packet_write_poll(struct ssh *ssh)
 {
 	struct session_state *state = ssh->state;
-	int len = sshbuf_len(state->output);
-	int r;
+	int len, r;
 
-	if (len > 0) {
+	if ((r = ssh_packet_flush_macs(ssh)) != 0)
+		return r;
+	len = sshbuf_len(state->output);
+	if (len > 0 && !state->detached) {
 		len = write(state->connection_out,
 		    sshbuf_ptr(state->output), len);
 		if (len == -1) {
 			if (errno == EINTR || errno == EAGAIN ||
 			    errno == EWOULDBLOCK)
 				return 0;
-			return SSH_ERR_SYSTEM_ERROR;
+			r = SSH_ERR_SYSTEM_ERROR;
+		} else if (len == 0)
+			r = SSH_ERR_CONN_CLOSED;
+		if (r != 0) {
+			if (state->replay == NULL)
+				return r;
+			debug_f("write: %s; detaching", r == SSH_ERR_SYSTEM_ERROR ?
+			    strerror(errno) : ssh_err(r));
+			ssh_packet_detach(ssh);
+			return 0;
 		}
-		if (len == 0)
-			return SSH_ERR_CONN_CLOSED;
+		if (state->replay != NULL && (r = sshbuf_put(state->replay,
+		    sshbuf_ptr(state->output), len)) != 0)
+			return r;
+		state->stream_tx += len;
 		if ((r = sshbuf_consume(state->output, len)) != 0)
 			return r;
 	}
@@ -2071,7 +2244,8 @@ ssh_packet_write_wait(struct ssh *ssh)
 
 	if ((r = ssh_packet_write_poll(ssh)) != 0)
 		return r;
-	while (ssh_packet_have_data_to_write(ssh)) {
+	/* Output waits in the buffer until a detached session resumes */
+	while (!state->detached && ssh_packet_have_data_to_write(ssh)) {
 		pfd.fd = state->connection_out;
 		pfd.events = POLLOUT;
 
@@ -2118,12 +2292,137 @@ ssh_packet_have_data_to_write(struct ssh *ssh)
 int
 ssh_packet_not_very_much_data_to_write(struct ssh *ssh)
 {
+	/* Hold back new data while the replay history is full */
+	if (ssh->state->replay != NULL &&
+	    sshbuf_len(ssh->state->replay) >= ssh->state->replay_max)
+		return 0;
 	if (ssh->state->interactive_mode)
 		return sshbuf_len(ssh->state->output) < 16384;
 	else
 		return sshbuf_len(ssh->state->output) < 128 * 1024;
 }
 
+/*
+ * Start keeping what we write for replay after a transport drop, up to
+ * about 'max' bytes beyond what the peer has acknowledged.
+ */
+int
+ssh_packet_resume_arm(struct ssh *ssh, size_t max)
+{
+	struct session_state *state = ssh->state;
+
+	if (state->replay == NULL && (state->replay = sshbuf_new()) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	state->replay_off = state->stream_tx;
+	state->replay_max = max;
+	return 0;
+}
+
+void
+ssh_packet_resume_disarm(struct ssh *ssh)
+{
+	sshbuf_free(ssh->state->replay);
+	ssh->state->replay = NULL;
+}
+
+int
+ssh_packet_resume_armed(struct ssh *ssh)
+{
+	return ssh->state->replay != NULL;
+}
+
+void
+ssh_packet_resume_offsets(struct ssh *ssh, u_int64_t *rxp, u_int64_t *txp)
+{
+	if (rxp != NULL)
+		*rxp = ssh->state->stream_rx;
+	if (txp != NULL)
+		*txp = ssh->state->stream_tx;
+}
+
+/* The peer has received everything we wrote before offset 'rx' */
+int
+ssh_packet_resume_ack(struct ssh *ssh, u_int64_t rx)
+{
+	struct session_state *state = ssh->state;
+	int r;
+
+	if (state->replay == NULL || rx <= state->replay_off)
+		return 0;
+	if (rx > state->stream_tx)
+		return SSH_ERR_INVALID_ARGUMENT;
+	if ((r = sshbuf_consume(state->replay, rx - state->replay_off)) != 0)
+		return r;
+	state->replay_off = rx;
+	return 0;
+}
+
+/* Drop the transport but keep the session, waiting for ssh_packet_reattach */
+void
+ssh_packet_detach(struct ssh *ssh)
+{
+	struct session_state *state = ssh->state;
+
+	if (state->detached)
+		return;
+	if (state->connection_in == state->connection_out)
+		close(state->connection_in);
+	else {
+		close(state->connection_in);
+		close(state->connection_out);
+	}
+	state->connection_in = state->connection_out = -1;
+	state->detached = 1;
+}
+
+int
+ssh_packet_is_detached(struct ssh *ssh)
+{
+	return ssh->state->detached;
+}
+
+/*
+ * Carry on over socket 'fd', first sending again whatever the peer missed
+ * after offset 'peer_rx'.  Any old transport is closed.
+ */
+int
+ssh_packet_reattach(struct ssh *ssh, int fd, u_int64_t peer_rx)
+{
+	struct session_state *state = ssh->state;
+	struct sshbuf *out;
+	size_t keep;
+	int r;
+
+	if (state->replay == NULL || peer_rx < state->replay_off ||
+	    peer_rx > state->stream_tx)
+		return SSH_ERR_INVALID_ARGUMENT;
+	/* Pending MACs are at offsets into the output we are about to move */
+	if ((r = ssh_packet_flush_macs(ssh)) != 0)
+		return r;
+	keep = peer_rx - state->replay_off;
+	if ((out = sshbuf_new()) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	if ((r = sshbuf_put(out, sshbuf_ptr(state->replay) + keep,
+	    sshbuf_len(state->replay) - keep)) != 0 ||
+	    (r = sshbuf_putb(out, state->output)) != 0) {
+		sshbuf_free(out);
+		return r;
+	}
+	sshbuf_free(state->output);
+	state->output = out;
+	sshbuf_reset(state->replay);
+	state->replay_off = state->stream_tx = peer_rx;
+
+	ssh_packet_detach(ssh);
+	state->connection_in = state->connection_out = fd;
+	state->detached = 0;
+	state->keep_alive_timeouts = 0;
+	set_nonblock(fd);
+	if (state->interactive_mode)
+		set_nodelay(fd);
+	return 0;
+}
+
 void
 ssh_packet_set_tos(struct ssh *ssh, int tos)
 {
@@ -2240,6 +2539,10 @@ ssh_packet_get_input(struct ssh *ssh)
 void *
 ssh_packet_get_output(struct ssh *ssh)
 {
+	int r;
+
+	if ((r = ssh_packet_flush_macs(ssh)) != 0)
+		fatal_fr(r, "flush MACs");
 	return (void *)ssh->state->output;
 }
 
@@ -2271,6 +2574,7 @@ kex_to_blob(struct sshbuf *m, struct kex *kex)
 	    (r = sshbuf_put_u32(m, kex->hostkey_type)) != 0 ||
 	    (r = sshbuf_put_u32(m, kex->hostkey_nid)) != 0 ||
 	    (r = sshbuf_put_u32(m, kex->kex_type)) != 0 ||
+	    (r = sshbuf_put_u32(m, kex->ec_nid)) != 0 ||
 	    (r = sshbuf_put_stringb(m, kex->my)) != 0 ||
 	    (r = sshbuf_put_stringb(m, kex->peer)) != 0 ||
 	    (r = sshbuf_put_stringb(m, kex->client_version)) != 0 ||
@@ -2332,7 +2636,8 @@ ssh_packet_get_state(struct ssh *ssh, struct sshbuf *m)
 	struct session_state *state = ssh->state;
 	int r;
 
-	if ((r = kex_to_blob(m, ssh->kex)) != 0 ||
+	if ((r = ssh_packet_flush_macs(ssh)) != 0 ||
+	    (r = kex_to_blob(m, ssh->kex)) != 0 ||
 	    (r = newkeys_to_blob(m, ssh, MODE_OUT)) != 0 ||
 	    (r = newkeys_to_blob(m, ssh, MODE_IN)) != 0 ||
 	    (r = sshbuf_put_u64(m, state->rekey_limit)) != 0 ||
@@ -2345,6 +2650,8 @@ ssh_packet_get_state(struct ssh *ssh, struct sshbuf *m)
 	    (r = sshbuf_put_u64(m, state->p_read.blocks)) != 0 ||
 	    (r = sshbuf_put_u32(m, state->p_read.packets)) != 0 ||
 	    (r = sshbuf_put_u64(m, state->p_read.bytes)) != 0 ||
+	    (r = sshbuf_put_u64(m, state->stream_rx)) != 0 ||
+	    (r = sshbuf_put_u64(m, state->stream_tx)) != 0 ||
 	    (r = sshbuf_put_stringb(m, state->input)) != 0 ||
 	    (r = sshbuf_put_stringb(m, state->output)) != 0)
 		return r;
@@ -2433,6 +2740,7 @@ kex_from_blob(struct sshbuf *m, struct kex **kexp)
 	    (r = sshbuf_get_u32(m, (u_int *)&kex->hostkey_type)) != 0 ||
 	    (r = sshbuf_get_u32(m, (u_int *)&kex->hostkey_nid)) != 0 ||
 	    (r = sshbuf_get_u32(m, &kex->kex_type)) != 0 ||
+	    (r = sshbuf_get_u32(m, (u_int *)&kex->ec_nid)) != 0 ||
 	    (r = sshbuf_get_stringb(m, kex->my)) != 0 ||
 	    (r = sshbuf_get_stringb(m, kex->peer)) != 0 ||
 	    (r = sshbuf_get_stringb(m, kex->client_version)) != 0 ||
@@ -2479,7 +2787,9 @@ ssh_packet_set_state(struct ssh *ssh, struct sshbuf *m)
 	    (r = sshbuf_get_u32(m, &state->p_read.seqnr)) != 0 ||
 	    (r = sshbuf_get_u64(m, &state->p_read.blocks)) != 0 ||
 	    (r = sshbuf_get_u32(m, &state->p_read.packets)) != 0 ||
-	    (r = sshbuf_get_u64(m, &state->p_read.bytes)) != 0)
+	    (r = sshbuf_get_u64(m, &state->p_read.bytes)) != 0 ||
+	    (r = sshbuf_get_u64(m, &state->stream_rx)) != 0 ||
+	    (r = sshbuf_get_u64(m, &state->stream_tx)) != 0)
 		return r;
 	/*
 	 * We set the time here so that in post-auth privsep child we
@@ -160,6 +160,16 @@ int      ssh_packet_not_very_much_data_to_write(struct ssh *);
 int	 ssh_packet_connection_is_on_socket(struct ssh *);
 int	 ssh_packet_remaining(struct ssh *);
 
+/* Session resumption, see resume.c */
+int	 ssh_packet_resume_arm(struct ssh *, size_t);
+void	 ssh_packet_resume_disarm(struct ssh *);
+int	 ssh_packet_resume_armed(struct ssh *);
+void	 ssh_packet_resume_offsets(struct ssh *, u_int64_t *, u_int64_t *);
+int	 ssh_packet_resume_ack(struct ssh *, u_int64_t);
+void	 ssh_packet_detach(struct ssh *);
+int	 ssh_packet_is_detached(struct ssh *);
+int	 ssh_packet_reattach(struct ssh *, int, u_int64_t);
+
 void	 ssh_tty_make_modes(struct ssh *, int, struct termios *);
 void	 ssh_tty_parse_modes(struct ssh *, int);
 
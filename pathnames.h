@@ -68,6 +68,9 @@
 /* backward compat for protocol 2 */
 #define _PATH_SSH_USER_HOSTFILE2	"~/" _PATH_SSH_USER_DIR "/known_hosts2"
 
+/* Per-user cache of DNSSEC-validated SSHFP records (VerifyHostKeyDNS). */
+#define _PATH_SSH_USER_SSHFP_CACHE	"~/" _PATH_SSH_USER_DIR "/sshfp_cache"
+
 /*
  * Name of the default file containing client-side authentication key. This
  * file should only be readable by the user him/herself.
@@ -162,7 +162,8 @@ typedef enum {
 	oClearAllForwardings, oNoHostAuthenticationForLocalhost,
 	oEnableSSHKeysign, oRekeyLimit, oVerifyHostKeyDNS, oConnectTimeout,
 	oAddressFamily, oGssAuthentication, oGssDelegateCreds,
-	oServerAliveInterval, oServerAliveCountMax, oIdentitiesOnly,
+	oServerAliveInterval, oServerAliveCountMax, oChannelIdleTimeout,
+	oIdentitiesOnly,
 	oSendEnv, oSetEnv, oControlPath, oControlMaster, oControlPersist,
 	oHashKnownHosts,
 	oTunnel, oTunnelDevice,
@@ -171,14 +172,16 @@ typedef enum {
 	oNoneEnabled, oNoneMacEnabled, oNoneSwitch,
 	oDisableMTAES, oHPNBufferLimit,
 	oVisualHostKey,
-	oKexAlgorithms, oIPQoS, oRequestTTY, oSessionType, oStdinNull,
+	oKexAlgorithms, oIPQoS, oRequestTTY, oPredictiveEcho,
+	oSessionType, oStdinNull,
 	oForkAfterAuthentication, oIgnoreUnknown, oProxyUseFdpass,
 	oCanonicalDomains, oCanonicalizeHostname, oCanonicalizeMaxDots,
 	oCanonicalizeFallbackLocal, oCanonicalizePermittedCNAMEs,
 	oStreamLocalBindMask, oStreamLocalBindUnlink, oRevokedHostKeys,
 	oFingerprintHash, oUpdateHostkeys, oHostbasedAcceptedAlgorithms,
 	oPubkeyAcceptedAlgorithms, oCASignatureAlgorithms, oProxyJump,
-	oSecurityKeyProvider, oKnownHostsCommand,
+	oSecurityKeyProvider, oKnownHostsCommand, oTimingReport,
+	oResumeTimeout,
 	oIgnore, oIgnoredUnknownOption, oDeprecated, oUnsupported
 } OpCodes;
 
@@ -285,6 +288,7 @@ static struct {
 	{ "connecttimeout", oConnectTimeout },
 	{ "addressfamily", oAddressFamily },
 	{ "serveraliveinterval", oServerAliveInterval },
+	{ "channelidletimeout", oChannelIdleTimeout },
 	{ "serveralivecountmax", oServerAliveCountMax },
 	{ "sendenv", oSendEnv },
 	{ "setenv", oSetEnv },
@@ -302,6 +306,7 @@ static struct {
 	{ "kexalgorithms", oKexAlgorithms },
 	{ "ipqos", oIPQoS },
 	{ "requesttty", oRequestTTY },
+	{ "predictiveecho", oPredictiveEcho },
 	{ "noneenabled", oNoneEnabled },
 	{ "nonemacenabled", oNoneMacEnabled },
 	{ "noneswitch", oNoneSwitch },
@@ -329,6 +334,8 @@ static struct {
 	{ "proxyjump", oProxyJump },
 	{ "securitykeyprovider", oSecurityKeyProvider },
 	{ "knownhostscommand", oKnownHostsCommand },
+	{ "timingreport", oTimingReport },
+	{ "resumetimeout", oResumeTimeout },
 	{ "tcprcvbufpoll", oTcpRcvBufPoll },
 	{ "tcprcvbuf", oTcpRcvBuf },
 	{ "hpndisabled", oHPNDisabled },
@@ -888,6 +895,14 @@ static const struct multistate multistate_requesttty[] = {
 	{ "auto",			REQUEST_TTY_AUTO },
 	{ NULL, -1 }
 };
+static const struct multistate multistate_predictiveecho[] = {
+	{ "true",			PREDICTIVE_ECHO_YES },
+	{ "false",			PREDICTIVE_ECHO_NO },
+	{ "yes",			PREDICTIVE_ECHO_YES },
+	{ "no",				PREDICTIVE_ECHO_NO },
+	{ "always",			PREDICTIVE_ECHO_ALWAYS },
+	{ NULL, -1 }
+};
 static const struct multistate multistate_sessiontype[] = {
 	{ "none",			SESSION_TYPE_NONE },
 	{ "subsystem",			SESSION_TYPE_SUBSYSTEM },
@@ -1382,6 +1397,24 @@ parse_char_array:
 		charptr = &options->known_hosts_command;
 		goto parse_command;
 
+	case oTimingReport:
+		arg = argv_next(&ac, &av);
+		if (!arg || *arg == '\0') {
+			error("%.200s line %d: Missing argument.",
+			    filename, linenum);
+			goto out;
+		}
+		if (strcasecmp(arg, "none") != 0 &&
+		    ((strncmp(arg, "json:", 5) != 0 &&
+		    strncmp(arg, "text:", 5) != 0) || arg[5] == '\0')) {
+			error("%.200s line %d: Invalid TimingReport \"%s\"",
+			    filename, linenum, arg);
+			goto out;
+		}
+		if (*activep && options->timing_report == NULL)
+			options->timing_report = xstrdup(arg);
+		break;
+
 	case oProxyCommand:
 		charptr = &options->proxy_command;
 		/* Ignore ProxyCommand if ProxyJump already specified */
@@ -1784,6 +1817,14 @@ parse_pubkey_algos:
 		intptr = &options->server_alive_count_max;
 		goto parse_int;
 
+	case oResumeTimeout:
+		intptr = &options->resume_timeout;
+		goto parse_time;
+
+	case oChannelIdleTimeout:
+		intptr = &options->channel_idle_timeout;
+		goto parse_time;
+
 	case oSendEnv:
 		while ((arg = argv_next(&ac, &av)) != NULL) {
 			if (*arg == '\0' || strchr(arg, '=') != NULL) {
@@ -2020,6 +2061,11 @@ parse_pubkey_algos:
 		multistate_ptr = multistate_requesttty;
 		goto parse_multistate;
 
+	case oPredictiveEcho:
+		intptr = &options->predictive_echo;
+		multistate_ptr = multistate_predictiveecho;
+		goto parse_multistate;
+
 	case oSessionType:
 		intptr = &options->session_type;
 		multistate_ptr = multistate_sessiontype;
@@ -2459,6 +2505,7 @@ initialize_options(Options * options)
 	options->rekey_interval = -1;
 	options->verify_host_key_dns = -1;
 	options->server_alive_interval = -1;
+	options->channel_idle_timeout = -1;
 	options->server_alive_count_max = -1;
 	options->send_env = NULL;
 	options->num_send_env = 0;
@@ -2482,6 +2529,7 @@ initialize_options(Options * options)
 	options->ip_qos_interactive = -1;
 	options->ip_qos_bulk = -1;
 	options->request_tty = -1;
+	options->predictive_echo = -1;
 	options->none_switch = -1;
 	options->none_enabled = -1;
 	options->nonemac_enabled = -1;
@@ -2507,6 +2555,8 @@ initialize_options(Options * options)
 	options->hostbased_accepted_algos = NULL;
 	options->pubkey_accepted_algos = NULL;
 	options->known_hosts_command = NULL;
+	options->timing_report = NULL;
+	options->resume_timeout = -1;
 }
 
 /*
@@ -2654,8 +2704,12 @@ fill_default_options(Options * options)
 		options->verify_host_key_dns = 0;
 	if (options->server_alive_interval == -1)
 		options->server_alive_interval = 0;
+	if (options->channel_idle_timeout == -1)
+		options->channel_idle_timeout = 0;
 	if (options->server_alive_count_max == -1)
 		options->server_alive_count_max = 3;
+	if (options->resume_timeout == -1)
+		options->resume_timeout = 0;
 	if (options->hpn_disabled == -1)
 		options->hpn_disabled = 0;
 	if (options->hpn_buffer_size > -1) {
@@ -2719,6 +2773,8 @@ fill_default_options(Options * options)
 		options->ip_qos_bulk = IPTOS_DSCP_CS1;
 	if (options->request_tty == -1)
 		options->request_tty = REQUEST_TTY_AUTO;
+	if (options->predictive_echo == -1)
+		options->predictive_echo = PREDICTIVE_ECHO_NO;
 	if (options->session_type == -1)
 		options->session_type = SESSION_TYPE_DEFAULT;
 	if (options->stdin_null == -1)
@@ -2786,6 +2842,7 @@ fill_default_options(Options * options)
 	CLEAR_ON_NONE(options->pkcs11_provider);
 	CLEAR_ON_NONE(options->sk_provider);
 	CLEAR_ON_NONE(options->known_hosts_command);
+	CLEAR_ON_NONE(options->timing_report);
 	if (options->jump_host != NULL &&
 	    strcmp(options->jump_host, "none") == 0 &&
 	    options->jump_port == 0 && options->jump_user == NULL) {
@@ -3248,6 +3305,8 @@ fmt_intarg(OpCodes code, int val)
 		return fmt_multistate_int(val, multistate_tunnel);
 	case oRequestTTY:
 		return fmt_multistate_int(val, multistate_requesttty);
+	case oPredictiveEcho:
+		return fmt_multistate_int(val, multistate_predictiveecho);
 	case oSessionType:
 		return fmt_multistate_int(val, multistate_sessiontype);
 	case oCanonicalizeHostname:
@@ -3410,6 +3469,7 @@ dump_client_config(Options *o, const char *host)
 	dump_cfg_fmtint(oNoHostAuthenticationForLocalhost, o->no_host_authentication_for_localhost);
 	dump_cfg_fmtint(oPasswordAuthentication, o->password_authentication);
 	dump_cfg_fmtint(oPermitLocalCommand, o->permit_local_command);
+	dump_cfg_fmtint(oPredictiveEcho, o->predictive_echo);
 	dump_cfg_fmtint(oProxyUseFdpass, o->proxy_use_fdpass);
 	dump_cfg_fmtint(oPubkeyAuthentication, o->pubkey_authentication);
 	dump_cfg_fmtint(oRequestTTY, o->request_tty);
@@ -3431,6 +3491,8 @@ dump_client_config(Options *o, const char *host)
 	dump_cfg_int(oNumberOfPasswordPrompts, o->number_of_password_prompts);
 	dump_cfg_int(oServerAliveCountMax, o->server_alive_count_max);
 	dump_cfg_int(oServerAliveInterval, o->server_alive_interval);
+	dump_cfg_int(oResumeTimeout, o->resume_timeout);
+	dump_cfg_int(oChannelIdleTimeout, o->channel_idle_timeout);
 
 	/* String options */
 	dump_cfg_string(oBindAddress, o->bind_address);
@@ -3458,6 +3520,7 @@ dump_client_config(Options *o, const char *host)
 	dump_cfg_string(oRevokedHostKeys, o->revoked_host_keys);
 	dump_cfg_string(oXAuthLocation, o->xauth_location);
 	dump_cfg_string(oKnownHostsCommand, o->known_hosts_command);
+	dump_cfg_string(oTimingReport, o->timing_report);
 
 	/* Forwards */
 	dump_cfg_forwards(oDynamicForward, o->num_local_forwards, o->local_forwards);
@@ -133,6 +133,7 @@ typedef struct {
 	int	identities_only;
 	int	server_alive_interval;
 	int	server_alive_count_max;
+	int	channel_idle_timeout;
 
 	int     num_send_env;
 	char   **send_env;
@@ -156,6 +157,7 @@ typedef struct {
 	int	visual_host_key;
 
 	int	request_tty;
+	int	predictive_echo;
 	int	session_type;
 	int	stdin_null;
 	int	fork_after_authentication;
@@ -185,6 +187,8 @@ typedef struct {
 	char   *jump_extra;
 
 	char   *known_hosts_command;
+	char   *timing_report;	/* "json:path" or "text:path" */
+	int	resume_timeout;	/* reconnect to a dropped session for */
 
 	char	*ignored_unknown; /* Pattern list of unknown tokens to ignore */
 }       Options;
@@ -209,6 +213,10 @@ typedef struct {
 #define REQUEST_TTY_YES		2
 #define REQUEST_TTY_FORCE	3
 
+#define PREDICTIVE_ECHO_NO	0
+#define PREDICTIVE_ECHO_YES	1	/* only on high-latency links */
+#define PREDICTIVE_ECHO_ALWAYS	2
+
 #define SESSION_TYPE_NONE	0
 #define SESSION_TYPE_SUBSYSTEM	1
 #define SESSION_TYPE_DEFAULT	2
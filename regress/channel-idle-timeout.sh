@@ -0,0 +1,69 @@
+#	Placed in the Public Domain.
+
+tid="channel idle timeout"
+
+cp $OBJ/sshd_proxy $OBJ/sshd_proxy.orig
+
+# A session that moves no data is closed; its pty goes away and the
+# shell is killed, so ssh exits before the command would have finished.
+verbose "test $tid: server closes idle pty session"
+(cat $OBJ/sshd_proxy.orig; echo "ChannelIdleTimeout 2") > $OBJ/sshd_proxy
+s=`date +%s`
+${SSH} -F $OBJ/ssh_proxy -tt somehost "sleep 20; echo done" \
+    </dev/null >$OBJ/idle.out 2>/dev/null
+e=`date +%s`
+test $((e - s)) -lt 15 || fail "idle session not closed after $((e - s))s"
+grep done $OBJ/idle.out >/dev/null && fail "idle session ran to completion"
+
+verbose "test $tid: client closes idle pty session"
+cp $OBJ/sshd_proxy.orig $OBJ/sshd_proxy
+s=`date +%s`
+${SSH} -F $OBJ/ssh_proxy -oChannelIdleTimeout=2 -tt somehost \
+    "sleep 20; echo done" </dev/null >$OBJ/idle.out 2>/dev/null
+e=`date +%s`
+test $((e - s)) -lt 15 || fail "idle session not closed after $((e - s))s"
+
+# A session that keeps sending less often than the timeout stays up.
+verbose "test $tid: active session survives"
+(cat $OBJ/sshd_proxy.orig; echo "ChannelIdleTimeout 3") > $OBJ/sshd_proxy
+n=`${SSH} -F $OBJ/ssh_proxy somehost \
+    "for i in 1 2 3 4 5 6; do sleep 1; echo x; done" | wc -l`
+test "$n" -eq 6 || fail "active session got $n lines, expected 6"
+
+# Channels shrink their window after 30 seconds of inactivity and grow it
+# again for the next transfer.  Going through that twice must not lose
+# data, and the server must never grant more window than its current
+# maximum.
+verbose "test $tid: transfers across idle periods"
+cp $OBJ/sshd_proxy.orig $OBJ/sshd_proxy
+for i in 1 2 3 4 5 6 7 8; do cat $DATA; done >$OBJ/idle.data
+start_sshd
+(cat $OBJ/idle.data; sleep 32; cat $OBJ/idle.data; sleep 32;
+    cat $OBJ/idle.data) | \
+    ${SSH} -F $OBJ/ssh_config somehost cat >$OBJ/idle.out ||
+	fail "transfer across idle periods failed"
+cat $OBJ/idle.data $OBJ/idle.data $OBJ/idle.data | cmp -s - $OBJ/idle.out ||
+	fail "corrupted transfer across idle periods"
+grep "idle, shrinking" $TEST_SSHD_LOGFILE >/dev/null ||
+	fail "server did not shrink the idle channel"
+awk '
+	/idle, shrinking buffers and window/ { max = $NF }
+	/Window growth to/ {
+		for (i = 1; i < NF; i++)
+			if ($i == "to")
+				max = $(i + 1)
+	}
+	/ sent adjust / && max != "" {
+		for (i = 1; i < NF; i++)
+			if ($i == "window")
+				w = $(i + 1)
+		if (w + $NF > max + 0) {
+			print "window " w " + " $NF " > " max
+			bad = 1
+		}
+	}
+	END { exit bad }' $TEST_SSHD_LOGFILE >>$TEST_REGRESS_LOGFILE ||
+	fail "server granted more than its maximum window"
+
+rm -f $OBJ/idle.out $OBJ/idle.data
+cp $OBJ/sshd_proxy.orig $OBJ/sshd_proxy
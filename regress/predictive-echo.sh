@@ -0,0 +1,58 @@
+#	Placed in the Public Domain.
+
+tid="predictive echo"
+
+if ! config_defined HAVE_OPENPTY && [ "x$SUDO" = "x" ]; then
+	echo "skipped (no openpty(3) and SUDO not set)"
+	exit 0
+fi
+
+READY=$OBJ/echo.ready
+
+# Once the remote end is reading, type "abcdef" one key at a time, slower
+# than the echo comes back.
+typekeys() {
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		test -f $READY && break
+		sleep 1
+	done
+	for k in a b c d e f; do
+		printf $k
+		sleep 0.3
+	done
+	sleep 1
+}
+
+# Reads six keys without the tty echoing them and echoes them itself,
+# the last three in upper case.
+REMOTE="stty raw -echo; touch $READY; "'i=0; while [ $i -lt 6 ]; do
+	k=`dd bs=1 count=1 2>/dev/null`
+	if [ $i -lt 3 ]; then printf %s "$k"; else printf %s "$k" | tr a-z A-Z; fi
+	i=`expr $i + 1`
+done'
+
+for mode in no always; do
+	verbose "$tid: PredictiveEcho=$mode with a verbatim echo"
+	rm -f $OBJ/echo.out $READY
+	typekeys | ${SSH} -tt -F $OBJ/ssh_proxy -oPredictiveEcho=$mode \
+	    -vvv -E $OBJ/echo.log somehost \
+	    "stty raw -echo; touch $READY; dd bs=1 count=6 2>/dev/null" \
+	    > $OBJ/echo.out || fail "ssh failed with PredictiveEcho=$mode"
+	# Anything the remote shell printed on starting up comes first
+	test "`tail -c 6 $OBJ/echo.out`" = "abcdef" ||
+		fail "PredictiveEcho=$mode: output \"`cat $OBJ/echo.out`\""
+	if [ $mode = always ]; then
+		grep "drew 1 of 1 predicted bytes" $OBJ/echo.log >/dev/null ||
+			fail "nothing was predicted"
+	fi
+done
+
+verbose "$tid: mispredictions are erased"
+printf 'abcd\b \bDEF' > $OBJ/echo.exp
+rm -f $OBJ/echo.out $READY
+typekeys | ${SSH} -ttq -F $OBJ/ssh_proxy -oPredictiveEcho=always somehost \
+    "$REMOTE" > $OBJ/echo.out || fail "ssh failed"
+tail -c 10 $OBJ/echo.out | cmp -s - $OBJ/echo.exp ||
+	fail "mismatch not erased: `tail -c 16 $OBJ/echo.out | od -An -tx1`"
+
+rm -f $OBJ/echo.out $OBJ/echo.exp $OBJ/echo.log $READY
@@ -0,0 +1,64 @@
+#	Placed in the Public Domain.
+
+tid="prewarm control masters"
+
+if config_defined DISABLE_FD_PASSING ; then
+	echo "skipped (not supported on this platform)"
+	exit 0
+fi
+
+make_tmpdir
+CTL=${SSH_REGRESS_TMP}/ctl-%n
+HOSTS="host1 host2 host3 host4"
+
+stop_masters() {
+	for h in $HOSTS host5 host6 host8; do
+		${SSH} -F $OBJ/ssh_config -S $CTL -Oexit $h >/dev/null 2>&1
+	done
+}
+trap 'stop_masters' EXIT
+
+check_master() {
+	${SSH} -F $OBJ/ssh_config -S $CTL -Ocheck $1 >/dev/null 2>&1 ||
+		fail "no master for $1"
+	r=`${SSH} -F $OBJ/ssh_config -S $CTL $1 echo ok`
+	test "$r" = "ok" || fail "command through $1 master failed"
+}
+
+start_sshd
+
+${SSH} -F $OBJ/ssh_config -S $CTL -O prewarm $HOSTS ||
+	fail "prewarm failed"
+for h in $HOSTS; do
+	check_master $h
+done
+
+verbose "prewarm destinations from stdin, some already running"
+printf "host1\n\n  host5	# comment\n" | \
+    ${SSH} -F $OBJ/ssh_config -S $CTL -O prewarm - ||
+	fail "prewarm from stdin failed"
+check_master host1
+check_master host5
+
+verbose "prewarm reports unreachable destinations"
+${SSH} -F $OBJ/ssh_config -S $CTL -O prewarm host6 ssh://host7:1 \
+    2>/dev/null && fail "prewarm of an unreachable host succeeded"
+check_master host6
+${SSH} -F $OBJ/ssh_config -S $CTL -Ocheck host7 >/dev/null 2>&1 &&
+	fail "master running for unreachable host"
+
+verbose "prewarm starts repeated destinations once"
+${SSH} -F $OBJ/ssh_config -S $CTL -O prewarm host8 host8 host8 ||
+	fail "prewarm of a repeated destination failed"
+check_master host8
+
+verbose "prewarm honours ControlMaster from the configuration"
+(printf "Host host9\n\tControlMaster no\n"; cat $OBJ/ssh_config) \
+    > $OBJ/ssh_config.prewarm
+${SSH} -F $OBJ/ssh_config.prewarm -S $CTL -O prewarm host9 2>/dev/null &&
+	fail "prewarm ignored ControlMaster no"
+${SSH} -F $OBJ/ssh_config -S $CTL -Ocheck host9 >/dev/null 2>&1 &&
+	fail "master running despite ControlMaster no"
+
+stop_masters
+trap - EXIT
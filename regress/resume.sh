@@ -0,0 +1,72 @@
+#	Placed in the Public Domain.
+
+tid="session resumption"
+
+# Sessions listen in a directory that only a privileged sshd creates
+if [ -z "$SUDO" -a "x$USER" != "xroot" ]; then
+	skip "need SUDO to run sshd as root"
+fi
+
+# The client reaches sshd through a netcat relay, which we kill to drop
+# the connection and then restart for the client to reconnect through.
+RPORT=`expr $PORT + 1`
+relay_pids=""
+
+start_relay() {
+	rm -f $OBJ/resume.in $OBJ/resume.back
+	mkfifo $OBJ/resume.in $OBJ/resume.back || fatal "mkfifo failed"
+	# Open the FIFOs in an order that can't deadlock
+	$NC -l 127.0.0.1 $RPORT >$OBJ/resume.in <$OBJ/resume.back &
+	relay_pids="$!"
+	$NC 127.0.0.1 $PORT <$OBJ/resume.in >$OBJ/resume.back &
+	relay_pids="$relay_pids $!"
+	sleep 1
+}
+
+stop_relay() {
+	kill $relay_pids 2>/dev/null
+	wait $relay_pids 2>/dev/null
+	relay_pids=""
+}
+trap 'stop_relay' EXIT
+
+echo "ResumeTimeout 30" >> $OBJ/sshd_config
+start_sshd
+
+i=1
+while [ $i -le 10 ]; do
+	echo "line $i"
+	i=`expr $i + 1`
+done > $OBJ/resume.expect
+
+start_relay
+${SSH} -F $OBJ/ssh_config -oPort=$RPORT -oResumeTimeout=30 somehost \
+    'i=1; while [ $i -le 10 ]; do echo "line $i"; i=`expr $i + 1`;
+    sleep 1; done' > $OBJ/resume.out &
+ssh_pid=$!
+sleep 3
+test -s $OBJ/resume.out || fail "no output before the drop"
+stop_relay
+start_relay
+wait $ssh_pid || fail "ssh failed"
+cmp $OBJ/resume.expect $OBJ/resume.out >/dev/null ||
+	fail "output differs after resumption"
+grep "Session resumed from" $TEST_SSHD_LOGFILE >/dev/null ||
+	fail "session was not resumed"
+
+verbose "session not resumed once the server has given up"
+stop_sshd
+sed 's/^ResumeTimeout .*/ResumeTimeout 2/' $OBJ/sshd_config > \
+    $OBJ/sshd_config.resume
+mv $OBJ/sshd_config.resume $OBJ/sshd_config
+start_sshd
+start_relay
+${SSH} -F $OBJ/ssh_config -oPort=$RPORT -oResumeTimeout=30 somehost \
+    'sleep 3; echo done' > $OBJ/resume.out 2>/dev/null &
+ssh_pid=$!
+sleep 1
+stop_relay
+sleep 4
+start_relay
+wait $ssh_pid && fail "ssh survived an expired session"
+stop_relay
@@ -0,0 +1,66 @@
+#	Placed in the Public Domain.
+
+tid="scp directory read-ahead"
+
+WALK=${OBJ}/scp-walk
+WALK2=${OBJ}/scp-walk2
+
+cp ${SRC}/scp-ssh-wrapper.sh ${OBJ}/scp-ssh-wrapper.scp
+chmod 755 ${OBJ}/scp-ssh-wrapper.scp
+export SCP # used in scp-ssh-wrapper.scp
+
+rm -rf ${WALK} ${WALK2}
+mkdir -p ${WALK} || fatal "mkdir ${WALK}"
+top=`cd ${WALK} && pwd -P`
+
+# Descend until a child's path can just reach PATH_MAX (4096 with the NUL)
+long=`printf '%0200d' 0 | tr 0 d`
+deep=${top}
+while test `expr ${#deep} + 220` -lt 4095 ; do
+	deep=${deep}/${long}
+done
+mkdir -p ${deep} || fatal "mkdir ${deep}"
+
+# Directories scp must skip, ahead of ones it must send
+pad=`expr 4095 - ${#deep} - 1 - 3`
+fill=`printf "%0${pad}d" 0 | tr 0 x`
+i=100
+while test $i -lt 250 ; do
+	mkdir ${deep}/${fill}$i || fatal "mkdir overlong $i"
+	i=`expr $i + 1`
+done
+i=0
+while test $i -lt 40 ; do
+	mkdir ${deep}/ok$i && echo $i > ${deep}/ok$i/file ||
+	    fatal "mkdir ok$i"
+	i=`expr $i + 1`
+done
+
+for mode in scp sftp ; do
+	if test $mode = scp ; then
+		scpopts="-O -S ${OBJ}/scp-ssh-wrapper.scp"
+	else
+		scpopts="-s -D ${SFTPSERVER}"
+	fi
+
+	verbose "$tid: $mode mode skips overlong names"
+	rm -rf ${WALK2}
+	${SCP} ${scpopts} -vvv -r ${top} somehost:${WALK2} \
+	    >${OBJ}/scp-walk.log 2>&1
+	sent=${WALK2}${deep#${top}}
+	i=0
+	while test $i -lt 40 ; do
+		cmp ${deep}/ok$i/file ${sent}/ok$i/file ||
+		    fail "$mode mode: ok$i not copied"
+		i=`expr $i + 1`
+	done
+
+	# Skipped directories must not use up the read-ahead
+	n=`grep -c 'reading .*ok[0-9]*" on demand' ${OBJ}/scp-walk.log`
+	if test $n -gt 10 ; then
+		fail "$mode mode: read-ahead stalled ($n listings on demand)"
+	fi
+done
+
+rm -rf ${WALK} ${WALK2} ${OBJ}/scp-walk.log
+rm -f ${OBJ}/scp-ssh-wrapper.scp
@@ -88,6 +88,28 @@ for mode in scp sftp ; do
 	$SCP $scpopts -r somehost:${DIR} ${DIR2} || fail "copy failed"
 	diff ${DIFFOPT} ${DIR} ${DIR2} || fail "corrupted copy"
 
+	verbose "$tag: verified copy local file to remote file"
+	scpclean
+	$SCP $scpopts -V ${DATA} somehost:${COPY} || fail "copy failed"
+	cmp ${DATA} ${COPY} || fail "corrupted copy"
+
+	verbose "$tag: verified recursive remote dir to local dir"
+	scpclean
+	rm -rf ${DIR2}
+	cp ${DATA} ${DIR}/copy
+	echo a > ${DIR}/small
+	$SCP $scpopts -V -r somehost:${DIR} ${DIR2} || fail "copy failed"
+	diff ${DIFFOPT} ${DIR} ${DIR2} || fail "corrupted copy"
+
+	if test $mode = scp ; then
+		verbose "$tag: verified resume of a partial copy"
+		scpclean
+		dd if=${DATA} of=${COPY} bs=1024 count=100 >/dev/null 2>&1
+		$SCP $scpopts -Z -V ${DATA} somehost:${COPY} ||
+		    fail "copy failed"
+		cmp ${DATA} ${COPY} || fail "corrupted copy"
+	fi
+
 	verbose "$tag: shell metacharacters"
 	scpclean
 	(cd ${DIR} && \
@@ -0,0 +1,85 @@
+#	Placed in the Public Domain.
+
+tid="sftp in process"
+
+BIGDATA=${OBJ}/bigdata
+rm -rf ${COPY} ${COPY}.1 ${COPY}.dd ${BIGDATA}
+
+# Several MB with a ragged tail so reads end mid-buffer.
+for i in 1 2 3 4 5 6 7 8; do cat $DATA; done > ${BIGDATA}
+echo tail >> ${BIGDATA}
+
+start_sshd -oInProcessSftp=yes -oForceCommand="internal-sftp"
+
+for B in 0 5000 32000 ; do
+	for R in 1 4 64 ; do
+		verbose "test $tid: buffer_size $B num_requests $R"
+		rm -f ${COPY} ${COPY}.1
+		opts=""
+		test "$B" != "0" && opts="-B $B"
+		${SFTP} -S "$SSH" -F $OBJ/ssh_config $opts -R $R -b - host \
+		    >>$TEST_REGRESS_LOGFILE 2>&1 <<EOF
+get ${BIGDATA} ${COPY}
+put ${COPY} ${COPY}.1
+EOF
+		test $? -eq 0 || fail "sftp failed B $B R $R"
+		cmp ${BIGDATA} ${COPY} || fail "corrupted get B $B R $R"
+		cmp ${BIGDATA} ${COPY}.1 || fail "corrupted put B $B R $R"
+	done
+done
+
+verbose "test $tid: directory operations"
+${SFTP} -S "$SSH" -F $OBJ/ssh_config -b - host \
+    >>$TEST_REGRESS_LOGFILE 2>&1 <<EOF
+mkdir ${COPY}.dd
+rename ${COPY}.1 ${COPY}.dd/moved
+ls -l ${COPY}.dd
+rm ${COPY}.dd/moved
+rmdir ${COPY}.dd
+EOF
+test $? -eq 0 || fail "directory operations failed"
+test -e ${COPY}.dd && fail "directory still exists"
+
+grep "running internal-sftp in process" $TEST_SSHD_LOGFILE >/dev/null || \
+	fail "internal-sftp did not run in process"
+
+if ! config_defined DISABLE_FD_PASSING ; then
+	verbose "test $tid: malformed request ends only its session"
+	make_tmpdir
+	CTL=${SSH_REGRESS_TMP}/ctl-sock
+	${SSH} -Nn2 -MS$CTL -F $OBJ/ssh_config somehost \
+	    -E $TEST_REGRESS_LOGFILE 2>&1 &
+	SSH_PID=$!
+	for i in 1 2 3 4 5 6 7 8 9; do
+		${SSH} -F $OBJ/ssh_config -S $CTL -Ocheck somehost \
+		    >/dev/null 2>&1 && break
+		sleep $i
+	done
+	# SSH2_FXP_INIT, then an SSH2_FXP_OPEN (id 1) cut off in its path
+	printf '\000\000\000\005\001\000\000\000\003' > ${COPY}.req
+	printf '\000\000\000\011\003\000\000\000\001\000\000\000\144' \
+	    >> ${COPY}.req
+	${SSH} -F $OBJ/ssh_config -S $CTL -s somehost sftp \
+	    < ${COPY}.req > ${COPY}.rep 2>>$TEST_REGRESS_LOGFILE
+	# SSH2_FXP_STATUS for id 1 with SSH2_FX_BAD_MESSAGE
+	od -An -tx1 ${COPY}.rep | tr -d ' \n' | \
+	    grep '650000000100000005' >/dev/null ||
+		fail "no SSH2_FX_BAD_MESSAGE reply"
+	${SSH} -F $OBJ/ssh_config -S $CTL -Ocheck somehost \
+	    >/dev/null 2>&1 || fail "connection lost"
+	echo "ls ${OBJ}" | ${SFTP} -S "$SSH" -F $OBJ/ssh_config \
+	    -oControlPath=$CTL -b - host >>$TEST_REGRESS_LOGFILE 2>&1 ||
+		fail "sftp after malformed request failed"
+	${SSH} -F $OBJ/ssh_config -S $CTL -Oexit somehost >/dev/null 2>&1
+	wait $SSH_PID
+	SSH_PID=""
+	grep "process_open: parse" $TEST_SSHD_LOGFILE >/dev/null ||
+		fail "malformed request not logged"
+	grep "fatal" $TEST_SSHD_LOGFILE >/dev/null &&
+		fail "sshd died on malformed request"
+	rm -f ${COPY}.req ${COPY}.rep
+fi
+
+stop_sshd
+
+rm -rf ${COPY} ${COPY}.1 ${COPY}.dd ${BIGDATA}
@@ -0,0 +1,46 @@
+#	Placed in the Public Domain.
+
+tid="sshd stats socket"
+
+cp $OBJ/sshd_config $OBJ/sshd_config.orig
+
+stats() {
+	$NC -U $OBJ/sshd.stats </dev/null
+}
+
+verbose "text statistics"
+echo "StatsSocket $OBJ/sshd.stats" >> $OBJ/sshd_config
+start_sshd
+for i in 1 2; do
+	${SSH} -F $OBJ/ssh_config somehost true || fail "ssh $i failed"
+done
+stats > $OBJ/stats.out
+grep '^sshd_connections_total 2$' $OBJ/stats.out >/dev/null ||
+	fail "connections not counted"
+grep '^sshd_accept_to_fork_seconds_count 2$' $OBJ/stats.out >/dev/null ||
+	fail "accept time not counted"
+grep '^sshd_handshake_seconds_count{kex="[a-z0-9@.-]*"} 2$' \
+    $OBJ/stats.out >/dev/null || fail "handshake not counted"
+grep '^sshd_auth_seconds_count{method="publickey",result="success"} 2$' \
+    $OBJ/stats.out >/dev/null || fail "authentication not counted"
+rm -f $OBJ/stats-key*
+${SSHKEYGEN} -q -t ed25519 -N '' -f $OBJ/stats-key || fatal "ssh-keygen failed"
+grep -vi '^IdentityFile' $OBJ/ssh_config > $OBJ/ssh_config.stats
+${SSH} -F $OBJ/ssh_config.stats -i $OBJ/stats-key -oBatchMode=yes \
+    somehost true 2>/dev/null && fail "ssh with unknown key succeeded"
+stats | grep '^sshd_auth_seconds_count{method="[a-z]*",result="failure"}' \
+    >/dev/null || fail "failed authentication not counted"
+stop_sshd
+
+verbose "json statistics"
+cp $OBJ/sshd_config.orig $OBJ/sshd_config
+echo "StatsSocket json:$OBJ/sshd.stats" >> $OBJ/sshd_config
+start_sshd
+${SSH} -F $OBJ/ssh_config somehost true || fail "ssh failed"
+stats | grep '^{"connections":1,' >/dev/null || fail "bad json statistics"
+stop_sshd
+
+test -S $OBJ/sshd.stats && fail "stats socket left behind"
+
+cp $OBJ/sshd_config.orig $OBJ/sshd_config
+rm -f $OBJ/stats.out $OBJ/stats-key* $OBJ/ssh_config.stats
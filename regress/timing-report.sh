@@ -0,0 +1,43 @@
+#	Placed in the Public Domain.
+
+tid="connection timing report"
+
+rm -f $OBJ/timing.out
+
+verbose "json report"
+${SSH} -F $OBJ/ssh_proxy -oTimingReport=json:$OBJ/timing.out somehost true ||
+	fail "ssh with TimingReport failed"
+for p in config banner kex hostkey auth session; do
+	grep "\"phase\":\"$p\"" $OBJ/timing.out >/dev/null ||
+		fail "json report missing phase $p"
+done
+grep '"complete":true' $OBJ/timing.out >/dev/null ||
+	fail "json report not complete"
+
+verbose "reports are appended"
+${SSH} -F $OBJ/ssh_proxy -oTimingReport=json:$OBJ/timing.out somehost true ||
+	fail "ssh with TimingReport failed"
+test `wc -l < $OBJ/timing.out` -eq 2 || fail "report not appended"
+
+verbose "tokens and environment variables in the path"
+rm -f $OBJ/timing-somehost.out
+TIMING_DIR=$OBJ ${SSH} -F $OBJ/ssh_proxy \
+    -oTimingReport='text:${TIMING_DIR}/timing-%n.out' somehost true ||
+	fail "ssh with TimingReport failed"
+grep "^Connection timing for" $OBJ/timing-somehost.out >/dev/null ||
+	fail "report path not expanded"
+rm -f $OBJ/timing-somehost.out
+
+verbose "failed authentication"
+rm -f $OBJ/timing.out
+${SSH} -F $OBJ/ssh_proxy -oTimingReport=text:$OBJ/timing.out \
+    -oBatchMode=yes -oPubkeyAuthentication=no somehost true 2>/dev/null &&
+	fail "ssh without authentication succeeded"
+grep "(incomplete)" $OBJ/timing.out >/dev/null ||
+	fail "text report not marked incomplete"
+
+verbose "invalid setting"
+${SSH} -F $OBJ/ssh_proxy -oTimingReport=yes somehost true 2>/dev/null &&
+	fail "invalid TimingReport accepted"
+
+rm -f $OBJ/timing.out
@@ -0,0 +1,129 @@
+/*
+ * Regress test for the multithreaded AES ciphers
+ *
+ * Placed in the public domain
+ */
+
+#include "includes.h"
+
+#include <sys/types.h>
+#include <stdio.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "../test_helper/test_helper.h"
+
+#include "cipher.h"
+#include "sshbuf.h"
+#include "ssherr.h"
+#include "xmalloc.h"
+
+void cipher_mt_tests(void);
+
+#define NPKTS		300
+#define AADLEN		4
+#define MAXLEN		(40 * 1024)
+
+/*
+ * Packet lengths that grow past a keystream queue, shrink back to
+ * keystrokes and jump again before the queues have caught up.
+ */
+static u_int
+pkt_len(u_int i)
+{
+	static const u_int edges[] = {
+		16, 32, 35008, 33280, 33296, 16, 48, 16, 32768, 64
+	};
+
+	if (i < sizeof(edges) / sizeof(*edges))
+		return edges[i];
+	if (i % 50 == 0)
+		return 32768;
+	if (i % 7 == 0)
+		return 16 * (1 + arc4random_uniform(MAXLEN / 16));
+	return 16 * (1 + arc4random_uniform(4));
+}
+
+static struct sshcipher_ctx *
+init_cipher(const struct sshcipher *c, const u_char *key, const u_char *iv,
+    int encrypt, int post_auth)
+{
+	struct sshcipher_ctx *cc = NULL;
+
+	ASSERT_INT_EQ(cipher_init(&cc, c, key, cipher_keylen(c), iv,
+	    cipher_ivlen(c), encrypt, post_auth), 0);
+	ASSERT_PTR_NE(cc, NULL);
+	return cc;
+}
+
+/* MT output and tags must be those of libcrypto's own AES-GCM */
+static void
+test_gcm(const char *name)
+{
+	const struct sshcipher *c;
+	struct sshcipher_ctx *evp, *mt, *mtdec;
+	u_char key[32], iv[16], *src, *want, *got, *plain;
+	u_int i, len, authlen;
+
+	ASSERT_PTR_NE(c = cipher_by_name(name), NULL);
+	authlen = cipher_authlen(c);
+	ASSERT_U_INT_EQ(authlen, 16);
+	arc4random_buf(key, sizeof(key));
+	arc4random_buf(iv, sizeof(iv));
+	src = xmalloc(AADLEN + MAXLEN + authlen);
+	want = xmalloc(AADLEN + MAXLEN + authlen);
+	got = xmalloc(AADLEN + MAXLEN + authlen);
+	plain = xmalloc(AADLEN + MAXLEN + authlen);
+
+	evp = init_cipher(c, key, iv, CIPHER_ENCRYPT, 0);
+	mt = init_cipher(c, key, iv, CIPHER_ENCRYPT, 1);
+	mtdec = init_cipher(c, key, iv, CIPHER_DECRYPT, 1);
+	for (i = 0; i < NPKTS; i++) {
+		len = pkt_len(i);
+		POKE_U32(src, len);
+		arc4random_buf(src + AADLEN, len);
+		ASSERT_INT_EQ(cipher_crypt(evp, i, want, src, len,
+		    AADLEN, authlen), 0);
+		ASSERT_INT_EQ(cipher_crypt(mt, i, got, src, len,
+		    AADLEN, authlen), 0);
+		ASSERT_MEM_EQ(got, want, AADLEN + len + authlen);
+		ASSERT_INT_EQ(cipher_crypt(mtdec, i, plain, got, len,
+		    AADLEN, authlen), 0);
+		ASSERT_MEM_EQ(plain, src, AADLEN + len);
+	}
+
+	/* and a bad tag must still be caught */
+	len = pkt_len(NPKTS);
+	POKE_U32(src, len);
+	arc4random_buf(src + AADLEN, len);
+	ASSERT_INT_EQ(cipher_crypt(mt, NPKTS, got, src, len,
+	    AADLEN, authlen), 0);
+	got[AADLEN + len] ^= 0x01;
+	ASSERT_INT_EQ(cipher_crypt(mtdec, NPKTS, plain, got, len,
+	    AADLEN, authlen), SSH_ERR_MAC_INVALID);
+
+	cipher_free(evp);
+	cipher_free(mt);
+	cipher_free(mtdec);
+	free(src);
+	free(want);
+	free(got);
+	free(plain);
+}
+
+void
+cipher_mt_tests(void)
+{
+#if defined(WITH_OPENSSL) && OPENSSL_VERSION_NUMBER >= 0x30000000UL
+	TEST_START("aes128-gcm MT matches EVP");
+	test_gcm("aes128-gcm@openssh.com");
+	TEST_DONE();
+
+	TEST_START("aes256-gcm MT matches EVP");
+	test_gcm("aes256-gcm@openssh.com");
+	TEST_DONE();
+#endif
+}
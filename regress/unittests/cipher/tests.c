@@ -0,0 +1,13 @@
+/*
+ * Placed in the public domain
+ */
+
+#include "../test_helper/test_helper.h"
+
+void cipher_mt_tests(void);
+
+void
+tests(void)
+{
+	cipher_mt_tests();
+}
@@ -0,0 +1,256 @@
+/*
+ * Regress test for the SSHFP answer cache
+ *
+ * Placed in the public domain
+ */
+
+#include "includes.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../test_helper/test_helper.h"
+
+#include "sshkey.h"
+#include "dns.h"
+#include "xmalloc.h"
+
+void sshfp_cache_tests(void);
+
+static char tmpdir[] = "/tmp/sshfp_cache.XXXXXXXXXX";
+static char *cache_path;
+
+static void
+write_cache(const char *contents, mode_t mode)
+{
+	FILE *f;
+
+	ASSERT_PTR_NE(f = fopen(cache_path, "w"), NULL);
+	ASSERT_INT_EQ(fputs(contents, f) >= 0, 1);
+	ASSERT_INT_EQ(fclose(f), 0);
+	ASSERT_INT_EQ(chmod(cache_path, mode), 0);
+}
+
+static char *
+read_cache(void)
+{
+	FILE *f;
+	char *buf;
+	size_t len;
+
+	buf = xcalloc(1, 4096);
+	ASSERT_PTR_NE(f = fopen(cache_path, "r"), NULL);
+	len = fread(buf, 1, 4095, f);
+	buf[len] = '\0';
+	fclose(f);
+	return buf;
+}
+
+static struct rrsetinfo *
+make_rrset(u_int flags, u_int ttl)
+{
+	struct rrsetinfo *rrset;
+
+	rrset = xcalloc(1, sizeof(*rrset));
+	rrset->rri_flags = flags;
+	rrset->rri_rdclass = DNS_RDATACLASS_IN;
+	rrset->rri_rdtype = DNS_RDATATYPE_SSHFP;
+	rrset->rri_ttl = ttl;
+	return rrset;
+}
+
+static void
+add_rdata(struct rrsetinfo *rrset, const u_char *data, size_t len)
+{
+	struct rdatainfo *rdi;
+
+	rrset->rri_rdatas = xrecallocarray(rrset->rri_rdatas,
+	    rrset->rri_nrdatas, rrset->rri_nrdatas + 1,
+	    sizeof(*rrset->rri_rdatas));
+	rdi = &rrset->rri_rdatas[rrset->rri_nrdatas++];
+	rdi->rdi_length = len;
+	rdi->rdi_data = xmalloc(len);
+	memcpy(rdi->rdi_data, data, len);
+}
+
+static void
+test_parse(void)
+{
+	struct rrsetinfo *rrset;
+	const u_char want0[] = { 4, 2, 0x0a, 0x0b, 0x0c };
+	const u_char want1[] = { 1, 1, 0xff };
+
+	TEST_START("sshfp_cache parse");
+	write_cache(
+	    "# not an entry\n"
+	    "\n"
+	    "host.example 9999999999 1 4 2 0a0b0c\n"
+	    "other.example 9999999999 1 4 2 00\n"
+	    "host.example 9999999999 1 4 2 0a0\n"	/* odd length */
+	    "host.example 9999999999 1 4 2 zz\n"	/* not hex */
+	    "host.example 9999999999 1 300 2 00\n"	/* bad algorithm */
+	    "host.example 9999999999 2 4 2 00\n"	/* bad flag */
+	    "host.example 9999999999 4 2 0a0b\n"	/* old format */
+	    "HOST.EXAMPLE 9999999999 1 1 1 ff\n", 0600);
+	ASSERT_INT_EQ(sshfp_cache_lookup("host.example", &rrset), 0);
+	ASSERT_PTR_NE(rrset, NULL);
+	ASSERT_U_INT_EQ(rrset->rri_flags & RRSET_VALIDATED, RRSET_VALIDATED);
+	ASSERT_U_INT_EQ(rrset->rri_rdtype, DNS_RDATATYPE_SSHFP);
+	ASSERT_STRING_EQ(rrset->rri_name, "host.example");
+	ASSERT_U_INT_EQ(rrset->rri_nrdatas, 2);
+	ASSERT_U_INT_EQ(rrset->rri_rdatas[0].rdi_length, sizeof(want0));
+	ASSERT_MEM_EQ(rrset->rri_rdatas[0].rdi_data, want0, sizeof(want0));
+	ASSERT_U_INT_EQ(rrset->rri_rdatas[1].rdi_length, sizeof(want1));
+	ASSERT_MEM_EQ(rrset->rri_rdatas[1].rdi_data, want1, sizeof(want1));
+	freerrset(rrset);
+	ASSERT_INT_EQ(sshfp_cache_lookup("missing.example", &rrset), -1);
+	ASSERT_PTR_EQ(rrset, NULL);
+	ASSERT_INT_EQ(sshfp_cache_lookup("bad host", &rrset), -1);
+	TEST_DONE();
+
+	TEST_START("sshfp_cache unvalidated entries");
+	write_cache(
+	    "host.example 9999999999 1 4 2 00\n"
+	    "host.example 9999999999 0 1 2 01\n", 0600);
+	ASSERT_INT_EQ(sshfp_cache_lookup("host.example", &rrset), 0);
+	ASSERT_U_INT_EQ(rrset->rri_nrdatas, 2);
+	ASSERT_U_INT_EQ(rrset->rri_flags & RRSET_VALIDATED, 0);
+	freerrset(rrset);
+	TEST_DONE();
+
+	TEST_START("sshfp_cache file permissions");
+	write_cache("host.example 9999999999 1 4 2 00\n", 0620);
+	ASSERT_INT_EQ(sshfp_cache_lookup("host.example", &rrset), -1);
+	ASSERT_INT_EQ(chmod(cache_path, 0602), 0);
+	ASSERT_INT_EQ(sshfp_cache_lookup("host.example", &rrset), -1);
+	ASSERT_INT_EQ(chmod(cache_path, 0644), 0);
+	ASSERT_INT_EQ(sshfp_cache_lookup("host.example", &rrset), 0);
+	freerrset(rrset);
+	TEST_DONE();
+}
+
+static void
+test_expiry(void)
+{
+	struct rrsetinfo *rrset;
+	char *buf;
+	long long now = time(NULL);
+
+	TEST_START("sshfp_cache expiry");
+	xasprintf(&buf,
+	    "host.example %lld 1 4 2 01\n"
+	    "host.example %lld 1 4 2 02\n", now - 1, now);
+	write_cache(buf, 0600);
+	free(buf);
+	ASSERT_INT_EQ(sshfp_cache_lookup("host.example", &rrset), -1);
+
+	xasprintf(&buf,
+	    "host.example %lld 1 4 2 01\n"
+	    "host.example %lld 1 4 2 02\n", now - 1, now + 100);
+	write_cache(buf, 0600);
+	free(buf);
+	ASSERT_INT_EQ(sshfp_cache_lookup("host.example", &rrset), 0);
+	ASSERT_U_INT_EQ(rrset->rri_nrdatas, 1);
+	ASSERT_U_INT_EQ(rrset->rri_rdatas[0].rdi_data[2], 2);
+	ASSERT_U_INT_LE(rrset->rri_ttl, 100);
+	ASSERT_U_INT_GE(rrset->rri_ttl, 90);
+	freerrset(rrset);
+	TEST_DONE();
+}
+
+static void
+test_store(void)
+{
+	struct rrsetinfo *rrset, *got;
+	const u_char fp0[] = { 4, 2, 0xde, 0xad };
+	const u_char fp1[] = { 1, 1, 0xbe, 0xef, 0x01 };
+	const u_char runt[] = { 4 };
+	char *buf, *contents;
+	long long now = time(NULL);
+
+	TEST_START("sshfp_cache_store replaces and prunes");
+	xasprintf(&buf,
+	    "old.example %lld 1 4 2 01\n"
+	    "keep.example %lld 1 4 2 02\n"
+	    "host.example %lld 1 4 2 03\n", now - 1, now + 1000, now + 1000);
+	write_cache(buf, 0600);
+	free(buf);
+	rrset = make_rrset(RRSET_VALIDATED, 300);
+	add_rdata(rrset, fp0, sizeof(fp0));
+	add_rdata(rrset, runt, sizeof(runt));
+	add_rdata(rrset, fp1, sizeof(fp1));
+	sshfp_cache_store("host.example", rrset);
+	freerrset(rrset);
+	contents = read_cache();
+	ASSERT_PTR_EQ(strstr(contents, "old.example"), NULL);
+	ASSERT_PTR_NE(strstr(contents, "keep.example"), NULL);
+	ASSERT_PTR_EQ(strstr(contents, " 03\n"), NULL);
+	ASSERT_PTR_NE(strstr(contents, " 1 4 2 dead\n"), NULL);
+	ASSERT_PTR_NE(strstr(contents, " 1 1 1 beef01\n"), NULL);
+	free(contents);
+	ASSERT_INT_EQ(sshfp_cache_lookup("host.example", &got), 0);
+	ASSERT_U_INT_EQ(got->rri_flags & RRSET_VALIDATED, RRSET_VALIDATED);
+	ASSERT_U_INT_EQ(got->rri_nrdatas, 2);
+	ASSERT_MEM_EQ(got->rri_rdatas[0].rdi_data, fp0, sizeof(fp0));
+	ASSERT_MEM_EQ(got->rri_rdatas[1].rdi_data, fp1, sizeof(fp1));
+	ASSERT_U_INT_LE(got->rri_ttl, 300);
+	ASSERT_U_INT_GE(got->rri_ttl, 290);
+	freerrset(got);
+	TEST_DONE();
+
+	TEST_START("sshfp_cache_store keeps the validation bit");
+	rrset = make_rrset(0, 300);
+	add_rdata(rrset, fp0, sizeof(fp0));
+	sshfp_cache_store("insecure.example", rrset);
+	freerrset(rrset);
+	ASSERT_INT_EQ(sshfp_cache_lookup("insecure.example", &got), 0);
+	ASSERT_U_INT_EQ(got->rri_flags & RRSET_VALIDATED, 0);
+	freerrset(got);
+	ASSERT_INT_EQ(sshfp_cache_lookup("host.example", &got), 0);
+	ASSERT_U_INT_EQ(got->rri_flags & RRSET_VALIDATED, RRSET_VALIDATED);
+	freerrset(got);
+	TEST_DONE();
+
+	TEST_START("sshfp_cache_store caps the TTL");
+	rrset = make_rrset(RRSET_VALIDATED, 7 * 24 * 60 * 60);
+	add_rdata(rrset, fp1, sizeof(fp1));
+	sshfp_cache_store("long.example", rrset);
+	freerrset(rrset);
+	ASSERT_INT_EQ(sshfp_cache_lookup("long.example", &got), 0);
+	ASSERT_U_INT_LE(got->rri_ttl, 24 * 60 * 60);
+	freerrset(got);
+	TEST_DONE();
+
+	TEST_START("sshfp_cache_store ignores zero TTLs");
+	rrset = make_rrset(RRSET_VALIDATED, 0);
+	add_rdata(rrset, fp1, sizeof(fp1));
+	sshfp_cache_store("zero.example", rrset);
+	freerrset(rrset);
+	ASSERT_INT_EQ(sshfp_cache_lookup("zero.example", &got), -1);
+	TEST_DONE();
+}
+
+void
+sshfp_cache_tests(void)
+{
+	ASSERT_PTR_NE(mkdtemp(tmpdir), NULL);
+	xasprintf(&cache_path, "%s/sshfp_cache", tmpdir);
+	dns_set_sshfp_cache(cache_path);
+
+	test_parse();
+	test_expiry();
+	test_store();
+
+	dns_set_sshfp_cache(NULL);
+	unlink(cache_path);
+	rmdir(tmpdir);
+	free(cache_path);
+}
@@ -0,0 +1,13 @@
+/*
+ * Placed in the public domain
+ */
+
+#include "../test_helper/test_helper.h"
+
+void sshfp_cache_tests(void);
+
+void
+tests(void)
+{
+	sshfp_cache_tests();
+}
@@ -22,8 +22,11 @@
 #include "sshbuf.h"
 #include "packet.h"
 #include "myproposal.h"
+#include "log.h"
+#include "xmalloc.h"
 
 void kex_tests(void);
+void kex_benchmarks(void);
 static int do_debug = 0;
 
 static int
@@ -206,3 +209,59 @@ kex_tests(void)
 # endif /* USE_SNTRUP761X25519 */
 #endif /* WITH_OPENSSL */
 }
+
+/* One full key exchange per operation: client rekeys an established pair */
+static void
+bench_kex(char *kex)
+{
+	struct ssh *client = NULL, *server = NULL;
+	struct sshkey *private, *public;
+	struct kex_params kex_params;
+	char *myproposal[PROPOSAL_MAX] = { KEX_CLIENT };
+	char *bname;
+
+	ASSERT_INT_EQ(sshkey_generate(KEY_ED25519, 256, &private), 0);
+	ASSERT_INT_EQ(sshkey_from_private(private, &public), 0);
+	memcpy(kex_params.proposal, myproposal, sizeof(myproposal));
+	kex_params.proposal[PROPOSAL_KEX_ALGS] = kex;
+	kex_params.proposal[PROPOSAL_SERVER_HOST_KEY_ALGS] = "ssh-ed25519";
+	ASSERT_INT_EQ(ssh_init(&client, 0, &kex_params), 0);
+	ASSERT_INT_EQ(ssh_init(&server, 1, &kex_params), 0);
+	ASSERT_INT_EQ(ssh_add_hostkey(server, private), 0);
+	ASSERT_INT_EQ(ssh_add_hostkey(client, public), 0);
+	run_kex(client, server);
+
+	xasprintf(&bname, "kex %s", kex);
+	BENCH_START(bname);
+	ASSERT_INT_EQ(kex_send_kexinit(client), 0);
+	run_kex(client, server);
+	BENCH_DONE();
+	free(bname);
+
+	sshkey_free(private);
+	sshkey_free(public);
+	ssh_free(client);
+	ssh_free(server);
+}
+
+void
+kex_benchmarks(void)
+{
+	/* Keep the per-kex "Ltype" logit() lines out of the results */
+	log_init("test_kex", SYSLOG_LEVEL_ERROR, SYSLOG_FACILITY_USER, 1);
+
+	bench_kex("curve25519-sha256@libssh.org");
+#ifdef WITH_OPENSSL
+#ifdef OPENSSL_HAS_ECC
+	bench_kex("ecdh-sha2-nistp256");
+	bench_kex("ecdh-sha2-nistp384");
+	bench_kex("ecdh-sha2-nistp521");
+#endif /* OPENSSL_HAS_ECC */
+	bench_kex("diffie-hellman-group-exchange-sha256");
+	bench_kex("diffie-hellman-group14-sha256");
+	bench_kex("diffie-hellman-group16-sha512");
+# ifdef USE_SNTRUP761X25519
+	bench_kex("sntrup761x25519-sha512@openssh.com");
+# endif /* USE_SNTRUP761X25519 */
+#endif /* WITH_OPENSSL */
+}
@@ -6,9 +6,14 @@
 #include "../test_helper/test_helper.h"
 
 void kex_tests(void);
+void kex_benchmarks(void);
 
 void
 tests(void)
 {
+	if (test_is_benchmark()) {
+		kex_benchmarks();
+		return;
+	}
 	kex_tests();
 }
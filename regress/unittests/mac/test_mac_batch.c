@@ -0,0 +1,238 @@
+/*
+ * Regress test for batched MAC computation
+ *
+ * Placed in the public domain
+ */
+
+#include "includes.h"
+
+#include <sys/types.h>
+#include <stdio.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "../test_helper/test_helper.h"
+
+#include "digest.h"
+#include "hmac.h"
+#include "mac.h"
+#include "ssherr.h"
+#include "xmalloc.h"
+
+void mac_batch_tests(void);
+void mac_batch_benchmarks(void);
+
+#define NJOBS		37
+#define MAXLEN		(35 * 1024)
+
+static const char *batch_macs[] = {
+	"hmac-sha2-256",
+	"hmac-sha2-512",
+	"hmac-sha2-256-etm@openssh.com",
+	"hmac-sha2-512-etm@openssh.com",
+	"hmac-sha1",
+	"umac-64-etm@openssh.com",
+	NULL
+};
+
+static void
+mac_setup_key(struct sshmac *mac, const char *name, u_char *key)
+{
+	memset(mac, 0, sizeof(*mac));
+	ASSERT_INT_EQ(mac_setup(mac, (char *)name), 0);
+	arc4random_buf(key, mac->key_len);
+	mac->key = key;
+	ASSERT_INT_EQ(mac_init(mac), 0);
+}
+
+/* Job lengths that straddle the block, padding and length boundaries */
+static size_t
+job_len(u_int i)
+{
+	static const size_t edges[] = {
+		0, 1, 51, 52, 55, 56, 59, 60, 64, 111, 112, 119, 120, 124, 128
+	};
+
+	if (i < sizeof(edges) / sizeof(*edges))
+		return edges[i];
+	return arc4random_uniform(MAXLEN);
+}
+
+static void
+test_batch(const char *name)
+{
+	struct sshmac mac;
+	struct sshmac_job jobs[NJOBS];
+	u_char key[128], *data, *got, *want;
+	u_int i, n;
+
+	mac_setup_key(&mac, name, key);
+	data = xmalloc(MAXLEN);
+	arc4random_buf(data, MAXLEN);
+	got = xcalloc(NJOBS, mac.mac_len);
+	want = xcalloc(NJOBS, mac.mac_len);
+	for (i = 0; i < NJOBS; i++) {
+		jobs[i].seqno = arc4random();
+		jobs[i].len = job_len(i);
+		jobs[i].data = data + arc4random_uniform(MAXLEN -
+		    jobs[i].len + 1);
+		jobs[i].digest = got + i * mac.mac_len;
+		ASSERT_INT_EQ(mac_compute(&mac, jobs[i].seqno, jobs[i].data,
+		    (int)jobs[i].len, want + i * mac.mac_len,
+		    mac.mac_len), 0);
+	}
+	/* every batch size up to more than MAC_BATCH_MAX */
+	for (n = 1; n <= NJOBS; n++) {
+		memset(got, 0, NJOBS * mac.mac_len);
+		ASSERT_INT_EQ(mac_compute_batch(&mac, jobs, n), 0);
+		ASSERT_MEM_EQ(got, want, n * mac.mac_len);
+		ASSERT_MEM_FILLED_EQ(got + n * mac.mac_len, 0,
+		    (NJOBS - n) * mac.mac_len);
+	}
+	free(data);
+	free(got);
+	free(want);
+	mac_clear(&mac);
+}
+
+/* RFC 4231 test cases 2 and 6; the first four bytes go in head */
+static void
+test_rfc4231(int alg, const u_char *expect2, const u_char *expect6)
+{
+	struct ssh_hmac_mb_ctx *ctx;
+	struct ssh_hmac_mb_job job;
+	const char *data2 = "what do ya want for nothing?";
+	const char *data6 =
+	    "Test Using Larger Than Block-Size Key - Hash Key First";
+	u_char key6[131], out[SSH_DIGEST_MAX_LENGTH];
+	size_t dlen = ssh_digest_bytes(alg);
+
+	if ((ctx = ssh_hmac_mb_start(alg)) == NULL)
+		return;
+	memset(&job, 0, sizeof(job));
+	job.out = out;
+	job.outlen = sizeof(out);
+
+	ASSERT_INT_EQ(ssh_hmac_mb_init(ctx, "Jefe", 4), 0);
+	memcpy(job.head, data2, 4);
+	job.data = (const u_char *)data2 + 4;
+	job.len = strlen(data2) - 4;
+	ASSERT_INT_EQ(ssh_hmac_mb_compute(ctx, &job, 1), 0);
+	ASSERT_MEM_EQ(out, expect2, dlen);
+
+	memset(key6, 0xaa, sizeof(key6));
+	ASSERT_INT_EQ(ssh_hmac_mb_init(ctx, key6, sizeof(key6)), 0);
+	memcpy(job.head, data6, 4);
+	job.data = (const u_char *)data6 + 4;
+	job.len = strlen(data6) - 4;
+	ASSERT_INT_EQ(ssh_hmac_mb_compute(ctx, &job, 1), 0);
+	ASSERT_MEM_EQ(out, expect6, dlen);
+
+	ssh_hmac_mb_free(ctx);
+}
+
+/* Packet-sized MACs one at a time vs. in batches */
+static void
+bench_mac(const char *name, size_t len)
+{
+	struct sshmac mac;
+	struct sshmac_job jobs[MAC_BATCH_MAX];
+	u_char key[128], *data, digest[MAC_BATCH_MAX][SSH_DIGEST_MAX_LENGTH];
+	char *bname;
+	u_int i, batch, seqno = 0;
+
+	mac_setup_key(&mac, name, key);
+	batch = mac_batch_size(&mac);
+	data = xmalloc(len);
+	arc4random_buf(data, len);
+	for (i = 0; i < MAC_BATCH_MAX; i++) {
+		jobs[i].seqno = i;
+		jobs[i].data = data;
+		jobs[i].len = len;
+		jobs[i].digest = digest[i];
+	}
+
+	xasprintf(&bname, "%s %zu single", name, len);
+	bench_set_bytes(len);
+	BENCH_START(bname);
+	ASSERT_INT_EQ(mac_compute(&mac, seqno++, data, (int)len,
+	    digest[0], sizeof(digest[0])), 0);
+	BENCH_DONE();
+	free(bname);
+
+	xasprintf(&bname, "%s %zu batch %u", name, len, batch);
+	bench_set_bytes(len * batch);
+	BENCH_START(bname);
+	for (i = 0; i < batch; i++)
+		jobs[i].seqno = seqno++;
+	ASSERT_INT_EQ(mac_compute_batch(&mac, jobs, batch), 0);
+	BENCH_DONE();
+	free(bname);
+
+	free(data);
+	mac_clear(&mac);
+}
+
+void
+mac_batch_benchmarks(void)
+{
+	bench_mac("hmac-sha2-256-etm@openssh.com", 1024);
+	bench_mac("hmac-sha2-256-etm@openssh.com", 32 * 1024);
+	bench_mac("hmac-sha2-512-etm@openssh.com", 1024);
+	bench_mac("hmac-sha2-512-etm@openssh.com", 32 * 1024);
+}
+
+void
+mac_batch_tests(void)
+{
+	static const u_char sha256_2[] = {
+		0x5b, 0xdc, 0xc1, 0x46, 0xbf, 0x60, 0x75, 0x4e,
+		0x6a, 0x04, 0x24, 0x26, 0x08, 0x95, 0x75, 0xc7,
+		0x5a, 0x00, 0x3f, 0x08, 0x9d, 0x27, 0x39, 0x83,
+		0x9d, 0xec, 0x58, 0xb9, 0x64, 0xec, 0x38, 0x43
+	};
+	static const u_char sha256_6[] = {
+		0x60, 0xe4, 0x31, 0x59, 0x1e, 0xe0, 0xb6, 0x7f,
+		0x0d, 0x8a, 0x26, 0xaa, 0xcb, 0xf5, 0xb7, 0x7f,
+		0x8e, 0x0b, 0xc6, 0x21, 0x37, 0x28, 0xc5, 0x14,
+		0x05, 0x46, 0x04, 0x0f, 0x0e, 0xe3, 0x7f, 0x54
+	};
+	static const u_char sha512_2[] = {
+		0x16, 0x4b, 0x7a, 0x7b, 0xfc, 0xf8, 0x19, 0xe2,
+		0xe3, 0x95, 0xfb, 0xe7, 0x3b, 0x56, 0xe0, 0xa3,
+		0x87, 0xbd, 0x64, 0x22, 0x2e, 0x83, 0x1f, 0xd6,
+		0x10, 0x27, 0x0c, 0xd7, 0xea, 0x25, 0x05, 0x54,
+		0x97, 0x58, 0xbf, 0x75, 0xc0, 0x5a, 0x99, 0x4a,
+		0x6d, 0x03, 0x4f, 0x65, 0xf8, 0xf0, 0xe6, 0xfd,
+		0xca, 0xea, 0xb1, 0xa3, 0x4d, 0x4a, 0x6b, 0x4b,
+		0x63, 0x6e, 0x07, 0x0a, 0x38, 0xbc, 0xe7, 0x37
+	};
+	static const u_char sha512_6[] = {
+		0x80, 0xb2, 0x42, 0x63, 0xc7, 0xc1, 0xa3, 0xeb,
+		0xb7, 0x14, 0x93, 0xc1, 0xdd, 0x7b, 0xe8, 0xb4,
+		0x9b, 0x46, 0xd1, 0xf4, 0x1b, 0x4a, 0xee, 0xc1,
+		0x12, 0x1b, 0x01, 0x37, 0x83, 0xf8, 0xf3, 0x52,
+		0x6b, 0x56, 0xd0, 0x37, 0xe0, 0x5f, 0x25, 0x98,
+		0xbd, 0x0f, 0xd2, 0x21, 0x5d, 0x6a, 0x1e, 0x52,
+		0x95, 0xe6, 0x4f, 0x73, 0xf6, 0x3f, 0x0a, 0xec,
+		0x8b, 0x91, 0x5a, 0x98, 0x5d, 0x78, 0x65, 0x98
+	};
+	u_int i;
+
+	for (i = 0; batch_macs[i] != NULL; i++) {
+		TEST_START(batch_macs[i]);
+		test_batch(batch_macs[i]);
+		TEST_DONE();
+	}
+
+	TEST_START("hmac_mb rfc4231 sha256");
+	test_rfc4231(SSH_DIGEST_SHA256, sha256_2, sha256_6);
+	TEST_DONE();
+
+	TEST_START("hmac_mb rfc4231 sha512");
+	test_rfc4231(SSH_DIGEST_SHA512, sha512_2, sha512_6);
+	TEST_DONE();
+}
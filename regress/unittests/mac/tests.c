@@ -0,0 +1,18 @@
+/*
+ * Placed in the public domain
+ */
+
+#include "../test_helper/test_helper.h"
+
+void mac_batch_tests(void);
+void mac_batch_benchmarks(void);
+
+void
+tests(void)
+{
+	if (test_is_benchmark()) {
+		mac_batch_benchmarks();
+		return;
+	}
+	mac_batch_tests();
+}
@@ -18,10 +18,53 @@
 #include "../test_helper/test_helper.h"
 
 #include "match.h"
+#include "xmalloc.h"
+
+static void
+bench_pattern_list(const char *name, const char *string, const char *pattern,
+    int dolower, int want)
+{
+	BENCH_START(name);
+	ASSERT_INT_EQ(match_pattern_list(string, pattern, dolower), want);
+	BENCH_DONE();
+}
+
+static void
+match_benchmarks(void)
+{
+	char list[2048], *cp;
+	size_t i;
+
+	bench_pattern_list("match_pattern_list literal", "host.example.com",
+	    "host.example.com", 0, 1);
+	bench_pattern_list("match_pattern_list wildcard",
+	    "host.example.com", "*.example.com", 0, 1);
+	bench_pattern_list("match_pattern_list negated",
+	    "bad.example.com", "*.example.com,!bad.example.com", 0, -1);
+	bench_pattern_list("match_pattern_list dolower",
+	    "host.example.com", "*.EXAMPLE.Com", 1, 1);
+
+	/* The miss walks every entry, as for a long Host line */
+	list[0] = '\0';
+	for (i = 0; i < 64; i++) {
+		xasprintf(&cp, "%shost%zu.*.example.org", i ? "," : "", i);
+		strlcat(list, cp, sizeof(list));
+		free(cp);
+	}
+	bench_pattern_list("match_pattern_list 64 wildcards miss",
+	    "host.example.com", list, 0, 0);
+	bench_pattern_list("match_pattern_list 64 wildcards last",
+	    "host63.a.example.org", list, 0, 1);
+}
 
 void
 tests(void)
 {
+	if (test_is_benchmark()) {
+		match_benchmarks();
+		return;
+	}
+
 	TEST_START("match_pattern");
 	ASSERT_INT_EQ(match_pattern("", ""), 1);
 	ASSERT_INT_EQ(match_pattern("", "aaa"), 0);
@@ -0,0 +1,145 @@
+/*
+ * Benchmarks for sshbuf.h buffer API
+ *
+ * Placed in the public domain
+ */
+
+#include "includes.h"
+
+#include <sys/types.h>
+#include <stdio.h>
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "../test_helper/test_helper.h"
+
+#include "b64.h"
+#include "sshbuf.h"
+
+void sshbuf_benchmarks(void);
+
+static void
+bench_chunk(const char *name, size_t len)
+{
+	struct sshbuf *b;
+	u_char *data;
+
+	ASSERT_PTR_NE(b = sshbuf_new(), NULL);
+	data = malloc(len);
+	ASSERT_PTR_NE(data, NULL);
+	arc4random_buf(data, len);
+	bench_set_bytes(len);
+	BENCH_START(name);
+	ASSERT_INT_EQ(sshbuf_put(b, data, len), 0);
+	ASSERT_INT_EQ(sshbuf_consume(b, len), 0);
+	BENCH_DONE();
+	free(data);
+	sshbuf_free(b);
+}
+
+/* The table/vector codec against the resolver's, on a key-sized blob */
+static void
+bench_b64(size_t len)
+{
+	u_char *data, *dec;
+	char *enc, name[64];
+	size_t elen = (len + 2) / 3 * 4 + 1;
+
+	/* b64_pton writes a byte past a partial one */
+	ASSERT_PTR_NE(data = calloc(1, len), NULL);
+	ASSERT_PTR_NE(dec = malloc(len + 1), NULL);
+	ASSERT_PTR_NE(enc = malloc(elen), NULL);
+	arc4random_buf(data, len);
+
+	snprintf(name, sizeof(name), "b64_ntop %zu", len);
+	bench_set_bytes(len);
+	BENCH_START(name);
+	ASSERT_INT_GE(b64_ntop(data, len, enc, elen), 0);
+	BENCH_DONE();
+	snprintf(name, sizeof(name), "ssh_b64_ntop %zu", len);
+	bench_set_bytes(len);
+	BENCH_START(name);
+	ASSERT_INT_GE(ssh_b64_ntop(data, len, enc, elen), 0);
+	BENCH_DONE();
+	snprintf(name, sizeof(name), "b64_pton %zu", len);
+	bench_set_bytes(len);
+	BENCH_START(name);
+	ASSERT_INT_EQ(b64_pton(enc, dec, len + 1), (int)len);
+	BENCH_DONE();
+	snprintf(name, sizeof(name), "ssh_b64_pton %zu", len);
+	bench_set_bytes(len);
+	BENCH_START(name);
+	ASSERT_INT_EQ(ssh_b64_pton(enc, dec, len + 1), (int)len);
+	BENCH_DONE();
+
+	free(data);
+	free(dec);
+	free(enc);
+}
+
+void
+sshbuf_benchmarks(void)
+{
+	struct sshbuf *b, *s, *sub;
+	const u_char *cp;
+	char *str;
+	u_char data[64];
+	u_int64_t v64;
+	u_int32_t v32;
+	size_t len;
+	u_int i;
+
+	ASSERT_PTR_NE(b = sshbuf_new(), NULL);
+	ASSERT_PTR_NE(s = sshbuf_new(), NULL);
+	arc4random_buf(data, sizeof(data));
+
+	BENCH_START("sshbuf_put_u32/get_u32");
+	ASSERT_INT_EQ(sshbuf_put_u32(b, 0x12345678), 0);
+	ASSERT_INT_EQ(sshbuf_get_u32(b, &v32), 0);
+	BENCH_DONE();
+
+	BENCH_START("sshbuf_put_u64/get_u64");
+	ASSERT_INT_EQ(sshbuf_put_u64(b, 0x123456789abcdef0ULL), 0);
+	ASSERT_INT_EQ(sshbuf_get_u64(b, &v64), 0);
+	BENCH_DONE();
+
+	/* the queue stays non-empty, so every get moves the offset on */
+	for (i = 0; i < 1024; i++)
+		ASSERT_INT_EQ(sshbuf_put_u32(b, i), 0);
+	BENCH_START("sshbuf_put_u32/get_u32 queued");
+	ASSERT_INT_EQ(sshbuf_put_u32(b, 0x12345678), 0);
+	ASSERT_INT_EQ(sshbuf_get_u32(b, &v32), 0);
+	BENCH_DONE();
+	sshbuf_reset(b);
+
+	BENCH_START("sshbuf_put_string/get_string_direct 64");
+	ASSERT_INT_EQ(sshbuf_put_string(b, data, sizeof(data)), 0);
+	ASSERT_INT_EQ(sshbuf_get_string_direct(b, &cp, &len), 0);
+	BENCH_DONE();
+
+	BENCH_START("sshbuf_put_cstring/get_cstring");
+	ASSERT_INT_EQ(sshbuf_put_cstring(b, "hmac-sha2-256-etm"), 0);
+	ASSERT_INT_EQ(sshbuf_get_cstring(b, &str, NULL), 0);
+	free(str);
+	BENCH_DONE();
+
+	ASSERT_INT_EQ(sshbuf_put(s, data, sizeof(data)), 0);
+	BENCH_START("sshbuf_put_stringb/froms 64");
+	ASSERT_INT_EQ(sshbuf_put_stringb(b, s), 0);
+	ASSERT_INT_EQ(sshbuf_froms(b, &sub), 0);
+	sshbuf_free(sub);
+	BENCH_DONE();
+
+	bench_chunk("sshbuf_put/consume 1k", 1024);
+	bench_chunk("sshbuf_put/consume 32k", 32 * 1024);
+	bench_chunk("sshbuf_put/consume 256k", 256 * 1024);
+
+	bench_b64(64);
+	bench_b64(1536);
+
+	sshbuf_free(b);
+	sshbuf_free(s);
+}
@@ -17,11 +17,87 @@
 
 #include "../test_helper/test_helper.h"
 
+#include "b64.h"
 #include "sshbuf.h"
 #include "ssherr.h"
 
 void sshbuf_misc_tests(void);
 
+/* Damage a base64 string with characters the decoder treats specially */
+static void
+b64_mangle(char *s, size_t max)
+{
+	static const char junk[] = " \n\t=A/+#\xa0";
+	size_t len = strlen(s), pos;
+	u_int i, n = arc4random_uniform(4);
+
+	for (i = 0; i < n; i++) {
+		pos = arc4random_uniform(len + 1);
+		switch (arc4random_uniform(3)) {
+		case 0:
+			if (len + 1 >= max)
+				break;
+			memmove(s + pos + 1, s + pos, len - pos + 1);
+			s[pos] = junk[arc4random_uniform(sizeof(junk) - 1)];
+			len++;
+			break;
+		case 1:
+			if (pos < len)
+				s[pos] = junk[arc4random_uniform(sizeof(junk) - 1)];
+			break;
+		case 2:
+			if (pos < len) {
+				memmove(s + pos, s + pos + 1, len - pos);
+				len--;
+			}
+			break;
+		}
+	}
+}
+
+/* The table/vector codec must agree with b64_ntop/b64_pton exactly */
+static void
+b64_compat_tests(void)
+{
+	u_char src[300], d1[400], d2[400];
+	char e1[500], e2[500];
+	size_t n, ts;
+	int r1, r2;
+	u_int i;
+
+	TEST_START("ssh_b64_ntop matches b64_ntop");
+	for (i = 0; i < 20000; i++) {
+		n = arc4random_uniform(sizeof(src));
+		ts = arc4random_uniform(2) ? sizeof(e1) :
+		    arc4random_uniform(sizeof(e1));
+		arc4random_buf(src, n);
+		r1 = b64_ntop(src, n, e1, ts);
+		r2 = ssh_b64_ntop(src, n, e2, ts);
+		ASSERT_INT_EQ(r1, r2);
+		if (r1 >= 0)
+			ASSERT_STRING_EQ(e1, e2);
+	}
+	TEST_DONE();
+
+	TEST_START("ssh_b64_pton matches b64_pton");
+	for (i = 0; i < 20000; i++) {
+		n = arc4random_uniform(sizeof(src));
+		arc4random_buf(src, n);
+		ASSERT_INT_GE(b64_ntop(src, n, e1, sizeof(e1)), 0);
+		b64_mangle(e1, sizeof(e1));
+		ts = arc4random_uniform(3) ? sizeof(d1) :
+		    arc4random_uniform(sizeof(d1));
+		memset(d1, 0xa5, sizeof(d1));
+		memset(d2, 0xa5, sizeof(d2));
+		r1 = b64_pton(e1, d1, ts);
+		r2 = ssh_b64_pton(e1, d2, ts);
+		ASSERT_INT_EQ(r1, r2);
+		ASSERT_MEM_EQ(d1, d2, sizeof(d1));
+		ASSERT_INT_EQ(b64_pton(e1, NULL, 0), ssh_b64_pton(e1, NULL, 0));
+	}
+	TEST_DONE();
+}
+
 void
 sshbuf_misc_tests(void)
 {
@@ -135,6 +211,30 @@ sshbuf_misc_tests(void)
 	sshbuf_free(p1);
 	TEST_DONE();
 
+	TEST_START("sshbuf_dtob64 wrap");
+	for (sz = 50; sz < 160; sz++) {
+		p1 = sshbuf_new();
+		ASSERT_PTR_NE(p1, NULL);
+		ASSERT_INT_EQ(sshbuf_reserve(p1, sz, NULL), 0);
+		arc4random_buf(sshbuf_mutable_ptr(p1), sz);
+		p = sshbuf_dtob64_string(p1, 1);
+		ASSERT_PTR_NE(p, NULL);
+		/* 70 column lines, every one newline terminated */
+		ASSERT_SIZE_T_EQ(strlen(p), ((sz + 2) / 3) * 4 +
+		    (((sz + 2) / 3) * 4 + 69) / 70);
+		ASSERT_INT_EQ(p[strlen(p) - 1], '\n');
+		ASSERT_PTR_EQ(strchr(p, '\n'), ((sz + 2) / 3) * 4 < 70 ?
+		    p + strlen(p) - 1 : p + 70);
+		sshbuf_reset(p1);
+		ASSERT_INT_EQ(sshbuf_b64tod(p1, p), 0);
+		ASSERT_SIZE_T_EQ(sshbuf_len(p1), sz);
+		free(p);
+		sshbuf_free(p1);
+	}
+	TEST_DONE();
+
+	b64_compat_tests();
+
 	TEST_START("sshbuf_dup_string");
 	p1 = sshbuf_new();
 	ASSERT_PTR_NE(p1, NULL);
@@ -14,10 +14,15 @@ void sshbuf_misc_tests(void);
 void sshbuf_fuzz_tests(void);
 void sshbuf_getput_fuzz_tests(void);
 void sshbuf_fixed(void);
+void sshbuf_benchmarks(void);
 
 void
 tests(void)
 {
+	if (test_is_benchmark()) {
+		sshbuf_benchmarks();
+		return;
+	}
 	sshbuf_tests();
 	sshbuf_getput_basic_tests();
 #ifdef WITH_OPENSSL
@@ -0,0 +1,61 @@
+/*
+ * Benchmarks for sshkey.h key parsing
+ *
+ * Placed in the public domain
+ */
+
+#include "includes.h"
+
+#include <sys/types.h>
+#include <stdio.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "../test_helper/test_helper.h"
+
+#include "ssherr.h"
+#include "authfile.h"
+#include "sshkey.h"
+#include "sshbuf.h"
+
+void sshkey_benchmarks(void);
+
+static void
+bench_from_blob(const char *file)
+{
+	struct sshkey *k;
+	struct sshbuf *blob;
+	char name[128];
+
+	ASSERT_INT_EQ(sshkey_load_public(test_data_file(file), &k, NULL), 0);
+	ASSERT_PTR_NE(blob = sshbuf_new(), NULL);
+	ASSERT_INT_EQ(sshkey_putb(k, blob), 0);
+	sshkey_free(k);
+
+	snprintf(name, sizeof(name), "sshkey_from_blob %s", file);
+	BENCH_START(name);
+	ASSERT_INT_EQ(sshkey_from_blob(sshbuf_ptr(blob), sshbuf_len(blob),
+	    &k), 0);
+	sshkey_free(k);
+	BENCH_DONE();
+
+	sshbuf_free(blob);
+}
+
+void
+sshkey_benchmarks(void)
+{
+	bench_from_blob("ed25519_1.pub");
+	bench_from_blob("ed25519_1-cert.pub");
+#ifdef WITH_OPENSSL
+	bench_from_blob("rsa_1.pub");
+	bench_from_blob("rsa_1-cert.pub");
+#ifdef OPENSSL_HAS_ECC
+	bench_from_blob("ecdsa_1.pub");
+	bench_from_blob("ecdsa_1-cert.pub");
+#endif /* OPENSSL_HAS_ECC */
+#endif /* WITH_OPENSSL */
+}
@@ -165,6 +165,42 @@ signature_tests(struct sshkey *k, struct sshkey *bad, const char *sig_alg)
 	}
 }
 
+/* Check sshkey_read_blob() and sshkey_blob_may_equal() on public keys */
+static void
+blob_compare_tests(const char *name, const char *other)
+{
+	struct sshkey *k1, *k2;
+	struct sshbuf *text, *blob, *want;
+	char *cp, path[256];
+
+	snprintf(path, sizeof(path), "%s.pub", name);
+	ASSERT_INT_EQ(sshkey_load_public(test_data_file(path), &k1, NULL), 0);
+	text = load_text_file(path);
+	snprintf(path, sizeof(path), "%s.pub", other);
+	ASSERT_INT_EQ(sshkey_load_public(test_data_file(path), &k2, NULL), 0);
+	ASSERT_PTR_NE(blob = sshbuf_new(), NULL);
+	ASSERT_PTR_NE(want = sshbuf_new(), NULL);
+
+	cp = (char *)sshbuf_mutable_ptr(text);
+	ASSERT_INT_EQ(sshkey_read_blob(blob, &cp), 0);
+	ASSERT_INT_EQ(sshkey_putb(k1, want), 0);
+	ASSERT_INT_EQ(sshkey_blob_may_equal(blob, want), 1);
+	sshbuf_reset(want);
+	ASSERT_INT_EQ(sshkey_putb(k2, want), 0);
+	if (sshkey_is_cert(k1) || sshkey_is_cert(k2)) {
+		/* a certificate may carry the other key; parse to be sure */
+		ASSERT_INT_EQ(sshkey_blob_may_equal(blob, want), 1);
+		ASSERT_INT_EQ(sshkey_blob_may_equal(want, blob), 1);
+	} else
+		ASSERT_INT_EQ(sshkey_blob_may_equal(blob, want), 0);
+
+	sshkey_free(k1);
+	sshkey_free(k2);
+	sshbuf_free(text);
+	sshbuf_free(blob);
+	sshbuf_free(want);
+}
+
 static struct sshkey *
 get_private(const char *n)
 {
@@ -183,6 +219,7 @@ sshkey_tests(void)
 	struct sshkey *k1, *k2, *k3, *kf;
 #ifdef WITH_OPENSSL
 	struct sshkey *k4, *kr, *kd;
+	struct sshbuf *b2, *want;
 #ifdef OPENSSL_HAS_ECC
 	struct sshkey *ke;
 #endif /* OPENSSL_HAS_ECC */
@@ -509,7 +546,42 @@ sshkey_tests(void)
 	sshkey_free(k2);
 	TEST_DONE();
 
+	TEST_START("blob compare ED25519");
+	blob_compare_tests("ed25519_1", "ed25519_2");
+	blob_compare_tests("ed25519_1-cert", "ed25519_2");
+	blob_compare_tests("ed25519_sk1", "ed25519_sk2");
+	TEST_DONE();
+
 #ifdef WITH_OPENSSL
+	TEST_START("blob compare RSA/DSA/ECDSA");
+	blob_compare_tests("rsa_1", "rsa_2");
+	blob_compare_tests("rsa_1", "ed25519_1");
+	blob_compare_tests("dsa_1", "dsa_2");
+#ifdef OPENSSL_HAS_ECC
+	blob_compare_tests("ecdsa_1", "ecdsa_2");
+	blob_compare_tests("ecdsa_sk1", "ecdsa_sk2");
+#endif /* OPENSSL_HAS_ECC */
+	TEST_DONE();
+
+	TEST_START("blob compare non-minimal RSA");
+	ASSERT_INT_EQ(sshkey_load_public(test_data_file("rsa_1.pub"), &k1,
+	    NULL), 0);
+	ASSERT_PTR_NE(b2 = sshbuf_new(), NULL);
+	ASSERT_PTR_NE(want = sshbuf_new(), NULL);
+	ASSERT_INT_EQ(sshkey_putb(k1, want), 0);
+	/* e = 65537 with a needless leading zero */
+	ASSERT_INT_EQ(sshbuf_put_cstring(b2, "ssh-rsa"), 0);
+	ASSERT_INT_EQ(sshbuf_put_string(b2, "\0\001\0\001", 4), 0);
+	ASSERT_INT_EQ(sshbuf_put_bignum2(b2, rsa_n(k1)), 0);
+	ASSERT_INT_EQ(sshkey_from_blob(sshbuf_ptr(b2), sshbuf_len(b2), &k2), 0);
+	ASSERT_INT_EQ(sshkey_equal(k1, k2), 1);
+	ASSERT_INT_EQ(sshkey_blob_may_equal(b2, want), 1);
+	sshkey_free(k1);
+	sshkey_free(k2);
+	sshbuf_free(b2);
+	sshbuf_free(want);
+	TEST_DONE();
+
 	TEST_START("nested certificate");
 	ASSERT_INT_EQ(sshkey_load_cert(test_data_file("rsa_1"), &k1), 0);
 	ASSERT_INT_EQ(sshkey_load_public(test_data_file("rsa_1.pub"), &k2,
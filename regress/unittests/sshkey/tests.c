@@ -12,10 +12,15 @@
 void sshkey_tests(void);
 void sshkey_file_tests(void);
 void sshkey_fuzz_tests(void);
+void sshkey_benchmarks(void);
 
 void
 tests(void)
 {
+	if (test_is_benchmark()) {
+		sshkey_benchmarks();
+		return;
+	}
 	sshkey_tests();
 	sshkey_file_tests();
 	sshkey_fuzz_tests();
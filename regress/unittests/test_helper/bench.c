@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2026 Pittsburgh Supercomputing Center. All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Microbenchmark support for regress tests */
+
+#include "includes.h"
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdio.h>
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "test_helper.h"
+
+/*
+ * A benchmark runs its body in batches.  During warmup the batch size is
+ * doubled until one batch takes at least BENCH_BATCH_NSEC, so that clock
+ * overhead and resolution don't matter; each batch after that is one
+ * sample of the time per operation.
+ */
+#define BENCH_BATCH_NSEC	(100 * 1000ULL)
+#define BENCH_MIN_SAMPLES	10
+#define BENCH_MAX_SAMPLES	10000
+
+extern char *__progname;
+
+enum bench_state { BENCH_IDLE, BENCH_WARMUP, BENCH_MEASURE };
+
+static struct {
+	enum bench_state state;
+	char *name;
+	const char *json_path;
+	u_int count;
+	size_t bytes;		/* per operation, for throughput */
+	u_int64_t batch;	/* operations in the current batch */
+	u_int64_t ops;		/* operations measured */
+	u_int64_t warmup_nsec, budget_nsec;
+	u_int64_t phase_start;	/* start of warmup or measurement */
+	u_int64_t batch_start;
+	u_int64_t batch_cycles;
+	double cycles;		/* total over measured batches */
+	double ns[BENCH_MAX_SAMPLES];
+	u_int nsamples;
+} bench;
+
+static u_int64_t
+bench_nsec(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		abort();
+	return (u_int64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Time stamp counter where there is a cheap one, otherwise 0 */
+static u_int64_t
+bench_cycles(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	u_int32_t lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((u_int64_t)hi << 32) | lo;
+#else
+	return 0;
+#endif
+}
+
+void
+bench_init(const char *json_path)
+{
+	bench.json_path = json_path;
+	bench.warmup_nsec = 20 * 1000000ULL;
+	bench.budget_nsec = 250 * 1000000ULL;
+	if (test_is_fast()) {
+		bench.warmup_nsec /= 4;
+		bench.budget_nsec /= 5;
+	}
+	if (test_is_slow()) {
+		bench.warmup_nsec *= 5;
+		bench.budget_nsec *= 8;
+	}
+}
+
+u_int
+bench_count(void)
+{
+	return bench.count;
+}
+
+void
+bench_set_bytes(size_t bytes)
+{
+	bench.bytes = bytes;
+}
+
+void
+bench_start(const char *name)
+{
+	if (bench.state != BENCH_IDLE)
+		abort();
+	test_start(name);
+	if ((bench.name = strdup(name)) == NULL)
+		abort();
+	bench.state = BENCH_WARMUP;
+	bench.batch = 0;
+	bench.ops = 0;
+	bench.cycles = 0;
+	bench.nsamples = 0;
+}
+
+u_int64_t
+bench_batch(void)
+{
+	u_int64_t now = bench_nsec(), cycles = bench_cycles(), elapsed;
+
+	elapsed = now - bench.batch_start;
+	switch (bench.state) {
+	case BENCH_WARMUP:
+		if (bench.batch == 0) {
+			bench.phase_start = now;
+			bench.batch = 1;
+			break;
+		}
+		if (elapsed < BENCH_BATCH_NSEC)
+			bench.batch *= 2;
+		if (now - bench.phase_start < bench.warmup_nsec)
+			break;
+		bench.state = BENCH_MEASURE;
+		bench.phase_start = bench_nsec();
+		break;
+	case BENCH_MEASURE:
+		bench.ns[bench.nsamples++] = (double)elapsed / bench.batch;
+		bench.ops += bench.batch;
+		bench.cycles += cycles - bench.batch_cycles;
+		if (bench.nsamples >= BENCH_MAX_SAMPLES ||
+		    (bench.nsamples >= BENCH_MIN_SAMPLES &&
+		    now - bench.phase_start >= bench.budget_nsec))
+			return 0;
+		break;
+	default:
+		abort();
+	}
+	bench.batch_cycles = bench_cycles();
+	bench.batch_start = bench_nsec();
+	return bench.batch;
+}
+
+static int
+bench_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile of the sorted samples */
+static double
+bench_pct(double p)
+{
+	size_t i = (size_t)(p / 100.0 * bench.nsamples + 0.5);
+
+	if (i > 0)
+		i--;
+	if (i >= bench.nsamples)
+		i = bench.nsamples - 1;
+	return bench.ns[i];
+}
+
+static void
+bench_json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((u_char)*s < 0x20)
+			fprintf(f, "\\u%04x", (u_char)*s);
+		else
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+/* Appends one object per line, so several programs can share a file */
+static void
+bench_json(double mean, double cpo)
+{
+	FILE *f;
+
+	if ((f = fopen(bench.json_path, "a")) == NULL) {
+		fprintf(stderr, "%s: %s\n", bench.json_path, strerror(errno));
+		exit(1);
+	}
+	fprintf(f, "{\"suite\":");
+	bench_json_string(f, __progname);
+	fprintf(f, ",\"name\":");
+	bench_json_string(f, bench.name);
+	fprintf(f, ",\"ops\":%llu,\"samples\":%u,\"batch\":%llu",
+	    (unsigned long long)bench.ops, bench.nsamples,
+	    (unsigned long long)bench.batch);
+	fprintf(f, ",\"ns_per_op\":{\"mean\":%.3f,\"min\":%.3f,"
+	    "\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f}",
+	    mean, bench.ns[0], bench_pct(50), bench_pct(90), bench_pct(99),
+	    bench.ns[bench.nsamples - 1]);
+	if (cpo > 0)
+		fprintf(f, ",\"cycles_per_op\":%.1f", cpo);
+	if (bench.bytes > 0) {
+		fprintf(f, ",\"bytes_per_op\":%zu,\"mb_per_sec\":%.1f",
+		    bench.bytes, bench.bytes * 1000.0 / bench_pct(50));
+	}
+	fprintf(f, "}\n");
+	if (fclose(f) != 0) {
+		fprintf(stderr, "%s: %s\n", bench.json_path, strerror(errno));
+		exit(1);
+	}
+}
+
+void
+bench_done(void)
+{
+	double mean = 0, cpo = 0;
+	u_int i;
+
+	if (bench.state != BENCH_MEASURE || bench.nsamples == 0)
+		abort();
+	for (i = 0; i < bench.nsamples; i++)
+		mean += bench.ns[i];
+	mean /= bench.nsamples;
+	if (bench.cycles > 0)
+		cpo = bench.cycles / bench.ops;
+	qsort(bench.ns, bench.nsamples, sizeof(*bench.ns), bench_cmp);
+
+	if (!test_is_quiet()) {
+		printf("\n  %-44s %11.1f ns/op  p50 %.1f  p90 %.1f  p99 %.1f",
+		    bench.name, mean, bench_pct(50), bench_pct(90),
+		    bench_pct(99));
+		if (cpo > 0)
+			printf("  %.0f cycles/op", cpo);
+		if (bench.bytes > 0)
+			printf("  %.1f MB/s", bench.bytes * 1000.0 /
+			    bench_pct(50));
+	}
+	if (bench.json_path != NULL)
+		bench_json(mean, cpo);
+
+	free(bench.name);
+	bench.name = NULL;
+	bench.bytes = 0;
+	bench.state = BENCH_IDLE;
+	bench.count++;
+	test_done();
+}
@@ -123,11 +123,13 @@ static const char *data_dir = NULL;
 static char subtest_info[512];
 static int fast = 0;
 static int slow = 0;
+static int benchmark_mode = 0;
 
 int
 main(int argc, char **argv)
 {
 	int ch;
+	const char *bench_json_path = NULL;
 
 	seed_rng();
 #ifdef WITH_OPENSSL
@@ -147,8 +149,14 @@ main(int argc, char **argv)
 		}
 	}
 
-	while ((ch = getopt(argc, argv, "Ffvqd:")) != -1) {
+	while ((ch = getopt(argc, argv, "bFfvqd:J:")) != -1) {
 		switch (ch) {
+		case 'b':
+			benchmark_mode = 1;
+			break;
+		case 'J':
+			bench_json_path = optarg;
+			break;
 		case 'F':
 			slow = 1;
 			break;
@@ -168,7 +176,8 @@ main(int argc, char **argv)
 			break;
 		default:
 			fprintf(stderr, "Unrecognised command line option\n");
-			fprintf(stderr, "Usage: %s [-v]\n", __progname);
+			fprintf(stderr, "Usage: %s [-bFfqv] [-d datadir] "
+			    "[-J json_file]\n", __progname);
 			exit(1);
 		}
 	}
@@ -178,9 +187,15 @@ main(int argc, char **argv)
 	if (verbose_mode)
 		printf("\n");
 
+	if (benchmark_mode)
+		bench_init(bench_json_path);
 	tests();
 
-	if (!quiet_mode)
+	if (quiet_mode)
+		return 0;
+	if (benchmark_mode)
+		printf("\n%u benchmarks done\n", bench_count());
+	else
 		printf(" %u tests ok\n", test_number);
 	return 0;
 }
@@ -209,6 +224,12 @@ test_is_slow(void)
 	return slow;
 }
 
+int
+test_is_benchmark(void)
+{
+	return benchmark_mode;
+}
+
 const char *
 test_data_file(const char *name)
 {
@@ -249,7 +270,7 @@ test_start(const char *n)
 	assert(active_test_name == NULL);
 	assert((active_test_name = strdup(n)) != NULL);
 	*subtest_info = '\0';
-	if (verbose_mode)
+	if (verbose_mode && !benchmark_mode)
 		printf("test %u - \"%s\": ", test_number, active_test_name);
 	test_number++;
 #ifdef SIGINFO
@@ -272,6 +293,8 @@ test_done(void)
 	assert(active_test_name != NULL);
 	free(active_test_name);
 	active_test_name = NULL;
+	if (benchmark_mode)
+		return;	/* benchmarks print their own results */
 	if (verbose_mode)
 		printf("OK\n");
 	else if (!quiet_mode) {
@@ -49,6 +49,7 @@ int test_is_verbose(void);
 int test_is_quiet(void);
 int test_is_fast(void);
 int test_is_slow(void);
+int test_is_benchmark(void);
 void test_subtest_info(const char *fmt, ...)
     __attribute__((format(printf, 1, 2)));
 void ssl_err_check(const char *file, int line);
@@ -323,4 +324,38 @@ u_char *fuzz_ptr(struct fuzz *fuzz);
 /* Dump the current fuzz case to stderr */
 void fuzz_dump(struct fuzz *fuzz);
 
+/* Benchmarking support */
+
+/* Set up benchmarking; results are appended to json_path if not NULL */
+void bench_init(const char *json_path);
+
+/* Number of benchmarks run so far */
+u_int bench_count(void);
+
+/* Report throughput for the next benchmark, given the bytes per operation */
+void bench_set_bytes(size_t bytes);
+
+/* Used by BENCH_START/BENCH_DONE */
+void bench_start(const char *name);
+u_int64_t bench_batch(void);
+void bench_done(void);
+
+/*
+ * Time the statements between BENCH_START and BENCH_DONE, which form one
+ * operation.  They are run repeatedly, first to warm up and then in timed
+ * batches, and must not break out of the loop.  Prints the mean and
+ * percentiles of the time per operation and, with -J, appends them to a
+ * JSON Lines file.  Only meaningful when test_is_benchmark() (-b).
+ */
+#define BENCH_START(name) do { \
+		u_int64_t bench_n_; \
+		bench_start(name); \
+		while ((bench_n_ = bench_batch()) != 0) { \
+			for (; bench_n_ > 0; bench_n_--) {
+#define BENCH_DONE() \
+			} \
+		} \
+		bench_done(); \
+	} while (0)
+
 #endif /* _TEST_HELPER_H */
@@ -0,0 +1,829 @@
+/*
+ * Copyright (c) 2026 Pittsburgh Supercomputing Center. All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Session resumption.
+ *
+ * Once authenticated, a client may ask for its session to be made
+ * resumable with a "resume@hpnssh.org" global request.  The server then
+ * listens on a Unix domain socket named after a random session ID, and
+ * replies with that ID, a random token and how long it will wait for the
+ * client to come back.  From then on both packet layers keep what they
+ * write until the peer acknowledges it with "resume-ack@hpnssh.org", and
+ * detach from a failed transport instead of giving up.
+ *
+ * To resume, the client makes a new TCP connection to the same address
+ * and names the session ID, and nothing else, in the comment of its
+ * version banner.  The sshd that accepts it is still privileged: it finds
+ * the session's socket, gets the token from the session and sends the
+ * client a nonce.  The client proves that it holds the token with an HMAC
+ * over the nonce and the number of bytes it has received.  Only then is
+ * the connection passed to the session, which answers with its own offset
+ * and proof, and each side writes again everything after the other's
+ * offset.  This is all below the packet layer, so keys, sequence numbers
+ * and channels simply carry on.  The session itself never waits on a
+ * handoff: it answers each step as poll says it can.
+ *
+ * Sessions listen in RESUME_DIR/<uid>.  RESUME_DIR belongs to root, and
+ * the privileged sshd makes each user's directory as they log in, so no
+ * one else can claim it first.
+ */
+
+#include "includes.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+#include <pwd.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "atomicio.h"
+#include "canohost.h"
+#include "digest.h"
+#include "hmac.h"
+#include "kex.h"
+#include "log.h"
+#include "misc.h"
+#include "monitor_fdpass.h"
+#include "packet.h"
+#include "pathnames.h"
+#include "resume.h"
+#include "ssh.h"
+#include "ssh2.h"
+#include "sshbuf.h"
+#include "ssherr.h"
+#include "version.h"
+#include "xmalloc.h"
+
+#define RESUME_NAME		"resume@hpnssh.org"
+#define RESUME_ACK_NAME		"resume-ack@hpnssh.org"
+#define RESUME_DIR		_PATH_SSH_PIDDIR "/ssh-resume"
+
+#define RESUME_ID_LEN		16
+#define RESUME_TOKEN_LEN	32
+#define RESUME_NONCE_LEN	32
+#define RESUME_MAC_LEN		32	/* HMAC-SHA256 */
+
+/* How long either side waits for the other during the handshake */
+#define RESUME_IO_TIMEOUT_MS	5000
+
+static int resume_active;
+static u_char resume_id[RESUME_ID_LEN];
+static u_char resume_token[RESUME_TOKEN_LEN];
+static int resume_timeout;		/* seconds the server waits */
+static u_int64_t resume_acked;		/* last offset we acknowledged */
+
+/* Server side */
+static int resume_listen_fd = -1;
+static char *resume_path;
+static time_t resume_detached_at;
+
+/* Connections from sshd that are partway through handing a client over */
+static struct resume_pending {
+	int sock;			/* -1 if unused */
+	int have_proof;			/* nonce and offset received */
+	u_char nonce[RESUME_NONCE_LEN];
+	u_int64_t peer_rx;
+	time_t started;
+} resume_pending[RESUME_MAX_PENDING];
+
+/* Client side */
+static struct sockaddr_storage resume_peer;
+static socklen_t resume_peerlen;
+
+/* The rendezvous directory must be private to 'uid' */
+static int
+resume_check_dir(const char *dir, uid_t uid)
+{
+	struct stat st;
+
+	if (lstat(dir, &st) == -1) {
+		error_f("%s: %s", dir, strerror(errno));
+		return -1;
+	}
+	if (!S_ISDIR(st.st_mode) || st.st_uid != uid ||
+	    (st.st_mode & 077) != 0) {
+		error_f("%s: bad ownership or modes", dir);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+resume_mac(const char *label, const u_char *nonce, u_int64_t off,
+    u_char *mac)
+{
+	struct ssh_hmac_ctx *ctx;
+	u_char b[8];
+	int ok;
+
+	POKE_U64(b, off);
+	if ((ctx = ssh_hmac_start(SSH_DIGEST_SHA256)) == NULL)
+		return -1;
+	ok = ssh_hmac_init(ctx, resume_token, sizeof(resume_token)) == 0 &&
+	    ssh_hmac_update(ctx, label, strlen(label)) == 0 &&
+	    ssh_hmac_update(ctx, resume_id, sizeof(resume_id)) == 0 &&
+	    ssh_hmac_update(ctx, nonce, RESUME_NONCE_LEN) == 0 &&
+	    ssh_hmac_update(ctx, b, sizeof(b)) == 0 &&
+	    ssh_hmac_final(ctx, mac, RESUME_MAC_LEN) == 0;
+	ssh_hmac_free(ctx);
+	return ok ? 0 : -1;
+}
+
+/* Read exactly 'len' bytes, waiting no more than RESUME_IO_TIMEOUT_MS */
+static int
+resume_read(int fd, void *buf, size_t len)
+{
+	int ms = RESUME_IO_TIMEOUT_MS;
+	size_t off = 0;
+	ssize_t n;
+
+	while (off < len) {
+		if (waitrfd(fd, &ms) == -1)
+			return -1;
+		if ((n = read(fd, (u_char *)buf + off, len - off)) == -1) {
+			if (errno == EINTR || errno == EAGAIN ||
+			    errno == EWOULDBLOCK)
+				continue;
+			return -1;
+		}
+		if (n == 0) {
+			errno = EPIPE;
+			return -1;
+		}
+		off += n;
+	}
+	return 0;
+}
+
+static int
+resume_write(int fd, const void *buf, size_t len)
+{
+	return atomicio(vwrite, fd, (void *)buf, len) == len ? 0 : -1;
+}
+
+/*
+ * Called by the privileged sshd once a user has logged in: make the
+ * directory their sessions will listen in.
+ */
+void
+resume_prepare_dir(struct passwd *pw)
+{
+	struct stat st;
+	char *dir;
+
+	if (mkdir(RESUME_DIR, 0711) == -1 && errno != EEXIST) {
+		debug_f("mkdir %s: %s", RESUME_DIR, strerror(errno));
+		return;
+	}
+	if (lstat(RESUME_DIR, &st) == -1 || !S_ISDIR(st.st_mode) ||
+	    st.st_uid != 0 || (st.st_mode & 022) != 0) {
+		error_f("%s: bad ownership or modes", RESUME_DIR);
+		return;
+	}
+	xasprintf(&dir, "%s/%lu", RESUME_DIR, (u_long)pw->pw_uid);
+	if (mkdir(dir, 0700) == -1 && errno != EEXIST)
+		error_f("mkdir %s: %s", dir, strerror(errno));
+	else if (lstat(dir, &st) == -1 || !S_ISDIR(st.st_mode))
+		error_f("%s: not a directory", dir);
+	else if ((st.st_uid != pw->pw_uid &&
+	    chown(dir, pw->pw_uid, pw->pw_gid) == -1) ||
+	    ((st.st_mode & 07777) != 0700 && chmod(dir, 0700) == -1))
+		error_f("%s: %s", dir, strerror(errno));
+	free(dir);
+}
+
+/*
+ * Called by the session on a "resume@hpnssh.org" request: start listening
+ * for the connections it may be resumed over, and fill in the reply.
+ */
+int
+resume_server_start(struct ssh *ssh, int timeout, struct sshbuf *resp)
+{
+	char *dir = NULL, *id = NULL;
+	mode_t omask;
+	u_int i;
+	int r, ret = -1;
+
+	if (resume_active) {
+		error_f("session is already resumable");
+		return -1;
+	}
+	arc4random_buf(resume_id, sizeof(resume_id));
+	arc4random_buf(resume_token, sizeof(resume_token));
+	if ((r = sshbuf_put_string(resp, resume_id, sizeof(resume_id))) != 0 ||
+	    (r = sshbuf_put_string(resp, resume_token,
+	    sizeof(resume_token))) != 0 ||
+	    (r = sshbuf_put_u32(resp, timeout)) != 0) {
+		error_fr(r, "compose reply");
+		return -1;
+	}
+
+	xasprintf(&dir, "%s/%lu", RESUME_DIR, (u_long)getuid());
+	if (resume_check_dir(dir, getuid()) != 0)
+		goto out;
+	id = tohex(resume_id, sizeof(resume_id));
+	xasprintf(&resume_path, "%s/%s", dir, id);
+	omask = umask(0177);
+	resume_listen_fd = unix_listener(resume_path, RESUME_MAX_PENDING, 0);
+	umask(omask);
+	if (resume_listen_fd == -1) {
+		free(resume_path);
+		resume_path = NULL;
+		goto out;
+	}
+	(void)fcntl(resume_listen_fd, F_SETFD, FD_CLOEXEC);
+	set_nonblock(resume_listen_fd);
+	for (i = 0; i < RESUME_MAX_PENDING; i++)
+		resume_pending[i].sock = -1;
+	if ((r = ssh_packet_resume_arm(ssh, RESUME_BUFFER_MAX)) != 0) {
+		error_fr(r, "ssh_packet_resume_arm");
+		resume_server_cleanup();
+		goto out;
+	}
+	debug_f("session %s resumable for %d seconds", id, timeout);
+	resume_timeout = timeout;
+	resume_active = 1;
+	ret = 0;
+ out:
+	free(dir);
+	free(id);
+	return ret;
+}
+
+static void
+resume_pending_drop(struct resume_pending *rp)
+{
+	close(rp->sock);
+	rp->sock = -1;
+}
+
+/* Fill in the RESUME_NPOLLFD pollfd entries the session needs */
+void
+resume_server_prepare_poll(struct pollfd *pfd)
+{
+	u_int i;
+
+	pfd[0].fd = resume_listen_fd;
+	pfd[0].events = POLLIN;
+	for (i = 0; i < RESUME_MAX_PENDING; i++) {
+		pfd[i + 1].fd = resume_listen_fd == -1 ?
+		    -1 : resume_pending[i].sock;
+		pfd[i + 1].events = POLLIN;
+	}
+}
+
+/* A privileged sshd has a client that wants to resume this session */
+static void
+resume_server_accept(void)
+{
+	struct resume_pending *rp = NULL;
+	uid_t euid;
+	gid_t egid;
+	u_int i;
+	int sock;
+
+	if ((sock = accept(resume_listen_fd, NULL, NULL)) == -1) {
+		if (errno != EINTR && errno != EAGAIN &&
+		    errno != EWOULDBLOCK && errno != ECONNABORTED)
+			error_f("accept: %s", strerror(errno));
+		return;
+	}
+	if (getpeereid(sock, &euid, &egid) == -1) {
+		error_f("getpeereid: %s", strerror(errno));
+		close(sock);
+		return;
+	}
+	if (euid != 0 && euid != getuid()) {
+		error_f("refusing connection from uid %lu", (u_long)euid);
+		close(sock);
+		return;
+	}
+	set_nonblock(sock);
+	/* A free slot, or else the oldest handoff, which has to go */
+	for (i = 0; i < RESUME_MAX_PENDING; i++) {
+		if (resume_pending[i].sock == -1) {
+			rp = &resume_pending[i];
+			break;
+		}
+		if (rp == NULL || resume_pending[i].started < rp->started)
+			rp = &resume_pending[i];
+	}
+	if (rp->sock != -1) {
+		debug_f("dropping a stalled handoff");
+		resume_pending_drop(rp);
+	}
+	/* sshd checks the client's proof; a new socket takes this at once */
+	if (write(sock, resume_token, sizeof(resume_token)) !=
+	    (ssize_t)sizeof(resume_token)) {
+		debug_f("write: %s", strerror(errno));
+		close(sock);
+		return;
+	}
+	rp->sock = sock;
+	rp->have_proof = 0;
+	rp->started = monotime();
+}
+
+/*
+ * Take the next step of a handoff.  sshd sends the nonce and the client's
+ * offset once it has checked the client's proof, then the connection.
+ * Returns 1 if the session has been resumed over it.
+ */
+static int
+resume_pending_input(struct ssh *ssh, struct resume_pending *rp)
+{
+	u_char buf[RESUME_NONCE_LEN + 8], reply[8 + RESUME_MAC_LEN];
+	u_int64_t rx, peer_rx;
+	char *addr;
+	ssize_t n;
+	int fd, port, r;
+
+	if (!rp->have_proof) {
+		if ((n = read(rp->sock, buf, sizeof(buf))) == -1 &&
+		    (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (n != (ssize_t)sizeof(buf)) {
+			debug_f("handoff failed");
+			resume_pending_drop(rp);
+			return 0;
+		}
+		memcpy(rp->nonce, buf, sizeof(rp->nonce));
+		rp->peer_rx = PEEK_U64(buf + RESUME_NONCE_LEN);
+		rp->have_proof = 1;
+		return 0;
+	}
+	fd = mm_receive_fd(rp->sock);
+	peer_rx = rp->peer_rx;
+	ssh_packet_resume_offsets(ssh, &rx, NULL);
+	POKE_U64(reply, rx);
+	r = resume_mac("server", rp->nonce, rx, reply + 8);
+	resume_pending_drop(rp);
+	if (fd == -1)
+		return 0;
+	if (r != 0) {
+		error_f("resume_mac failed");
+		close(fd);
+		return 0;
+	}
+
+	addr = get_peer_ipaddr(fd);
+	port = get_peer_port(fd);
+	if ((r = ssh_packet_reattach(ssh, fd, peer_rx)) != 0) {
+		logit("Session resumption from %s port %d failed: %s",
+		    addr, port, ssh_err(r));
+		close(fd);
+		free(addr);
+		return 0;
+	}
+	/*
+	 * A new connection takes this much without blocking.  If it
+	 * doesn't, detach again and let the client retry.
+	 */
+	if (write(fd, reply, sizeof(reply)) != (ssize_t)sizeof(reply)) {
+		debug_f("write: %s", strerror(errno));
+		ssh_packet_detach(ssh);
+		free(addr);
+		return 1;
+	}
+	logit("Session resumed from %s port %d", addr, port);
+	resume_detached_at = 0;
+	free(addr);
+	return 1;
+}
+
+/*
+ * Service the entries filled in by resume_server_prepare_poll once poll
+ * returns.  Returns 1 if the session has moved to a new connection.
+ */
+int
+resume_server_after_poll(struct ssh *ssh, struct pollfd *pfd)
+{
+	struct resume_pending *rp;
+	time_t now;
+	u_int i;
+	int resumed = 0;
+
+	if (resume_listen_fd == -1)
+		return 0;
+	now = monotime();
+	for (i = 0; i < RESUME_MAX_PENDING; i++) {
+		rp = &resume_pending[i];
+		if (rp->sock == -1)
+			continue;
+		if (pfd[i + 1].fd == rp->sock && pfd[i + 1].revents != 0)
+			resumed |= resume_pending_input(ssh, rp);
+		else if (now - rp->started > RESUME_IO_TIMEOUT_MS / 1000) {
+			debug_f("handoff timed out");
+			resume_pending_drop(rp);
+		}
+	}
+	if ((pfd[0].revents & (POLLIN|POLLHUP|POLLERR)) != 0)
+		resume_server_accept();
+	return resumed;
+}
+
+/*
+ * Milliseconds left for a detached session to be resumed, or 0 if it is
+ * attached.  Exits once the time is up.
+ */
+int
+resume_server_wait(struct ssh *ssh)
+{
+	time_t now;
+
+	if (!ssh_packet_is_detached(ssh)) {
+		resume_detached_at = 0;
+		return 0;
+	}
+	now = monotime();
+	if (resume_detached_at == 0) {
+		resume_detached_at = now;
+		logit("Connection from %s port %d lost; waiting %d seconds "
+		    "for the session to be resumed", ssh_remote_ipaddr(ssh),
+		    ssh_remote_port(ssh), resume_timeout);
+	}
+	if (now >= resume_detached_at + resume_timeout) {
+		logit("Session not resumed within %d seconds", resume_timeout);
+		cleanup_exit(255);
+	}
+	return (resume_detached_at + resume_timeout - now) * 1000;
+}
+
+void
+resume_server_cleanup(void)
+{
+	u_int i;
+
+	if (resume_listen_fd != -1) {
+		for (i = 0; i < RESUME_MAX_PENDING; i++) {
+			if (resume_pending[i].sock != -1)
+				resume_pending_drop(&resume_pending[i]);
+		}
+		close(resume_listen_fd);
+		resume_listen_fd = -1;
+	}
+	if (resume_path != NULL) {
+		unlink(resume_path);
+		free(resume_path);
+		resume_path = NULL;
+	}
+}
+
+/*
+ * Find the socket of session 'id' in the per-user directories, and the
+ * user it belongs to.
+ */
+static char *
+resume_find(const char *id, uid_t *uidp)
+{
+	struct dirent *dp;
+	struct stat st;
+	const char *errstr;
+	char *dir, *path;
+	long long uid;
+	DIR *d;
+
+	if ((d = opendir(RESUME_DIR)) == NULL)
+		return NULL;
+	while ((dp = readdir(d)) != NULL) {
+		uid = strtonum(dp->d_name, 0, UINT_MAX, &errstr);
+		if (errstr != NULL)
+			continue;
+		xasprintf(&dir, "%s/%s", RESUME_DIR, dp->d_name);
+		xasprintf(&path, "%s/%s", dir, id);
+		if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode) &&
+		    st.st_uid == (uid_t)uid &&
+		    resume_check_dir(dir, (uid_t)uid) == 0) {
+			free(dir);
+			closedir(d);
+			*uidp = (uid_t)uid;
+			return path;
+		}
+		free(dir);
+		free(path);
+	}
+	closedir(d);
+	return NULL;
+}
+
+/*
+ * Called by a new connection's sshd after the banner exchange.  If the
+ * client asked to resume a session and proves it may, pass the connection
+ * to the session and exit.
+ */
+void
+resume_handoff(struct ssh *ssh, int enabled)
+{
+	u_char nonce[RESUME_NONCE_LEN], mac[RESUME_MAC_LEN];
+	u_char proof[8 + RESUME_MAC_LEN], buf[RESUME_NONCE_LEN + 8];
+	char *banner, *cp, *id, *path = NULL;
+	struct sockaddr_un sunaddr;
+	u_int64_t peer_rx;
+	uid_t uid, euid;
+	gid_t egid;
+	int sock, fd, c;
+	size_t i;
+
+	if ((banner = sshbuf_dup_string(ssh->kex->client_version)) == NULL)
+		fatal_f("sshbuf_dup_string failed");
+	if ((cp = strstr(banner, " " RESUME_NAME " ")) == NULL) {
+		free(banner);
+		return;
+	}
+	cp += strlen(" " RESUME_NAME " ");
+	id = strsep(&cp, " ");
+	if (!enabled || !ssh_packet_connection_is_on_socket(ssh)) {
+		logit("Refusing to resume a session for %s port %d: "
+		    "resumption is disabled", ssh_remote_ipaddr(ssh),
+		    ssh_remote_port(ssh));
+		goto out;
+	}
+	if (cp != NULL || strlen(id) != RESUME_ID_LEN * 2 ||
+	    strspn(id, "0123456789abcdef") != RESUME_ID_LEN * 2) {
+		logit("Bad session resumption request from %s port %d",
+		    ssh_remote_ipaddr(ssh), ssh_remote_port(ssh));
+		goto out;
+	}
+	for (i = 0; i < RESUME_ID_LEN; i++) {
+		sscanf(id + i * 2, "%2x", &c);
+		resume_id[i] = c;
+	}
+	if ((path = resume_find(id, &uid)) == NULL) {
+		logit("No session %s to resume for %s port %d", id,
+		    ssh_remote_ipaddr(ssh), ssh_remote_port(ssh));
+		goto out;
+	}
+
+	memset(&sunaddr, 0, sizeof(sunaddr));
+	sunaddr.sun_family = AF_UNIX;
+	if (strlcpy(sunaddr.sun_path, path,
+	    sizeof(sunaddr.sun_path)) >= sizeof(sunaddr.sun_path))
+		fatal_f("path too long: %s", path);
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+		fatal_f("socket: %s", strerror(errno));
+	if (connect(sock, (struct sockaddr *)&sunaddr, sizeof(sunaddr)) == -1) {
+		logit("Cannot reach session %s: %s", id, strerror(errno));
+		goto out;
+	}
+	if (getpeereid(sock, &euid, &egid) == -1 || euid != uid) {
+		logit("Session %s is not owned by uid %lu", id, (u_long)uid);
+		goto out;
+	}
+	if (resume_read(sock, resume_token, sizeof(resume_token)) != 0) {
+		logit("Session %s did not answer: %s", id, strerror(errno));
+		goto out;
+	}
+
+	fd = ssh_packet_get_connection_in(ssh);
+	arc4random_buf(nonce, sizeof(nonce));
+	if (resume_write(fd, nonce, sizeof(nonce)) != 0 ||
+	    resume_read(fd, proof, sizeof(proof)) != 0) {
+		logit("Session resumption from %s port %d failed: %s",
+		    ssh_remote_ipaddr(ssh), ssh_remote_port(ssh),
+		    strerror(errno));
+		goto out;
+	}
+	peer_rx = PEEK_U64(proof);
+	if (resume_mac("client", nonce, peer_rx, mac) != 0 ||
+	    timingsafe_bcmp(mac, proof + 8, sizeof(mac)) != 0) {
+		logit("Session resumption from %s port %d failed: "
+		    "bad proof", ssh_remote_ipaddr(ssh), ssh_remote_port(ssh));
+		goto out;
+	}
+	memcpy(buf, nonce, sizeof(nonce));
+	POKE_U64(buf + RESUME_NONCE_LEN, peer_rx);
+	if (resume_write(sock, buf, sizeof(buf)) != 0 ||
+	    mm_send_fd(sock, fd) == -1)
+		goto out;
+	verbose("Passed connection from %s port %d to session %s",
+	    ssh_remote_ipaddr(ssh), ssh_remote_port(ssh), id);
+	exit(0);
+ out:
+	explicit_bzero(resume_token, sizeof(resume_token));
+	cleanup_exit(255);
+}
+
+/*
+ * Make the session resumable if the server agrees.  We start keeping our
+ * output now, so that nothing we write after asking can be lost.
+ */
+int
+resume_client_request(struct ssh *ssh)
+{
+	int r, fd = ssh_packet_get_connection_in(ssh);
+
+	resume_peerlen = sizeof(resume_peer);
+	if (fd != ssh_packet_get_connection_out(ssh) ||
+	    getpeername(fd, (struct sockaddr *)&resume_peer,
+	    &resume_peerlen) == -1 || (resume_peer.ss_family != AF_INET &&
+	    resume_peer.ss_family != AF_INET6)) {
+		debug("Not connected over TCP; session cannot be resumed");
+		return -1;
+	}
+	if ((r = ssh_packet_resume_arm(ssh, RESUME_BUFFER_MAX)) != 0 ||
+	    (r = sshpkt_start(ssh, SSH2_MSG_GLOBAL_REQUEST)) != 0 ||
+	    (r = sshpkt_put_cstring(ssh, RESUME_NAME)) != 0 ||
+	    (r = sshpkt_put_u8(ssh, 1)) != 0 ||	/* want reply */
+	    (r = sshpkt_send(ssh)) != 0)
+		fatal_fr(r, "send resume request");
+	return 0;
+}
+
+/* Parse the server's acceptance of our request */
+int
+resume_client_start(struct ssh *ssh, int timeout)
+{
+	const u_char *id, *token;
+	size_t idlen, tokenlen;
+	u_int server_timeout;
+	int r;
+
+	if ((r = sshpkt_get_string_direct(ssh, &id, &idlen)) != 0 ||
+	    (r = sshpkt_get_string_direct(ssh, &token, &tokenlen)) != 0 ||
+	    (r = sshpkt_get_u32(ssh, &server_timeout)) != 0 ||
+	    (r = sshpkt_get_end(ssh)) != 0) {
+		error_fr(r, "parse reply");
+		return -1;
+	}
+	if (idlen != sizeof(resume_id) || tokenlen != sizeof(resume_token)) {
+		error_f("bad ID or token length");
+		return -1;
+	}
+	memcpy(resume_id, id, sizeof(resume_id));
+	memcpy(resume_token, token, sizeof(resume_token));
+	resume_timeout = MINIMUM((u_int)timeout, server_timeout);
+	resume_active = 1;
+	debug("Session is resumable for %d seconds", resume_timeout);
+	return 0;
+}
+
+/* Skip the server's version banner and any lines before it */
+static int
+resume_read_banner(int fd)
+{
+	char c, line[4];
+	size_t len;
+	u_int n;
+
+	for (n = 0; n < SSH_MAX_PRE_BANNER_LINES; n++) {
+		for (len = 0; len <= SSH_MAX_BANNER_LEN; len++) {
+			if (resume_read(fd, &c, 1) != 0)
+				return -1;
+			if (c == '\n')
+				break;
+			if (len < sizeof(line))
+				line[len] = c;
+		}
+		if (c != '\n')
+			break;
+		if (len >= sizeof(line) && memcmp(line, "SSH-", 4) == 0)
+			return 0;
+	}
+	errno = EPROTO;
+	return -1;
+}
+
+/*
+ * Returns 0 once resumed over 'fd', -1 if worth trying again or -2 if the
+ * session cannot be resumed at all.
+ */
+static int
+resume_client_handshake(struct ssh *ssh, int fd)
+{
+	u_char nonce[RESUME_NONCE_LEN], mac[RESUME_MAC_LEN];
+	u_char buf[8 + RESUME_MAC_LEN];
+	u_int64_t rx, peer_rx;
+	char *id, *banner;
+	int r;
+
+	id = tohex(resume_id, sizeof(resume_id));
+	xasprintf(&banner, "SSH-2.0-%.100s %s %s\r\n", SSH_RELEASE,
+	    RESUME_NAME, id);
+	free(id);
+	r = resume_write(fd, banner, strlen(banner));
+	free(banner);
+	ssh_packet_resume_offsets(ssh, &rx, NULL);
+	if (r != 0 || resume_read_banner(fd) != 0 ||
+	    resume_read(fd, nonce, sizeof(nonce)) != 0) {
+		debug_f("server: %s", strerror(errno));
+		return -1;
+	}
+	POKE_U64(buf, rx);
+	if (resume_mac("client", nonce, rx, buf + 8) != 0)
+		return -2;
+	if (resume_write(fd, buf, sizeof(buf)) != 0 ||
+	    resume_read(fd, buf, sizeof(buf)) != 0) {
+		debug_f("server: %s", strerror(errno));
+		return -1;
+	}
+	peer_rx = PEEK_U64(buf);
+	if (resume_mac("server", nonce, peer_rx, mac) != 0 ||
+	    timingsafe_bcmp(mac, buf + 8, sizeof(mac)) != 0) {
+		error("Server failed to prove that it holds the session");
+		return -2;
+	}
+	if ((r = ssh_packet_reattach(ssh, fd, peer_rx)) != 0) {
+		error_r(r, "Cannot resume session");
+		return -2;
+	}
+	return 0;
+}
+
+/*
+ * Reconnect to the server after the transport failed, retrying until the
+ * server would have given up on us.  Returns 0 once resumed.
+ */
+int
+resume_client_reconnect(struct ssh *ssh)
+{
+	time_t deadline;
+	int fd, ms, r;
+
+	if (!resume_active)
+		return -1;
+	logit("Connection lost; trying to resume the session for up to "
+	    "%d seconds", resume_timeout);
+	deadline = monotime() + resume_timeout;
+	for (;;) {
+		if ((fd = socket(resume_peer.ss_family, SOCK_STREAM, 0)) == -1) {
+			error_f("socket: %s", strerror(errno));
+			return -1;
+		}
+		ms = RESUME_IO_TIMEOUT_MS;
+		if (timeout_connect(fd, (struct sockaddr *)&resume_peer,
+		    resume_peerlen, &ms) == -1)
+			debug_f("connect: %s", strerror(errno));
+		else if ((r = resume_client_handshake(ssh, fd)) == 0) {
+			logit("Session resumed.");
+			return 0;
+		} else if (r == -2) {
+			close(fd);
+			return -1;
+		}
+		close(fd);
+		if (monotime() >= deadline)
+			return -1;
+		sleep(1);
+	}
+}
+
+/* Tell the peer how far we have got, so it can drop what it is keeping */
+void
+resume_poll(struct ssh *ssh)
+{
+	u_int64_t rx;
+	int r;
+
+	if (!resume_active || ssh_packet_is_detached(ssh))
+		return;
+	ssh_packet_resume_offsets(ssh, &rx, NULL);
+	if (rx - resume_acked < RESUME_BUFFER_MAX / 8)
+		return;
+	if ((r = sshpkt_start(ssh, SSH2_MSG_GLOBAL_REQUEST)) != 0 ||
+	    (r = sshpkt_put_cstring(ssh, RESUME_ACK_NAME)) != 0 ||
+	    (r = sshpkt_put_u8(ssh, 0)) != 0 ||	/* want reply */
+	    (r = sshpkt_put_u64(ssh, rx)) != 0 ||
+	    (r = sshpkt_send(ssh)) != 0)
+		fatal_fr(r, "send ack");
+	resume_acked = rx;
+}
+
+/* Handle a "resume-ack@hpnssh.org" request, after its name and flag */
+int
+resume_input_ack(struct ssh *ssh)
+{
+	u_int64_t rx;
+	int r;
+
+	if ((r = sshpkt_get_u64(ssh, &rx)) != 0 ||
+	    (r = sshpkt_get_end(ssh)) != 0)
+		return r;
+	return ssh_packet_resume_ack(ssh, rx);
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2026 Pittsburgh Supercomputing Center. All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _RESUME_H
+#define _RESUME_H
+
+/*
+ * Session resumption: a client whose TCP connection to the server drops
+ * reconnects and reattaches to its still running session, and each side
+ * sends again whatever the other missed.  See resume.c.
+ */
+
+/* Most unacknowledged output kept for replay before new data is held back */
+#define RESUME_BUFFER_MAX	(32 * 1024 * 1024)
+
+/* Handoffs from sshd a session works on at once */
+#define RESUME_MAX_PENDING	4
+/* pollfd entries for the listener and those handoffs */
+#define RESUME_NPOLLFD		(1 + RESUME_MAX_PENDING)
+
+struct passwd;
+struct pollfd;
+
+/* Server side */
+void	resume_prepare_dir(struct passwd *);
+int	resume_server_start(struct ssh *, int, struct sshbuf *);
+void	resume_server_prepare_poll(struct pollfd *);
+int	resume_server_after_poll(struct ssh *, struct pollfd *);
+int	resume_server_wait(struct ssh *);
+void	resume_server_cleanup(void);
+void	resume_handoff(struct ssh *, int);
+
+/* Client side */
+int	resume_client_request(struct ssh *);
+int	resume_client_start(struct ssh *, int);
+int	resume_client_reconnect(struct ssh *);
+
+/* Both sides */
+void	resume_poll(struct ssh *);
+int	resume_input_ack(struct ssh *);
+
+#endif /* _RESUME_H */
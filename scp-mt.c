@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2026 Pittsburgh Supercomputing Center. All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Threaded read-ahead and write-behind for scp */
+
+#include "includes.h"
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "atomicio.h"
+#include "log.h"
+#include "misc.h"
+#include "xmalloc.h"
+#include "scp-mt.h"
+
+struct scp_slot {
+	u_char *buf;
+	size_t len;
+	int err;		/* errno of a failed read */
+};
+
+/*
+ * Slots are filled at 'head' and drained at 'tail'.  Whoever holds a slot
+ * between the begin and end calls below owns its contents; the lock only
+ * protects the indices and flags.
+ */
+struct scp_ring {
+	int fd;
+	off_t remaining;	/* left for a reader thread to read */
+	size_t bufsize;
+	u_int depth;
+	struct scp_slot *slots;
+	u_int head, tail, filled;
+	int eof;		/* producer has finished */
+	int stop;		/* consumer has finished */
+	int err;		/* first write error of a writer thread */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t tid;
+};
+
+/* Wait for a free slot; NULL if the consumer has gone away */
+static struct scp_slot *
+produce_begin(struct scp_ring *r)
+{
+	struct scp_slot *s = NULL;
+
+	pthread_mutex_lock(&r->lock);
+	while (r->filled == r->depth && !r->stop)
+		pthread_cond_wait(&r->cond, &r->lock);
+	if (!r->stop)
+		s = &r->slots[r->head];
+	pthread_mutex_unlock(&r->lock);
+	return s;
+}
+
+static void
+produce_end(struct scp_ring *r)
+{
+	pthread_mutex_lock(&r->lock);
+	r->head = (r->head + 1) % r->depth;
+	r->filled++;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+}
+
+/* Wait for a filled slot; NULL once the producer is done and all drained */
+static struct scp_slot *
+consume_begin(struct scp_ring *r)
+{
+	struct scp_slot *s = NULL;
+
+	pthread_mutex_lock(&r->lock);
+	while (r->filled == 0 && !r->eof)
+		pthread_cond_wait(&r->cond, &r->lock);
+	if (r->filled != 0)
+		s = &r->slots[r->tail];
+	pthread_mutex_unlock(&r->lock);
+	return s;
+}
+
+static void
+consume_end(struct scp_ring *r)
+{
+	pthread_mutex_lock(&r->lock);
+	r->tail = (r->tail + 1) % r->depth;
+	r->filled--;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+}
+
+static void
+ring_set_flag(struct scp_ring *r, int *flag)
+{
+	pthread_mutex_lock(&r->lock);
+	*flag = 1;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+}
+
+static void *
+reader_thread(void *arg)
+{
+	struct scp_ring *r = arg;
+	struct scp_slot *s;
+	size_t amt;
+
+	while (r->remaining > 0 && (s = produce_begin(r)) != NULL) {
+		amt = MINIMUM((off_t)r->bufsize, r->remaining);
+		s->err = 0;
+		if ((s->len = atomicio(read, r->fd, s->buf, amt)) != amt) {
+			s->err = errno != 0 ? errno : EIO;
+			memset(s->buf + s->len, 0, amt - s->len);
+			s->len = amt;
+		}
+		r->remaining -= amt;
+		produce_end(r);
+		if (s->err != 0)
+			break;
+	}
+	ring_set_flag(r, &r->eof);
+	return NULL;
+}
+
+static void *
+writer_thread(void *arg)
+{
+	struct scp_ring *r = arg;
+	struct scp_slot *s;
+
+	/* After an error keep draining, so the main loop stays in sync */
+	while ((s = consume_begin(r)) != NULL) {
+		if (r->err == 0 &&
+		    atomicio(vwrite, r->fd, s->buf, s->len) != s->len)
+			r->err = errno != 0 ? errno : EIO;
+		consume_end(r);
+	}
+	return NULL;
+}
+
+static void
+ring_destroy(struct scp_ring *r)
+{
+	u_int i;
+
+	for (i = 0; i < r->depth; i++)
+		free(r->slots[i].buf);
+	free(r->slots);
+	pthread_cond_destroy(&r->cond);
+	pthread_mutex_destroy(&r->lock);
+	free(r);
+}
+
+static struct scp_ring *
+ring_start(int fd, off_t len, size_t bufsize, u_int depth,
+    void *(*fn)(void *))
+{
+	struct scp_ring *r;
+	sigset_t all, old;
+	u_int i;
+	int ret;
+
+	r = xcalloc(1, sizeof(*r));
+	r->fd = fd;
+	r->remaining = len;
+	r->bufsize = bufsize;
+	r->depth = depth;
+	r->slots = xcalloc(depth, sizeof(*r->slots));
+	for (i = 0; i < depth; i++)
+		r->slots[i].buf = xmalloc(bufsize);
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+
+	/* Leave signals, e.g. the progress meter's SIGALRM, to the main loop */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	ret = pthread_create(&r->tid, NULL, fn, r);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (ret != 0) {
+		debug_f("pthread_create: %s", strerror(ret));
+		ring_destroy(r);
+		return NULL;
+	}
+	return r;
+}
+
+struct scp_ring *
+scp_ring_reader(int fd, off_t len, size_t bufsize, u_int depth)
+{
+	return ring_start(fd, len, bufsize, depth, reader_thread);
+}
+
+struct scp_ring *
+scp_ring_writer(int fd, size_t bufsize, u_int depth)
+{
+	return ring_start(fd, 0, bufsize, depth, writer_thread);
+}
+
+u_char *
+scp_ring_get(struct scp_ring *r, size_t *lenp, int *errp)
+{
+	struct scp_slot *s;
+
+	if ((s = consume_begin(r)) == NULL)
+		fatal_f("read past end of file");
+	*lenp = s->len;
+	*errp = s->err;
+	return s->buf;
+}
+
+void
+scp_ring_release(struct scp_ring *r)
+{
+	consume_end(r);
+}
+
+u_char *
+scp_ring_buf(struct scp_ring *r)
+{
+	struct scp_slot *s;
+
+	if ((s = produce_begin(r)) == NULL)
+		fatal_f("writer stopped");
+	return s->buf;
+}
+
+void
+scp_ring_commit(struct scp_ring *r, size_t len)
+{
+	r->slots[r->head].len = len;
+	produce_end(r);
+}
+
+int
+scp_ring_free(struct scp_ring *r)
+{
+	int err;
+
+	if (r == NULL)
+		return 0;
+	/* A reader stops at its next buffer; a writer drains what's queued */
+	ring_set_flag(r, &r->stop);
+	ring_set_flag(r, &r->eof);
+	pthread_join(r->tid, NULL);
+	err = r->err;
+	ring_destroy(r);
+	return err;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2026 Pittsburgh Supercomputing Center. All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _SCP_MT_H
+#define _SCP_MT_H
+
+/*
+ * A ring of buffers between the scp main loop and a thread doing the file
+ * I/O, so that disk and network transfers overlap.
+ *
+ * A reader ring has the thread read a file ahead of the main loop, which
+ * takes each filled buffer with scp_ring_get() and hands it back with
+ * scp_ring_release().  A writer ring has the main loop fill buffers from
+ * scp_ring_buf() and pass them to scp_ring_commit(), while the thread
+ * writes them out behind it.
+ *
+ * Both constructors return NULL if the thread can't be started, in which
+ * case the caller should do the I/O itself.
+ */
+struct scp_ring;
+
+struct scp_ring *scp_ring_reader(int fd, off_t len, size_t bufsize,
+    u_int depth);
+struct scp_ring *scp_ring_writer(int fd, size_t bufsize, u_int depth);
+
+/*
+ * Next buffer read from the file, with its length.  After a read error
+ * *errp is set and the rest of the buffer is zeroed; no more follow.
+ */
+u_char *scp_ring_get(struct scp_ring *, size_t *lenp, int *errp);
+void scp_ring_release(struct scp_ring *);
+
+/* Next free buffer to fill, and queue the first 'len' bytes of it */
+u_char *scp_ring_buf(struct scp_ring *);
+void scp_ring_commit(struct scp_ring *, size_t len);
+
+/*
+ * Stop a reader, or let a writer finish writing, and free the ring.
+ * Returns the errno of the first failed write, or 0.
+ */
+int scp_ring_free(struct scp_ring *);
+
+#endif /* _SCP_MT_H */
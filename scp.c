@@ -129,8 +129,11 @@
 #include "pathnames.h"
 #include "log.h"
 #include "misc.h"
+#include "digest.h"
 #include "progressmeter.h"
 #include "utf8.h"
+#include "scp-mt.h"
+#include "dirwalk.h"
 #ifdef WITH_OPENSSL
 #include <openssl/evp.h>
 #endif
@@ -143,6 +146,10 @@ extern char *__progname;
 
 #define COPY_BUFLEN	16384
 
+/* Buffers for the threaded file I/O pipeline, and how many by default */
+#define RING_BUFLEN	(256 * 1024)
+#define RING_DEPTH	4
+
 int do_cmd(char *, char *, char *, int, int, char *, int *, int *, pid_t *);
 int do_cmd2(char *, char *, int, char *, int, int);
 
@@ -190,6 +197,17 @@ volatile sig_atomic_t interrupted = 0;
 int remote_glob(struct sftp_conn *, const char *, int,
     int (*)(const char *, int), glob_t *); /* proto for sftp-glob.c */
 
+/*
+ * Number of buffers the file read-ahead (source) or write-behind (sink)
+ * thread may get ahead by; less than 2 does the file I/O inline.
+ */
+u_int io_depth = RING_DEPTH;
+int io_depth_set = 0;
+
+/* Check each file against a digest computed by the other end */
+int verify_flag = 0;
+#define SCP_DIGEST_ALG	SSH_DIGEST_SHA256
+
 /* Flag to indicate that this is a file resume */
 int resume_flag = 0; /* 0 is off, 1 is on */
 
@@ -475,6 +493,7 @@ main(int argc, char **argv)
 	extern int optind;
 	enum scp_mode_e mode = MODE_SFTP;
 	char *sftp_direct = NULL;
+	char depthflag[16] = "";
 
 	/* we use this to prepend the debugging statements
 	 * so we know which side is saying what */
@@ -513,7 +532,7 @@ main(int argc, char **argv)
 
 	fflag = Tflag = tflag = 0;
 	while ((ch = getopt(argc, argv,
-	    "12346ABCTdfOpqRrstvZz:D:F:J:M:P:S:c:i:l:o:")) != -1) {
+	    "12346ABCTdfOpqRrstVvZz:D:F:J:M:P:S:W:c:i:l:o:")) != -1) {
 		switch (ch) {
 		/* User-visible flags. */
 		case '1':
@@ -580,6 +599,15 @@ main(int argc, char **argv)
 		case 'S':
 			ssh_program = xstrdup(optarg);
 			break;
+		case 'W':
+			io_depth = strtonum(optarg, 0, 64, &errstr);
+			if (errstr != NULL)
+				fatal("I/O depth %s: %s", optarg, errstr);
+			io_depth_set = 1;
+			break;
+		case 'V':
+			verify_flag = 1;
+			break;
 		case 'z':
 			remote_path = xstrdup(optarg);
 			break;
@@ -680,13 +708,18 @@ main(int argc, char **argv)
 	 * to whatever scp is first in their path -cjr */
 	/* TODO: Rethink this in light renaming the binaries */
 
-	(void) snprintf(cmd, sizeof cmd, "%s%s%s%s%s%s",
+	/* Only pass -W on if asked, as older servers don't know it */
+	if (io_depth_set)
+		snprintf(depthflag, sizeof(depthflag), " -W %u", io_depth);
+	(void) snprintf(cmd, sizeof cmd, "%s%s%s%s%s%s%s%s",
 			remote_path ? remote_path : "scp",
 			verbose_mode ? " -v" : "",
 			iamrecursive ? " -r" : "",
 			pflag ? " -p" : "",
 			targetshouldbedirectory ? " -d" : "",
-			resume_flag ? " -Z" : "");
+			resume_flag ? " -Z" : "",
+			verify_flag ? " -V" : "",
+			depthflag);
 #ifdef DEBUG
 		fprintf(stderr, "%s: Sending cmd %s\n", hostname, cmd);
 #endif
@@ -1013,6 +1046,8 @@ static struct sftp_conn *
 do_sftp_connect(char *host, char *user, int port, char *sftp_direct,
    int *reminp, int *remoutp, int *pidp)
 {
+	struct sftp_conn *conn;
+
 	if (sftp_direct == NULL) {
 		if (do_cmd(ssh_program, host, user, port, 1, "sftp",
 		    reminp, remoutp, pidp) < 0)
@@ -1025,7 +1060,10 @@ do_sftp_connect(char *host, char *user, int port, char *sftp_direct,
 		    reminp, remoutp, pidp) < 0)
 			return NULL;
 	}
-	return do_init(*reminp, *remoutp, 32768, 64, limit_kbps);
+	conn = do_init(*reminp, *remoutp, 32768, 64, limit_kbps);
+	if (conn != NULL && verify_flag && sftp_verify_enable(conn) != 0)
+		fatal("Unable to verify transfers with %s", host);
+	return conn;
 }
 
 void
@@ -1443,14 +1481,138 @@ source_sftp(int argc, char *src, char *targ, struct sftp_conn *conn)
 	free(target);
 }
 
+static void
+digest_update(struct ssh_digest_ctx *ctx, const void *data, size_t len)
+{
+	int r;
+
+	if (ctx != NULL && (r = ssh_digest_update(ctx, data, len)) != 0)
+		fatal_fr(r, "digest");
+}
+
+/* Digest len bytes of fd from offset off, leaving the file offset alone */
+static int
+digest_fd(struct ssh_digest_ctx *ctx, int fd, off_t off, off_t len)
+{
+	char buf[HASH_BUFLEN];
+	ssize_t n;
+
+	while (len > 0) {
+		n = pread(fd, buf, MINIMUM((off_t)sizeof(buf), len), off);
+		if (n <= 0) {
+			if (n == 0)
+				errno = EIO;
+			return -1;
+		}
+		digest_update(ctx, buf, n);
+		off += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Send xfer_size bytes of fd, reading and sending in turn */
+static int
+source_inline(int fd, BUF *bp, off_t xfer_size, off_t *statbytes,
+    struct ssh_digest_ctx *dctx)
+{
+	off_t i;
+	size_t amt, nr;
+	int haderr;
+
+	for (haderr = i = 0; i < xfer_size; i += bp->cnt) {
+		amt = bp->cnt;
+		if (i + (off_t)amt > xfer_size)
+			amt = xfer_size - i;
+		if (!haderr) {
+			if ((nr = atomicio(read, fd, bp->buf, amt)) != amt) {
+				haderr = errno;
+				memset(bp->buf + nr, 0, amt - nr);
+			}
+		}
+		/* Keep writing after error to retain sync */
+		if (haderr) {
+			(void)atomicio(vwrite, remout, bp->buf, amt);
+			memset(bp->buf, 0, amt);
+			continue;
+		}
+		digest_update(dctx, bp->buf, amt);
+		if (atomicio6(vwrite, remout, bp->buf, amt, scpio,
+		    statbytes) != amt)
+			haderr = errno;
+	}
+	return haderr;
+}
+
+/* Send xfer_size bytes that the ring's thread reads ahead */
+static int
+source_ring(struct scp_ring *ring, BUF *bp, off_t xfer_size,
+    off_t *statbytes, struct ssh_digest_ctx *dctx)
+{
+	off_t i;
+	size_t amt;
+	u_char *data;
+	int haderr;
+
+	for (haderr = i = 0; i < xfer_size; i += amt) {
+		if (haderr) {
+			/* Keep writing after error to retain sync */
+			amt = MINIMUM((off_t)bp->cnt, xfer_size - i);
+			memset(bp->buf, 0, amt);
+			(void)atomicio(vwrite, remout, bp->buf, amt);
+			continue;
+		}
+		data = scp_ring_get(ring, &amt, &haderr);
+		if (!haderr)
+			digest_update(dctx, data, amt);
+		if (atomicio6(vwrite, remout, data, amt, scpio,
+		    statbytes) != amt && !haderr)
+			haderr = errno;
+		scp_ring_release(ring);
+	}
+	return haderr;
+}
+
+/* Send the digest of a file after its data */
+static void
+source_digest(struct ssh_digest_ctx *dctx)
+{
+	u_char digest[SSH_DIGEST_MAX_LENGTH];
+	size_t len = ssh_digest_bytes(SCP_DIGEST_ALG);
+	int r;
+
+	if ((r = ssh_digest_final(dctx, digest, sizeof(digest))) != 0)
+		fatal_fr(r, "digest");
+	(void) atomicio(vwrite, remout, digest, len);
+}
+
+/* Read the digest that follows a file and compare it with our own */
+static void
+sink_verify(struct ssh_digest_ctx *dctx, const char *np)
+{
+	u_char digest[SSH_DIGEST_MAX_LENGTH], rdigest[SSH_DIGEST_MAX_LENGTH];
+	size_t len = ssh_digest_bytes(SCP_DIGEST_ALG);
+	int r;
+
+	if (atomicio(read, remin, rdigest, len) != len)
+		lostconn(0);
+	if ((r = ssh_digest_final(dctx, digest, sizeof(digest))) != 0)
+		fatal_fr(r, "digest");
+	if (timingsafe_bcmp(digest, rdigest, len) != 0)
+		note_err("%s: checksum mismatch", np);
+	else
+		debug("%s: checksum verified", np);
+}
+
 void
 source(int argc, char **argv)
 {
 	struct stat stb;
 	static BUF buffer;
 	BUF *bp;
-	off_t i, statbytes, xfer_size;
-	size_t amt, nr;
+	struct scp_ring *ring;
+	struct ssh_digest_ctx *dctx;
+	off_t statbytes, xfer_size, skip;
 	int fd = -1, haderr, indx;
 	char *cp, *last, *name, buf[PATH_MAX + BUF_AND_HASH], encname[PATH_MAX];
 	int len;
@@ -1466,7 +1628,7 @@ source(int argc, char **argv)
 #ifdef DEBUG
 		fprintf(stderr, "%s index is %d, name is %s\n", hostname, indx, name);
 #endif
-		statbytes = 0;
+		statbytes = skip = 0;
 		len = strlen(name);
 		while (len > 1 && name[len-1] == '/')
 			name[--len] = '\0';
@@ -1610,6 +1772,7 @@ syserr:			run_err("%s: %s", name, strerror(errno));
 #endif
 						goto next;
 					}
+					skip = insize;
 					match = "M";
 				} else {
 					/* the fragments don't match so we should start over from the begining */
@@ -1657,27 +1820,26 @@ next:			if (fd != -1) {
 		if (showprogress) {
 			start_progress_meter(curfile, xfer_size, &statbytes);
 		}
+		dctx = NULL;
+		if (verify_flag &&
+		    (dctx = ssh_digest_start(SCP_DIGEST_ALG)) == NULL)
+			fatal_f("ssh_digest_start failed");
+		/* The digest covers the whole file, not just the resent tail */
+		if (dctx != NULL && skip > 0 &&
+		    digest_fd(dctx, fd, 0, skip) != 0)
+			error("%s: digest: %s", name, strerror(errno));
 		set_nonblock(remout);
-		for (haderr = i = 0; i < xfer_size; i += bp->cnt) {
-			amt = bp->cnt;
-			if (i + (off_t)amt > xfer_size)
-				amt = xfer_size - i;
-			if (!haderr) {
-				if ((nr = atomicio(read, fd, bp->buf, amt)) != amt) {
-					haderr = errno;
-					memset(bp->buf + nr, 0, amt - nr);
-				}
-			}
-			/* Keep writing after error to retain sync */
-			if (haderr) {
-				(void)atomicio(vwrite, remout, bp->buf, amt);
-				memset(bp->buf, 0, amt);
-				continue;
-			}
-			if (atomicio6(vwrite, remout, bp->buf, amt, scpio,
-			    &statbytes) != amt)
-				haderr = errno;
-		}
+		ring = NULL;
+		if (io_depth > 1 && xfer_size > RING_BUFLEN)
+			ring = scp_ring_reader(fd, xfer_size, RING_BUFLEN,
+			    io_depth);
+		if (ring != NULL)
+			haderr = source_ring(ring, bp, xfer_size, &statbytes,
+			    dctx);
+		else
+			haderr = source_inline(fd, bp, xfer_size, &statbytes,
+			    dctx);
+		scp_ring_free(ring);
 		unset_nonblock(remout);
 
 		if (fd != -1) {
@@ -1685,10 +1847,14 @@ next:			if (fd != -1) {
 				haderr = errno;
 			fd = -1;
 		}
-		if (!haderr)
+		if (!haderr) {
 			(void) atomicio(vwrite, remout, "", 1);
-		else
+			/* The sink expects our digest after a good file */
+			if (dctx != NULL)
+				source_digest(dctx);
+		} else
 			run_err("%s: %s", name, strerror(haderr));
+		ssh_digest_free(dctx);
 		(void) response();
 		if (showprogress)
 			stop_progress_meter();
@@ -1698,13 +1864,20 @@ next:			if (fd != -1) {
 void
 rsource(char *name, struct stat *statp)
 {
-	DIR *dirp;
-	struct dirent *dp;
+	static struct dirwalk *walk;
+	struct dirwalk_ent *ents;
+	size_t i, nents;
+	int own_walk = 0;
 	char *last, *vect[1], path[PATH_MAX];
 
-	if (!(dirp = opendir(name))) {
+	/* Read the tree ahead from the top directory being sent */
+	if (walk == NULL) {
+		walk = dirwalk_open(name);
+		own_walk = 1;
+	}
+	if (dirwalk_readdir(walk, name, &ents, &nents) == -1) {
 		run_err("%s: %s", name, strerror(errno));
-		return;
+		goto out;
 	}
 	last = strrchr(name, '/');
 	if (last == NULL)
@@ -1712,36 +1885,41 @@ rsource(char *name, struct stat *statp)
 	else
 		last++;
 	if (pflag) {
-		if (do_times(remout, verbose_mode, statp) < 0) {
-			closedir(dirp);
-			return;
-		}
+		if (do_times(remout, verbose_mode, statp) < 0)
+			goto prune;
 	}
 	(void) snprintf(path, sizeof path, "D%04o %d %.1024s\n",
 	    (u_int) (statp->st_mode & FILEMODEMASK), 0, last);
 	if (verbose_mode)
 		fmprintf(stderr, "Entering directory: %s", path);
 	(void) atomicio(vwrite, remout, path, strlen(path));
-	if (response() < 0) {
-		closedir(dirp);
-		return;
-	}
-	while ((dp = readdir(dirp)) != NULL) {
-		if (dp->d_ino == 0)
-			continue;
-		if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, ".."))
-			continue;
-		if (strlen(name) + 1 + strlen(dp->d_name) >= sizeof(path) - 1) {
-			run_err("%s/%s: name too long", name, dp->d_name);
-			continue;
+	if (response() < 0)
+		goto prune;
+	for (i = 0; i < nents; i++) {
+		if (strlen(ents[i].path) >= sizeof(path) - 1)
+			run_err("%s: name too long", ents[i].path);
+		else {
+			strlcpy(path, ents[i].path, sizeof(path));
+			vect[0] = path;
+			source(1, vect);
 		}
-		(void) snprintf(path, sizeof path, "%s/%s", name, dp->d_name);
-		vect[0] = path;
-		source(1, vect);
+		/* Whatever source() skipped mustn't hold up the read-ahead */
+		if (ents[i].err == 0 && S_ISDIR(ents[i].st.st_mode))
+			dirwalk_prune(walk, ents[i].path);
 	}
-	(void) closedir(dirp);
 	(void) atomicio(vwrite, remout, "E\n", 2);
 	(void) response();
+	goto done;
+ prune:
+	for (i = 0; i < nents; i++)
+		dirwalk_prune(walk, ents[i].path);
+ done:
+	dirwalk_free_ents(ents, nents);
+ out:
+	if (own_walk) {
+		dirwalk_close(walk);
+		walk = NULL;
+	}
 }
 
 void
@@ -1844,14 +2022,16 @@ sink(int argc, char **argv, const char *src)
 	static BUF buffer;
 	struct stat stb, cpstat, npstat;
 	BUF *bp;
+	struct scp_ring *ring;
+	struct ssh_digest_ctx *dctx = NULL;
 	off_t i;
 	size_t j, count;
-	int amt, exists, first, ofd;
+	int amt, exists, first, ofd, ioerr;
 	mode_t mode, omode, mask;
 	off_t size, statbytes, xfer_size;
 	unsigned long long ull;
 	int setimes, targisdir, wrerr;
-	char ch, *cp, *np, *np_tmp, *targ, *why, *vect[1], buf[16384], visbuf[16384];
+	char ch, *cp, *np, *np_tmp, *np_part = NULL, *targ, *why, *vect[1], buf[16384], visbuf[16384];
 	char **patterns = NULL;
 	size_t n, npatterns = 0;
 	struct timeval tv[2];
@@ -2220,9 +2400,11 @@ sink(int argc, char **argv, const char *src)
 				resume_flag = 1;
 				np_tmp = xstrdup(np);
 				/* We should have a random component to avoid clobbering a
-				 * local file */
+				 * local file. np has no room for it, use a copy */
 				rand_str(rand_string, 8);
-				strcat(np, rand_string);
+				free(np_part);
+				xasprintf(&np_part, "%s%s", np_tmp, rand_string);
+				np = np_part;
 #ifdef DEBUG
 				fprintf(stderr, "%s: Will concat %s to %s after xfer\n",
 					hostname, np, np_tmp);
@@ -2330,45 +2512,74 @@ bad:			run_err("%s: %s", np, strerror(errno));
 #ifdef DEBUG
 		fprintf(stderr, "%s: xfer_size is %ld\n", hostname, xfer_size);
 #endif
-		for (count = i = 0; i < xfer_size; i += bp->cnt) {
-			amt = bp->cnt;
-			if (i + amt > xfer_size)
-				amt = xfer_size - i;
-			count += amt;
-			/* read the data from the socket*/
-			do {
-
+		ssh_digest_free(dctx);
+		dctx = NULL;
+		if (verify_flag &&
+		    (dctx = ssh_digest_start(SCP_DIGEST_ALG)) == NULL)
+			fatal_f("ssh_digest_start failed");
+		ring = NULL;
+		if (io_depth > 1 && xfer_size > RING_BUFLEN)
+			ring = scp_ring_writer(ofd, RING_BUFLEN, io_depth);
+		if (ring != NULL) {
+			for (i = 0; i < xfer_size; i += amt) {
+				amt = MINIMUM(RING_BUFLEN, xfer_size - i);
+				cp = (char *)scp_ring_buf(ring);
 				j = atomicio6(read, remin, cp, amt,
 				    scpio, &statbytes);
-				if (j == 0) {
-					run_err("%s", j != EPIPE ?
+				if (j != (size_t)amt) {
+					run_err("%s", errno != EPIPE ?
 					    strerror(errno) :
 					    "dropped connection");
 					exit(1);
 				}
-				amt -= j;
-				cp += j;
-			} while (amt > 0);
-			if (count == bp->cnt) {
-				/* Keep reading so we stay sync'd up. */
-				if (!wrerr) {
-					if (atomicio(vwrite, ofd, bp->buf,
-					    count) != count) {
+				digest_update(dctx, cp, amt);
+				scp_ring_commit(ring, amt);
+			}
+			if ((ioerr = scp_ring_free(ring)) != 0) {
+				note_err("%s: %s", np, strerror(ioerr));
+				wrerr = 1;
+			}
+		} else {
+			for (count = i = 0; i < xfer_size; i += bp->cnt) {
+				amt = bp->cnt;
+				if (i + amt > xfer_size)
+					amt = xfer_size - i;
+				count += amt;
+				/* read the data from the socket*/
+				do {
+
+					j = atomicio6(read, remin, cp, amt,
+					    scpio, &statbytes);
+					if (j == 0) {
+						run_err("%s", j != EPIPE ?
+						    strerror(errno) :
+						    "dropped connection");
+						exit(1);
+					}
+					amt -= j;
+					cp += j;
+				} while (amt > 0);
+				if (count == bp->cnt) {
+					digest_update(dctx, bp->buf, count);
+					/* Keep reading so we stay sync'd up. */
+					if (!wrerr && atomicio(vwrite, ofd,
+					    bp->buf, count) != count) {
 						note_err("%s: %s", np,
 						    strerror(errno));
 						wrerr = 1;
 					}
+					count = 0;
+					cp = bp->buf;
 				}
-				count = 0;
-				cp = bp->buf;
+			}
+			digest_update(dctx, bp->buf, count);
+			if (count != 0 && !wrerr &&
+			    atomicio(vwrite, ofd, bp->buf, count) != count) {
+				note_err("%s: %s", np, strerror(errno));
+				wrerr = 1;
 			}
 		}
 		unset_nonblock(remin);
-		if (count != 0 && !wrerr &&
-		    atomicio(vwrite, ofd, bp->buf, count) != count) {
-			note_err("%s: %s", np, strerror(errno));
-			wrerr = 1;
-		}
 		if (!wrerr && (!exists || S_ISREG(stb.st_mode)) &&
 		    ftruncate(ofd, xfer_size) != 0)
 			note_err("%s: truncate: %s", np, strerror(errno));
@@ -2441,6 +2652,24 @@ stopcat:		if (orig)
 				atomicio(vwrite, remout, "", 1);
 				goto bad;
 			}
+			/*
+			 * What we were sent only covers the tail. Digest the
+			 * whole file instead so a bad local prefix is caught.
+			 */
+			if (dctx != NULL) {
+				int ifd;
+
+				ssh_digest_free(dctx);
+				if ((dctx = ssh_digest_start(SCP_DIGEST_ALG)) ==
+				    NULL)
+					fatal_f("ssh_digest_start failed");
+				if ((ifd = open(np, O_RDONLY)) == -1 ||
+				    digest_fd(dctx, ifd, 0, size) != 0)
+					note_err("%s: digest: %s", np,
+					    strerror(errno));
+				if (ifd != -1)
+					close(ifd);
+			}
 		}
 		if (pflag) {
 			if (exists || omode != mode)
@@ -2465,7 +2694,10 @@ stopcat:		if (orig)
 		}
 		if (close(ofd) == -1)
 			note_err("%s: close: %s", np, strerror(errno));
-		(void) response();
+		if (response() == 0 && dctx != NULL)
+			sink_verify(dctx, np);
+		ssh_digest_free(dctx);
+		dctx = NULL;
 		if (showprogress)
 			stop_progress_meter();
 		if (setimes && !wrerr) {
@@ -2488,6 +2720,7 @@ stopcat:		if (orig)
 		}
 	}
 done:
+	free(np_part);
 	for (n = 0; n < npatterns; n++)
 		free(patterns[n]);
 	free(patterns);
@@ -2617,17 +2850,17 @@ usage(void)
 {
 #ifdef WITH_OPENSSL
 	(void) fprintf(stderr,
-	    "usage: scp [-346ABCOpqRrsTvZ] [-c cipher] [-D sftp_server_path] [-F ssh_config]\n"
+	    "usage: scp [-346ABCOpqRrsTVvZ] [-c cipher] [-D sftp_server_path] [-F ssh_config]\n"
 	    "           [-i identity_file] [-J destination] [-l limit]\n"
 	    "           [-o ssh_option] [-P port] [-z filepath of remote scp]" 
-	    "           [-S program] source ... target\n");
+	    "           [-S program] [-W depth] source ... target\n");
 	exit(1);
 #else
 	(void) fprintf(stderr,
-	    "usage: hpnscp [-346ABCOpqRrsTv] [-c cipher] [-D sftp_server_path] [-F ssh_config]\n"
+	    "usage: hpnscp [-346ABCOpqRrsTVv] [-c cipher] [-D sftp_server_path] [-F ssh_config]\n"
 	    "              [-i identity_file] [-J destination] [-l limit]\n"
 	    "              [-o ssh_option] [-P port]"
-	    "              [-S program] source ... target\n");
+	    "              [-S program] [-W depth] source ... target\n");
 	exit(1);
 #endif
 
@@ -172,6 +172,12 @@ initialize_server_options(ServerOptions *options)
 	options->max_sessions = -1;
 	options->banner = NULL;
 	options->use_dns = -1;
+	options->dns_cache_time = -1;
+	options->dns_cache_negative_time = -1;
+	options->dns_timeout = -1;
+	options->ident_screen_time = -1;
+	options->stats_socket = NULL;
+	options->resume_timeout = -1;
 	options->client_alive_interval = -1;
 	options->client_alive_count_max = -1;
 	options->num_authkeys_files = 0;
@@ -196,7 +202,15 @@ initialize_server_options(ServerOptions *options)
 	options->none_enabled = -1;
 	options->nonemac_enabled = -1;
 	options->disable_multithreaded = -1;
+	options->mtaes_max_threads = -1;
 	options->hpn_buffer_limit = -1;
+	options->notify_hostkeys = -1;
+	options->hostkey_proof_threads = -1;
+	options->inprocess_sftp = -1;
+	options->session_pipe_size = -1;
+	options->pty_coalesce_size = -1;
+	options->pty_coalesce_usec = -1;
+	options->channel_idle_timeout = -1;
 	options->ip_qos_interactive = -1;
 	options->ip_qos_bulk = -1;
 	options->version_addendum = NULL;
@@ -419,6 +433,16 @@ fill_default_server_options(ServerOptions *options)
 		options->max_sessions = DEFAULT_SESSIONS_MAX;
 	if (options->use_dns == -1)
 		options->use_dns = 0;
+	if (options->dns_cache_time == -1)
+		options->dns_cache_time = 0;
+	if (options->dns_cache_negative_time == -1)
+		options->dns_cache_negative_time = options->dns_cache_time;
+	if (options->dns_timeout == -1)
+		options->dns_timeout = 0;
+	if (options->ident_screen_time == -1)
+		options->ident_screen_time = 0;
+	if (options->resume_timeout == -1)
+		options->resume_timeout = 0;
 	if (options->client_alive_interval == -1)
 		options->client_alive_interval = 0;
 	if (options->client_alive_count_max == -1)
@@ -445,10 +469,27 @@ fill_default_server_options(ServerOptions *options)
 	}
 	if (options->disable_multithreaded == -1)
 		options->disable_multithreaded = 0;
+	if (options->mtaes_max_threads == -1)
+		options->mtaes_max_threads =
+		    2 * MAXIMUM(1, sysconf(_SC_NPROCESSORS_ONLN));
 	if (options->hpn_disabled == -1)
 		options->hpn_disabled = 0;
 	if (options->hpn_buffer_limit == -1)
 		options->hpn_buffer_limit = 0;
+	if (options->notify_hostkeys == -1)
+		options->notify_hostkeys = 1;
+	if (options->hostkey_proof_threads < 1)
+		options->hostkey_proof_threads = 1;
+	if (options->inprocess_sftp == -1)
+		options->inprocess_sftp = 0;
+	if (options->session_pipe_size == -1)
+		options->session_pipe_size = 0;
+	if (options->pty_coalesce_size == -1)
+		options->pty_coalesce_size = 0;
+	if (options->pty_coalesce_usec == -1)
+		options->pty_coalesce_usec = DEFAULT_PTY_COALESCE_USEC;
+	if (options->channel_idle_timeout == -1)
+		options->channel_idle_timeout = 0;
 
 	if (options->hpn_buffer_size == -1) {
 		/* option not explicitly set. Now we have to figure out */
@@ -515,6 +556,7 @@ fill_default_server_options(ServerOptions *options)
 		} \
 	} while(0)
 	CLEAR_ON_NONE(options->pid_file);
+	CLEAR_ON_NONE(options->stats_socket);
 	CLEAR_ON_NONE(options->xauth_location);
 	CLEAR_ON_NONE(options->banner);
 	CLEAR_ON_NONE(options->trusted_user_ca_keys);
@@ -553,7 +595,7 @@ typedef enum {
 	sKbdInteractiveAuthentication, sListenAddress, sAddressFamily,
 	sPrintMotd, sPrintLastLog, sIgnoreRhosts,
 	sNoneEnabled, sNoneMacEnabled,
-	sDisableMTAES, sHPNBufferLimit,
+	sDisableMTAES, sMTAESMaxThreads, sHPNBufferLimit,
 	sTcpRcvBufPoll, sHPNDisabled, sHPNBufferSize,
 	sX11Forwarding, sX11DisplayOffset, sX11UseLocalhost,
 	sPermitTTY, sStrictModes, sEmptyPasswd, sTCPKeepAlive,
@@ -579,6 +621,10 @@ typedef enum {
 	sStreamLocalBindMask, sStreamLocalBindUnlink,
 	sAllowStreamLocalForwarding, sFingerprintHash, sDisableForwarding,
 	sExposeAuthInfo, sRDomain, sPubkeyAuthOptions, sSecurityKeyProvider,
+	sNotifyHostKeys, sHostKeyProofThreads, sInProcessSftp,
+	sSessionPipeSize, sPtyCoalesce, sChannelIdleTimeout,
+	sDNSCacheTime, sDNSTimeout, sIdentScreenTime, sStatsSocket,
+	sResumeTimeout,
 	sDeprecated, sIgnore, sUnsupported
 } ServerOpCodes;
 
@@ -695,10 +741,15 @@ static struct {
 	{ "maxstartups", sMaxStartups, SSHCFG_GLOBAL },
 	{ "persourcemaxstartups", sPerSourceMaxStartups, SSHCFG_GLOBAL },
 	{ "persourcenetblocksize", sPerSourceNetBlockSize, SSHCFG_GLOBAL },
+	{ "identscreentime", sIdentScreenTime, SSHCFG_GLOBAL },
+	{ "statssocket", sStatsSocket, SSHCFG_GLOBAL },
+	{ "resumetimeout", sResumeTimeout, SSHCFG_GLOBAL },
 	{ "maxauthtries", sMaxAuthTries, SSHCFG_ALL },
 	{ "maxsessions", sMaxSessions, SSHCFG_ALL },
 	{ "banner", sBanner, SSHCFG_ALL },
 	{ "usedns", sUseDNS, SSHCFG_GLOBAL },
+	{ "dnscachetime", sDNSCacheTime, SSHCFG_GLOBAL },
+	{ "dnstimeout", sDNSTimeout, SSHCFG_GLOBAL },
 	{ "verifyreversemapping", sDeprecated, SSHCFG_GLOBAL },
 	{ "reversemappingcheck", sDeprecated, SSHCFG_GLOBAL },
 	{ "clientaliveinterval", sClientAliveInterval, SSHCFG_ALL },
@@ -725,8 +776,15 @@ static struct {
 	{ "tcprcvbufpoll", sTcpRcvBufPoll, SSHCFG_ALL },
 	{ "noneenabled", sNoneEnabled, SSHCFG_ALL },
 	{ "disableMTAES", sDisableMTAES, SSHCFG_ALL },
+	{ "mtaesmaxthreads", sMTAESMaxThreads, SSHCFG_GLOBAL },
 	{ "nonemacenabled", sNoneMacEnabled, SSHCFG_ALL },
 	{ "hpnbufferlimit", sHPNBufferLimit, SSHCFG_ALL },
+	{ "notifyhostkeys", sNotifyHostKeys, SSHCFG_ALL },
+	{ "hostkeyproofthreads", sHostKeyProofThreads, SSHCFG_GLOBAL },
+	{ "inprocesssftp", sInProcessSftp, SSHCFG_ALL },
+	{ "sessionpipesize", sSessionPipeSize, SSHCFG_ALL },
+	{ "ptycoalesce", sPtyCoalesce, SSHCFG_ALL },
+	{ "channelidletimeout", sChannelIdleTimeout, SSHCFG_ALL },
 	{ "kexalgorithms", sKexAlgorithms, SSHCFG_GLOBAL },
 	{ "include", sInclude, SSHCFG_ALL },
 	{ "ipqos", sIPQoS, SSHCFG_ALL },
@@ -1586,10 +1644,77 @@ process_server_config_line_depth(ServerOptions *options, char *line,
 		intptr = &options->disable_multithreaded;
 		goto parse_flag;
 
+	case sMTAESMaxThreads:
+		intptr = &options->mtaes_max_threads;
+		goto parse_int;
+
 	case sHPNBufferLimit:
 		intptr = &options->hpn_buffer_limit;
 		goto parse_flag;
 
+	case sNotifyHostKeys:
+		intptr = &options->notify_hostkeys;
+		goto parse_flag;
+
+	case sHostKeyProofThreads:
+		intptr = &options->hostkey_proof_threads;
+		goto parse_int;
+
+	case sInProcessSftp:
+		intptr = &options->inprocess_sftp;
+		goto parse_flag;
+
+	case sSessionPipeSize:
+		arg = argv_next(&ac, &av);
+		if (!arg || *arg == '\0')
+			fatal("%s line %d: %s missing argument.",
+			    filename, linenum, keyword);
+		if (strcmp(arg, "default") == 0) {
+			val64 = 0;
+		} else {
+			if (scan_scaled(arg, &val64) == -1)
+				fatal("%.200s line %d: Bad %s number '%s': %s",
+				    filename, linenum, keyword,
+				    arg, strerror(errno));
+			if (val64 < 0 || val64 > INT_MAX)
+				fatal("%.200s line %d: %s out of range",
+				    filename, linenum, keyword);
+		}
+		if (*activep && options->session_pipe_size == -1)
+			options->session_pipe_size = (int)val64;
+		break;
+
+	case sPtyCoalesce:
+		arg = argv_next(&ac, &av);
+		if (!arg || *arg == '\0')
+			fatal("%s line %d: %s missing argument.",
+			    filename, linenum, keyword);
+		if (strcmp(arg, "none") == 0) {
+			val64 = 0;
+		} else {
+			if (scan_scaled(arg, &val64) == -1)
+				fatal("%.200s line %d: Bad %s number '%s': %s",
+				    filename, linenum, keyword,
+				    arg, strerror(errno));
+			if (val64 < 0 || val64 > CHAN_SES_PACKET_DEFAULT)
+				fatal("%.200s line %d: %s size out of range",
+				    filename, linenum, keyword);
+		}
+		value = -1;
+		if ((arg = argv_next(&ac, &av)) != NULL) {
+			/* optional delay in microseconds */
+			value = (int)strtonum(arg, 1,
+			    MAX_PTY_COALESCE_USEC, &errstr);
+			if (errstr != NULL)
+				fatal("%s line %d: %s delay is %s: %s",
+				    filename, linenum, keyword, errstr, arg);
+		}
+		if (*activep && options->pty_coalesce_size == -1) {
+			options->pty_coalesce_size = (int)val64;
+			options->pty_coalesce_usec = value;
+		}
+		break;
+
 	case sHostbasedAuthentication:
 		intptr = &options->hostbased_authentication;
 		goto parse_flag;
@@ -1801,6 +1926,49 @@ process_server_config_line_depth(ServerOptions *options, char *line,
 		multistate_ptr = multistate_gatewayports;
 		goto parse_multistate;
 
+	case sDNSCacheTime:
+		arg = argv_next(&ac, &av);
+		if (!arg || *arg == '\0')
+			fatal("%s line %d: %s missing argument.",
+			    filename, linenum, keyword);
+		if ((value = convtime(arg)) == -1)
+			fatal("%s line %d: invalid time value.",
+			    filename, linenum);
+		if (*activep && options->dns_cache_time == -1)
+			options->dns_cache_time = value;
+		if (ac != 0) { /* optional time for failed lookups */
+			intptr = &options->dns_cache_negative_time;
+			goto parse_time;
+		}
+		break;
+
+	case sDNSTimeout:
+		intptr = &options->dns_timeout;
+		goto parse_time;
+
+	case sIdentScreenTime:
+		intptr = &options->ident_screen_time;
+		goto parse_time;
+
+	case sResumeTimeout:
+		intptr = &options->resume_timeout;
+		goto parse_time;
+
+	case sStatsSocket:
+		arg = argv_next(&ac, &av);
+		if (!arg || *arg == '\0')
+			fatal("%s line %d: missing file name.",
+			    filename, linenum);
+		p = arg;
+		if (strncmp(p, "text:", 5) == 0 || strncmp(p, "json:", 5) == 0)
+			p += 5;
+		if (strcasecmp(arg, "none") != 0 && *p != '/')
+			fatal("%s line %d: %s must be an absolute path.",
+			    filename, linenum, keyword);
+		if (*activep && options->stats_socket == NULL)
+			options->stats_socket = xstrdup(arg);
+		break;
+
 	case sUseDNS:
 		intptr = &options->use_dns;
 		goto parse_flag;
@@ -2105,6 +2273,10 @@ process_server_config_line_depth(ServerOptions *options, char *line,
 		intptr = &options->client_alive_interval;
 		goto parse_time;
 
+	case sChannelIdleTimeout:
+		intptr = &options->channel_idle_timeout;
+		goto parse_time;
+
 	case sClientAliveCountMax:
 		intptr = &options->client_alive_count_max;
 		goto parse_int;
@@ -2684,6 +2856,12 @@ copy_set_server_options(ServerOptions *dst, ServerOptions *src, int preauth)
 	M_CP_INTOPT(allow_agent_forwarding);
 	M_CP_INTOPT(disable_forwarding);
 	M_CP_INTOPT(expose_userauth_info);
+	M_CP_INTOPT(notify_hostkeys);
+	M_CP_INTOPT(inprocess_sftp);
+	M_CP_INTOPT(session_pipe_size);
+	M_CP_INTOPT(pty_coalesce_size);
+	M_CP_INTOPT(pty_coalesce_usec);
+	M_CP_INTOPT(channel_idle_timeout);
 	M_CP_INTOPT(permit_tun);
 	M_CP_INTOPT(fwd_opts.gateway_ports);
 	M_CP_INTOPT(fwd_opts.streamlocal_bind_unlink);
@@ -2965,6 +3143,13 @@ dump_config(ServerOptions *o)
 	dump_cfg_int(sMaxSessions, o->max_sessions);
 	dump_cfg_int(sClientAliveInterval, o->client_alive_interval);
 	dump_cfg_int(sClientAliveCountMax, o->client_alive_count_max);
+	dump_cfg_int(sHostKeyProofThreads, o->hostkey_proof_threads);
+	dump_cfg_int(sMTAESMaxThreads, o->mtaes_max_threads);
+	dump_cfg_int(sDNSTimeout, o->dns_timeout);
+	dump_cfg_int(sIdentScreenTime, o->ident_screen_time);
+	dump_cfg_int(sResumeTimeout, o->resume_timeout);
+	dump_cfg_int(sSessionPipeSize, o->session_pipe_size);
+	dump_cfg_int(sChannelIdleTimeout, o->channel_idle_timeout);
 	dump_cfg_oct(sStreamLocalBindMask, o->fwd_opts.streamlocal_bind_mask);
 
 	/* formatted integer arguments */
@@ -3011,9 +3196,12 @@ dump_config(ServerOptions *o)
 	dump_cfg_fmtint(sStreamLocalBindUnlink, o->fwd_opts.streamlocal_bind_unlink);
 	dump_cfg_fmtint(sFingerprintHash, o->fingerprint_hash);
 	dump_cfg_fmtint(sExposeAuthInfo, o->expose_userauth_info);
+	dump_cfg_fmtint(sNotifyHostKeys, o->notify_hostkeys);
+	dump_cfg_fmtint(sInProcessSftp, o->inprocess_sftp);
 
 	/* string arguments */
 	dump_cfg_string(sPidFile, o->pid_file);
+	dump_cfg_string(sStatsSocket, o->stats_socket);
 	dump_cfg_string(sModuliFile, o->moduli_file);
 	dump_cfg_string(sXAuthLocation, o->xauth_location);
 	dump_cfg_string(sCiphers, o->ciphers);
@@ -3091,8 +3279,15 @@ dump_config(ServerOptions *o)
 	printf("ipqos %s ", iptos2str(o->ip_qos_interactive));
 	printf("%s\n", iptos2str(o->ip_qos_bulk));
 
+	printf("dnscachetime %d %d\n", o->dns_cache_time,
+	    o->dns_cache_negative_time);
 	printf("rekeylimit %llu %d\n", (unsigned long long)o->rekey_limit,
 	    o->rekey_interval);
+	if (o->pty_coalesce_size == 0)
+		printf("ptycoalesce none\n");
+	else
+		printf("ptycoalesce %d %d\n", o->pty_coalesce_size,
+		    o->pty_coalesce_usec);
 
 	printf("permitopen");
 	if (o->num_permitted_opens == 0)
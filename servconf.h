@@ -46,6 +46,10 @@
 #define DEFAULT_AUTH_FAIL_MAX	6	/* Default for MaxAuthTries */
 #define DEFAULT_SESSIONS_MAX	10	/* Default for MaxSessions */
 
+/* PtyCoalesce delay, microseconds */
+#define DEFAULT_PTY_COALESCE_USEC	500
+#define MAX_PTY_COALESCE_USEC		100000
+
 /* Magic name for internal sftp-server */
 #define INTERNAL_SFTP_NAME	"internal-sftp"
 
@@ -184,6 +188,12 @@ typedef struct {
 	int	max_sessions;
 	char   *banner;			/* SSH-2 banner message */
 	int	use_dns;
+	int	dns_cache_time;		/* listener cache of UseDNS results */
+	int	dns_cache_negative_time; /* same, for failed lookups */
+	int	dns_timeout;		/* give up on UseDNS lookups after */
+	int	ident_screen_time;	/* listener waits this long for ident */
+	char   *stats_socket;		/* listener serves statistics here */
+	int	resume_timeout;		/* detached sessions wait this long */
 	int	client_alive_interval;	/*
 					 * poke the client this often to
 					 * see if it's still there
@@ -205,8 +215,16 @@ typedef struct {
 	int	hpn_buffer_size;	/* set the hpn buffer size - default 3MB */
 	int	none_enabled;		/* Enable NONE cipher switch */
 	int disable_multithreaded;  /* disable multithreaded aes-ctr cipher */
+	int	mtaes_max_threads;	/* AES MT threads for all connections */
 	int nonemac_enabled;        /* Enable NONE MAC switch */
 	int hpn_buffer_limit;       /* limit local_window_max to 1/2 receive buffer */
+	int	notify_hostkeys;	/* send hostkeys-00@openssh.com after auth */
+	int	hostkey_proof_threads;	/* concurrent hostkeys-prove signers */
+	int	inprocess_sftp;		/* run internal-sftp inside sshd */
+	int	session_pipe_size;	/* buffer size of session child pipes */
+	int	pty_coalesce_size;	/* batch pty output below this size */
+	int	pty_coalesce_usec;	/* ... for at most this many usec */
+	int	channel_idle_timeout;	/* close channels idle this long */
 
 	int	permit_tun;
 
@@ -81,6 +81,7 @@
 #include "auth-options.h"
 #include "serverloop.h"
 #include "ssherr.h"
+#include "resume.h"
 
 extern ServerOptions options;
 
@@ -133,12 +134,20 @@ client_alive_check(struct ssh *ssh)
 	char remote_id[512];
 	int r, channel_id;
 
+	/* Nobody to ask while waiting for the session to be resumed */
+	if (ssh_packet_is_detached(ssh))
+		return;
+
 	/* timeout, check to see how many we have had */
 	if (options.client_alive_count_max > 0 &&
 	    ssh_packet_inc_alive_timeouts(ssh) >
 	    options.client_alive_count_max) {
 		sshpkt_fmt_connection_id(ssh, remote_id, sizeof(remote_id));
 		logit("Timeout, client not responding from %s", remote_id);
+		if (ssh_packet_resume_armed(ssh)) {
+			ssh_packet_detach(ssh);
+			return;
+		}
 		cleanup_exit(255);
 	}
 
@@ -169,27 +178,32 @@ static void
 wait_until_can_do_something(struct ssh *ssh,
     int connection_in, int connection_out, struct pollfd **pfdp,
     u_int *npfd_allocp, u_int *npfd_activep, u_int64_t max_time_ms,
-    sigset_t *sigsetp, int *conn_in_readyp, int *conn_out_readyp)
+    sigset_t *sigsetp, int *conn_in_readyp, int *conn_out_readyp,
+    int *resume_readyp)
 {
-	struct timespec ts, *tsp;
+	struct timespec ts, cts, *tsp;
 	int ret;
 	time_t minwait_secs = 0;
-	int client_alive_scheduled = 0;
+	int client_alive_scheduled = 0, coalesce_wakeup = 0;
 	u_int p;
 	/* time we last heard from the client OR sent a keepalive */
 	static time_t last_client_time;
 
-	*conn_in_readyp = *conn_out_readyp = 0;
+	*conn_in_readyp = *conn_out_readyp = *resume_readyp = 0;
 
-	/* Prepare channel poll. First two pollfd entries are reserved */
+	/*
+	 * Prepare channel poll. The first entries are reserved for the
+	 * connection and for resuming the session.
+	 */
 	channel_prepare_poll(ssh, pfdp, npfd_allocp, npfd_activep,
-	    2, &minwait_secs);
-	if (*npfd_activep < 2)
+	    2 + RESUME_NPOLLFD, &minwait_secs);
+	if (*npfd_activep < 2 + RESUME_NPOLLFD)
 		fatal_f("bad npfd %u", *npfd_activep); /* shouldn't happen */
 
 	/* XXX need proper deadline system for rekey/client alive */
-	if (minwait_secs != 0)
-		max_time_ms = MINIMUM(max_time_ms, (u_int)minwait_secs * 1000);
+	if (minwait_secs != 0 && (max_time_ms == 0 ||
+	    max_time_ms > (u_int64_t)minwait_secs * 1000))
+		max_time_ms = (u_int64_t)minwait_secs * 1000;
 
 	/*
 	 * if using client_alive, set the max timeout accordingly,
@@ -220,13 +234,15 @@ wait_until_can_do_something(struct ssh *ssh,
 	(*pfdp)[0].events = POLLIN;
 	(*pfdp)[1].fd = connection_out;
 	(*pfdp)[1].events = ssh_packet_have_data_to_write(ssh) ? POLLOUT : 0;
+	/* and on connections to resume the session over */
+	resume_server_prepare_poll(*pfdp + 2);
 
 	/*
 	 * If child has terminated and there is enough buffer space to read
 	 * from it, then read as much as is available and exit.
 	 */
 	if (child_terminated && ssh_packet_not_very_much_data_to_write(ssh))
-		if (max_time_ms == 0 || client_alive_scheduled)
+		if (max_time_ms == 0 || max_time_ms > 100)
 			max_time_ms = 100;
 
 	if (max_time_ms == 0)
@@ -237,6 +253,14 @@ wait_until_can_do_something(struct ssh *ssh,
 		tsp = &ts;
 	}
 
+	/* Wake up in time to send pty output held back for coalescing */
+	if (channel_coalesce_timeout(ssh, &cts) &&
+	    (tsp == NULL || timespeccmp(&cts, tsp, <))) {
+		ts = cts;
+		tsp = &ts;
+		coalesce_wakeup = 1;
+	}
+
 	/* Wait for something to happen, or the timeout to expire. */
 	ret = ppoll(*pfdp, *npfd_activep, tsp, sigsetp);
 
@@ -250,6 +274,8 @@ wait_until_can_do_something(struct ssh *ssh,
 
 	*conn_in_readyp = (*pfdp)[0].revents != 0;
 	*conn_out_readyp = (*pfdp)[1].revents != 0;
+	for (p = 2; p < 2 + RESUME_NPOLLFD; p++)
+		*resume_readyp |= (*pfdp)[p].revents != 0;
 
 	if (client_alive_scheduled) {
 		time_t now = monotime();
@@ -258,7 +284,8 @@ wait_until_can_do_something(struct ssh *ssh,
 		 * If the ppoll timed out, or returned for some other reason
 		 * but we haven't heard from the client in time, send keepalive.
 		 */
-		if (ret == 0 || (last_client_time != 0 && last_client_time +
+		if ((ret == 0 && !coalesce_wakeup) ||
+		    (last_client_time != 0 && last_client_time +
 		    options.client_alive_interval <= now)) {
 			client_alive_check(ssh);
 			last_client_time = now;
@@ -336,9 +363,9 @@ server_loop2(struct ssh *ssh, Authctxt *authctxt)
 {
 	struct pollfd *pfd = NULL;
 	u_int npfd_alloc = 0, npfd_active = 0;
-	int r, conn_in_ready, conn_out_ready;
+	int r, conn_in_ready, conn_out_ready, resume_ready;
 	u_int connection_in, connection_out;
-	u_int64_t rekey_timeout_ms = 0;
+	u_int64_t rekey_timeout_ms = 0, resume_wait_ms;
 	sigset_t bsigset, osigset;
 
 	debug("Entering interactive session for SSH2.");
@@ -348,8 +375,6 @@ server_loop2(struct ssh *ssh, Authctxt *authctxt)
 		error_f("bsigset setup: %s", strerror(errno));
 	ssh_signal(SIGCHLD, sigchld_handler);
 	child_terminated = 0;
-	connection_in = ssh_packet_get_connection_in(ssh);
-	connection_out = ssh_packet_get_connection_out(ssh);
 
 	if (!use_privsep) {
 		ssh_signal(SIGTERM, sigterm_handler);
@@ -365,6 +390,7 @@ server_loop2(struct ssh *ssh, Authctxt *authctxt)
 		if (!ssh_packet_is_rekeying(ssh) &&
 		    ssh_packet_not_very_much_data_to_write(ssh))
 			channel_output_poll(ssh);
+		resume_poll(ssh);
 		if (options.rekey_interval > 0 &&
 		    !ssh_packet_is_rekeying(ssh)) {
 			rekey_timeout_ms = ssh_packet_get_rekey_timeout(ssh) *
@@ -372,6 +398,14 @@ server_loop2(struct ssh *ssh, Authctxt *authctxt)
 		} else {
 			rekey_timeout_ms = 0;
 		}
+		/* A detached session gives up if not resumed in time */
+		resume_wait_ms = resume_server_wait(ssh);
+		if (resume_wait_ms != 0 && (rekey_timeout_ms == 0 ||
+		    rekey_timeout_ms > resume_wait_ms))
+			rekey_timeout_ms = resume_wait_ms;
+		/* The transport may have changed */
+		connection_in = ssh_packet_get_connection_in(ssh);
+		connection_out = ssh_packet_get_connection_out(ssh);
 
 		/*
 		 * Block SIGCHLD while we check for dead children, then pass
@@ -383,7 +417,7 @@ server_loop2(struct ssh *ssh, Authctxt *authctxt)
 		collect_children(ssh);
 		wait_until_can_do_something(ssh, connection_in, connection_out,
 		    &pfd, &npfd_alloc, &npfd_active, rekey_timeout_ms, &osigset,
-		    &conn_in_ready, &conn_out_ready);
+		    &conn_in_ready, &conn_out_ready, &resume_ready);
 		if (sigprocmask(SIG_UNBLOCK, &bsigset, &osigset) == -1)
 			error_f("osigset sigprocmask: %s", strerror(errno));
 
@@ -397,6 +431,8 @@ server_loop2(struct ssh *ssh, Authctxt *authctxt)
 
 		if (!ssh_packet_is_rekeying(ssh))
 			channel_after_poll(ssh, pfd, npfd_active);
+		if (resume_ready && resume_server_after_poll(ssh, pfd + 2))
+			continue;
 		if (conn_in_ready &&
 		    process_input(ssh, connection_in) < 0)
 			break;
@@ -420,6 +456,8 @@ server_loop2(struct ssh *ssh, Authctxt *authctxt)
 
 	/* free remaining sessions, e.g. remove wtmp entries */
 	session_destroy_all(ssh, NULL);
+
+	resume_server_cleanup();
 }
 
 static int
@@ -691,17 +729,46 @@ server_input_channel_open(int type, u_int32_t seq, struct ssh *ssh)
 	return 0;
 }
 
+/*
+ * Make the session resumable after a transport drop. The sshd that accepts
+ * the client's new connection finds it by a socket in /tmp, which it can't
+ * see from outside a chroot.
+ */
+static int
+server_input_resume(struct ssh *ssh, struct sshbuf **respp)
+{
+	struct passwd *pw = the_authctxt->pw;
+	struct sshbuf *resp;
+
+	if (pw == NULL || !the_authctxt->valid)
+		return 0;
+	if (options.resume_timeout <= 0 || session_in_chroot()) {
+		debug_f("session resumption not allowed");
+		return 0;
+	}
+	if ((resp = sshbuf_new()) == NULL)
+		fatal_f("sshbuf_new");
+	if (resume_server_start(ssh, options.resume_timeout, resp) != 0) {
+		sshbuf_free(resp);
+		return 0;
+	}
+	*respp = resp;
+	return 1;
+}
+
 static int
 server_input_hostkeys_prove(struct ssh *ssh, struct sshbuf **respp)
 {
 	struct sshbuf *resp = NULL;
 	struct sshbuf *sigbuf = NULL;
-	struct sshkey *key = NULL, *key_pub = NULL, *key_prv = NULL;
+	struct sshkey **keys = NULL, *key_pub, *key_prv;
+	struct hostkey_proof *proofs = NULL;
 	int r, ndx, success = 0;
 	const u_char *blob;
 	const char *sigalg, *kex_rsa_sigalg = NULL;
 	u_char *sig = 0;
 	size_t blen, slen;
+	u_int i, nkeys = 0;
 
 	if ((resp = sshbuf_new()) == NULL || (sigbuf = sshbuf_new()) == NULL)
 		fatal_f("sshbuf_new");
@@ -709,10 +776,15 @@ server_input_hostkeys_prove(struct ssh *ssh, struct sshbuf **respp)
 	    ssh->kex->hostkey_alg)) == KEY_RSA)
 		kex_rsa_sigalg = ssh->kex->hostkey_alg;
 	while (ssh_packet_remaining(ssh) > 0) {
-		sshkey_free(key);
-		key = NULL;
+		if (nkeys >= options.num_host_key_files) {
+			error_f("too many keys");
+			goto out;
+		}
+		keys = xrecallocarray(keys, nkeys, nkeys + 1, sizeof(*keys));
+		proofs = xrecallocarray(proofs, nkeys, nkeys + 1,
+		    sizeof(*proofs));
 		if ((r = sshpkt_get_string_direct(ssh, &blob, &blen)) != 0 ||
-		    (r = sshkey_from_blob(blob, blen, &key)) != 0) {
+		    (r = sshkey_from_blob(blob, blen, &keys[nkeys])) != 0) {
 			error_fr(r, "parse key");
 			goto out;
 		}
@@ -720,28 +792,18 @@ server_input_hostkeys_prove(struct ssh *ssh, struct sshbuf **respp)
 		 * Better check that this is actually one of our hostkeys
 		 * before attempting to sign anything with it.
 		 */
-		if ((ndx = ssh->kex->host_key_index(key, 1, ssh)) == -1) {
-			error_f("unknown host %s key", sshkey_type(key));
+		if ((ndx = ssh->kex->host_key_index(keys[nkeys],
+		    1, ssh)) == -1) {
+			error_f("unknown host %s key", sshkey_type(keys[nkeys]));
+			nkeys++;
 			goto out;
 		}
-		/*
-		 * XXX refactor: make kex->sign just use an index rather
-		 * than passing in public and private keys
-		 */
-		if ((key_prv = get_hostkey_by_index(ndx)) == NULL &&
-		    (key_pub = get_hostkey_public_by_index(ndx, ssh)) == NULL) {
-			error_f("can't retrieve hostkey %d", ndx);
-			goto out;
-		}
-		sshbuf_reset(sigbuf);
-		free(sig);
-		sig = NULL;
 		/*
 		 * For RSA keys, prefer to use the signature type negotiated
 		 * during KEX to the default (SHA1).
 		 */
 		sigalg = NULL;
-		if (sshkey_type_plain(key->type) == KEY_RSA) {
+		if (sshkey_type_plain(keys[nkeys]->type) == KEY_RSA) {
 			if (kex_rsa_sigalg != NULL)
 				sigalg = kex_rsa_sigalg;
 			else if (ssh->kex->flags & KEX_RSA_SHA2_512_SUPPORTED)
@@ -750,28 +812,73 @@ server_input_hostkeys_prove(struct ssh *ssh, struct sshbuf **respp)
 				sigalg = "rsa-sha2-256";
 		}
 		debug3_f("sign %s key (index %d) using sigalg %s",
-		    sshkey_type(key), ndx, sigalg == NULL ? "default" : sigalg);
+		    sshkey_type(keys[nkeys]), ndx,
+		    sigalg == NULL ? "default" : sigalg);
+		proofs[nkeys].ndx = ndx;
+		proofs[nkeys].alg = sigalg == NULL ? NULL : xstrdup(sigalg);
+		nkeys++;
+	}
+
+	/* Let the monitor sign all the proofs at once if it can */
+	if (nkeys > 1 && options.hostkey_proof_threads > 1) {
+		if ((r = sshd_hostkey_sign_proofs(ssh, proofs, nkeys)) != 0) {
+			error_fr(r, "sign proofs");
+			goto out;
+		}
+		for (i = 0; i < nkeys; i++) {
+			if ((r = sshbuf_put_string(resp, proofs[i].sig,
+			    proofs[i].slen)) != 0) {
+				error_fr(r, "assemble signature");
+				goto out;
+			}
+		}
+		goto done;
+	}
+
+	for (i = 0; i < nkeys; i++) {
+		/*
+		 * XXX refactor: make kex->sign just use an index rather
+		 * than passing in public and private keys
+		 */
+		key_pub = NULL;
+		if ((key_prv = get_hostkey_by_index(proofs[i].ndx)) == NULL &&
+		    (key_pub = get_hostkey_public_by_index(proofs[i].ndx,
+		    ssh)) == NULL) {
+			error_f("can't retrieve hostkey %d", proofs[i].ndx);
+			goto out;
+		}
+		sshbuf_reset(sigbuf);
+		free(sig);
+		sig = NULL;
 		if ((r = sshbuf_put_cstring(sigbuf,
 		    "hostkeys-prove-00@openssh.com")) != 0 ||
 		    (r = sshbuf_put_stringb(sigbuf,
 		    ssh->kex->session_id)) != 0 ||
-		    (r = sshkey_puts(key, sigbuf)) != 0 ||
+		    (r = sshkey_puts(keys[i], sigbuf)) != 0 ||
 		    (r = ssh->kex->sign(ssh, key_prv, key_pub, &sig, &slen,
-		    sshbuf_ptr(sigbuf), sshbuf_len(sigbuf), sigalg)) != 0 ||
+		    sshbuf_ptr(sigbuf), sshbuf_len(sigbuf),
+		    proofs[i].alg)) != 0 ||
 		    (r = sshbuf_put_string(resp, sig, slen)) != 0) {
 			error_fr(r, "assemble signature");
 			goto out;
 		}
 	}
+ done:
 	/* Success */
 	*respp = resp;
 	resp = NULL; /* don't free it */
 	success = 1;
  out:
+	for (i = 0; i < nkeys; i++) {
+		sshkey_free(keys[i]);
+		free(proofs[i].alg);
+		free(proofs[i].sig);
+	}
+	free(keys);
+	free(proofs);
 	free(sig);
 	sshbuf_free(resp);
 	sshbuf_free(sigbuf);
-	sshkey_free(key);
 	return success;
 }
 
@@ -866,6 +973,11 @@ server_input_global_request(int type, u_int32_t seq, struct ssh *ssh)
 		success = 1;
 	} else if (strcmp(rtype, "hostkeys-prove-00@openssh.com") == 0) {
 		success = server_input_hostkeys_prove(ssh, &resp);
+	} else if (strcmp(rtype, "resume@hpnssh.org") == 0) {
+		success = server_input_resume(ssh, &resp);
+	} else if (strcmp(rtype, "resume-ack@hpnssh.org") == 0) {
+		if ((r = resume_input_ack(ssh)) != 0)
+			sshpkt_fatal(ssh, r, "%s: parse resume ack", __func__);
 	}
 	/* XXX sshpkt_get_end() */
 	if (want_reply) {
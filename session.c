@@ -94,7 +94,9 @@
 #include "kex.h"
 #include "monitor_wrap.h"
 #include "sftp.h"
+#include "sftp-common.h"
 #include "atomicio.h"
+#include "resume.h"
 
 #if defined(KRB5) && defined(USE_AFS)
 #include <kafs.h>
@@ -128,6 +130,7 @@ int	check_quietlogin(Session *, const char *);
 static void do_authenticated2(struct ssh *, Authctxt *);
 
 static int session_pty_req(struct ssh *, Session *);
+static int do_exec_sftp_inproc(struct ssh *, Session *, const char *);
 
 /* import */
 extern ServerOptions options;
@@ -160,6 +163,9 @@ login_cap_t *lc;
 static int is_child = 0;
 static int in_chroot = 0;
 
+/* Session running internal-sftp inside this process, or -1 */
+static int inproc_sftp_session = -1;
+
 /* File containing userauth info, if ExposeAuthInfo set */
 static char *auth_info_file = NULL;
 
@@ -356,6 +362,7 @@ do_authenticated(struct ssh *ssh, Authctxt *authctxt)
 		else
 			channel_permit_all(ssh, FORWARD_REMOTE);
 	}
+	channel_set_idle_timeout(ssh, options.channel_idle_timeout);
 	auth_debug_send(ssh);
 
 	prepare_auth_info_file(authctxt->pw, authctxt->session_info);
@@ -381,6 +388,46 @@ xauth_valid_string(const char *s)
 }
 
 #define USE_PIPES 1
+/*
+ * Enlarge the buffer of a pipe or socket used to talk to a session's child
+ * as requested by SessionPipeSize, so that bulk transfers move in fewer,
+ * larger reads and writes.
+ */
+static void
+session_resize_pipe(int fd)
+{
+#if defined(USE_PIPES) && defined(F_SETPIPE_SZ)
+	static int max_size = -1;
+	int size = options.session_pipe_size;
+	FILE *f;
+
+	if (size <= 0)
+		return;
+	/* Unprivileged users may not exceed the system limit */
+	if (max_size == -1) {
+		max_size = 0;
+		if ((f = fopen("/proc/sys/fs/pipe-max-size", "r")) != NULL) {
+			if (fscanf(f, "%d", &max_size) != 1)
+				max_size = 0;
+			fclose(f);
+		}
+	}
+	if (max_size > 0 && size > max_size)
+		size = max_size;
+	if (fcntl(fd, F_SETPIPE_SZ, size) == -1)
+		debug_f("F_SETPIPE_SZ %d: %s", size, strerror(errno));
+#elif !defined(USE_PIPES)
+	int size = options.session_pipe_size;
+
+	if (size <= 0)
+		return;
+	if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) == -1)
+		debug_f("SO_SNDBUF %d: %s", size, strerror(errno));
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) == -1)
+		debug_f("SO_RCVBUF %d: %s", size, strerror(errno));
+#endif
+}
+
 /*
  * This is called to fork and execute a command when we have no tty.  This
  * will call do_child from the child, and server_loop from the parent after
@@ -415,6 +462,8 @@ do_exec_no_pty(struct ssh *ssh, Session *s, const char *command)
 		close(pout[1]);
 		return -1;
 	}
+	session_resize_pipe(pin[1]);
+	session_resize_pipe(pout[0]);
 #else
 	int inout[2], err[2];
 
@@ -432,6 +481,8 @@ do_exec_no_pty(struct ssh *ssh, Session *s, const char *command)
 		close(inout[1]);
 		return -1;
 	}
+	session_resize_pipe(inout[0]);
+	session_resize_pipe(inout[1]);
 #endif
 
 	session_proctitle(s);
@@ -719,6 +770,9 @@ do_exec(struct ssh *ssh, Session *s, const char *command)
 #endif
 	if (s->ttyfd != -1)
 		ret = do_exec_pty(ssh, s, command);
+	else if (s->is_subsystem == SUBSYSTEM_INT_SFTP &&
+	    do_exec_sftp_inproc(ssh, s, command) == 0)
+		ret = 0;
 	else
 		ret = do_exec_no_pty(ssh, s, command);
 
@@ -1716,6 +1770,90 @@ do_child(struct ssh *ssh, Session *s, const char *command)
 	exit(1);
 }
 
+static int
+session_sftp_inproc(struct ssh *ssh, int id, struct sshbuf **inp,
+    struct sshbuf **outp, size_t limit, int eof, void *ctx)
+{
+	int r, status;
+
+	if ((status = sftp_server_inproc_exchange(inp, outp, limit,
+	    eof)) == -1)
+		return 0;
+	debug_f("channel %d: internal-sftp exited with status %d",
+	    id, status);
+	sftp_server_inproc_cleanup();
+	inproc_sftp_session = -1;
+	channel_request_start(ssh, id, "exit-status", 0);
+	if ((r = sshpkt_put_u32(ssh, status)) != 0 ||
+	    (r = sshpkt_send(ssh)) != 0)
+		sshpkt_fatal(ssh, r, "%s: exit reply", __func__);
+	/* As for an exited child, close the channel once it has drained */
+	channel_register_cleanup(ssh, id, session_close_by_channel, 1);
+	return -1;
+}
+
+/*
+ * Run internal-sftp inside this process, on a thread that works on the
+ * session channel's buffers, instead of in a child that sshd relays to
+ * over pipes. This is only done when this process already runs as the
+ * user and inside any ChrootDirectory, as it does after the privilege
+ * separation post-auth drop. Returns -1 if the session should use a child
+ * process as usual.
+ */
+static int
+do_exec_sftp_inproc(struct ssh *ssh, Session *s, const char *command)
+{
+	extern int optind, optreset;
+	char *p, *args, *argv[ARGV_MAX];
+	u_int window;
+	int i, r, wakefd;
+
+	if (!options.inprocess_sftp || inproc_sftp_session != -1)
+		return -1;
+	if (s->authctxt->force_pwchange ||
+	    getuid() != s->pw->pw_uid || geteuid() != s->pw->pw_uid ||
+	    (options.chroot_directory != NULL &&
+	    strcasecmp(options.chroot_directory, "none") != 0))
+		return -1;
+#ifdef WITH_SELINUX
+	/* The forked server changes to its own SELinux context */
+	if (ssh_selinux_enabled())
+		return -1;
+#endif
+	if (s->chanid == -1)
+		fatal("no channel for session %d", s->self);
+
+	args = xstrdup(command ? command : "sftp-server");
+	for (i = 0, (p = strtok(args, " ")); p; (p = strtok(NULL, " ")))
+		if (i < ARGV_MAX - 1)
+			argv[i++] = p;
+	argv[i] = NULL;
+	optind = optreset = 1;
+	if (chdir(s->pw->pw_dir) == -1 && !in_chroot)
+		debug("Could not chdir to home directory %s: %s",
+		    s->pw->pw_dir, strerror(errno));
+	r = sftp_server_inproc_init(i, argv, s->pw, ssh_remote_ipaddr(ssh),
+	    &wakefd);
+	free(args);
+	if (r != 0) {
+		debug_f("session %d: arguments need a separate process",
+		    s->self);
+		return -1;
+	}
+	debug_f("session %d: running internal-sftp in process", s->self);
+	inproc_sftp_session = s->self;
+	/*
+	 * Requests are only consumed once complete, so the window must
+	 * have room for the largest one with some to spare.
+	 */
+	window = options.hpn_disabled ? CHAN_SES_WINDOW_DEFAULT :
+	    options.hpn_buffer_size;
+	window = MAXIMUM(window, 2 * SFTP_MAX_MSG_LENGTH);
+	channel_set_inproc(ssh, s->chanid, session_sftp_inproc, NULL, wakefd,
+	    window);
+	return 0;
+}
+
 void
 session_unused(int id)
 {
@@ -2253,6 +2391,9 @@ session_set_fds(struct ssh *ssh, Session *s,
 		fdout, fdin, fderr,
 		ignore_fderr ? CHAN_EXTENDED_IGNORE : CHAN_EXTENDED_READ,
 		1, is_tty, options.hpn_disabled ? CHAN_SES_WINDOW_DEFAULT : options.hpn_buffer_size);
+	if (is_tty && options.pty_coalesce_size > 0)
+		channel_set_coalesce(ssh, s->chanid, options.pty_coalesce_size,
+		    options.pty_coalesce_usec);
 }
 
 /*
@@ -2432,6 +2573,10 @@ session_close(struct ssh *ssh, Session *s)
 
 	if (s->ttyfd != -1)
 		session_pty_cleanup(s);
+	if (s->self == inproc_sftp_session) {
+		sftp_server_inproc_cleanup();
+		inproc_sftp_session = -1;
+	}
 	free(s->term);
 	free(s->display);
 	free(s->x11_chanids);
@@ -2682,6 +2827,9 @@ do_cleanup(struct ssh *ssh, Authctxt *authctxt)
 	/* remove agent socket */
 	auth_sock_cleanup_proc(authctxt->pw);
 
+	/* stop listening for the session to be resumed */
+	resume_server_cleanup();
+
 	/* remove userauth info */
 	if (auth_info_file != NULL) {
 		temporarily_use_uid(authctxt->pw);
@@ -2699,6 +2847,12 @@ do_cleanup(struct ssh *ssh, Authctxt *authctxt)
 		session_destroy_all(ssh, session_pty_cleanup2);
 }
 
+int
+session_in_chroot(void)
+{
+	return in_chroot;
+}
+
 /* Return a name for the remote host that fits inside utmp_size */
 
 const char *
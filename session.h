@@ -78,6 +78,7 @@ Session	*session_new(void);
 Session	*session_by_tty(char *);
 void	 session_close(struct ssh *, Session *);
 void	 do_setusercontext(struct passwd *);
+int	 session_in_chroot(void);
 
 const char	*session_get_remote_name_or_ip(struct ssh *, u_int, int);
 
@@ -60,6 +60,8 @@
 #include "progressmeter.h"
 #include "misc.h"
 #include "utf8.h"
+#include "digest.h"
+#include "dirwalk.h"
 
 #include "sftp.h"
 #include "sftp-common.h"
@@ -81,6 +83,16 @@ extern int showprogress;
 /* Maximum depth to descend in directory trees */
 #define MAX_DIR_DEPTH 64
 
+/* Most directory listings kept in the cache */
+#define SFTP_DIRCACHE_MAX	256
+
+/* Listings with more entries or bytes of names are not cached */
+#define SFTP_DIRCACHE_MAX_ENTS	4096
+#define SFTP_DIRCACHE_MAX_BYTES	(512 * 1024)
+
+/* Most subdirectories listed ahead by sftp_dircache_prefetch() */
+#define SFTP_DIRCACHE_PREFETCH	32
+
 /* Directory separator characters */
 #ifdef HAVE_CYGWIN
 # define SFTP_DIRECTORY_CHARS      "/\\"
@@ -88,6 +100,15 @@ extern int showprogress;
 # define SFTP_DIRECTORY_CHARS      "/"
 #endif /* HAVE_CYGWIN */
 
+/* A cached directory listing */
+struct dircache_entry {
+	char *path;
+	struct sftp_dirlist *list;
+	time_t fetched;
+	TAILQ_ENTRY(dircache_entry) next;
+};
+TAILQ_HEAD(dircache, dircache_entry);
+
 struct sftp_conn {
 	int fd_in;
 	int fd_out;
@@ -105,9 +126,15 @@ struct sftp_conn {
 #define SFTP_EXT_LIMITS		0x00000040
 #define SFTP_EXT_PATH_EXPAND	0x00000080
 #define SFTP_EXT_COPY_DATA	0x00000100
+#define SFTP_EXT_DIGEST_HANDLE	0x00000200
 	u_int exts;
 	u_int64_t limit_kbps;
 	struct bwlimit bwlimit_in, bwlimit_out;
+	struct dircache dircache;	/* most recently used first */
+	u_int dircache_len;
+	u_int dircache_ttl;		/* seconds; 0 disables the cache */
+	char *dircache_prefetch;	/* list its subdirs on first use */
+	int verify;			/* check transfers with a digest */
 };
 
 /* Tracks in-progress requests during file transfers */
@@ -468,6 +495,7 @@ do_init(int fd_in, int fd_out, u_int transfer_buflen, u_int num_requests,
 	    num_requests ? num_requests : DEFAULT_NUM_REQUESTS;
 	ret->exts = 0;
 	ret->limit_kbps = 0;
+	TAILQ_INIT(&ret->dircache);
 
 	if ((msg = sshbuf_new()) == NULL)
 		fatal_f("sshbuf_new failed");
@@ -540,6 +568,10 @@ do_init(int fd_in, int fd_out, u_int transfer_buflen, u_int num_requests,
 		    strcmp((char *)value, "1") == 0) {
 			ret->exts |= SFTP_EXT_COPY_DATA;
 			known = 1;
+		} else if (strcmp(name, "digest-handle@hpnssh.org") == 0 &&
+		    strcmp((char *)value, "1") == 0) {
+			ret->exts |= SFTP_EXT_DIGEST_HANDLE;
+			known = 1;
 		}
 		if (known) {
 			debug2("Server supports extension \"%s\" revision %s",
@@ -682,14 +714,76 @@ do_close(struct sftp_conn *conn, const u_char *handle, u_int handle_len)
 }
 
 
+/*
+ * Decode the entries of a SSH2_FXP_NAME reply to a READDIR, appending
+ * them to *dir (if dir is not NULL), which holds *ents entries so far.
+ * The number of entries in the reply is returned in *countp.
+ */
+static int
+decode_dirents(struct sshbuf *msg, const char *path, int print_flag,
+    SFTP_DIRENT ***dir, u_int *ents, u_int *countp)
+{
+	u_int count, i;
+	int r;
+
+	if ((r = sshbuf_get_u32(msg, &count)) != 0)
+		fatal_fr(r, "parse count");
+	if (count > SSHBUF_SIZE_MAX)
+		fatal_f("nonsensical number of entries");
+	*countp = count;
+	debug3("Received %d SSH2_FXP_NAME responses", count);
+	for (i = 0; i < count; i++) {
+		char *filename, *longname;
+		Attrib a;
+
+		if ((r = sshbuf_get_cstring(msg, &filename, NULL)) != 0 ||
+		    (r = sshbuf_get_cstring(msg, &longname, NULL)) != 0)
+			fatal_fr(r, "parse filenames");
+		if ((r = decode_attrib(msg, &a)) != 0) {
+			error_fr(r, "couldn't decode attrib");
+			free(filename);
+			free(longname);
+			return -1;
+		}
+
+		if (print_flag)
+			mprintf("%s\n", longname);
+
+		/*
+		 * Directory entries should never contain '/'
+		 * These can be used to attack recursive ops
+		 * (e.g. send '../../../../etc/passwd')
+		 */
+		if (strpbrk(filename, SFTP_DIRECTORY_CHARS) != NULL) {
+			error("Server sent suspect path \"%s\" "
+			    "during readdir of \"%s\"", filename, path);
+		} else if (dir) {
+			*dir = xreallocarray(*dir, *ents + 2, sizeof(**dir));
+			(*dir)[*ents] = xcalloc(1, sizeof(***dir));
+			(*dir)[*ents]->filename = xstrdup(filename);
+			(*dir)[*ents]->longname = xstrdup(longname);
+			memcpy(&(*dir)[*ents]->a, &a, sizeof(a));
+			(*dir)[++(*ents)] = NULL;
+		}
+		free(filename);
+		free(longname);
+	}
+	return 0;
+}
+
+/*
+ * List 'path', either collecting the entries in *dir or, if 'cb' is set,
+ * passing each reply's worth of entries to it as they arrive.
+ */
 static int
 do_lsreaddir(struct sftp_conn *conn, const char *path, int print_flag,
-    SFTP_DIRENT ***dir)
+    SFTP_DIRENT ***dir, int (*cb)(SFTP_DIRENT **, void *), void *cbctx)
 {
 	struct sshbuf *msg;
-	u_int count, id, i, expected_id, ents = 0;
+	u_int count, id, expected_id, ents = 0;
 	size_t handle_len;
 	u_char type, *handle;
+	SFTP_DIRENT **batch;
 	int status = SSH2_FX_FAILURE;
 	int r;
 
@@ -758,51 +852,24 @@ do_lsreaddir(struct sftp_conn *conn, const char *path, int print_flag,
 			fatal("Expected SSH2_FXP_NAME(%u) packet, got %u",
 			    SSH2_FXP_NAME, type);
 
-		if ((r = sshbuf_get_u32(msg, &count)) != 0)
-			fatal_fr(r, "parse count");
-		if (count > SSHBUF_SIZE_MAX)
-			fatal_f("nonsensical number of entries");
-		if (count == 0)
-			break;
-		debug3("Received %d SSH2_FXP_NAME responses", count);
-		for (i = 0; i < count; i++) {
-			char *filename, *longname;
-			Attrib a;
-
-			if ((r = sshbuf_get_cstring(msg, &filename,
-			    NULL)) != 0 ||
-			    (r = sshbuf_get_cstring(msg, &longname,
-			    NULL)) != 0)
-				fatal_fr(r, "parse filenames");
-			if ((r = decode_attrib(msg, &a)) != 0) {
-				error_fr(r, "couldn't decode attrib");
-				free(filename);
-				free(longname);
+		if (cb != NULL) {
+			/* Only one reply's entries are held at a time */
+			ents = 0;
+			batch = xcalloc(1, sizeof(*batch));
+			if (decode_dirents(msg, path, print_flag, &batch,
+			    &ents, &count) != 0) {
+				free_sftp_dirents(batch);
 				goto out;
 			}
-
-			if (print_flag)
-				mprintf("%s\n", longname);
-
-			/*
-			 * Directory entries should never contain '/'
-			 * These can be used to attack recursive ops
-			 * (e.g. send '../../../../etc/passwd')
-			 */
-			if (strpbrk(filename, SFTP_DIRECTORY_CHARS) != NULL) {
-				error("Server sent suspect path \"%s\" "
-				    "during readdir of \"%s\"", filename, path);
-			} else if (dir) {
-				*dir = xreallocarray(*dir, ents + 2, sizeof(**dir));
-				(*dir)[ents] = xcalloc(1, sizeof(***dir));
-				(*dir)[ents]->filename = xstrdup(filename);
-				(*dir)[ents]->longname = xstrdup(longname);
-				memcpy(&(*dir)[ents]->a, &a, sizeof(a));
-				(*dir)[++ents] = NULL;
-			}
-			free(filename);
-			free(longname);
-		}
+			r = ents == 0 ? 0 : cb(batch, cbctx);
+			free_sftp_dirents(batch);
+			if (r != 0)
+				break;
+		} else if (decode_dirents(msg, path, print_flag, dir, &ents,
+		    &count) != 0)
+			goto out;
+		if (count == 0)
+			break;
 	}
 	status = 0;
 
@@ -828,7 +895,14 @@ do_lsreaddir(struct sftp_conn *conn, const char *path, int print_flag,
 int
 do_readdir(struct sftp_conn *conn, const char *path, SFTP_DIRENT ***dir)
 {
-	return(do_lsreaddir(conn, path, 0, dir));
+	return(do_lsreaddir(conn, path, 0, dir, NULL, NULL));
+}
+
+int
+do_readdir_stream(struct sftp_conn *conn, const char *path,
+    int (*cb)(SFTP_DIRENT **, void *), void *ctx)
+{
+	return(do_lsreaddir(conn, path, 0, NULL, cb, ctx));
 }
 
 void free_sftp_dirents(SFTP_DIRENT **s)
@@ -845,6 +919,414 @@ void free_sftp_dirents(SFTP_DIRENT **s)
 	free(s);
 }
 
+static size_t
+dirents_bytes(SFTP_DIRENT **d, u_int from, u_int to)
+{
+	size_t n = 0;
+
+	for (; from < to; from++)
+		n += strlen(d[from]->filename) + strlen(d[from]->longname);
+	return n;
+}
+
+static int
+dirent_name_comp(const void *aa, const void *bb)
+{
+	const SFTP_DIRENT *a = *(SFTP_DIRENT * const *)aa;
+	const SFTP_DIRENT *b = *(SFTP_DIRENT * const *)bb;
+
+	return strcmp(a->filename, b->filename);
+}
+
+/* Takes ownership of 'dir' */
+static struct sftp_dirlist *
+dirlist_new(SFTP_DIRENT **dir)
+{
+	struct sftp_dirlist *list;
+
+	list = xcalloc(1, sizeof(*list));
+	list->dir = dir;
+	for (list->nents = 0; dir[list->nents] != NULL; list->nents++)
+		;
+	list->bytes = dirents_bytes(dir, 0, list->nents);
+	list->refs = 1;
+	return list;
+}
+
+void
+sftp_dirlist_free(struct sftp_dirlist *list)
+{
+	if (list == NULL || --list->refs > 0)
+		return;
+	free(list->byname);
+	free_sftp_dirents(list->dir);
+	free(list);
+}
+
+/* Cache keys are paths without trailing slashes */
+static char *
+dircache_key(const char *path)
+{
+	char *key = xstrdup(path);
+	size_t len = strlen(key);
+
+	while (len > 1 && key[len - 1] == '/')
+		key[--len] = '\0';
+	return key;
+}
+
+static void
+dircache_remove(struct sftp_conn *conn, struct dircache_entry *e)
+{
+	TAILQ_REMOVE(&conn->dircache, e, next);
+	conn->dircache_len--;
+	free(e->path);
+	sftp_dirlist_free(e->list);
+	free(e);
+}
+
+static struct dircache_entry *
+dircache_lookup(struct sftp_conn *conn, const char *path)
+{
+	struct dircache_entry *e, *tmp;
+	time_t now = monotime();
+	char *key;
+
+	if (conn->dircache_ttl == 0)
+		return NULL;
+	key = dircache_key(path);
+	TAILQ_FOREACH_SAFE(e, &conn->dircache, next, tmp) {
+		if (now - e->fetched >= (time_t)conn->dircache_ttl) {
+			dircache_remove(conn, e);
+			continue;
+		}
+		if (strcmp(e->path, key) == 0)
+			break;
+	}
+	free(key);
+	if (e != NULL && e != TAILQ_FIRST(&conn->dircache)) {
+		TAILQ_REMOVE(&conn->dircache, e, next);
+		TAILQ_INSERT_HEAD(&conn->dircache, e, next);
+	}
+	return e;
+}
+
+/* Adds a reference to 'list' if it is kept */
+static void
+dircache_store(struct sftp_conn *conn, const char *path,
+    struct sftp_dirlist *list)
+{
+	struct dircache_entry *e;
+
+	if (conn->dircache_ttl == 0)
+		return;
+	if (list->nents > SFTP_DIRCACHE_MAX_ENTS ||
+	    list->bytes > SFTP_DIRCACHE_MAX_BYTES) {
+		debug3_f("not caching \"%s\": %u entries, %zu bytes",
+		    path, list->nents, list->bytes);
+		return;
+	}
+	if ((e = dircache_lookup(conn, path)) != NULL)
+		dircache_remove(conn, e);
+	while (conn->dircache_len >= SFTP_DIRCACHE_MAX)
+		dircache_remove(conn, TAILQ_LAST(&conn->dircache, dircache));
+	/* index the names for sftp_dircache_stat() */
+	if (list->byname == NULL && list->nents > 0) {
+		list->byname = xcalloc(list->nents, sizeof(*list->byname));
+		memcpy(list->byname, list->dir,
+		    list->nents * sizeof(*list->byname));
+		qsort(list->byname, list->nents, sizeof(*list->byname),
+		    dirent_name_comp);
+	}
+	e = xcalloc(1, sizeof(*e));
+	e->path = dircache_key(path);
+	e->list = list;
+	list->refs++;
+	e->fetched = monotime();
+	TAILQ_INSERT_HEAD(&conn->dircache, e, next);
+	conn->dircache_len++;
+}
+
+void
+sftp_dircache_enable(struct sftp_conn *conn, u_int ttl)
+{
+	sftp_dircache_flush(conn);
+	conn->dircache_ttl = ttl;
+}
+
+void
+sftp_dircache_flush(struct sftp_conn *conn)
+{
+	struct dircache_entry *e;
+
+	while ((e = TAILQ_FIRST(&conn->dircache)) != NULL)
+		dircache_remove(conn, e);
+	free(conn->dircache_prefetch);
+	conn->dircache_prefetch = NULL;
+}
+
+static void dircache_fetch_many(struct sftp_conn *, char **, u_int);
+
+/*
+ * The first time a subdirectory of the directory passed to
+ * sftp_dircache_prefetch() is listed, list its siblings along with it.
+ */
+static void
+dircache_prefetch_run(struct sftp_conn *conn, const char *path)
+{
+	struct dircache_entry *e;
+	struct sftp_dirlist *list;
+	char *key, *cp, **paths, *p;
+	u_int i, n = 0;
+
+	if (conn->dircache_prefetch == NULL)
+		return;
+	key = dircache_key(path);
+	if ((cp = strrchr(key, '/')) == NULL || cp[1] == '\0') {
+		free(key);
+		return;
+	}
+	*cp = '\0';
+	if (strcmp(*key == '\0' ? "/" : key, conn->dircache_prefetch) != 0 ||
+	    (e = dircache_lookup(conn, conn->dircache_prefetch)) == NULL) {
+		free(key);
+		return;
+	}
+	*cp = '/';
+	free(conn->dircache_prefetch);
+	conn->dircache_prefetch = NULL;
+
+	list = e->list;
+	list->refs++;
+	paths = xcalloc(SFTP_DIRCACHE_PREFETCH, sizeof(*paths));
+	paths[n++] = key;
+	for (i = 0; i < list->nents && n < SFTP_DIRCACHE_PREFETCH; i++) {
+		if (strcmp(list->dir[i]->filename, ".") == 0 ||
+		    strcmp(list->dir[i]->filename, "..") == 0 ||
+		    !(list->dir[i]->a.flags & SSH2_FILEXFER_ATTR_PERMISSIONS) ||
+		    !S_ISDIR(list->dir[i]->a.perm))
+			continue;
+		p = path_append(e->path, list->dir[i]->filename);
+		if (strcmp(p, key) == 0 || dircache_lookup(conn, p) != NULL) {
+			free(p);
+			continue;
+		}
+		paths[n++] = p;
+	}
+	sftp_dirlist_free(list);
+
+	dircache_fetch_many(conn, paths, n);
+	for (i = 0; i < n; i++)
+		free(paths[i]);
+	free(paths);
+}
+
+int
+do_readdir_cached(struct sftp_conn *conn, const char *path,
+    struct sftp_dirlist **listp)
+{
+	struct dircache_entry *e;
+	SFTP_DIRENT **dir;
+	int r;
+
+	*listp = NULL;
+	if ((e = dircache_lookup(conn, path)) == NULL) {
+		dircache_prefetch_run(conn, path);
+		e = dircache_lookup(conn, path);
+	}
+	if (e != NULL) {
+		debug3_f("using cached listing of \"%s\"", path);
+		e->list->refs++;
+		*listp = e->list;
+		return 0;
+	}
+	if ((r = do_readdir(conn, path, &dir)) != 0) {
+		free_sftp_dirents(dir);
+		return r;
+	}
+	*listp = dirlist_new(dir);
+	/* Interrupted listings come back empty and mustn't be kept */
+	if (!interrupted)
+		dircache_store(conn, path, *listp);
+	return 0;
+}
+
+int
+sftp_dircache_stat(struct sftp_conn *conn, const char *path, int follow,
+    Attrib *a)
+{
+	struct dircache_entry *e;
+	SFTP_DIRENT want, *wantp = &want, **found;
+	char *key, *name;
+	int ret = -1;
+
+	if (conn->dircache_ttl == 0)
+		return -1;
+	key = dircache_key(path);
+	if ((name = strrchr(key, '/')) == NULL || name[1] == '\0' ||
+	    strcmp(name + 1, ".") == 0 || strcmp(name + 1, "..") == 0)
+		goto out;
+	*name++ = '\0';
+	if ((e = dircache_lookup(conn, *key == '\0' ? "/" : key)) == NULL ||
+	    e->list->byname == NULL)
+		goto out;
+	want.filename = name;
+	if ((found = bsearch(&wantp, e->list->byname, e->list->nents,
+	    sizeof(*e->list->byname), dirent_name_comp)) == NULL)
+		goto out;
+	/* A listing doesn't say where a symlink points */
+	if (follow && ((*found)->a.flags & SSH2_FILEXFER_ATTR_PERMISSIONS) &&
+	    S_ISLNK((*found)->a.perm))
+		goto out;
+	memcpy(a, &(*found)->a, sizeof(*a));
+	ret = 0;
+ out:
+	free(key);
+	return ret;
+}
+
+/* State of one directory in a pipelined listing of several */
+struct dircache_fetch {
+	char *path;
+	u_int id;		/* outstanding request */
+	u_char *handle;
+	size_t handle_len;
+	SFTP_DIRENT **dir;
+	u_int ents;
+	size_t bytes;
+	int eof, failed, closing;
+};
+
+/*
+ * List several directories into the cache at once, keeping a request
+ * outstanding for each so the whole batch costs a few round trips rather
+ * than a few per directory.
+ */
+static void
+dircache_fetch_many(struct sftp_conn *conn, char **paths, u_int n)
+{
+	struct dircache_fetch *f, *fetches;
+	struct sftp_dirlist *list;
+	struct sshbuf *msg;
+	u_int i, id, status, count, first, outstanding = 0;
+	u_char type;
+	int r;
+
+	if (n == 0)
+		return;
+	if ((msg = sshbuf_new()) == NULL)
+		fatal_f("sshbuf_new failed");
+	fetches = xcalloc(n, sizeof(*fetches));
+	for (i = 0; i < n; i++) {
+		f = &fetches[i];
+		f->path = paths[i];
+		f->id = conn->msg_id++;
+		debug3("Sending SSH2_FXP_OPENDIR I:%u \"%s\"", f->id, f->path);
+		send_string_request(conn, f->id, SSH2_FXP_OPENDIR,
+		    f->path, strlen(f->path));
+		outstanding++;
+	}
+
+	while (outstanding > 0) {
+		sshbuf_reset(msg);
+		get_msg(conn, msg);
+		if ((r = sshbuf_get_u8(msg, &type)) != 0 ||
+		    (r = sshbuf_get_u32(msg, &id)) != 0)
+			fatal_fr(r, "parse");
+		debug3("Received reply T:%u I:%u", type, id);
+		for (i = 0; i < n && fetches[i].id != id; i++)
+			;
+		if (i >= n)
+			fatal("Unexpected reply %u", id);
+		f = &fetches[i];
+		outstanding--;
+
+		switch (type) {
+		case SSH2_FXP_HANDLE:
+			if (f->handle != NULL)
+				fatal("Unexpected SSH2_FXP_HANDLE I:%u", id);
+			if ((r = sshbuf_get_string(msg, &f->handle,
+			    &f->handle_len)) != 0)
+				fatal_fr(r, "parse handle");
+			f->dir = xcalloc(1, sizeof(*f->dir));
+			break;
+		case SSH2_FXP_NAME:
+			if (f->handle == NULL || f->closing)
+				fatal("Unexpected SSH2_FXP_NAME I:%u", id);
+			first = f->ents;
+			if (decode_dirents(msg, f->path, 0, &f->dir,
+			    &f->ents, &count) != 0)
+				f->failed = 1;
+			else if (count == 0)
+				f->eof = 1;
+			f->bytes += dirents_bytes(f->dir, first, f->ents);
+			/* too big to cache, don't read the rest */
+			if (f->ents > SFTP_DIRCACHE_MAX_ENTS ||
+			    f->bytes > SFTP_DIRCACHE_MAX_BYTES) {
+				debug2("prefetch of \"%s\" stopped at %u "
+				    "entries", f->path, f->ents);
+				f->failed = 1;
+			}
+			break;
+		case SSH2_FXP_STATUS:
+			if ((r = sshbuf_get_u32(msg, &status)) != 0)
+				fatal_fr(r, "parse status");
+			/* Reply to OPENDIR or CLOSE: nothing more to send */
+			if (f->handle == NULL) {
+				debug2("prefetch of \"%s\" failed: %s",
+				    f->path, fx2txt(status));
+				f->failed = 1;
+				continue;
+			}
+			if (f->closing)
+				continue;
+			if (status == SSH2_FX_EOF)
+				f->eof = 1;
+			else
+				f->failed = 1;
+			break;
+		default:
+			fatal("Expected SSH2_FXP_NAME(%u) packet, got %u",
+			    SSH2_FXP_NAME, type);
+		}
+
+		f->id = conn->msg_id++;
+		if (f->eof || f->failed || interrupted) {
+			f->closing = 1;
+			send_string_request(conn, f->id, SSH2_FXP_CLOSE,
+			    (const char *)f->handle, f->handle_len);
+		} else {
+			send_string_request(conn, f->id, SSH2_FXP_READDIR,
+			    (const char *)f->handle, f->handle_len);
+		}
+		outstanding++;
+	}
+
+	for (i = 0; i < n; i++) {
+		f = &fetches[i];
+		if (f->eof && !f->failed && !interrupted) {
+			debug3_f("cached \"%s\" (%u entries)", f->path,
+			    f->ents);
+			list = dirlist_new(f->dir);
+			dircache_store(conn, f->path, list);
+			sftp_dirlist_free(list);
+		} else
+			free_sftp_dirents(f->dir);
+		free(f->handle);
+	}
+	free(fetches);
+	sshbuf_free(msg);
+}
+
+void
+sftp_dircache_prefetch(struct sftp_conn *conn, const char *path)
+{
+	free(conn->dircache_prefetch);
+	conn->dircache_prefetch = NULL;
+	if (conn->dircache_ttl != 0)
+		conn->dircache_prefetch = dircache_key(path);
+}
+
 int
 do_rm(struct sftp_conn *conn, const char *path)
 {
@@ -1350,6 +1832,117 @@ do_fsync(struct sftp_conn *conn, u_char *handle, u_int handle_len)
 	return status == SSH2_FX_OK ? 0 : -1;
 }
 
+int
+sftp_verify_enable(struct sftp_conn *conn)
+{
+	if ((conn->exts & SFTP_EXT_DIGEST_HANDLE) == 0) {
+		error("Server does not support digest-handle@hpnssh.org "
+		    "extension");
+		return -1;
+	}
+	conn->verify = 1;
+	return 0;
+}
+
+/* Have the server start a digest of the data passing through 'handle' */
+static int
+digest_begin(struct sftp_conn *conn, const u_char *handle, u_int handle_len,
+    struct sftp_digest *d)
+{
+	struct sshbuf *msg;
+	u_int status, id;
+	int r;
+
+	if ((msg = sshbuf_new()) == NULL)
+		fatal_f("sshbuf_new failed");
+	id = conn->msg_id++;
+	if ((r = sshbuf_put_u8(msg, SSH2_FXP_EXTENDED)) != 0 ||
+	    (r = sshbuf_put_u32(msg, id)) != 0 ||
+	    (r = sshbuf_put_cstring(msg, "digest-handle@hpnssh.org")) != 0 ||
+	    (r = sshbuf_put_string(msg, handle, handle_len)) != 0 ||
+	    (r = sshbuf_put_u8(msg, SFTP_DIGEST_BEGIN)) != 0 ||
+	    (r = sshbuf_put_cstring(msg, SFTP_DIGEST_ALG)) != 0)
+		fatal_fr(r, "compose");
+	send_msg(conn, msg);
+	debug3("Sent message digest-handle@hpnssh.org I:%u", id);
+	sshbuf_free(msg);
+
+	if ((status = get_status(conn, id)) != SSH2_FX_OK) {
+		error("remote digest: %s", fx2txt(status));
+		return -1;
+	}
+	if ((r = sftp_digest_start(d, SFTP_DIGEST_ALG)) != 0) {
+		error_fr(r, "start digest");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Fetch the server's digest for 'handle' and compare it with ours for the
+ * local file 'path'.
+ */
+static int
+digest_check(struct sftp_conn *conn, const u_char *handle, u_int handle_len,
+    struct sftp_digest *d, const char *path)
+{
+	struct sshbuf *msg;
+	u_char type, *rdigest = NULL, digest[SSH_DIGEST_MAX_LENGTH];
+	size_t rlen, len;
+	u_int id, rid, status;
+	int r, ret = -1;
+
+	if ((msg = sshbuf_new()) == NULL)
+		fatal_f("sshbuf_new failed");
+	id = conn->msg_id++;
+	if ((r = sshbuf_put_u8(msg, SSH2_FXP_EXTENDED)) != 0 ||
+	    (r = sshbuf_put_u32(msg, id)) != 0 ||
+	    (r = sshbuf_put_cstring(msg, "digest-handle@hpnssh.org")) != 0 ||
+	    (r = sshbuf_put_string(msg, handle, handle_len)) != 0 ||
+	    (r = sshbuf_put_u8(msg, SFTP_DIGEST_END)) != 0 ||
+	    (r = sshbuf_put_cstring(msg, SFTP_DIGEST_ALG)) != 0)
+		fatal_fr(r, "compose");
+	send_msg(conn, msg);
+	debug3("Sent message digest-handle@hpnssh.org I:%u", id);
+
+	sshbuf_reset(msg);
+	get_msg(conn, msg);
+	if ((r = sshbuf_get_u8(msg, &type)) != 0 ||
+	    (r = sshbuf_get_u32(msg, &rid)) != 0)
+		fatal_fr(r, "parse");
+	if (rid != id)
+		fatal("ID mismatch (%u != %u)", rid, id);
+	if (type == SSH2_FXP_STATUS) {
+		if ((r = sshbuf_get_u32(msg, &status)) != 0)
+			fatal_fr(r, "parse status");
+		error("remote digest: %s", fx2txt(status));
+		goto out;
+	}
+	if (type != SSH2_FXP_EXTENDED_REPLY)
+		fatal("Expected SSH2_FXP_EXTENDED_REPLY(%u) packet, got %u",
+		    SSH2_FXP_EXTENDED_REPLY, type);
+	if ((r = sshbuf_get_string(msg, &rdigest, &rlen)) != 0)
+		fatal_fr(r, "parse digest");
+
+	if ((r = sftp_digest_final(d, path, digest, sizeof(digest))) != 0) {
+		error_fr(r, "digest local \"%s\"", path);
+		goto out;
+	}
+	debug3_f("local digest of \"%s\"%s", path,
+	    d->ordered ? "" : " (reread)");
+	len = ssh_digest_bytes(d->alg);
+	if (rlen != len || timingsafe_bcmp(rdigest, digest, len) != 0) {
+		error("\"%s\": checksum mismatch", path);
+		goto out;
+	}
+	debug("\"%s\": checksum verified", path);
+	ret = 0;
+ out:
+	sshbuf_free(msg);
+	free(rdigest);
+	return ret;
+}
+
 #ifdef notyet
 char *
 do_readlink(struct sftp_conn *conn, const char *path)
@@ -1594,12 +2187,14 @@ do_download(struct sftp_conn *conn, const char *remote_path,
 	struct stat st;
 	struct requests requests;
 	struct request *req;
+	struct sftp_digest digest;
 	u_char type;
 
 	debug2_f("download remote \"%s\" to local \"%s\"",
 	    remote_path, local_path);
 
 	TAILQ_INIT(&requests);
+	memset(&digest, 0, sizeof(digest));
 
 	if (a == NULL && (a = do_stat(conn, remote_path, 0)) == NULL)
 		return -1;
@@ -1657,6 +2252,9 @@ do_download(struct sftp_conn *conn, const char *remote_path,
 		}
 		offset = highwater = st.st_size;
 	}
+	if (conn->verify && digest_begin(conn, handle, handle_len,
+	    &digest) != 0)
+		goto fail;
 
 	/* Read from remote and write to local */
 	write_error = read_error = write_errno = num_req = 0;
@@ -1742,6 +2340,9 @@ do_download(struct sftp_conn *conn, const char *remote_path,
 				highwater = req->offset + len;
 			else if (!reordered && req->offset > highwater)
 				reordered = 1;
+			if (!write_error)
+				sftp_digest_update(&digest, req->offset,
+				    data, len);
 			progress_counter += len;
 			free(data);
 
@@ -1811,10 +2412,14 @@ do_download(struct sftp_conn *conn, const char *remote_path,
 		status = SSH2_FX_FAILURE;
 		do_close(conn, handle, handle_len);
 	} else {
-		if (do_close(conn, handle, handle_len) != 0 || interrupted)
+		if (conn->verify && !interrupted &&
+		    digest_check(conn, handle, handle_len, &digest,
+		    local_path) != 0)
 			status = SSH2_FX_FAILURE;
 		else
 			status = SSH2_FX_OK;
+		if (do_close(conn, handle, handle_len) != 0 || interrupted)
+			status = SSH2_FX_FAILURE;
 		/* Override umask and utimes if asked */
 #ifdef HAVE_FCHMOD
 		if (preserve_flag && fchmod(local_fd, mode) == -1)
@@ -1844,6 +2449,7 @@ do_download(struct sftp_conn *conn, const char *remote_path,
 	}
 	close(local_fd);
 	sshbuf_free(msg);
+	sftp_digest_free(&digest);
 	free(handle);
 
 	return status == SSH2_FX_OK ? 0 : -1;
@@ -1995,12 +2601,14 @@ do_upload(struct sftp_conn *conn, const char *local_path,
 	u_int32_t ackid;
 	struct request *ack = NULL;
 	struct requests acks;
+	struct sftp_digest digest;
 	size_t handle_len;
 
 	debug2_f("upload local \"%s\" to remote \"%s\"",
 	    local_path, remote_path);
 
 	TAILQ_INIT(&acks);
+	memset(&digest, 0, sizeof(digest));
 
 	if ((local_fd = open(local_path, O_RDONLY)) == -1) {
 		error("open local \"%s\": %s", local_path, strerror(errno));
@@ -2051,6 +2659,13 @@ do_upload(struct sftp_conn *conn, const char *local_path,
 		close(local_fd);
 		return -1;
 	}
+	if (conn->verify && digest_begin(conn, handle, handle_len,
+	    &digest) != 0) {
+		do_close(conn, handle, handle_len);
+		free(handle);
+		close(local_fd);
+		return -1;
+	}
 
 	id = conn->msg_id;
 	startid = ackid = id + 1;
@@ -2085,6 +2700,7 @@ do_upload(struct sftp_conn *conn, const char *local_path,
 			fatal("read local \"%s\": %s",
 			    local_path, strerror(errno));
 		} else if (len != 0) {
+			sftp_digest_update(&digest, offset, data, len);
 			ack = request_enqueue(&acks, ++id, len, offset);
 			sshbuf_reset(msg);
 			if ((r = sshbuf_put_u8(msg, SSH2_FXP_WRITE)) != 0 ||
@@ -2158,23 +2774,28 @@ do_upload(struct sftp_conn *conn, const char *local_path,
 	if (fsync_flag)
 		(void)do_fsync(conn, handle, handle_len);
 
+	if (conn->verify && status == SSH2_FX_OK && !interrupted &&
+	    digest_check(conn, handle, handle_len, &digest, local_path) != 0)
+		status = SSH2_FX_FAILURE;
+
 	if (do_close(conn, handle, handle_len) != 0)
 		status = SSH2_FX_FAILURE;
 
+	sftp_digest_free(&digest);
 	free(handle);
 
 	return status == SSH2_FX_OK ? 0 : -1;
 }
 
 static int
-upload_dir_internal(struct sftp_conn *conn, const char *src, const char *dst,
-    int depth, int preserve_flag, int print_flag, int resume, int fsync_flag,
-    int follow_link_flag)
+upload_dir_internal(struct sftp_conn *conn, struct dirwalk *walk,
+    const char *src, const char *dst, int depth, int preserve_flag,
+    int print_flag, int resume, int fsync_flag, int follow_link_flag)
 {
 	int ret = 0;
-	DIR *dirp;
-	struct dirent *dp;
-	char *filename, *new_src = NULL, *new_dst = NULL;
+	struct dirwalk_ent *ents, *e;
+	size_t i, nents;
+	char *filename, *new_dst = NULL;
 	struct stat sb;
 	Attrib a, *dirattrib;
 	u_int32_t saved_perm;
@@ -2183,15 +2804,18 @@ upload_dir_internal(struct sftp_conn *conn, const char *src, const char *dst,
 
 	if (depth >= MAX_DIR_DEPTH) {
 		error("Maximum directory depth exceeded: %d levels", depth);
+		dirwalk_prune(walk, src);
 		return -1;
 	}
 
 	if (stat(src, &sb) == -1) {
 		error("stat local \"%s\": %s", src, strerror(errno));
+		dirwalk_prune(walk, src);
 		return -1;
 	}
 	if (!S_ISDIR(sb.st_mode)) {
 		error("\"%s\" is not a directory", src);
+		dirwalk_prune(walk, src);
 		return -1;
 	}
 	if (print_flag && print_flag != SFTP_PROGRESS_ONLY)
@@ -2213,59 +2837,55 @@ upload_dir_internal(struct sftp_conn *conn, const char *src, const char *dst,
 	saved_perm = a.perm;
 	a.perm |= (S_IWUSR|S_IXUSR);
 	if (do_mkdir(conn, dst, &a, 0) != 0) {
-		if ((dirattrib = do_stat(conn, dst, 0)) == NULL)
+		if ((dirattrib = do_stat(conn, dst, 0)) == NULL) {
+			dirwalk_prune(walk, src);
 			return -1;
+		}
 		if (!S_ISDIR(dirattrib->perm)) {
 			error("\"%s\" exists but is not a directory", dst);
+			dirwalk_prune(walk, src);
 			return -1;
 		}
 	}
 	a.perm = saved_perm;
 
-	if ((dirp = opendir(src)) == NULL) {
+	/* The entries come already lstat()ed by the walker's threads */
+	if (dirwalk_readdir(walk, src, &ents, &nents) == -1) {
 		error("local opendir \"%s\": %s", src, strerror(errno));
 		return -1;
 	}
 
-	while (((dp = readdir(dirp)) != NULL) && !interrupted) {
-		if (dp->d_ino == 0)
-			continue;
+	for (i = 0; i < nents && !interrupted; i++) {
+		e = &ents[i];
 		free(new_dst);
-		free(new_src);
-		filename = dp->d_name;
+		filename = e->name;
 		new_dst = path_append(dst, filename);
-		new_src = path_append(src, filename);
 
-		if (lstat(new_src, &sb) == -1) {
+		if (e->err != 0) {
 			logit("local lstat \"%s\": %s", filename,
-			    strerror(errno));
+			    strerror(e->err));
 			ret = -1;
-		} else if (S_ISDIR(sb.st_mode)) {
-			if (strcmp(filename, ".") == 0 ||
-			    strcmp(filename, "..") == 0)
-				continue;
-
-			if (upload_dir_internal(conn, new_src, new_dst,
+		} else if (S_ISDIR(e->st.st_mode)) {
+			if (upload_dir_internal(conn, walk, e->path, new_dst,
 			    depth + 1, preserve_flag, print_flag, resume,
 			    fsync_flag, follow_link_flag) == -1)
 				ret = -1;
-		} else if (S_ISREG(sb.st_mode) ||
-		    (follow_link_flag && S_ISLNK(sb.st_mode))) {
-			if (do_upload(conn, new_src, new_dst,
+		} else if (S_ISREG(e->st.st_mode) ||
+		    (follow_link_flag && S_ISLNK(e->st.st_mode))) {
+			if (do_upload(conn, e->path, new_dst,
 			    preserve_flag, resume, fsync_flag) == -1) {
 				error("upload \"%s\" to \"%s\" failed",
-				    new_src, new_dst);
+				    e->path, new_dst);
 				ret = -1;
 			}
 		} else
 			logit("%s: not a regular file", filename);
 	}
 	free(new_dst);
-	free(new_src);
+	dirwalk_free_ents(ents, nents);
 
 	do_setstat(conn, dst, &a);
 
-	(void) closedir(dirp);
 	return ret;
 }
 
@@ -2274,6 +2894,7 @@ upload_dir(struct sftp_conn *conn, const char *src, const char *dst,
     int preserve_flag, int print_flag, int resume, int fsync_flag,
     int follow_link_flag)
 {
+	struct dirwalk *walk;
 	char *dst_canon;
 	int ret;
 
@@ -2282,8 +2903,10 @@ upload_dir(struct sftp_conn *conn, const char *src, const char *dst,
 		return -1;
 	}
 
-	ret = upload_dir_internal(conn, src, dst_canon, 0, preserve_flag,
-	    print_flag, resume, fsync_flag, follow_link_flag);
+	walk = dirwalk_open(src);
+	ret = upload_dir_internal(conn, walk, src, dst_canon, 0,
+	    preserve_flag, print_flag, resume, fsync_flag, follow_link_flag);
+	dirwalk_close(walk);
 
 	free(dst_canon);
 	return ret;
@@ -35,6 +35,15 @@ struct SFTP_DIRENT {
 	Attrib a;
 };
 
+/* A directory listing shared with the cache; treat it as read-only */
+struct sftp_dirlist {
+	SFTP_DIRENT **dir;	/* NULL terminated */
+	SFTP_DIRENT **byname;	/* the same entries sorted by filename */
+	u_int nents;
+	size_t bytes;		/* of filenames and longnames */
+	u_int refs;
+};
+
 /*
  * Used for statvfs responses on the wire from the server, because the
  * server's native format may be larger than the client's.
@@ -83,9 +92,48 @@ int do_close(struct sftp_conn *, const u_char *, u_int);
 /* Read contents of 'path' to NULL-terminated array 'dir' */
 int do_readdir(struct sftp_conn *, const char *, SFTP_DIRENT ***);
 
+/*
+ * Read contents of 'path', passing each batch of entries to the callback
+ * as it arrives instead of collecting them all. Each NULL-terminated batch
+ * is freed once the callback returns; a non-zero return stops the listing.
+ */
+int do_readdir_stream(struct sftp_conn *, const char *,
+    int (*)(SFTP_DIRENT **, void *), void *);
+
 /* Frees a NULL-terminated array of SFTP_DIRENTs (eg. from do_readdir) */
 void free_sftp_dirents(SFTP_DIRENT **);
 
+/*
+ * Cache directory listings for 'ttl' seconds, for the interactive client.
+ * A ttl of 0 (the default) disables the cache.
+ */
+void sftp_dircache_enable(struct sftp_conn *, u_int);
+
+/* Discard all cached directory listings */
+void sftp_dircache_flush(struct sftp_conn *);
+
+/*
+ * As do_readdir, but answered from the cache when possible. The listing
+ * is shared and must be released with sftp_dirlist_free().
+ */
+int do_readdir_cached(struct sftp_conn *, const char *,
+    struct sftp_dirlist **);
+
+/* Drop a reference to a listing from do_readdir_cached() */
+void sftp_dirlist_free(struct sftp_dirlist *);
+
+/*
+ * Get the attributes of 'path' from the cached listing of its directory,
+ * following symlinks if 'follow' is set. Returns 0 if they were found.
+ */
+int sftp_dircache_stat(struct sftp_conn *, const char *, int, Attrib *);
+
+/*
+ * List the subdirectories of 'path' in one batch the first time one of
+ * them is listed through the cache.
+ */
+void sftp_dircache_prefetch(struct sftp_conn *, const char *);
+
 /* Delete file 'path' */
 int do_rm(struct sftp_conn *, const char *);
 
@@ -137,6 +185,12 @@ int do_symlink(struct sftp_conn *, const char *, const char *);
 /* Call fsync() on open file 'handle' */
 int do_fsync(struct sftp_conn *conn, u_char *, u_int);
 
+/*
+ * Check each file transferred by do_download() and do_upload() against a
+ * digest computed by the server. Returns -1 if the server can't do this.
+ */
+int sftp_verify_enable(struct sftp_conn *);
+
 /*
  * Download 'remote_path' to 'local_path'. Preserve permissions and times
  * if 'pflag' is set
@@ -29,6 +29,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include <errno.h>
+#include <fcntl.h>
 #include <grp.h>
 #include <pwd.h>
 #include <stdio.h>
@@ -46,6 +48,7 @@
 #include "sshbuf.h"
 #include "log.h"
 #include "misc.h"
+#include "digest.h"
 
 #include "sftp.h"
 #include "sftp-common.h"
@@ -257,3 +260,91 @@ ls_file(const char *name, const struct stat *st, int remote, int si_units)
 	}
 	return xstrdup(buf);
 }
+
+int
+sftp_digest_start(struct sftp_digest *d, const char *alg_name)
+{
+	memset(d, 0, sizeof(*d));
+	if ((d->alg = ssh_digest_alg_by_name(alg_name)) == -1)
+		return SSH_ERR_INVALID_ARGUMENT;
+	if ((d->ctx = ssh_digest_start(d->alg)) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	d->ordered = 1;
+	return 0;
+}
+
+void
+sftp_digest_update(struct sftp_digest *d, u_int64_t off,
+    const void *data, size_t len)
+{
+	if (d->ctx == NULL || !d->ordered)
+		return;
+	if (off != d->off || ssh_digest_update(d->ctx, data, len) != 0) {
+		debug3_f("out of sequence at %llu, will reread file",
+		    (unsigned long long)off);
+		d->ordered = 0;
+		return;
+	}
+	d->off += len;
+}
+
+/* Digest of the whole file at 'path', used when the stream had gaps */
+static int
+digest_file(int alg, const char *path, u_char *out, size_t outlen)
+{
+	struct ssh_digest_ctx *ctx;
+	u_char buf[64 * 1024];
+	ssize_t len;
+	int fd, oerrno, r = 0;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return SSH_ERR_SYSTEM_ERROR;
+	if ((ctx = ssh_digest_start(alg)) == NULL) {
+		close(fd);
+		return SSH_ERR_ALLOC_FAIL;
+	}
+	for (;;) {
+		if ((len = read(fd, buf, sizeof(buf))) == -1) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			r = SSH_ERR_SYSTEM_ERROR;
+			break;
+		}
+		if (len == 0) {
+			r = ssh_digest_final(ctx, out, outlen);
+			break;
+		}
+		if ((r = ssh_digest_update(ctx, buf, len)) != 0)
+			break;
+	}
+	oerrno = errno;
+	ssh_digest_free(ctx);
+	close(fd);
+	errno = oerrno;
+	return r;
+}
+
+int
+sftp_digest_final(struct sftp_digest *d, const char *path,
+    u_char *out, size_t outlen)
+{
+	struct stat st;
+
+	if (d->ctx == NULL)
+		return SSH_ERR_INVALID_ARGUMENT;
+	if (outlen < ssh_digest_bytes(d->alg))
+		return SSH_ERR_NO_BUFFER_SPACE;
+	/* The stream must also have covered the whole file, e.g. not resumed */
+	if (d->ordered && stat(path, &st) == 0 &&
+	    (u_int64_t)st.st_size == d->off)
+		return ssh_digest_final(d->ctx, out, outlen);
+	d->ordered = 0;
+	return digest_file(d->alg, path, out, outlen);
+}
+
+void
+sftp_digest_free(struct sftp_digest *d)
+{
+	ssh_digest_free(d->ctx);
+	memset(d, 0, sizeof(*d));
+}
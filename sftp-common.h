@@ -50,3 +50,29 @@ int	 encode_attrib(struct sshbuf *, const Attrib *);
 char	*ls_file(const char *, const struct stat *, int, int);
 
 const char *fx2txt(int);
+
+/*
+ * Digest of a file kept while its contents are streamed.  If the data
+ * doesn't arrive contiguously from offset zero, the file is read back in
+ * full to compute it instead.
+ */
+#define SFTP_DIGEST_ALG		"SHA256"
+
+/* digest-handle@hpnssh.org operations */
+#define SFTP_DIGEST_BEGIN	0
+#define SFTP_DIGEST_END		1
+
+struct ssh_digest_ctx;
+struct sftp_digest {
+	struct ssh_digest_ctx	*ctx;
+	int			 alg;
+	u_int64_t		 off;		/* next offset in sequence */
+	int			 ordered;
+};
+
+int	 sftp_digest_start(struct sftp_digest *, const char *);
+void	 sftp_digest_update(struct sftp_digest *, u_int64_t,
+    const void *, size_t);
+int	 sftp_digest_final(struct sftp_digest *, const char *,
+    u_char *, size_t);
+void	 sftp_digest_free(struct sftp_digest *);
@@ -36,6 +36,7 @@ int remote_glob(struct sftp_conn *, const char *, int,
     int (*)(const char *, int), glob_t *);
 
 struct SFTP_OPENDIR {
+	struct sftp_dirlist *list;
 	SFTP_DIRENT **dir;
 	int offset;
 };
@@ -51,11 +52,12 @@ fudge_opendir(const char *path)
 
 	r = xcalloc(1, sizeof(*r));
 
-	if (do_readdir(cur.conn, path, &r->dir)) {
+	if (do_readdir_cached(cur.conn, path, &r->list)) {
 		free(r);
 		return(NULL);
 	}
 
+	r->dir = r->list->dir;
 	r->offset = 0;
 
 	return((void *)r);
@@ -103,16 +105,18 @@ fudge_readdir(struct SFTP_OPENDIR *od)
 static void
 fudge_closedir(struct SFTP_OPENDIR *od)
 {
-	free_sftp_dirents(od->dir);
+	sftp_dirlist_free(od->list);
 	free(od);
 }
 
 static int
 fudge_lstat(const char *path, struct stat *st)
 {
-	Attrib *a;
+	Attrib *a, ca;
 
-	if (!(a = do_lstat(cur.conn, path, 1)))
+	if (sftp_dircache_stat(cur.conn, path, 0, &ca) == 0)
+		a = &ca;
+	else if (!(a = do_lstat(cur.conn, path, 1)))
 		return(-1);
 
 	attrib_to_stat(a, st);
@@ -123,9 +127,11 @@ fudge_lstat(const char *path, struct stat *st)
 static int
 fudge_stat(const char *path, struct stat *st)
 {
-	Attrib *a;
+	Attrib *a, ca;
 
-	if (!(a = do_stat(cur.conn, path, 1)))
+	if (sftp_dircache_stat(cur.conn, path, 1, &ca) == 0)
+		a = &ca;
+	else if (!(a = do_stat(cur.conn, path, 1)))
 		return(-1);
 
 	attrib_to_stat(a, st);
@@ -36,7 +36,9 @@
 #ifdef HAVE_POLL_H
 #include <poll.h>
 #endif
+#include <pthread.h>
 #include <pwd.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -52,6 +54,7 @@
 #include "misc.h"
 #include "match.h"
 #include "uidswap.h"
+#include "digest.h"
 
 #include "sftp.h"
 #include "sftp-common.h"
@@ -84,6 +87,31 @@ static int readonly;
 /* Requests that are allowed/denied */
 static char *request_allowlist, *request_denylist;
 
+/* Request being handled, for the reply to one that doesn't parse */
+static u_int32_t cur_id;
+static int have_cur_id;
+
+/*
+ * In-process operation, see sftp_server_inproc_init(). The server runs on
+ * a thread of its own. sshd hands it requests through "ib" and collects
+ * its replies from "ob", both under "lock", and is woken through "wakefd"
+ * when there are replies or the session has ended.
+ */
+static struct {
+	int running;
+	pthread_t tid;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct sshbuf *ib, *ob;
+	size_t limit;		/* replies sshd can take */
+	int eof;		/* client will send nothing more */
+	int work;		/* something changed, see inproc_main() */
+	int stop;		/* sshd is closing the session */
+	int done, status;	/* session ended with exit status */
+	int wakefd;
+	char *homedir;
+} inproc;
+
 /* portable attributes, etc. */
 typedef struct Stat Stat;
 
@@ -121,6 +149,7 @@ static void process_extended_lsetstat(u_int32_t id);
 static void process_extended_limits(u_int32_t id);
 static void process_extended_expand(u_int32_t id);
 static void process_extended_copy_data(u_int32_t id);
+static void process_extended_digest_handle(u_int32_t id);
 static void process_extended(u_int32_t id);
 
 struct sftp_handler {
@@ -167,6 +196,8 @@ static const struct sftp_handler extended_handlers[] = {
 	{ "expand-path", "expand-path@openssh.com", 0,
 	    process_extended_expand, 0 },
 	{ "copy-data", "copy-data", 0, process_extended_copy_data, 1 },
+	{ "digest-handle", "digest-handle@hpnssh.org", 0,
+	    process_extended_digest_handle, 0 },
 	{ NULL, NULL, 0, NULL, 0 }
 };
 
@@ -307,6 +338,7 @@ struct Handle {
 	int flags;
 	char *name;
 	u_int64_t bytes_read, bytes_write;
+	struct sftp_digest digest;	/* if requested by the client */
 	int next_unused;
 };
 
@@ -349,6 +381,7 @@ handle_new(int use, const char *name, int fd, int flags, DIR *dirp)
 	handles[i].flags = flags;
 	handles[i].name = xstrdup(name);
 	handles[i].bytes_read = handles[i].bytes_write = 0;
+	memset(&handles[i].digest, 0, sizeof(handles[i].digest));
 
 	return i;
 }
@@ -418,17 +451,23 @@ handle_to_flags(int handle)
 }
 
 static void
-handle_update_read(int handle, ssize_t bytes)
+handle_update_read(int handle, u_int64_t off, const u_char *data,
+    ssize_t bytes)
 {
-	if (handle_is_ok(handle, HANDLE_FILE) && bytes > 0)
+	if (handle_is_ok(handle, HANDLE_FILE) && bytes > 0) {
 		handles[handle].bytes_read += bytes;
+		sftp_digest_update(&handles[handle].digest, off, data, bytes);
+	}
 }
 
 static void
-handle_update_write(int handle, ssize_t bytes)
+handle_update_write(int handle, u_int64_t off, const u_char *data,
+    ssize_t bytes)
 {
-	if (handle_is_ok(handle, HANDLE_FILE) && bytes > 0)
+	if (handle_is_ok(handle, HANDLE_FILE) && bytes > 0) {
 		handles[handle].bytes_write += bytes;
+		sftp_digest_update(&handles[handle].digest, off, data, bytes);
+	}
 }
 
 static u_int64_t
@@ -454,6 +493,7 @@ handle_close(int handle)
 
 	if (handle_is_ok(handle, HANDLE_FILE)) {
 		ret = close(handles[handle].fd);
+		sftp_digest_free(&handles[handle].digest);
 		free(handles[handle].name);
 		handle_unused(handle);
 	} else if (handle_is_ok(handle, HANDLE_DIR)) {
@@ -586,13 +626,6 @@ send_data_or_handle(char type, u_int32_t id, const u_char *data, int dlen)
 	sshbuf_free(msg);
 }
 
-static void
-send_data(u_int32_t id, const u_char *data, int dlen)
-{
-	debug("request %u: sent data len %d", id, dlen);
-	send_data_or_handle(SSH2_FXP_DATA, id, data, dlen);
-}
-
 static void
 send_handle(u_int32_t id, int handle)
 {
@@ -697,6 +730,36 @@ compose_extension(struct sshbuf *msg, const char *name, const char *ver)
 	return 0;
 }
 
+static void inproc_exit(int) __attribute__((noreturn));
+
+/*
+ * The client sent a request that doesn't parse. The forked server just
+ * exits. In process, only this session ends: the request is refused with
+ * SSH2_FX_BAD_MESSAGE and the thread serving the session exits.
+ */
+static void __attribute__((noreturn)) __attribute__((format(printf, 4, 5)))
+bad_request(const char *func, int line, int r, const char *fmt, ...)
+{
+	char msg[1024];
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, args);
+	va_end(args);
+	if (!inproc.running) {
+		sshfatal(__FILE__, func, line, 1, SYSLOG_LEVEL_FATAL,
+		    r == 0 ? NULL : ssh_err(r), "%s", msg);
+	}
+	sshlog(__FILE__, func, line, 1, SYSLOG_LEVEL_ERROR,
+	    r == 0 ? NULL : ssh_err(r), "%s", msg);
+	if (have_cur_id)
+		send_status(cur_id, SSH2_FX_BAD_MESSAGE);
+	inproc_exit(255);
+}
+
+#define bad_request_f(...) bad_request(__func__, __LINE__, 0, __VA_ARGS__)
+#define bad_request_fr(r, ...) bad_request(__func__, __LINE__, r, __VA_ARGS__)
+
 /* parse incoming */
 
 static void
@@ -706,7 +769,7 @@ process_init(void)
 	int r;
 
 	if ((r = sshbuf_get_u32(iqueue, &version)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 	verbose("received client version %u", version);
 	if ((msg = sshbuf_new()) == NULL)
 		fatal_f("sshbuf_new failed");
@@ -724,6 +787,7 @@ process_init(void)
 	compose_extension(msg, "limits@openssh.com", "1");
 	compose_extension(msg, "expand-path@openssh.com", "1");
 	compose_extension(msg, "copy-data", "1");
+	compose_extension(msg, "digest-handle@hpnssh.org", "1");
 
 	send_msg(msg);
 	sshbuf_free(msg);
@@ -740,7 +804,7 @@ process_open(u_int32_t id)
 	if ((r = sshbuf_get_cstring(iqueue, &name, NULL)) != 0 ||
 	    (r = sshbuf_get_u32(iqueue, &pflags)) != 0 || /* portable flags */
 	    (r = decode_attrib(iqueue, &a)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 
 	debug3("request %u: open flags %d", id, pflags);
 	flags = flags_from_portable(pflags);
@@ -777,7 +841,7 @@ process_close(u_int32_t id)
 	int r, handle, ret, status = SSH2_FX_FAILURE;
 
 	if ((r = get_handle(iqueue, &handle)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 
 	debug3("request %u: close handle %u", id, handle);
 	handle_log_close(handle, NULL);
@@ -789,16 +853,16 @@ process_close(u_int32_t id)
 static void
 process_read(u_int32_t id)
 {
-	static u_char *buf;
-	static size_t buflen;
+	u_char *p;
 	u_int32_t len;
 	int r, handle, fd, ret, status = SSH2_FX_FAILURE;
 	u_int64_t off;
+	const size_t hlen = 4 + 1 + 4 + 4; /* length, type, id, data length */
 
 	if ((r = get_handle(iqueue, &handle)) != 0 ||
 	    (r = sshbuf_get_u64(iqueue, &off)) != 0 ||
 	    (r = sshbuf_get_u32(iqueue, &len)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 
 	debug("request %u: read \"%s\" (handle %d) off %llu len %u",
 	    id, handle_to_name(handle), handle, (unsigned long long)off, len);
@@ -808,32 +872,37 @@ process_read(u_int32_t id)
 		debug2("read change len %u to %u", len, SFTP_MAX_READ_LENGTH);
 		len = SFTP_MAX_READ_LENGTH;
 	}
-	if (len > buflen) {
-		debug3_f("allocate %zu => %u", buflen, len);
-		if ((buf = realloc(NULL, len)) == NULL)
-			fatal_f("realloc failed");
-		buflen = len;
-	}
 	if (lseek(fd, off, SEEK_SET) == -1) {
 		status = errno_to_portable(errno);
 		error_f("seek \"%.100s\": %s", handle_to_name(handle),
 		    strerror(errno));
 		goto out;
 	}
+	/* Read straight into the output queue, after the reply header */
+	if ((r = sshbuf_reserve(oqueue, hlen + len, &p)) != 0)
+		fatal_fr(r, "reserve");
 	if (len == 0) {
 		/* weird, but not strictly disallowed */
 		ret = 0;
-	} else if ((ret = read(fd, buf, len)) == -1) {
+	} else if ((ret = read(fd, p + hlen, len)) == -1) {
 		status = errno_to_portable(errno);
 		error_f("read \"%.100s\": %s", handle_to_name(handle),
 		    strerror(errno));
-		goto out;
-	} else if (ret == 0) {
+	} else if (ret == 0)
 		status = SSH2_FX_EOF;
+	if (len != 0 && ret <= 0) {
+		if ((r = sshbuf_consume_end(oqueue, hlen + len)) != 0)
+			fatal_fr(r, "consume");
 		goto out;
 	}
-	send_data(id, buf, ret);
-	handle_update_read(handle, ret);
+	if ((r = sshbuf_consume_end(oqueue, len - ret)) != 0)
+		fatal_fr(r, "consume");
+	put_u32(p, hlen - 4 + ret);
+	p[4] = SSH2_FXP_DATA;
+	put_u32(p + 5, id);
+	put_u32(p + 9, ret);
+	debug("request %u: sent data len %d", id, ret);
+	handle_update_read(handle, off, p + hlen, ret);
 	/* success */
 	status = SSH2_FX_OK;
  out:
@@ -847,12 +916,12 @@ process_write(u_int32_t id)
 	u_int64_t off;
 	size_t len;
 	int r, handle, fd, ret, status;
-	u_char *data;
+	const u_char *data;
 
 	if ((r = get_handle(iqueue, &handle)) != 0 ||
 	    (r = sshbuf_get_u64(iqueue, &off)) != 0 ||
-	    (r = sshbuf_get_string(iqueue, &data, &len)) != 0)
-		fatal_fr(r, "parse");
+	    (r = sshbuf_get_string_direct(iqueue, &data, &len)) != 0)
+		bad_request_fr(r, "parse");
 
 	debug("request %u: write \"%s\" (handle %d) off %llu len %zu",
 	    id, handle_to_name(handle), handle, (unsigned long long)off, len);
@@ -875,7 +944,7 @@ process_write(u_int32_t id)
 				    handle_to_name(handle), strerror(errno));
 			} else if ((size_t)ret == len) {
 				status = SSH2_FX_OK;
-				handle_update_write(handle, ret);
+				handle_update_write(handle, off, data, ret);
 			} else {
 				debug2_f("nothing at all written");
 				status = SSH2_FX_FAILURE;
@@ -883,7 +952,6 @@ process_write(u_int32_t id)
 		}
 	}
 	send_status(id, status);
-	free(data);
 }
 
 static void
@@ -895,7 +963,7 @@ process_do_stat(u_int32_t id, int do_lstat)
 	int r, status = SSH2_FX_FAILURE;
 
 	if ((r = sshbuf_get_cstring(iqueue, &name, NULL)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 
 	debug3("request %u: %sstat", id, do_lstat ? "l" : "");
 	verbose("%sstat name \"%s\"", do_lstat ? "l" : "", name);
@@ -932,7 +1000,7 @@ process_fstat(u_int32_t id)
 	int fd, r, handle, status = SSH2_FX_FAILURE;
 
 	if ((r = get_handle(iqueue, &handle)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 	debug("request %u: fstat \"%s\" (handle %u)",
 	    id, handle_to_name(handle), handle);
 	fd = handle_to_fd(handle);
@@ -983,7 +1051,7 @@ process_setstat(u_int32_t id)
 
 	if ((r = sshbuf_get_cstring(iqueue, &name, NULL)) != 0 ||
 	    (r = decode_attrib(iqueue, &a)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 
 	debug("request %u: setstat name \"%s\"", id, name);
 	if (a.flags & SSH2_FILEXFER_ATTR_SIZE) {
@@ -1030,7 +1098,7 @@ process_fsetstat(u_int32_t id)
 
 	if ((r = get_handle(iqueue, &handle)) != 0 ||
 	    (r = decode_attrib(iqueue, &a)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 
 	debug("request %u: fsetstat handle %d", id, handle);
 	fd = handle_to_fd(handle);
@@ -1094,7 +1162,7 @@ process_opendir(u_int32_t id)
 	int r, handle, status = SSH2_FX_FAILURE;
 
 	if ((r = sshbuf_get_cstring(iqueue, &path, NULL)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 
 	debug3("request %u: opendir", id);
 	logit("opendir \"%s\"", path);
@@ -1125,7 +1193,7 @@ process_readdir(u_int32_t id)
 	int r, handle;
 
 	if ((r = get_handle(iqueue, &handle)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 
 	debug("request %u: readdir \"%s\" (handle %d)", id,
 	    handle_to_name(handle), handle);
@@ -1179,7 +1247,7 @@ process_remove(u_int32_t id)
 	int r, status = SSH2_FX_FAILURE;
 
 	if ((r = sshbuf_get_cstring(iqueue, &name, NULL)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 
 	debug3("request %u: remove", id);
 	logit("remove name \"%s\"", name);
@@ -1198,7 +1266,7 @@ process_mkdir(u_int32_t id)
 
 	if ((r = sshbuf_get_cstring(iqueue, &name, NULL)) != 0 ||
 	    (r = decode_attrib(iqueue, &a)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 
 	mode = (a.flags & SSH2_FILEXFER_ATTR_PERMISSIONS) ?
 	    a.perm & 07777 : 0777;
@@ -1217,7 +1285,7 @@ process_rmdir(u_int32_t id)
 	int r, status;
 
 	if ((r = sshbuf_get_cstring(iqueue, &name, NULL)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 
 	debug3("request %u: rmdir", id);
 	logit("rmdir name \"%s\"", name);
@@ -1235,7 +1303,7 @@ process_realpath(u_int32_t id)
 	int r;
 
 	if ((r = sshbuf_get_cstring(iqueue, &path, NULL)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 
 	if (path[0] == '\0') {
 		free(path);
@@ -1263,7 +1331,7 @@ process_rename(u_int32_t id)
 
 	if ((r = sshbuf_get_cstring(iqueue, &oldpath, NULL)) != 0 ||
 	    (r = sshbuf_get_cstring(iqueue, &newpath, NULL)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 
 	debug3("request %u: rename", id);
 	logit("rename old \"%s\" new \"%s\"", oldpath, newpath);
@@ -1322,7 +1390,7 @@ process_readlink(u_int32_t id)
 	char *path;
 
 	if ((r = sshbuf_get_cstring(iqueue, &path, NULL)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 
 	debug3("request %u: readlink", id);
 	verbose("readlink \"%s\"", path);
@@ -1347,7 +1415,7 @@ process_symlink(u_int32_t id)
 
 	if ((r = sshbuf_get_cstring(iqueue, &oldpath, NULL)) != 0 ||
 	    (r = sshbuf_get_cstring(iqueue, &newpath, NULL)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 
 	debug3("request %u: symlink", id);
 	logit("symlink old \"%s\" new \"%s\"", oldpath, newpath);
@@ -1367,7 +1435,7 @@ process_extended_posix_rename(u_int32_t id)
 
 	if ((r = sshbuf_get_cstring(iqueue, &oldpath, NULL)) != 0 ||
 	    (r = sshbuf_get_cstring(iqueue, &newpath, NULL)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 
 	debug3("request %u: posix-rename", id);
 	logit("posix-rename old \"%s\" new \"%s\"", oldpath, newpath);
@@ -1386,7 +1454,7 @@ process_extended_statvfs(u_int32_t id)
 	int r;
 
 	if ((r = sshbuf_get_cstring(iqueue, &path, NULL)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 	debug3("request %u: statvfs", id);
 	logit("statvfs \"%s\"", path);
 
@@ -1404,7 +1472,7 @@ process_extended_fstatvfs(u_int32_t id)
 	struct statvfs st;
 
 	if ((r = get_handle(iqueue, &handle)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 	debug("request %u: fstatvfs \"%s\" (handle %u)",
 	    id, handle_to_name(handle), handle);
 	if ((fd = handle_to_fd(handle)) < 0) {
@@ -1425,7 +1493,7 @@ process_extended_hardlink(u_int32_t id)
 
 	if ((r = sshbuf_get_cstring(iqueue, &oldpath, NULL)) != 0 ||
 	    (r = sshbuf_get_cstring(iqueue, &newpath, NULL)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 
 	debug3("request %u: hardlink", id);
 	logit("hardlink old \"%s\" new \"%s\"", oldpath, newpath);
@@ -1442,7 +1510,7 @@ process_extended_fsync(u_int32_t id)
 	int handle, fd, r, status = SSH2_FX_OP_UNSUPPORTED;
 
 	if ((r = get_handle(iqueue, &handle)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 	debug3("request %u: fsync (handle %u)", id, handle);
 	verbose("fsync \"%s\"", handle_to_name(handle));
 	if ((fd = handle_to_fd(handle)) < 0)
@@ -1463,7 +1531,7 @@ process_extended_lsetstat(u_int32_t id)
 
 	if ((r = sshbuf_get_cstring(iqueue, &name, NULL)) != 0 ||
 	    (r = decode_attrib(iqueue, &a)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 
 	debug("request %u: lsetstat name \"%s\"", id, name);
 	if (a.flags & SSH2_FILEXFER_ATTR_SIZE) {
@@ -1546,7 +1614,7 @@ process_extended_expand(u_int32_t id)
 	Stat s;
 
 	if ((r = sshbuf_get_cstring(iqueue, &path, NULL)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 	if (getcwd(cwd, sizeof(cwd)) == NULL) {
 		send_status(id, errno_to_portable(errno));
 		goto out;
@@ -1610,7 +1678,7 @@ process_extended_copy_data(u_int32_t id)
 	    (r = sshbuf_get_u64(iqueue, &read_len)) != 0 ||
 	    (r = get_handle(iqueue, &write_handle)) != 0 ||
 	    (r = sshbuf_get_u64(iqueue, &write_off)) != 0)
-		fatal("%s: buffer error: %s", __func__, ssh_err(r));
+		bad_request_fr(r, "parse");
 
 	debug("request %u: copy-data from \"%s\" (handle %d) off %llu len %llu "
 	    "to \"%s\" (handle %d) off %llu",
@@ -1664,7 +1732,8 @@ process_extended_copy_data(u_int32_t id)
 			break;
 		}
 		len = ret;
-		handle_update_read(read_handle, len);
+		handle_update_read(read_handle, read_off, buf, len);
+		read_off += len;
 
 		ret = atomicio(vwrite, write_fd, buf, len);
 		if (ret != len) {
@@ -1674,7 +1743,8 @@ process_extended_copy_data(u_int32_t id)
 			    strerror(errno));
 			break;
 		}
-		handle_update_write(write_handle, len);
+		handle_update_write(write_handle, write_off, buf, len);
+		write_off += len;
 	}
 
 	if (read_len == 0)
@@ -1684,6 +1754,74 @@ process_extended_copy_data(u_int32_t id)
 	send_status(id, status);
 }
 
+/*
+ * Begin keeping a digest of the data read from or written to a handle, or
+ * return it.  Lets a client check a transfer without reading the file back.
+ */
+static void
+process_extended_digest_handle(u_int32_t id)
+{
+	struct sftp_digest *d;
+	struct sshbuf *msg;
+	u_char op, digest[SSH_DIGEST_MAX_LENGTH];
+	char *alg;
+	int handle, r, status = SSH2_FX_OK;
+
+	if ((r = get_handle(iqueue, &handle)) != 0 ||
+	    (r = sshbuf_get_u8(iqueue, &op)) != 0 ||
+	    (r = sshbuf_get_cstring(iqueue, &alg, NULL)) != 0)
+		bad_request_fr(r, "parse");
+	debug3("request %u: digest-handle op %u alg %s (handle %d)",
+	    id, op, alg, handle);
+	if (!handle_is_ok(handle, HANDLE_FILE)) {
+		send_status(id, SSH2_FX_NO_SUCH_FILE);
+		free(alg);
+		return;
+	}
+	d = &handles[handle].digest;
+	switch (op) {
+	case SFTP_DIGEST_BEGIN:
+		sftp_digest_free(d);
+		if (sftp_digest_start(d, alg) != 0)
+			status = SSH2_FX_OP_UNSUPPORTED;
+		send_status(id, status);
+		break;
+	case SFTP_DIGEST_END:
+		if (d->ctx == NULL) {
+			send_status(id, SSH2_FX_FAILURE);
+			break;
+		}
+		r = sftp_digest_final(d, handle_to_name(handle),
+		    digest, sizeof(digest));
+		verbose("digest \"%s\"%s", handle_to_name(handle),
+		    d->ordered ? "" : " (reread)");
+		if (r != 0) {
+			status = r == SSH_ERR_SYSTEM_ERROR ?
+			    errno_to_portable(errno) : SSH2_FX_FAILURE;
+			error_fr(r, "digest \"%.100s\"",
+			    handle_to_name(handle));
+			sftp_digest_free(d);
+			send_status(id, status);
+			break;
+		}
+		if ((msg = sshbuf_new()) == NULL)
+			fatal_f("sshbuf_new failed");
+		if ((r = sshbuf_put_u8(msg, SSH2_FXP_EXTENDED_REPLY)) != 0 ||
+		    (r = sshbuf_put_u32(msg, id)) != 0 ||
+		    (r = sshbuf_put_string(msg, digest,
+		    ssh_digest_bytes(d->alg))) != 0)
+			fatal_fr(r, "compose");
+		send_msg(msg);
+		sshbuf_free(msg);
+		sftp_digest_free(d);
+		break;
+	default:
+		send_status(id, SSH2_FX_BAD_MESSAGE);
+		break;
+	}
+	free(alg);
+}
+
 static void
 process_extended(u_int32_t id)
 {
@@ -1692,7 +1830,7 @@ process_extended(u_int32_t id)
 	const struct sftp_handler *exthand;
 
 	if ((r = sshbuf_get_cstring(iqueue, &request, NULL)) != 0)
-		fatal_fr(r, "parse");
+		bad_request_fr(r, "parse");
 	if ((exthand = extended_handler_byname(request)) == NULL) {
 		error("Unknown extended request \"%.100s\"", request);
 		send_status(id, SSH2_FX_OP_UNSUPPORTED);	/* MUST */
@@ -1707,7 +1845,11 @@ process_extended(u_int32_t id)
 
 /* stolen from ssh-agent */
 
-static void
+/*
+ * Handle one complete message from iqueue, if there is one. Returns 0 or,
+ * if the client sent something it should not have, an exit status.
+ */
+static int
 process(void)
 {
 	u_int msg_len;
@@ -1720,21 +1862,22 @@ process(void)
 
 	buf_len = sshbuf_len(iqueue);
 	if (buf_len < 5)
-		return;		/* Incomplete message. */
+		return 0;	/* Incomplete message. */
 	cp = sshbuf_ptr(iqueue);
 	msg_len = get_u32(cp);
 	if (msg_len > SFTP_MAX_MSG_LENGTH) {
 		error("bad message from %s local user %s",
 		    client_addr, pw->pw_name);
-		sftp_server_cleanup_exit(11);
+		return 11;
 	}
 	if (buf_len < msg_len + 4)
-		return;
+		return 0;
 	if ((r = sshbuf_consume(iqueue, 4)) != 0)
 		fatal_fr(r, "consume");
 	buf_len -= 4;
+	have_cur_id = 0;
 	if ((r = sshbuf_get_u8(iqueue, &type)) != 0)
-		fatal_fr(r, "parse type");
+		bad_request_fr(r, "parse type");
 
 	switch (type) {
 	case SSH2_FXP_INIT:
@@ -1743,16 +1886,20 @@ process(void)
 		break;
 	case SSH2_FXP_EXTENDED:
 		if (!init_done)
-			fatal("Received extended request before init");
+			bad_request_f("Received extended request before init");
 		if ((r = sshbuf_get_u32(iqueue, &id)) != 0)
-			fatal_fr(r, "parse extended ID");
+			bad_request_fr(r, "parse extended ID");
+		cur_id = id;
+		have_cur_id = 1;
 		process_extended(id);
 		break;
 	default:
 		if (!init_done)
-			fatal("Received %u request before init", type);
+			bad_request_f("Received %u request before init", type);
 		if ((r = sshbuf_get_u32(iqueue, &id)) != 0)
-			fatal_fr(r, "parse ID");
+			bad_request_fr(r, "parse ID");
+		cur_id = id;
+		have_cur_id = 1;
 		for (i = 0; handlers[i].handler != NULL; i++) {
 			if (type == handlers[i].type) {
 				if (!request_permitted(&handlers[i])) {
@@ -1770,16 +1917,17 @@ process(void)
 	/* discard the remaining bytes from the current packet */
 	if (buf_len < sshbuf_len(iqueue)) {
 		error("iqueue grew unexpectedly");
-		sftp_server_cleanup_exit(255);
+		return 255;
 	}
 	consumed = buf_len - sshbuf_len(iqueue);
 	if (msg_len < consumed) {
 		error("msg_len %u < consumed %u", msg_len, consumed);
-		sftp_server_cleanup_exit(255);
+		return 255;
 	}
 	if (msg_len > consumed &&
 	    (r = sshbuf_consume(iqueue, msg_len - consumed)) != 0)
 		fatal_fr(r, "consume");
+	return 0;
 }
 
 /* Cleanup handler that logs active handles upon normal exit */
@@ -1808,27 +1956,26 @@ sftp_server_usage(void)
 	exit(1);
 }
 
-int
-sftp_server_main(int argc, char **argv, struct passwd *user_pw)
+/*
+ * Parse the sftp-server command line. When running in-process, options
+ * that would exit the server are rejected instead; returns -1 for those.
+ */
+static int
+sftp_server_args(int argc, char **argv, struct passwd *user_pw, int inproc,
+    SyslogFacility *log_facility, int *log_stderr, char **homedir)
 {
-	int i, r, in, out, ch, skipargs = 0, log_stderr = 0;
-	ssize_t len, olen;
-	SyslogFacility log_facility = SYSLOG_FACILITY_AUTH;
-	char *cp, *homedir = NULL, uidstr[32], buf[4*4096];
+	int i, ch, skipargs = 0;
+	char *cp, uidstr[32];
 	long mask;
 
 	extern char *optarg;
-	extern char *__progname;
-
-	__progname = ssh_get_progname(argv[0]);
-	log_init(__progname, log_level, log_facility, log_stderr);
-
-	pw = pwcopy(user_pw);
 
 	while (!skipargs && (ch = getopt(argc, argv,
 	    "d:f:l:P:p:Q:u:cehR")) != -1) {
 		switch (ch) {
 		case 'Q':
+			if (inproc)
+				return -1;
 			if (strcasecmp(optarg, "requests") != 0) {
 				fprintf(stderr, "Invalid query type\n");
 				exit(1);
@@ -1850,7 +1997,7 @@ sftp_server_main(int argc, char **argv, struct passwd *user_pw)
 			skipargs = 1;
 			break;
 		case 'e':
-			log_stderr = 1;
+			*log_stderr = 1;
 			break;
 		case 'l':
 			log_level = log_level_number(optarg);
@@ -1858,29 +2005,39 @@ sftp_server_main(int argc, char **argv, struct passwd *user_pw)
 				error("Invalid log level \"%s\"", optarg);
 			break;
 		case 'f':
-			log_facility = log_facility_number(optarg);
-			if (log_facility == SYSLOG_FACILITY_NOT_SET)
+			*log_facility = log_facility_number(optarg);
+			if (*log_facility == SYSLOG_FACILITY_NOT_SET)
 				error("Invalid log facility \"%s\"", optarg);
 			break;
 		case 'd':
 			cp = tilde_expand_filename(optarg, user_pw->pw_uid);
 			snprintf(uidstr, sizeof(uidstr), "%llu",
 			    (unsigned long long)pw->pw_uid);
-			homedir = percent_expand(cp, "d", user_pw->pw_dir,
+			free(*homedir);
+			*homedir = percent_expand(cp, "d", user_pw->pw_dir,
 			    "u", user_pw->pw_name, "U", uidstr, (char *)NULL);
 			free(cp);
 			break;
 		case 'p':
-			if (request_allowlist != NULL)
+			if (request_allowlist != NULL) {
+				if (inproc)
+					return -1;
 				fatal("Permitted requests already set");
+			}
 			request_allowlist = xstrdup(optarg);
 			break;
 		case 'P':
-			if (request_denylist != NULL)
+			if (request_denylist != NULL) {
+				if (inproc)
+					return -1;
 				fatal("Refused requests already set");
+			}
 			request_denylist = xstrdup(optarg);
 			break;
 		case 'u':
+			/* The umask is per process, sshd's would change too */
+			if (inproc)
+				return -1;
 			errno = 0;
 			mask = strtol(optarg, &cp, 8);
 			if (mask < 0 || mask > 0777 || *cp != '\0' ||
@@ -1890,9 +2047,31 @@ sftp_server_main(int argc, char **argv, struct passwd *user_pw)
 			break;
 		case 'h':
 		default:
+			if (inproc)
+				return -1;
 			sftp_server_usage();
 		}
 	}
+	return 0;
+}
+
+int
+sftp_server_main(int argc, char **argv, struct passwd *user_pw)
+{
+	int r, in, out, log_stderr = 0;
+	ssize_t len, olen;
+	SyslogFacility log_facility = SYSLOG_FACILITY_AUTH;
+	char *cp, *homedir = NULL, buf[4*4096];
+
+	extern char *__progname;
+
+	__progname = ssh_get_progname(argv[0]);
+	log_init(__progname, log_level, log_facility, log_stderr);
+
+	pw = pwcopy(user_pw);
+
+	sftp_server_args(argc, argv, user_pw, 0, &log_facility, &log_stderr,
+	    &homedir);
 
 	log_init(__progname, log_level, log_facility, log_stderr);
 
@@ -2010,9 +2189,333 @@ sftp_server_main(int argc, char **argv, struct passwd *user_pw)
 		 * and let the output queue drain.
 		 */
 		r = sshbuf_check_reserve(oqueue, SFTP_MAX_MSG_LENGTH);
-		if (r == 0)
-			process();
-		else if (r != SSH_ERR_NO_BUFFER_SPACE)
+		if (r == 0) {
+			if ((r = process()) != 0)
+				sftp_server_cleanup_exit(r);
+		} else if (r != SSH_ERR_NO_BUFFER_SPACE)
 			fatal_fr(r, "reserve");
 	}
 }
+
+/*
+ * In-process operation: sshd runs the request engine on a thread rather
+ * than forking a server that it talks to over pipes. The caller has
+ * already taken on the user's identity. The thread owns all of the
+ * server's state, so the file system calls never hold up sshd's event
+ * loop, and logs at the server's own level. Errors on the thread end the
+ * session, never sshd.
+ *
+ * Data isn't copied between sshd and the thread: the channel's buffers
+ * change hands with iqueue and oqueue via "ib" and "ob", each of which is
+ * only refilled once the other side has taken what it held. The one
+ * exception is a request that straddles two buffers from the channel:
+ * the rest of it is copied onto the part already queued. Channel data
+ * isn't framed as sftp requests and an sshbuf can't be split without a
+ * copy, so uploads whose writes span packets still copy up to one
+ * request per handoff; replies are never copied.
+ */
+
+static void
+inproc_swap(struct sshbuf **a, struct sshbuf **b)
+{
+	struct sshbuf *t = *a;
+
+	*a = *b;
+	*b = t;
+}
+
+/* Hand the replies so far to sshd. Called with inproc.lock held */
+static void
+inproc_publish(int status)
+{
+	int r, wake = status != -1;
+	char c = 0;
+
+	if (sshbuf_len(oqueue) > 0 && sshbuf_len(inproc.ob) == 0) {
+		inproc_swap(&oqueue, &inproc.ob);
+		wake = 1;
+	} else if (sshbuf_len(oqueue) > 0 && status != -1) {
+		/* Last chance: the final replies, e.g. a refusal */
+		if ((r = sshbuf_putb(inproc.ob, oqueue)) != 0)
+			error_fr(r, "final replies");
+	}
+	if (status != -1) {
+		inproc.done = 1;
+		inproc.status = status;
+	}
+	/* Nonblocking; if the pipe is full, sshd has a wakeup pending */
+	if (wake)
+		(void)write(inproc.wakefd, &c, 1);
+}
+
+/*
+ * Take the requests sshd has handed over: the whole buffer if no partial
+ * request is pending, otherwise just the rest of that request. Returns
+ * -1 on error. Called with inproc.lock held.
+ */
+static int
+inproc_take_requests(void)
+{
+	size_t want, n;
+	int r;
+
+	while (sshbuf_len(inproc.ib) > 0) {
+		if (sshbuf_len(iqueue) == 0) {
+			inproc_swap(&iqueue, &inproc.ib);
+			break;
+		}
+		/* See process() */
+		want = 5;
+		if (sshbuf_len(iqueue) >= 4 &&
+		    PEEK_U32(sshbuf_ptr(iqueue)) <= SFTP_MAX_MSG_LENGTH)
+			want = MAXIMUM(want, 4 + PEEK_U32(sshbuf_ptr(iqueue)));
+		if (sshbuf_len(iqueue) >= want)
+			break;
+		n = MINIMUM(want - sshbuf_len(iqueue), sshbuf_len(inproc.ib));
+		if ((r = sshbuf_put(iqueue, sshbuf_ptr(inproc.ib), n)) != 0 ||
+		    (r = sshbuf_consume(inproc.ib, n)) != 0) {
+			error_fr(r, "queue request");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Handle requests until "limit" bytes of replies are queued */
+static int
+inproc_process(size_t limit, int eof)
+{
+	size_t ilen;
+	int r, status = 0, stalled = 0;
+
+	while (sshbuf_len(oqueue) < limit) {
+		if ((r = sshbuf_check_reserve(oqueue,
+		    SFTP_MAX_MSG_LENGTH)) != 0) {
+			if (r != SSH_ERR_NO_BUFFER_SPACE)
+				fatal_fr(r, "reserve");
+			break;
+		}
+		ilen = sshbuf_len(iqueue);
+		if ((status = process()) != 0)
+			break;
+		if (sshbuf_len(iqueue) == ilen) {
+			stalled = 1;
+			break;
+		}
+	}
+	if (eof && stalled)
+		debug("read eof");
+	if (status != 0 || (eof && stalled))
+		return status;
+	return -1;
+}
+
+/* End the session thread, releasing what it holds */
+static void
+inproc_exit(int status)
+{
+	u_int i;
+
+	if (client_addr != NULL) {
+		handle_log_exit();
+		logit("session closed for local user %s from [%s]",
+		    pw->pw_name, client_addr);
+	}
+	for (i = 0; i < num_handles; i++)
+		if (handles[i].use != HANDLE_UNUSED)
+			handle_close(i);
+	pthread_mutex_lock(&inproc.lock);
+	inproc_publish(status);
+	pthread_mutex_unlock(&inproc.lock);
+	pthread_exit(NULL);
+}
+
+/* A fatal error on the session thread only ends the session */
+static void
+inproc_fatal(void)
+{
+	log_thread_fatal(NULL);
+	inproc_exit(255);
+}
+
+static void *
+inproc_main(void *arg)
+{
+	size_t room, ilen;
+	int eof, status;
+
+	log_thread_level(&log_level);
+	log_thread_fatal(inproc_fatal);
+	logit("session opened for local user %s from [%s]",
+	    pw->pw_name, client_addr);
+	if (inproc.homedir != NULL && chdir(inproc.homedir) != 0) {
+		error("chdir to \"%s\" failed: %s", inproc.homedir,
+		    strerror(errno));
+	}
+
+	pthread_mutex_lock(&inproc.lock);
+	for (;;) {
+		while (!inproc.work && !inproc.stop)
+			pthread_cond_wait(&inproc.cond, &inproc.lock);
+		if (inproc.stop)
+			break;
+		inproc.work = 0;
+		if (inproc_take_requests() != 0) {
+			status = 255;
+			break;
+		}
+		eof = inproc.eof && sshbuf_len(inproc.ib) == 0;
+		room = inproc.limit > sshbuf_len(inproc.ob) ?
+		    inproc.limit - sshbuf_len(inproc.ob) : 0;
+		ilen = sshbuf_len(iqueue);
+		pthread_mutex_unlock(&inproc.lock);
+
+		status = inproc_process(room, eof);
+
+		pthread_mutex_lock(&inproc.lock);
+		if (status != -1)
+			break;
+		/* Requests held back above can be taken now there's progress */
+		if (sshbuf_len(inproc.ib) > 0 && sshbuf_len(iqueue) != ilen)
+			inproc.work = 1;
+		inproc_publish(-1);
+	}
+	pthread_mutex_unlock(&inproc.lock);
+	inproc_exit(inproc.stop ? 0 : status);
+	return NULL;
+}
+
+/*
+ * Start an in-process session. On success, *wakefdp is a descriptor that
+ * becomes readable when sftp_server_inproc_exchange() has something new.
+ * Returns -1 if the arguments need a separate server.
+ */
+int
+sftp_server_inproc_init(int argc, char **argv, struct passwd *user_pw,
+    const char *remote_addr, int *wakefdp)
+{
+	SyslogFacility log_facility = SYSLOG_FACILITY_AUTH;
+	int log_stderr = 0, pfd[2];
+	sigset_t all, omask;
+
+	if (pw != NULL)
+		fatal_f("already running");
+	pw = user_pw; /* owned by the session */
+	log_level = SYSLOG_LEVEL_ERROR;
+	if (sftp_server_args(argc, argv, user_pw, 1, &log_facility,
+	    &log_stderr, &inproc.homedir) != 0 || pipe(pfd) == -1) {
+		sftp_server_inproc_cleanup();
+		return -1;
+	}
+	set_nonblock(pfd[0]);
+	set_nonblock(pfd[1]);
+	client_addr = xstrdup(remote_addr);
+	if ((iqueue = sshbuf_new()) == NULL ||
+	    (oqueue = sshbuf_new()) == NULL ||
+	    (inproc.ib = sshbuf_new()) == NULL ||
+	    (inproc.ob = sshbuf_new()) == NULL)
+		fatal_f("sshbuf_new failed");
+	inproc.wakefd = pfd[1];
+	pthread_mutex_init(&inproc.lock, NULL);
+	pthread_cond_init(&inproc.cond, NULL);
+
+	platform_disable_tracing(1);	/* strict */
+
+	/* Signals are for sshd's thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &omask);
+	inproc.running = 1;
+	if (pthread_create(&inproc.tid, NULL, inproc_main, NULL) != 0) {
+		error_f("pthread_create failed");
+		inproc.running = 0;
+		pthread_cond_destroy(&inproc.cond);
+		pthread_mutex_destroy(&inproc.lock);
+		close(pfd[0]);
+		close(pfd[1]);
+	}
+	pthread_sigmask(SIG_SETMASK, &omask, NULL);
+	if (!inproc.running) {
+		sftp_server_inproc_cleanup();
+		return -1;
+	}
+	*wakefdp = pfd[0];
+	return 0;
+}
+
+/*
+ * Give the session thread what the client has sent in *inp, and collect
+ * its replies in *outp, which the thread fills to at most "limit" bytes.
+ * Either buffer may be exchanged for one of the thread's rather than
+ * copied. "eof" indicates that the client will send nothing more. This
+ * never waits for the thread. Returns -1 while the session continues,
+ * otherwise its exit status.
+ */
+int
+sftp_server_inproc_exchange(struct sshbuf **inp, struct sshbuf **outp,
+    size_t limit, int eof)
+{
+	size_t n;
+	int status = -1, work = 0;
+
+	pthread_mutex_lock(&inproc.lock);
+	if (sshbuf_len(*inp) > 0 && sshbuf_len(inproc.ib) == 0) {
+		inproc_swap(inp, &inproc.ib);
+		work = 1;
+	}
+	if (sshbuf_len(inproc.ob) > 0 && sshbuf_len(*outp) == 0) {
+		inproc_swap(outp, &inproc.ob);
+		work = 1;
+	}
+	if (eof && sshbuf_len(*inp) == 0 && !inproc.eof)
+		inproc.eof = work = 1;
+	n = sshbuf_len(*outp) < limit ? limit - sshbuf_len(*outp) : 0;
+	if (n > inproc.limit)
+		work = 1;
+	inproc.limit = n;
+	if (inproc.done) {
+		if (sshbuf_len(inproc.ob) == 0)
+			status = inproc.status;
+	} else if (work) {
+		inproc.work = 1;
+		pthread_cond_signal(&inproc.cond);
+	}
+	pthread_mutex_unlock(&inproc.lock);
+	return status;
+}
+
+/* Stop an in-process session and release everything it held */
+void
+sftp_server_inproc_cleanup(void)
+{
+	if (pw == NULL)
+		return;
+	if (inproc.running) {
+		pthread_mutex_lock(&inproc.lock);
+		inproc.stop = 1;
+		pthread_cond_signal(&inproc.cond);
+		pthread_mutex_unlock(&inproc.lock);
+		pthread_join(inproc.tid, NULL);
+		pthread_cond_destroy(&inproc.cond);
+		pthread_mutex_destroy(&inproc.lock);
+		close(inproc.wakefd);
+	}
+	sshbuf_free(inproc.ib);
+	sshbuf_free(inproc.ob);
+	free(inproc.homedir);
+	memset(&inproc, 0, sizeof(inproc));
+	sshbuf_free(iqueue);
+	sshbuf_free(oqueue);
+	iqueue = oqueue = NULL;
+	free(handles);
+	handles = NULL;
+	num_handles = 0;
+	first_unused_handle = -1;
+	free(request_allowlist);
+	free(request_denylist);
+	request_allowlist = request_denylist = NULL;
+	free(client_addr);
+	client_addr = NULL;
+	pw = NULL;
+	version = 0;
+	init_done = readonly = 0;
+}
@@ -117,6 +117,9 @@ extern char *__progname;
 /* Separators for interactive commands */
 #define WHITESPACE " \t\r\n"
 
+/* Seconds that remote directory listings are cached in interactive mode */
+#define DIRCACHE_TTL	30
+
 /* ls flags */
 #define LS_LONG_VIEW	0x0001	/* Full view ala ls -l */
 #define LS_SHORT_VIEW	0x0002	/* Single row view ala ls -1 */
@@ -799,6 +802,127 @@ sdirent_comp(const void *aa, const void *bb)
 	fatal("Unknown ls sort type");
 }
 
+/* Print one entry of a listing of 'path', in the format chosen by lflag */
+static void
+ls_print_dirent(const char *path, const char *strip_path, SFTP_DIRENT *d,
+    int lflag, u_int colspace, u_int columns, u_int *c)
+{
+	char *tmp, *fname;
+
+	if (d->filename[0] == '.' && !(lflag & LS_SHOW_ALL))
+		return;
+
+	tmp = path_append(path, d->filename);
+	fname = path_strip(tmp, strip_path);
+	free(tmp);
+
+	if (lflag & LS_LONG_VIEW) {
+		if (lflag & (LS_NUMERIC_VIEW|LS_SI_UNITS)) {
+			char *lname;
+			struct stat sb;
+
+			memset(&sb, 0, sizeof(sb));
+			attrib_to_stat(&d->a, &sb);
+			lname = ls_file(fname, &sb, 1,
+			    (lflag & LS_SI_UNITS));
+			mprintf("%s\n", lname);
+			free(lname);
+		} else
+			mprintf("%s\n", d->longname);
+	} else {
+		mprintf("%-*s", colspace, fname);
+		if (*c >= columns) {
+			printf("\n");
+			*c = 1;
+		} else
+			(*c)++;
+	}
+
+	free(fname);
+}
+
+/* State of an unsorted listing printed as it arrives */
+struct ls_stream {
+	const char *path;
+	const char *strip_path;
+	int lflag;
+	u_int width;	/* of the terminal */
+	u_int m;	/* longest name so far */
+	u_int colspace, columns, c;
+};
+
+static int
+ls_stream_batch(SFTP_DIRENT **d, void *arg)
+{
+	struct ls_stream *ls = arg;
+	u_int n, m = ls->m, columns;
+	char *tmp;
+
+	if (interrupted)
+		return -1;
+
+	/*
+	 * Columns can only be sized for the names seen so far, so they
+	 * widen as longer ones arrive, starting a new row when they do.
+	 */
+	if (!(ls->lflag & LS_SHORT_VIEW)) {
+		for (n = 0; d[n] != NULL; n++) {
+			if (d[n]->filename[0] != '.' ||
+			    (ls->lflag & LS_SHOW_ALL))
+				m = MAXIMUM(m, strlen(d[n]->filename));
+		}
+		if (m > ls->m || ls->columns == 0) {
+			ls->m = m;
+			tmp = path_strip(ls->path, ls->strip_path);
+			m += strlen(tmp);
+			free(tmp);
+			columns = MAXIMUM(ls->width / (m + 2), 1);
+			if (ls->c != 1 && !(ls->lflag & LS_LONG_VIEW)) {
+				printf("\n");
+				ls->c = 1;
+			}
+			ls->columns = columns;
+			ls->colspace = MINIMUM(ls->width / columns, ls->width);
+		}
+	}
+
+	for (n = 0; d[n] != NULL && !interrupted; n++) {
+		ls_print_dirent(ls->path, ls->strip_path, d[n], ls->lflag,
+		    ls->colspace, ls->columns, &ls->c);
+	}
+	return 0;
+}
+
+/*
+ * Unsorted listings are printed as each READDIR reply arrives, so huge
+ * directories start printing at once and memory use doesn't grow with
+ * the size of the directory.
+ */
+static int
+do_ls_dir_stream(struct sftp_conn *conn, const char *path,
+    const char *strip_path, int lflag)
+{
+	struct ls_stream ls;
+	struct winsize ws;
+	int r;
+
+	memset(&ls, 0, sizeof(ls));
+	ls.path = path;
+	ls.strip_path = strip_path;
+	ls.lflag = lflag;
+	ls.width = 80;
+	ls.columns = (lflag & LS_SHORT_VIEW) ? 1 : 0;
+	ls.c = 1;
+	if (ioctl(fileno(stdin), TIOCGWINSZ, &ws) != -1)
+		ls.width = ws.ws_col;
+
+	r = do_readdir_stream(conn, path, ls_stream_batch, &ls);
+
+	if (!(lflag & LS_LONG_VIEW) && (ls.c != 1))
+		printf("\n");
+	return r;
+}
+
 /* sftp ls.1 replacement for directories */
 static int
 do_ls_dir(struct sftp_conn *conn, const char *path,
@@ -806,10 +930,17 @@ do_ls_dir(struct sftp_conn *conn, const char *path,
 {
 	int n;
 	u_int c = 1, colspace = 0, columns = 1;
+	struct sftp_dirlist *list;
 	SFTP_DIRENT **d;
 
-	if ((n = do_readdir(conn, path, &d)) != 0)
+	if (!(lflag & SORT_FLAGS))
+		return do_ls_dir_stream(conn, path, strip_path, lflag);
+
+	if ((n = do_readdir_cached(conn, path, &list)) != 0)
 		return (n);
+	/* the listing is shared with the cache, sort a copy of it */
+	d = xcalloc(list->nents + 1, sizeof(*d));
+	memcpy(d, list->dir, list->nents * sizeof(*d));
 
 	if (!(lflag & LS_SHORT_VIEW)) {
 		u_int m = 0, width = 80;
@@ -836,52 +967,21 @@ do_ls_dir(struct sftp_conn *conn, const char *path,
 		colspace = MINIMUM(colspace, width);
 	}
 
-	if (lflag & SORT_FLAGS) {
-		for (n = 0; d[n] != NULL; n++)
-			;	/* count entries */
-		sort_flag = lflag & (SORT_FLAGS|LS_REVERSE_SORT);
-		qsort(d, n, sizeof(*d), sdirent_comp);
-	}
+	for (n = 0; d[n] != NULL; n++)
+		;	/* count entries */
+	sort_flag = lflag & (SORT_FLAGS|LS_REVERSE_SORT);
+	qsort(d, n, sizeof(*d), sdirent_comp);
 
 	for (n = 0; d[n] != NULL && !interrupted; n++) {
-		char *tmp, *fname;
-
-		if (d[n]->filename[0] == '.' && !(lflag & LS_SHOW_ALL))
-			continue;
-
-		tmp = path_append(path, d[n]->filename);
-		fname = path_strip(tmp, strip_path);
-		free(tmp);
-
-		if (lflag & LS_LONG_VIEW) {
-			if (lflag & (LS_NUMERIC_VIEW|LS_SI_UNITS)) {
-				char *lname;
-				struct stat sb;
-
-				memset(&sb, 0, sizeof(sb));
-				attrib_to_stat(&d[n]->a, &sb);
-				lname = ls_file(fname, &sb, 1,
-				    (lflag & LS_SI_UNITS));
-				mprintf("%s\n", lname);
-				free(lname);
-			} else
-				mprintf("%s\n", d[n]->longname);
-		} else {
-			mprintf("%-*s", colspace, fname);
-			if (c >= columns) {
-				printf("\n");
-				c = 1;
-			} else
-				c++;
-		}
-
-		free(fname);
+		ls_print_dirent(path, strip_path, d[n], lflag, colspace,
+		    columns, &c);
 	}
 
 	if (!(lflag & LS_LONG_VIEW) && (c != 1))
 		printf("\n");
 
-	free_sftp_dirents(d);
+	free(d);
+	sftp_dirlist_free(list);
 	return (0);
 }
 
@@ -1286,6 +1386,29 @@ makeargv(const char *arg, int *argcp, int sloppy, char *lastquote,
 	return argv;
 }
 
+/* Returns non-zero if the command may change anything on the server */
+static int
+modifies_remote(int cmdnum)
+{
+	switch (cmdnum) {
+	case I_PUT:
+	case I_REPUT:
+	case I_COPY:
+	case I_RENAME:
+	case I_SYMLINK:
+	case I_LINK:
+	case I_RM:
+	case I_MKDIR:
+	case I_RMDIR:
+	case I_CHMOD:
+	case I_CHOWN:
+	case I_CHGRP:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
 static int
 parse_args(const char **cpp, int *ignore_errors, int *disable_echo, int *aflag,
 	  int *fflag, int *hflag, int *iflag, int *lflag, int *pflag,
@@ -1522,6 +1645,10 @@ parse_dispatch_command(struct sftp_conn *conn, const char *cmd, char **pwd,
 
 	memset(&g, 0, sizeof(g));
 
+	/* Glob against fresh listings, and don't keep ones we'll change */
+	if (modifies_remote(cmdnum))
+		sftp_dircache_flush(conn);
+
 	/* Perform command */
 	switch (cmdnum) {
 	case 0:
@@ -1614,6 +1741,7 @@ parse_dispatch_command(struct sftp_conn *conn, const char *cmd, char **pwd,
 		}
 		free(*pwd);
 		*pwd = tmp;
+		sftp_dircache_prefetch(conn, *pwd);
 		break;
 	case I_LS:
 		if (!path1) {
@@ -1752,6 +1880,9 @@ parse_dispatch_command(struct sftp_conn *conn, const char *cmd, char **pwd,
 		fatal("%d is not implemented", cmdnum);
 	}
 
+	if (modifies_remote(cmdnum))
+		sftp_dircache_flush(conn);
+
 	if (g.gl_pathc)
 		globfree(&g);
 	free(path1);
@@ -2178,6 +2309,10 @@ interactive_loop(struct sftp_conn *conn, char *file1, char *file2)
 		fatal("Need cwd");
 	startdir = xstrdup(remote_path);
 
+	/* Keep completion and ls responsive on slow links */
+	if (!batchmode && isatty(STDIN_FILENO))
+		sftp_dircache_enable(conn, DIRCACHE_TTL);
+
 	if (file1 != NULL) {
 		dir = xstrdup(file1);
 		dir = make_absolute(dir, remote_path);
@@ -2214,6 +2349,8 @@ interactive_loop(struct sftp_conn *conn, char *file1, char *file2)
 	setvbuf(stdout, NULL, _IOLBF, 0);
 	setvbuf(infile, NULL, _IOLBF, 0);
 
+	sftp_dircache_prefetch(conn, remote_path);
+
 	interactive = !batchmode && isatty(STDIN_FILENO);
 	err = 0;
 	for (;;) {
@@ -2348,7 +2485,7 @@ usage(void)
 	extern char *__progname;
 
 	fprintf(stderr,
-	    "usage: %s [-46AaCfNpqrv] [-B buffer_size] [-b batchfile] [-c cipher]\n"
+	    "usage: %s [-46AaCfNpqrVv] [-B buffer_size] [-b batchfile] [-c cipher]\n"
 	    "          [-D sftp_server_path] [-F ssh_config] [-i identity_file]\n"
 	    "          [-J destination] [-l limit] [-o ssh_option] [-P port]\n"
 	    "          [-R num_requests] [-S program] [-s subsystem | sftp_server]\n"
@@ -2360,7 +2497,7 @@ usage(void)
 int
 main(int argc, char **argv)
 {
-	int in, out, ch, err, tmp, port = -1, noisy = 0;
+	int in, out, ch, err, tmp, port = -1, noisy = 0, verify = 0;
 	char *host = NULL, *user, *cp, *file2 = NULL;
 	int debug_level = 0;
 	char *file1 = NULL, *sftp_server = NULL;
@@ -2393,7 +2530,7 @@ main(int argc, char **argv)
 	infile = stdin;
 
 	while ((ch = getopt(argc, argv,
-	    "1246AafhNpqrvCc:D:i:l:o:s:S:b:B:F:J:P:R:")) != -1) {
+	    "1246AafhNpqrVvCc:D:i:l:o:s:S:b:B:F:J:P:R:")) != -1) {
 		switch (ch) {
 		/* Passed through to ssh(1) */
 		case 'A':
@@ -2477,6 +2614,9 @@ main(int argc, char **argv)
 		case 'r':
 			global_rflag = 1;
 			break;
+		case 'V':
+			verify = 1;
+			break;
 		case 'R':
 			num_requests = strtol(optarg, &cp, 10);
 			if (num_requests == 0 || *cp != '\0')
@@ -2569,6 +2709,8 @@ main(int argc, char **argv)
 	conn = do_init(in, out, copy_buffer_len, num_requests, limit_kbps);
 	if (conn == NULL)
 		fatal("Couldn't initialise connection to server");
+	if (verify && sftp_verify_enable(conn) != 0)
+		fatal("Unable to verify transfers");
 
 	if (!quiet) {
 		if (sftp_direct == NULL)
@@ -96,6 +96,13 @@
 #define SSH2_FX_MAX			8
 
 struct passwd;
+struct sshbuf;
 
 int	sftp_server_main(int, char **, struct passwd *);
 void	sftp_server_cleanup_exit(int) __attribute__((noreturn));
+
+int	sftp_server_inproc_init(int, char **, struct passwd *, const char *,
+    int *);
+int	sftp_server_inproc_exchange(struct sshbuf **, struct sshbuf **,
+    size_t, int);
+void	sftp_server_inproc_cleanup(void);
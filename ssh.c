@@ -99,6 +99,7 @@
 #include "misc.h"
 #include "readconf.h"
 #include "sshconnect.h"
+#include "dns.h"
 #include "kex.h"
 #include "mac.h"
 #include "sshpty.h"
@@ -107,6 +108,7 @@
 #include "version.h"
 #include "ssherr.h"
 #include "myproposal.h"
+#include "timing.h"
 #include "utf8.h"
 
 #ifdef ENABLE_PKCS11
@@ -169,6 +171,16 @@ struct sshbuf *command;
 /* # of replies received for global requests */
 static int forward_confirms_pending = -1;
 
+/* TimingReport span for opening the session channel */
+static int session_timing = -1;
+
+/* ssh -O prewarm, and the destination this process starts a master for */
+static int prewarm_flag;
+static char *prewarm_dest;
+
+/* Most prewarm connections in progress at once */
+#define PREWARM_MAX_INFLIGHT	64
+
 /* mux.c */
 extern int muxserver_sock;
 extern u_int muxclient_command;
@@ -193,6 +205,7 @@ usage(void)
 static int ssh_session2(struct ssh *, const struct ssh_conn_info *);
 static void load_public_identity_files(const struct ssh_conn_info *);
 static void main_sigchld_handler(int);
+static char *prewarm_fork(int, char **);
 
 /* ~/ expand a list of paths. NB. assumes path[n] is heap-allocated. */
 static void
@@ -252,7 +265,7 @@ resolve_host(const char *name, int port, int logerr, char *cname, size_t clen)
 {
 	char strport[NI_MAXSERV];
 	struct addrinfo hints, *res;
-	int gaierr;
+	int gaierr, tid;
 	LogLevel loglevel = SYSLOG_LEVEL_DEBUG1;
 
 	if (port <= 0)
@@ -268,7 +281,10 @@ resolve_host(const char *name, int port, int logerr, char *cname, size_t clen)
 	hints.ai_socktype = SOCK_STREAM;
 	if (cname != NULL)
 		hints.ai_flags = AI_CANONNAME;
-	if ((gaierr = getaddrinfo(name, strport, &hints, &res)) != 0) {
+	tid = timing_begin("dns", name);
+	gaierr = getaddrinfo(name, strport, &hints, &res);
+	timing_end(tid);
+	if (gaierr != 0) {
 		if (logerr || (gaierr != EAI_NONAME && gaierr != EAI_NODATA))
 			loglevel = SYSLOG_LEVEL_ERROR;
 		do_log2(loglevel, "%s: Could not resolve hostname %.100s: %s",
@@ -618,7 +634,7 @@ int
 main(int ac, char **av)
 {
 	struct ssh *ssh = NULL;
-	int i, r, opt, exit_status, use_syslog, direct, timeout_ms;
+	int i, r, opt, exit_status, use_syslog, direct, timeout_ms, tid;
 	int was_addr, config_test = 0, opt_terminated = 0, want_final_pass = 0;
 	char *p, *cp, *line, *argv0, *logfile, *host_arg;
 	char cname[NI_MAXHOST], thishost[NI_MAXHOST];
@@ -632,6 +648,8 @@ main(int ac, char **av)
 	u_int j;
 	struct ssh_conn_info *cinfo = NULL;
 
+	timing_start();
+
 	/* Ensure that fds 0, 1 and 2 are open or directed to /dev/null */
 	sanitise_stdfd();
 
@@ -743,7 +761,7 @@ main(int ac, char **av)
 			if (options.stdio_forward_host != NULL)
 				fatal("Cannot specify multiplexing "
 				    "command with -W");
-			else if (muxclient_command != 0)
+			else if (muxclient_command != 0 || prewarm_flag)
 				fatal("Multiplexing command already specified");
 			if (strcmp(optarg, "check") == 0)
 				muxclient_command = SSHMUX_COMMAND_ALIVE_CHECK;
@@ -757,6 +775,8 @@ main(int ac, char **av)
 				muxclient_command = SSHMUX_COMMAND_CANCEL_FWD;
 			else if (strcmp(optarg, "proxy") == 0)
 				muxclient_command = SSHMUX_COMMAND_PROXY;
+			else if (strcmp(optarg, "prewarm") == 0)
+				prewarm_flag = 1;
 			else
 				fatal("Invalid multiplex command.");
 			break;
@@ -890,7 +910,7 @@ main(int ac, char **av)
 		case 'W':
 			if (options.stdio_forward_host != NULL)
 				fatal("stdio forward already specified");
-			if (muxclient_command != 0)
+			if (muxclient_command != 0 || prewarm_flag)
 				fatal("Cannot specify stdio forward with -O");
 			if (parse_forward(&fwd, optarg, 1, 0)) {
 				options.stdio_forward_host = fwd.listen_host;
@@ -1057,6 +1077,32 @@ main(int ac, char **av)
 	ac -= optind;
 	av += optind;
 
+	/*
+	 * With -O prewarm every argument is a destination.  Only the
+	 * children that start the masters return here, with one each.
+	 */
+	if (prewarm_flag && !host) {
+		if (ac == 0)
+			usage();
+		if (use_syslog && logfile != NULL)
+			fatal("Can't specify both -y and -E");
+		if (logfile != NULL)
+			log_redirect_stderr_to(logfile);
+		log_init(argv0,
+		    options.log_level == SYSLOG_LEVEL_NOT_SET ?
+		    SYSLOG_LEVEL_INFO : options.log_level,
+		    options.log_facility == SYSLOG_FACILITY_NOT_SET ?
+		    SYSLOG_FACILITY_USER : options.log_facility,
+		    !use_syslog);
+		prewarm_dest = prewarm_fork(ac, av);
+		ac = 1;
+		av = &prewarm_dest;
+		/* Nothing to run and nobody to ask; just leave a master */
+		options.session_type = SESSION_TYPE_NONE;
+		options.request_tty = REQUEST_TTY_NO;
+		options.stdin_null = 1;
+	}
+
 	if (ac > 0 && !host) {
 		int tport;
 		char *tuser;
@@ -1098,7 +1144,7 @@ main(int ac, char **av)
 	}
 
 	/* Check that we got a host name. */
-	if (!host)
+	if (!host || (prewarm_flag && prewarm_dest == NULL))
 		usage();
 
 	host_arg = xstrdup(host);
@@ -1147,7 +1193,9 @@ main(int ac, char **av)
 		logit("%s, %s", SSH_RELEASE, SSH_OPENSSL_VERSION);
 
 	/* Parse the configuration files */
+	tid = timing_begin("config", NULL);
 	process_config_files(host_arg, pw, 0, &want_final_pass);
+	timing_end(tid);
 	if (want_final_pass)
 		debug("configuration requests final Match pass");
 
@@ -1216,7 +1264,9 @@ main(int ac, char **av)
 		debug("re-parsing configuration");
 		free(options.hostname);
 		options.hostname = xstrdup(host);
+		tid = timing_begin("config", "final");
 		process_config_files(host_arg, pw, 1, NULL);
+		timing_end(tid);
 		/*
 		 * Address resolution happens early with canonicalisation
 		 * enabled and the port number may have changed since, so
@@ -1226,6 +1276,21 @@ main(int ac, char **av)
 			set_addrinfo_port(addrs, options.port);
 	}
 
+	/*
+	 * A prewarmed master has to outlive this process, and nobody is
+	 * there to answer prompts unless the configuration says otherwise.
+	 */
+	if (prewarm_flag) {
+		if (options.control_persist <= 0) {
+			options.control_persist = 1;
+			options.control_persist_timeout = 0;
+		}
+		if (options.batch_mode == -1)
+			options.batch_mode = 1;
+		if (options.control_master == -1)
+			options.control_master = SSHCTL_MASTER_AUTO;
+	}
+
 	/* Fill configuration defaults. */
 	if (fill_default_options(&options) != 0)
 		cleanup_exit(255);
@@ -1411,6 +1476,18 @@ main(int ac, char **av)
 		options.identity_agent = cp;
 	}
 
+	if (options.timing_report != NULL) {
+		/* Only the path after the "json:"/"text:" format is expanded */
+		p = tilde_expand_filename(options.timing_report + 5, getuid());
+		cp = default_client_percent_dollar_expand(p, cinfo);
+		free(p);
+		xasprintf(&p, "%.5s%s", options.timing_report, cp);
+		free(cp);
+		free(options.timing_report);
+		options.timing_report = p;
+		timing_set_report(options.timing_report, host);
+	}
+
 	if (options.forward_agent_sock_path != NULL) {
 		p = tilde_expand_filename(options.forward_agent_sock_path,
 		    getuid());
@@ -1523,6 +1600,15 @@ main(int ac, char **av)
 
 	if (muxclient_command != 0 && options.control_path == NULL)
 		fatal("No ControlPath specified for \"-O\" command");
+	if (prewarm_flag) {
+		if (options.control_path == NULL)
+			fatal("No ControlPath specified for \"-O prewarm\"");
+		if ((j = muxclient_master_pid(options.control_path)) != 0) {
+			debug("Master for %s already running (pid=%u)",
+			    host_arg, j);
+			exit(0);
+		}
+	}
 	if (options.control_path != NULL) {
 		int sock;
 		if ((sock = muxclient(options.control_path)) >= 0) {
@@ -1532,6 +1618,18 @@ main(int ac, char **av)
 		}
 	}
 
+	/*
+	 * Start the SSHFP lookup now so that it overlaps the connection
+	 * and key exchange rather than delaying host key verification.
+	 */
+	if (options.verify_host_key_dns) {
+		cp = tilde_expand_filename(_PATH_SSH_USER_SSHFP_CACHE,
+		    getuid());
+		dns_set_sshfp_cache(cp);
+		free(cp);
+		dns_prefetch_sshfp(host);
+	}
+
 	/*
 	 * If hostname canonicalisation was not enabled, then we may not
 	 * have yet resolved the hostname. Do so now.
@@ -1549,16 +1647,21 @@ main(int ac, char **av)
 		timeout_ms = options.connection_timeout * 1000;
 
 	/* Open a connection to the remote host. */
+	tid = timing_begin("connect", NULL);
 	if (ssh_connect(ssh, host, host_arg, addrs, &hostaddr, options.port,
 	    options.connection_attempts,
-	    &timeout_ms, options.tcp_keep_alive) != 0)
+	    &timeout_ms, options.tcp_keep_alive) != 0) {
+		timing_report(0);
 		exit(255);
+	}
+	timing_end(tid);
 
 	if (addrs != NULL)
 		freeaddrinfo(addrs);
 
 	ssh_packet_set_timeout(ssh, options.server_alive_interval,
 	    options.server_alive_count_max);
+	channel_set_idle_timeout(ssh, options.channel_idle_timeout);
 
 	if (timeout_ms > 0)
 		debug3("timeout: %d ms remain after connect", timeout_ms);
@@ -1703,6 +1806,7 @@ main(int ac, char **av)
 	/* Kill ProxyCommand if it is running. */
 	ssh_kill_proxy_command();
 
+	timing_report(0);
 	return exit_status;
 }
 
@@ -1743,6 +1847,92 @@ control_persist_detach(void)
 	setproctitle("%s [mux]", options.control_path);
 }
 
+/*
+ * ssh -O prewarm: start a ControlPersist master for each destination,
+ * up to PREWARM_MAX_INFLIGHT at once.  Each is started by a child that
+ * returns its destination and carries on through main(), exiting once
+ * its master has gone to the background.  The parent waits for them all
+ * and exits.  A destination of "-" reads them from standard input, one
+ * per line.  Duplicates are dropped so that two children never race for
+ * one ControlPath.
+ */
+static int
+prewarm_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static char *
+prewarm_fork(int ac, char **av)
+{
+	char **dests = NULL, *line = NULL, *cp;
+	size_t ndests = 0, linesize = 0, i, next, inflight = 0, failed = 0;
+	pid_t pid, *pids;
+	int status;
+
+	if (ac == 1 && strcmp(av[0], "-") == 0) {
+		while (getline(&line, &linesize, stdin) != -1) {
+			cp = line + strspn(line, " \t");
+			cp[strcspn(cp, " \t\r\n#")] = '\0';
+			if (*cp == '\0')
+				continue;
+			dests = xrecallocarray(dests, ndests, ndests + 1,
+			    sizeof(*dests));
+			dests[ndests++] = xstrdup(cp);
+		}
+		free(line);
+		if (ndests == 0)
+			fatal("No destinations to prewarm");
+	} else {
+		dests = xcalloc(ac, sizeof(*dests));
+		for (ndests = 0; ndests < (size_t)ac; ndests++)
+			dests[ndests] = av[ndests];
+	}
+	qsort(dests, ndests, sizeof(*dests), prewarm_cmp);
+	for (i = next = 0; i < ndests; i++) {
+		if (next > 0 && strcmp(dests[next - 1], dests[i]) == 0)
+			continue;
+		dests[next++] = dests[i];
+	}
+	ndests = next;
+	pids = xcalloc(ndests, sizeof(*pids));
+
+	for (next = 0; next < ndests || inflight > 0;) {
+		if (next < ndests && inflight < PREWARM_MAX_INFLIGHT) {
+			if ((pid = fork()) == 0) {
+				free(pids);
+				return dests[next];
+			}
+			if (pid != -1) {
+				debug2_f("%s: pid %ld", dests[next], (long)pid);
+				pids[next++] = pid;
+				inflight++;
+				continue;
+			}
+			if (inflight == 0)
+				fatal_f("fork: %s", strerror(errno));
+			debug_f("fork: %s; waiting", strerror(errno));
+		}
+		if ((pid = waitpid(-1, &status, 0)) == -1) {
+			if (errno == EINTR)
+				continue;
+			fatal_f("waitpid: %s", strerror(errno));
+		}
+		for (i = 0; i < next && pids[i] != pid; i++)
+			;
+		if (i == next)
+			continue;
+		inflight--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			error("%s: master not started", dests[i]);
+			failed++;
+		}
+	}
+	debug("Started masters for %zu of %zu destinations",
+	    ndests - failed, ndests);
+	exit(failed == 0 ? 0 : 255);
+}
+
 /* Do fork() after authentication. Used by "ssh -f" */
 static void
 fork_postauth(void)
@@ -2058,6 +2248,9 @@ ssh_session2_setup(struct ssh *ssh, int id, int success, void *arg)
 	client_session2_setup(ssh, id, tty_flag,
 	    options.session_type == SESSION_TYPE_SUBSYSTEM, term,
 	    NULL, fileno(stdin), command, environ);
+
+	timing_end(session_timing);
+	timing_report(1);
 }
 
 static void
@@ -2175,6 +2368,7 @@ ssh_session2_open(struct ssh *ssh)
 
 	debug3_f("channel_new: %d", c->self);
 
+	session_timing = timing_begin("session", NULL);
 	channel_send_open(ssh, c->self);
 	if (options.session_type != SESSION_TYPE_NONE)
 		channel_register_open_confirm(ssh, c->self,
@@ -2216,6 +2410,13 @@ ssh_session2(struct ssh *ssh, const struct ssh_conn_info *cinfo)
 	/* Start listening for multiplex clients */
 	if (!ssh_packet_get_mux(ssh))
 		muxserver_listen(ssh);
+	/*
+	 * A prewarm that could not become the master, e.g. because another
+	 * destination shares its ControlPath, must not linger as a plain
+	 * connection.
+	 */
+	if (prewarm_flag && muxserver_sock == -1)
+		exit(muxclient_master_pid(options.control_path) != 0 ? 0 : 255);
 
 	/*
 	 * If we are in control persist mode and have a working mux listen
@@ -2253,6 +2454,8 @@ ssh_session2(struct ssh *ssh, const struct ssh_conn_info *cinfo)
 		ssh_packet_set_interactive(ssh,
 		    options.control_master == SSHCTL_MASTER_NO,
 		    options.ip_qos_interactive, options.ip_qos_bulk);
+		/* Nothing more to set up */
+		timing_report(1);
 	}
 
 	/* If we don't expect to open a new session, then disallow it */
@@ -32,6 +32,8 @@
 #include <ctype.h>
 #include <unistd.h>
 
+#include "b64.h"
+#include "misc.h"
 #include "ssherr.h"
 #define SSHBUF_INTERNAL
 #include "sshbuf.h"
@@ -93,9 +95,9 @@ sshbuf_dtob16(struct sshbuf *buf)
 int
 sshbuf_dtob64(const struct sshbuf *d, struct sshbuf *b64, int wrap)
 {
-	size_t i, slen = 0;
+	size_t i, len, slen = 0;
 	char *s = NULL;
-	int r;
+	int r, n;
 
 	if (d == NULL || b64 == NULL || sshbuf_len(d) >= SIZE_MAX / 2)
 		return SSH_ERR_INVALID_ARGUMENT;
@@ -104,21 +106,21 @@ sshbuf_dtob64(const struct sshbuf *d, struct sshbuf *b64, int wrap)
 	slen = ((sshbuf_len(d) + 2) / 3) * 4 + 1;
 	if ((s = malloc(slen)) == NULL)
 		return SSH_ERR_ALLOC_FAIL;
-	if (b64_ntop(sshbuf_ptr(d), sshbuf_len(d), s, slen) == -1) {
+	n = ssh_b64_ntop(sshbuf_ptr(d), sshbuf_len(d), s, slen);
+	if (n == -1) {
 		r = SSH_ERR_INTERNAL_ERROR;
 		goto fail;
 	}
 	if (wrap) {
-		for (i = 0; s[i] != '\0'; i++) {
-			if ((r = sshbuf_put_u8(b64, s[i])) != 0)
-				goto fail;
-			if (i % 70 == 69 && (r = sshbuf_put_u8(b64, '\n')) != 0)
+		/* lines of 70 characters, the last one newline-terminated too */
+		for (i = 0; i < (size_t)n; i += len) {
+			len = MINIMUM((size_t)n - i, 70);
+			if ((r = sshbuf_put(b64, s + i, len)) != 0 ||
+			    (r = sshbuf_put_u8(b64, '\n')) != 0)
 				goto fail;
 		}
-		if ((i - 1) % 70 != 69 && (r = sshbuf_put_u8(b64, '\n')) != 0)
-			goto fail;
 	} else {
-		if ((r = sshbuf_put(b64, s, strlen(s))) != 0)
+		if ((r = sshbuf_put(b64, s, n)) != 0)
 			goto fail;
 	}
 	/* Success */
@@ -156,7 +158,7 @@ sshbuf_b64tod(struct sshbuf *buf, const char *b64)
 		return 0;
 	if ((p = malloc(plen)) == NULL)
 		return SSH_ERR_ALLOC_FAIL;
-	if ((nlen = b64_pton(b64, p, plen)) < 0) {
+	if ((nlen = ssh_b64_pton(b64, p, plen)) < 0) {
 		freezero(p, plen);
 		return SSH_ERR_INVALID_FORMAT;
 	}
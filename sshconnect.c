@@ -69,6 +69,7 @@
 #include "ssherr.h"
 #include "authfd.h"
 #include "kex.h"
+#include "timing.h"
 
 struct sshkey *previous_host_key = NULL;
 
@@ -1570,7 +1571,7 @@ ssh_login(struct ssh *ssh, Sensitive *sensitive, const char *orighost,
 {
 	char *host;
 	char *server_user, *local_user;
-	int r;
+	int r, tid;
 
 	local_user = xstrdup(pw->pw_name);
 	server_user = options.user ? options.user : local_user;
@@ -1580,8 +1581,10 @@ ssh_login(struct ssh *ssh, Sensitive *sensitive, const char *orighost,
 	lowercase(host);
 
 	/* Exchange protocol version identification strings with the server. */
+	tid = timing_begin("banner", NULL);
 	if ((r = kex_exchange_identification(ssh, timeout_ms, NULL)) != 0)
 		sshpkt_fatal(ssh, r, "banner exchange");
+	timing_end(tid);
 
 	/* Put the connection into non-blocking mode. */
 	ssh_packet_set_nonblocking(ssh);
@@ -1589,7 +1592,9 @@ ssh_login(struct ssh *ssh, Sensitive *sensitive, const char *orighost,
 	/* key exchange */
 	/* authenticate user */
 	debug("Authenticating to %s:%d as '%s'", host, port, server_user);
+	tid = timing_begin("kex", NULL);
 	ssh_kex2(ssh, host, hostaddr, port, cinfo);
+	timing_end(tid);
 	ssh_userauth2(ssh, local_user, server_user, host, sensitive);
 	free(local_user);
 	free(host);
@@ -75,6 +75,7 @@
 #include "utf8.h"
 #include "ssh-sk.h"
 #include "sk-api.h"
+#include "timing.h"
 
 #ifdef GSSAPI
 #include "ssh-gss.h"
@@ -103,9 +104,12 @@ static const struct ssh_conn_info *xxx_conn_info;
 static int
 verify_host_key_callback(struct sshkey *hostkey, struct ssh *ssh)
 {
+	int tid = timing_begin("hostkey", sshkey_type(hostkey));
+
 	if (verify_host_key(xxx_host, xxx_hostaddr, hostkey,
 	    xxx_conn_info) == -1)
 		fatal("Host key verification failed.");
+	timing_end(tid);
 	return 0;
 }
 
@@ -344,6 +348,7 @@ struct cauthctxt {
 	struct cauthmethod *method;
 	sig_atomic_t success;
 	char *authlist;
+	int timing;		/* TimingReport span of the current attempt */
 #ifdef GSSAPI
 	/* gssapi */
 	gss_OID_set gss_supported_mechs;
@@ -476,7 +481,9 @@ ssh_userauth2(struct ssh *ssh, const char *local_user,
 	authctxt.mech_tried = 0;
 #endif
 	authctxt.agent_fd = -1;
+	authctxt.timing = timing_begin("keys", NULL);
 	pubkey_prepare(ssh, &authctxt);
+	timing_end(authctxt.timing);
 	if (authctxt.method == NULL) {
 		fatal_f("internal error: cannot send userauth none request");
 	}
@@ -538,9 +545,15 @@ ssh_userauth2(struct ssh *ssh, const char *local_user,
 		 * the cipher_reset_multithreaded() anymore. We just need to
 		 * force a rekey -cjr 09/08/2022 */
 		const void *cc = ssh_packet_get_send_context(ssh);
-		/* only do this for the ctr cipher. otherwise gcm mode breaks. */
-		if (strstr(cipher_ctx_name(cc), "ctr")) {
-			debug("Single to Multithread CTR cipher swap - client request");
+		/* only do this for the ctr cipher. otherwise gcm mode breaks
+		 * unless the provider has a threaded gcm (OSSL 3.0+) */
+		if (strstr(cipher_ctx_name(cc), "ctr")
+#if OPENSSL_VERSION_NUMBER >= 0x30000000UL
+		    || strstr(cipher_ctx_name(cc), "gcm")
+#endif
+		    ) {
+			debug("Single to Multithread %s cipher swap - client request",
+			    cipher_ctx_name(cc));
 			/* cipher_reset_multithreaded(); */
 			packet_request_rekeying();
 		}
@@ -560,6 +573,7 @@ ssh_userauth2(struct ssh *ssh, const char *local_user,
 static int
 input_userauth_service_accept(int type, u_int32_t seq, struct ssh *ssh)
 {
+	Authctxt *authctxt = ssh->authctxt;
 	int r;
 
 	if (ssh_packet_remaining(ssh) > 0) {
@@ -577,6 +591,7 @@ input_userauth_service_accept(int type, u_int32_t seq, struct ssh *ssh)
 	debug("SSH2_MSG_SERVICE_ACCEPT received");
 
 	/* initial userauth request */
+	authctxt->timing = timing_begin("auth", "none");
 	userauth_none(ssh);
 
 	ssh_dispatch_set(ssh, SSH2_MSG_EXT_INFO, &input_userauth_error);
@@ -602,6 +617,7 @@ userauth(struct ssh *ssh, char *authlist)
 
 	if (authctxt->method != NULL && authctxt->method->cleanup != NULL)
 		authctxt->method->cleanup(ssh);
+	timing_end(authctxt->timing);
 
 	free(authctxt->methoddata);
 	authctxt->methoddata = NULL;
@@ -623,12 +639,14 @@ userauth(struct ssh *ssh, char *authlist)
 		    SSH2_MSG_USERAUTH_PER_METHOD_MAX, NULL);
 
 		/* and try new method */
+		authctxt->timing = timing_begin("auth", method->name);
 		if (method->userauth(ssh) != 0) {
 			debug2("we sent a %s packet, wait for reply", method->name);
 			break;
 		} else {
 			debug2("we did not send a packet, disable method");
 			method->enabled = NULL;
+			timing_end(authctxt->timing);
 		}
 	}
 }
@@ -675,6 +693,7 @@ input_userauth_success(int type, u_int32_t seq, struct ssh *ssh)
 		authctxt->method->cleanup(ssh);
 	free(authctxt->methoddata);
 	authctxt->methoddata = NULL;
+	timing_end(authctxt->timing);
 	authctxt->success = 1;			/* break out */
 	return 0;
 }
@@ -57,6 +57,8 @@
 #include "openbsd-compat/sys-queue.h"
 #include <sys/wait.h>
 
+#include <netinet/tcp.h>
+
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
@@ -75,6 +77,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <limits.h>
+#include <pthread.h>
 
 #ifdef WITH_OPENSSL
 #include <openssl/dh.h>
@@ -127,6 +130,10 @@
 #include "ssherr.h"
 #include "sk-api.h"
 #include "srclimit.h"
+#include "dnscache.h"
+#include "identscreen.h"
+#include "resume.h"
+#include "connstats.h"
 #include "dh.h"
 
 /* Re-exec fds */
@@ -233,6 +240,22 @@ static int *startup_pipes = NULL;
 static int *startup_flags = NULL;	/* Indicates child closed listener */
 static int startup_pipe = -1;		/* in child */
 
+/* connection children forked and reaped, for StatsSocket */
+static int children_forked;
+static volatile sig_atomic_t children_reaped;
+
+/*
+ * MTAESMaxThreads: the listener hands each connection a share of the
+ * keystream threads left and gets it back when the child is reaped.
+ * No more than mtaes_max_threads children can hold a share.
+ */
+static struct mtaes_share {
+	pid_t	pid;		/* 0 if free, -1 while forking */
+	int	threads;
+} *mtaes_shares;
+static volatile sig_atomic_t mtaes_used;
+static int mtaes_share = -1;	/* this connection's share; -1 if unlimited */
+
 /* variables used for privilege separation */
 int use_privsep = -1;
 struct monitor *pmonitor = NULL;
@@ -315,6 +338,7 @@ sighup_restart(void)
 	platform_pre_restart();
 	close_listen_socks();
 	close_startup_pipes();
+	connstats_close(1);
 	ssh_signal(SIGHUP, SIG_IGN); /* will be restored after exec */
 	execv(saved_argv[0], saved_argv);
 	logit("RESTART FAILED: av[0]='%.100s', error: %.100s.", saved_argv[0],
@@ -332,6 +356,67 @@ sigterm_handler(int sig)
 	received_sigterm = sig;
 }
 
+/*
+ * Picks the share of MTAESMaxThreads for the connection about to be forked
+ * and reserves a slot for it in *slotp, or -1 if it gets none.  SIGCHLD
+ * must stay blocked until mtaes_share_set_pid() has recorded the child.
+ */
+static int
+mtaes_share_take(int *slotp)
+{
+	int i, n;
+
+	*slotp = -1;
+	if (mtaes_shares == NULL)
+		return -1;
+#ifdef WITH_OPENSSL
+	n = MINIMUM(cipher_mt_pool_size(),
+	    options.mtaes_max_threads - mtaes_used);
+#else
+	n = 0;
+#endif
+	for (i = 0; n > 0 && i < options.mtaes_max_threads; i++) {
+		if (mtaes_shares[i].pid == 0) {
+			mtaes_shares[i].pid = -1;
+			mtaes_shares[i].threads = n;
+			mtaes_used += n;
+			*slotp = i;
+			return n;
+		}
+	}
+	return 0;
+}
+
+static void
+mtaes_share_set_pid(int slot, pid_t pid)
+{
+	if (slot == -1)
+		return;
+	if (pid > 0) {
+		mtaes_shares[slot].pid = pid;
+		return;
+	}
+	mtaes_used -= mtaes_shares[slot].threads;
+	mtaes_shares[slot].pid = 0;
+}
+
+/* Called from the SIGCHLD handler */
+static void
+mtaes_share_release(pid_t pid)
+{
+	int i;
+
+	if (mtaes_shares == NULL)
+		return;
+	for (i = 0; i < options.mtaes_max_threads; i++) {
+		if (mtaes_shares[i].pid == pid) {
+			mtaes_used -= mtaes_shares[i].threads;
+			mtaes_shares[i].pid = 0;
+			return;
+		}
+	}
+}
+
 /*
  * SIGCHLD handler.  This is called whenever a child dies.  This will then
  * reap any zombies left by exited children.
@@ -345,8 +430,12 @@ main_sigchld_handler(int sig)
 	int status;
 
 	while ((pid = waitpid(-1, &status, WNOHANG)) > 0 ||
-	    (pid == -1 && errno == EINTR))
-		;
+	    (pid == -1 && errno == EINTR)) {
+		if (pid > 0) {
+			children_reaped++;
+			mtaes_share_release(pid);
+		}
+	}
 	errno = save_errno;
 }
 
@@ -528,6 +617,14 @@ privsep_preauth(struct ssh *ssh)
 		/* Arrange for logging to be sent to the monitor */
 		set_log_handler(mm_log_handler, pmonitor);
 
+		/* Only the monitor reports to the listener */
+		if (startup_pipe != -1) {
+			close(startup_pipe);
+			startup_pipe = -1;
+			dnscache_set_report_fd(-1);
+			connstats_set_report_fd(-1);
+		}
+
 		privsep_preauth_child();
 		setproctitle("%s", "[net]");
 		if (box != NULL)
@@ -853,9 +950,10 @@ drop_connection(int sock, int startups, int notify_pipe)
 	static u_int ndropped;
 	LogLevel drop_level = SYSLOG_LEVEL_VERBOSE;
 	time_t now;
+	int full;
 
 	now = monotime();
-	if (!should_drop_connection(startups) &&
+	if (!(full = should_drop_connection(startups)) &&
 	    srclimit_check_allow(sock, notify_pipe) == 1) {
 		if (last_drop != 0 &&
 		    startups < options.max_startups_begin - 1) {
@@ -883,6 +981,7 @@ drop_connection(int sock, int startups, int notify_pipe)
 	}
 	last_drop = now;
 	ndropped++;
+	connstats_drop(full ? "startups" : "source");
 
 	laddr = get_local_ipaddr(sock);
 	raddr = get_peer_ipaddr(sock);
@@ -909,7 +1008,8 @@ usage(void)
 }
 
 static void
-send_rexec_state(int fd, struct sshbuf *conf)
+send_rexec_state(int fd, struct sshbuf *conf, const char *dns_addr,
+    const char *dns_name, int mt_share)
 {
 	struct sshbuf *m = NULL, *inc = NULL;
 	struct include_item *item = NULL;
@@ -938,6 +1038,9 @@ send_rexec_state(int fd, struct sshbuf *conf)
 	 *		string	contents
 	 *	}
 	 *	string	rng_seed (if required)
+	 *	string	cached UseDNS address (empty if none)
+	 *	string	cached UseDNS name (empty if lookup failed)
+	 *	u32	share of MTAESMaxThreads (0xffffffff if unlimited)
 	 */
 	if ((r = sshbuf_put_stringb(m, conf)) != 0 ||
 	    (r = sshbuf_put_stringb(m, inc)) != 0)
@@ -945,6 +1048,11 @@ send_rexec_state(int fd, struct sshbuf *conf)
 #if defined(WITH_OPENSSL) && !defined(OPENSSL_PRNG_ONLY)
 	rexec_send_rng_seed(m);
 #endif
+	if ((r = sshbuf_put_cstring(m, dns_addr)) != 0 ||
+	    (r = sshbuf_put_cstring(m, dns_name)) != 0)
+		fatal_fr(r, "compose dns cache");
+	if ((r = sshbuf_put_u32(m, (u_int)mt_share)) != 0)
+		fatal_fr(r, "compose MTAES share");
 	if (ssh_msg_send(fd, 0, m) == -1)
 		error_f("ssh_msg_send failed");
 
@@ -959,7 +1067,9 @@ recv_rexec_state(int fd, struct sshbuf *conf)
 {
 	struct sshbuf *m, *inc;
 	u_char *cp, ver;
+	char *dns_addr, *dns_name;
 	size_t len;
+	u_int share;
 	int r;
 	struct include_item *item;
 
@@ -980,6 +1090,16 @@ recv_rexec_state(int fd, struct sshbuf *conf)
 #if defined(WITH_OPENSSL) && !defined(OPENSSL_PRNG_ONLY)
 	rexec_recv_rng_seed(m);
 #endif
+	if ((r = sshbuf_get_cstring(m, &dns_addr, NULL)) != 0 ||
+	    (r = sshbuf_get_cstring(m, &dns_name, NULL)) != 0)
+		fatal_fr(r, "parse dns cache");
+	if (*dns_addr != '\0')
+		dnscache_set_hint(dns_addr, *dns_name == '\0' ? NULL : dns_name);
+	free(dns_addr);
+	free(dns_name);
+	if ((r = sshbuf_get_u32(m, &share)) != 0)
+		fatal_fr(r, "parse MTAES share");
+	mtaes_share = (int)share;
 
 	if (conf != NULL && (r = sshbuf_put(conf, cp, len)))
 		fatal_fr(r, "sshbuf_put");
@@ -1076,6 +1196,16 @@ listen_on_addrs(struct listenaddr *la)
 		if (ai->ai_family == AF_INET6)
 			sock_set_v6only(listen_sock);
 
+#ifdef TCP_DEFER_ACCEPT
+		/* Have the kernel hold connections until the client talks */
+		if (options.ident_screen_time > 0 &&
+		    setsockopt(listen_sock, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+		    &options.ident_screen_time,
+		    sizeof(options.ident_screen_time)) == -1)
+			verbose("setsockopt TCP_DEFER_ACCEPT: %s",
+			    strerror(errno));
+#endif
+
 		debug("Bind to port %s on %s.", strport, ntop);
 
 		getsockopt(listen_sock, SOL_SOCKET, SO_RCVBUF,
@@ -1112,6 +1242,14 @@ server_listen(void)
 	/* Initialise per-source limit tracking. */
 	srclimit_init(options.max_startups, options.per_source_max_startups,
 	    options.per_source_masklen_ipv4, options.per_source_masklen_ipv6);
+	if (options.use_dns)
+		dnscache_init(options.max_startups, options.dns_cache_time,
+		    options.dns_cache_negative_time);
+	identscreen_init(options.max_startups, options.ident_screen_time);
+	connstats_init(options.stats_socket);
+	if (options.mtaes_max_threads > 0)
+		mtaes_shares = xcalloc(options.mtaes_max_threads,
+		    sizeof(*mtaes_shares));
 
 	for (i = 0; i < options.num_listen_addrs; i++) {
 		listen_on_addrs(&options.listen_addrs[i]);
@@ -1128,6 +1266,42 @@ server_listen(void)
 		fatal("Cannot bind any address.");
 }
 
+/*
+ * Next connection to start a child for: one that has passed screening, or
+ * failing that one accepted from the next listening socket from *next on
+ * that poll() found ready. Returns -1 once there are none.
+ */
+static int
+next_connection(struct pollfd *pfd, int *next)
+{
+	struct sockaddr_storage from;
+	socklen_t fromlen;
+	int sock;
+
+	if ((sock = identscreen_next()) != -1)
+		return sock;
+	for (; *next < num_listen_socks; (*next)++) {
+		if (!(pfd[*next].revents & POLLIN))
+			continue;
+		fromlen = sizeof(from);
+		sock = accept(listen_socks[*next],
+		    (struct sockaddr *)&from, &fromlen);
+		if (sock == -1) {
+			if (errno != EINTR && errno != EWOULDBLOCK &&
+			    errno != ECONNABORTED && errno != EAGAIN)
+				error("accept: %.100s", strerror(errno));
+			if (errno == EMFILE || errno == ENFILE)
+				usleep(100 * 1000);
+			continue;
+		}
+		if (identscreen_add(sock))
+			continue;
+		(*next)++;
+		return sock;
+	}
+	return -1;
+}
+
 /*
  * The main TCP accept loop. Note that, for the non-debug case, returns
  * from this function are in a forked subprocess.
@@ -1136,12 +1310,13 @@ static void
 server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 {
 	struct pollfd *pfd = NULL;
-	int i, j, ret, npfd;
+	int i, j, ret, npfd, nscreen, nstats, timeout_ms;
 	int ostartups = -1, startups = 0, listening = 0, lameduck = 0;
-	int startup_p[2] = { -1 , -1 }, *startup_pollfd;
-	char c = 0;
-	struct sockaddr_storage from;
-	socklen_t fromlen;
+	int startup_p[2] = { -1 , -1 }, *startup_pollfd, mtaes_slot;
+	char buf[NI_MAXHOST + 3], *dns_addr, *dns_name;
+	ssize_t len;
+	double accepted;
+	struct timespec ts;
 	pid_t pid;
 	u_char rnd[256];
 	sigset_t nsigset, osigset;
@@ -1165,8 +1340,11 @@ server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 	sigaddset(&nsigset, SIGTERM);
 	sigaddset(&nsigset, SIGQUIT);
 
-	/* sized for worst-case */
-	pfd = xcalloc(num_listen_socks + options.max_startups,
+	/*
+	 * sized for worst-case, including held connections being screened
+	 * and the stats socket
+	 */
+	pfd = xcalloc(num_listen_socks + 2 * options.max_startups + 1,
 	    sizeof(struct pollfd));
 
 	/*
@@ -1181,6 +1359,7 @@ server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 			close_listen_socks();
 			if (options.pid_file != NULL)
 				unlink(options.pid_file);
+			connstats_close(1);
 			exit(received_sigterm == SIGTERM ? 0 : 255);
 		}
 		if (ostartups != startups) {
@@ -1197,6 +1376,7 @@ server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 			}
 			if (listening <= 0) {
 				sigprocmask(SIG_SETMASK, &osigset, NULL);
+				identscreen_close();
 				sighup_restart();
 			}
 		}
@@ -1214,9 +1394,20 @@ server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 				startup_pollfd[i] = npfd++;
 			}
 		}
+		nscreen = npfd;
+		npfd += identscreen_pollfds(pfd + nscreen);
+		nstats = npfd;
+		npfd += connstats_pollfds(pfd + nstats);
+		if ((timeout_ms = identscreen_timeout()) >= 0) {
+			ts.tv_sec = timeout_ms / 1000;
+			ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+		}
 
-		/* Wait until a connection arrives or a child exits. */
-		ret = ppoll(pfd, npfd, NULL, &osigset);
+		/*
+		 * Wait until a connection arrives, a child exits or a held
+		 * connection identifies itself or runs out of time.
+		 */
+		ret = ppoll(pfd, npfd, timeout_ms >= 0 ? &ts : NULL, &osigset);
 		if (ret == -1 && errno != EINTR) {
 			error("ppoll: %.100s", strerror(errno));
 			if (errno == EINVAL)
@@ -1231,7 +1422,7 @@ server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 			    startup_pollfd[i] == -1 ||
 			    !(pfd[startup_pollfd[i]].revents & (POLLIN|POLLHUP)))
 				continue;
-			switch (read(startup_pipes[i], &c, sizeof(c))) {
+			switch ((len = read(startup_pipes[i], buf, sizeof(buf)))) {
 			case -1:
 				if (errno == EINTR || errno == EAGAIN)
 					continue;
@@ -1245,6 +1436,7 @@ server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 				/* child exited or completed auth */
 				close(startup_pipes[i]);
 				srclimit_done(startup_pipes[i]);
+				dnscache_done(startup_pipes[i]);
 				startup_pipes[i] = -1;
 				startups--;
 				if (startup_flags[i])
@@ -1257,23 +1449,26 @@ server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 					startup_flags[i] = 0;
 				}
 				break;
+			default:
+				/* the monitor's reports, perhaps after that */
+				if (buf[0] == '\0' && startup_flags[i]) {
+					listening--;
+					startup_flags[i] = 0;
+				}
+				/* it may have resolved the peer's name */
+				dnscache_child_report(startup_pipes[i],
+				    buf, len);
+				/* or have timings to report */
+				connstats_child_report(buf, len);
+				break;
 			}
 		}
-		for (i = 0; i < num_listen_socks; i++) {
-			if (!(pfd[i].revents & POLLIN))
-				continue;
-			fromlen = sizeof(from);
-			*newsock = accept(listen_socks[i],
-			    (struct sockaddr *)&from, &fromlen);
-			if (*newsock == -1) {
-				if (errno != EINTR && errno != EWOULDBLOCK &&
-				    errno != ECONNABORTED && errno != EAGAIN)
-					error("accept: %.100s",
-					    strerror(errno));
-				if (errno == EMFILE || errno == ENFILE)
-					usleep(100 * 1000);
-				continue;
-			}
+		identscreen_check(pfd + nscreen);
+		connstats_check(pfd + nstats, startups, MAXIMUM(0,
+		    children_forked - children_reaped - startups));
+		i = 0;
+		while ((*newsock = next_connection(pfd, &i)) != -1) {
+			accepted = monotime_double();
 			if (unset_nonblock(*newsock) == -1 ||
 			    pipe(startup_p) == -1) {
 				close(*newsock);
@@ -1303,6 +1498,8 @@ server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 					startup_flags[j] = 1;
 					break;
 				}
+			dnscache_accept(*newsock, startup_p[0],
+			    &dns_addr, &dns_name);
 
 			/*
 			 * Got connection.  Fork a child to handle it, unless
@@ -1316,6 +1513,8 @@ server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 				 */
 				debug("Server will not fork when running in debugging mode.");
 				close_listen_socks();
+				identscreen_close();
+				connstats_close(0);
 				*sock_in = *newsock;
 				*sock_out = *newsock;
 				close(startup_p[0]);
@@ -1323,9 +1522,12 @@ server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 				startup_pipe = -1;
 				pid = getpid();
 				if (rexec_flag) {
-					send_rexec_state(config_s[0], cfg);
+					send_rexec_state(config_s[0], cfg,
+					    dns_addr, dns_name, -1);
 					close(config_s[0]);
 				}
+				free(dns_addr);
+				free(dns_name);
 				free(pfd);
 				return;
 			}
@@ -1335,9 +1537,13 @@ server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 			 * the child process the connection. The
 			 * parent continues listening.
 			 */
+			/* until the child is recorded with its share */
+			sigprocmask(SIG_BLOCK, &nsigset, &osigset);
+			mtaes_share = mtaes_share_take(&mtaes_slot);
 			platform_pre_fork();
 			listening++;
 			if ((pid = fork()) == 0) {
+				sigprocmask(SIG_SETMASK, &osigset, NULL);
 				/*
 				 * Child.  Close the listening and
 				 * max_startup sockets.  Start using
@@ -1350,6 +1556,8 @@ server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 				startup_pipe = startup_p[1];
 				close_startup_pipes();
 				close_listen_socks();
+				identscreen_close();
+				connstats_close(0);
 				*sock_in = *newsock;
 				*sock_out = *newsock;
 				log_init(__progname,
@@ -1374,20 +1582,29 @@ server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 			}
 
 			/* Parent.  Stay in the loop. */
+			mtaes_share_set_pid(mtaes_slot, pid);
+			sigprocmask(SIG_SETMASK, &osigset, NULL);
 			platform_post_fork_parent(pid);
 			if (pid == -1)
 				error("fork: %.100s", strerror(errno));
-			else
+			else {
 				debug("Forked child %ld.", (long)pid);
+				children_forked++;
+			}
 
 			close(startup_p[1]);
 
 			if (rexec_flag) {
 				close(config_s[1]);
-				send_rexec_state(config_s[0], cfg);
+				send_rexec_state(config_s[0], cfg,
+				    dns_addr, dns_name, mtaes_share);
 				close(config_s[0]);
 			}
+			free(dns_addr);
+			free(dns_name);
 			close(*newsock);
+			if (pid != -1)
+				connstats_accepted(accepted);
 
 			/*
 			 * Ensure that our random state differs
@@ -2146,6 +2363,14 @@ main(int ac, char **av)
 		    sock_in, sock_out, newsock, startup_pipe, config_s[0]);
 	}
 
+	/* Let the listener cache what we learn about the peer's name */
+	if (options.use_dns && (options.dns_cache_time > 0 ||
+	    options.dns_cache_negative_time > 0))
+		dnscache_set_report_fd(startup_pipe);
+	/* and time the handshake and authentication */
+	if (options.stats_socket != NULL)
+		connstats_set_report_fd(startup_pipe);
+
 	/* Executed child processes don't need these. */
 	fcntl(sock_out, F_SETFD, FD_CLOEXEC);
 	fcntl(sock_in, F_SETFD, FD_CLOEXEC);
@@ -2228,6 +2453,9 @@ main(int ac, char **av)
 	    options.version_addendum)) != 0)
 		sshpkt_fatal(ssh, r, "banner exchange");
 
+	/* Hand a connection resuming an existing session over to it */
+	resume_handoff(ssh, options.resume_timeout > 0);
+
 	ssh_packet_set_nonblocking(ssh);
 
 	/* allocate authentication context */
@@ -2281,9 +2509,13 @@ main(int ac, char **av)
 	alarm(0);
 	ssh_signal(SIGALRM, SIG_DFL);
 	authctxt->authenticated = 1;
+	if (options.resume_timeout > 0)
+		resume_prepare_dir(authctxt->pw);
 	if (startup_pipe != -1) {
 		close(startup_pipe);
 		startup_pipe = -1;
+		dnscache_set_report_fd(-1);
+		connstats_set_report_fd(-1);
 	}
 
 #ifdef SSH_AUDIT_EVENTS
@@ -2317,10 +2549,16 @@ main(int ac, char **av)
 	    options.client_alive_count_max);
 
 	/* Try to send all our hostkeys to the client */
-	notify_hostkeys(ssh);
+	if (options.notify_hostkeys)
+		notify_hostkeys(ssh);
+
+	/* Out of the sandbox: get the keys for the first rekey going */
+	kex_gen_pregen_start(ssh->kex);
 
 #ifdef WITH_OPENSSL
-	if (options.disable_multithreaded == 0) {
+	/* A connection with no share of MTAESMaxThreads keeps stock AES */
+	cipher_set_mt_limit(mtaes_share);
+	if (options.disable_multithreaded == 0 && mtaes_share != 0) {
 		/* if we are using aes-ctr there can be issues in either a fork or sandbox
 		 * so the initial aes-ctr is defined to point to the original single process
 		 * evp. After authentication we'll be past the fork and the sandboxed privsep
@@ -2332,9 +2570,15 @@ main(int ac, char **av)
 		 * force a rekey -cjr 09/08/2022 */
 		const void *cc = ssh_packet_get_send_context(the_active_state);
 
-		/* only rekey if necessary. If we don't do this gcm mode cipher breaks */
-		if (strstr(cipher_ctx_name(cc), "ctr")) {
-			debug("Single to Multithreaded CTR cipher swap - server request");
+		/* only rekey if necessary. If we don't do this gcm mode cipher breaks
+		 * unless the provider has a threaded gcm (OSSL 3.0+) */
+		if (strstr(cipher_ctx_name(cc), "ctr")
+#if OPENSSL_VERSION_NUMBER >= 0x30000000UL
+		    || strstr(cipher_ctx_name(cc), "gcm")
+#endif
+		    ) {
+			debug("Single to Multithreaded %s cipher swap - server request",
+			    cipher_ctx_name(cc));
 			/* cipher_reset_multithreaded(); */
 			packet_request_rekeying();
 		}
@@ -2403,6 +2647,158 @@ sshd_hostkey_sign(struct ssh *ssh, struct sshkey *privkey,
 	return 0;
 }
 
+/*
+ * Hostkey proofs are independent of one another, so when a client asks
+ * for several at once (UpdateHostKeys) the in-memory keys are signed by
+ * a small pool of helper threads. Agent-held keys share one socket and
+ * are signed serially by the calling thread; so are FIDO and XMSS keys,
+ * which are stateful.
+ */
+struct proof_job {
+	struct sshkey *key;		/* private key, NULL if agent-held */
+	struct sshkey *pubkey;
+	struct sshbuf *data;
+	struct hostkey_proof *proof;
+	int r;
+};
+
+struct proof_queue {
+	pthread_mutex_t lock;
+	struct proof_job **jobs;
+	u_int njobs, next;
+	u_int compat;
+};
+
+static void *
+proof_worker(void *arg)
+{
+	struct proof_queue *q = arg;
+	struct proof_job *job;
+
+	for (;;) {
+		pthread_mutex_lock(&q->lock);
+		job = q->next < q->njobs ? q->jobs[q->next++] : NULL;
+		pthread_mutex_unlock(&q->lock);
+		if (job == NULL)
+			return NULL;
+		job->r = sshkey_sign(job->key, &job->proof->sig,
+		    &job->proof->slen, sshbuf_ptr(job->data),
+		    sshbuf_len(job->data), job->proof->alg,
+		    options.sk_provider, NULL, q->compat);
+	}
+}
+
+static int
+proof_threadsafe(const struct sshkey *key)
+{
+	return !sshkey_is_sk(key) &&
+	    sshkey_type_plain(key->type) != KEY_XMSS;
+}
+
+/*
+ * Sign nproofs hostkey proofs for the given session. The signed data
+ * is constructed here rather than taken from the caller, so this is
+ * safe to call from the monitor on behalf of the unprivileged child.
+ */
+int
+hostkey_sign_proofs(struct ssh *ssh, const u_char *session_id,
+    size_t session_id_len, u_int compat, int agent_fd,
+    struct hostkey_proof *proofs, u_int nproofs)
+{
+	struct proof_job *jobs;
+	struct proof_queue q;
+	pthread_t *tids;
+	u_int i, nthreads, nstarted = 0;
+	int r = 0;
+
+	memset(&q, 0, sizeof(q));
+	q.compat = compat;
+	jobs = xcalloc(nproofs, sizeof(*jobs));
+	q.jobs = xcalloc(nproofs, sizeof(*q.jobs));
+	for (i = 0; i < nproofs; i++) {
+		jobs[i].proof = &proofs[i];
+		jobs[i].key = get_hostkey_by_index(proofs[i].ndx);
+		if ((jobs[i].pubkey = get_hostkey_public_by_index(
+		    proofs[i].ndx, ssh)) == NULL) {
+			error_f("no hostkey for index %d", proofs[i].ndx);
+			r = SSH_ERR_KEY_NOT_FOUND;
+			goto out;
+		}
+		if ((jobs[i].data = sshbuf_new()) == NULL)
+			fatal_f("sshbuf_new");
+		if ((r = sshbuf_put_cstring(jobs[i].data,
+		    "hostkeys-prove-00@openssh.com")) != 0 ||
+		    (r = sshbuf_put_string(jobs[i].data, session_id,
+		    session_id_len)) != 0 ||
+		    (r = sshkey_puts(jobs[i].pubkey, jobs[i].data)) != 0) {
+			error_fr(r, "assemble proof %u", i);
+			goto out;
+		}
+		if (jobs[i].key != NULL && proof_threadsafe(jobs[i].key))
+			q.jobs[q.njobs++] = &jobs[i];
+	}
+
+	/* The calling thread works the queue too once it is done below */
+	nthreads = MINIMUM((u_int)options.hostkey_proof_threads, q.njobs);
+	tids = nthreads > 1 ? xcalloc(nthreads - 1, sizeof(*tids)) : NULL;
+	pthread_mutex_init(&q.lock, NULL);
+	for (i = 0; i + 1 < nthreads; i++) {
+		if (pthread_create(&tids[i], NULL, proof_worker, &q) != 0)
+			break;
+		nstarted++;
+	}
+	debug3_f("%u proofs, %u concurrent, %u helper threads",
+	    nproofs, q.njobs, nstarted);
+
+	for (i = 0; i < nproofs; i++) {
+		if (jobs[i].key != NULL && proof_threadsafe(jobs[i].key))
+			continue;
+		if (jobs[i].key != NULL) {
+			jobs[i].r = sshkey_sign(jobs[i].key, &proofs[i].sig,
+			    &proofs[i].slen, sshbuf_ptr(jobs[i].data),
+			    sshbuf_len(jobs[i].data), proofs[i].alg,
+			    options.sk_provider, NULL, compat);
+		} else if (agent_fd != -1) {
+			jobs[i].r = ssh_agent_sign(agent_fd, jobs[i].pubkey,
+			    &proofs[i].sig, &proofs[i].slen,
+			    sshbuf_ptr(jobs[i].data), sshbuf_len(jobs[i].data),
+			    proofs[i].alg, compat);
+		} else
+			jobs[i].r = SSH_ERR_KEY_NOT_FOUND;
+	}
+	proof_worker(&q);
+	for (i = 0; i < nstarted; i++)
+		pthread_join(tids[i], NULL);
+	pthread_mutex_destroy(&q.lock);
+	free(tids);
+
+	for (i = 0; i < nproofs; i++) {
+		if (jobs[i].r != 0) {
+			r = jobs[i].r;
+			error_fr(r, "sign %s proof (index %d)",
+			    sshkey_type(jobs[i].pubkey), proofs[i].ndx);
+			break;
+		}
+	}
+ out:
+	for (i = 0; i < nproofs; i++)
+		sshbuf_free(jobs[i].data);
+	free(jobs);
+	free(q.jobs);
+	return r;
+}
+
+int
+sshd_hostkey_sign_proofs(struct ssh *ssh, struct hostkey_proof *proofs,
+    u_int nproofs)
+{
+	if (use_privsep)
+		return mm_sshkey_sign_proofs(ssh, proofs, nproofs);
+	return hostkey_sign_proofs(ssh, sshbuf_ptr(ssh->kex->session_id),
+	    sshbuf_len(ssh->kex->session_id), ssh->compat, auth_sock,
+	    proofs, nproofs);
+}
+
 /* SSH2 key exchange */
 static void
 do_ssh2_kex(struct ssh *ssh)
@@ -2461,6 +2857,7 @@ do_ssh2_kex(struct ssh *ssh)
 	kex->sign = sshd_hostkey_sign;
 
 	ssh_dispatch_run_fatal(ssh, DISPATCH_BLOCK, &kex->done);
+	mm_inform_kexdone(kex->name);
 
 #ifdef DEBUG_KEXDH
 	/* send 1st encrypted/maced/compressed message */
@@ -48,6 +48,7 @@
 #include <util.h>
 #endif /* HAVE_UTIL_H */
 
+#include "b64.h"
 #include "ssh2.h"
 #include "ssherr.h"
 #include "misc.h"
@@ -1068,7 +1069,8 @@ fingerprint_b64(const char *alg, u_char *dgst_raw, size_t dgst_raw_len)
 	strlcat(ret, ":", rlen);
 	if (dgst_raw_len == 0)
 		return ret;
-	if (b64_ntop(dgst_raw, dgst_raw_len, ret + plen, rlen - plen) == -1) {
+	if (ssh_b64_ntop(dgst_raw, dgst_raw_len, ret + plen,
+	    rlen - plen) == -1) {
 		freezero(ret, rlen);
 		return NULL;
 	}
@@ -1521,6 +1523,130 @@ sshkey_read(struct sshkey *ret, char **cpp)
 	return 0;
 }
 
+/*
+ * Like sshkey_read(), but only decodes the key blob into "blob", without
+ * constructing the key or checking its contents. Used with
+ * sshkey_blob_may_equal() to skip keys that cannot match before paying
+ * for a full parse.
+ */
+int
+sshkey_read_blob(struct sshbuf *blob, char **cpp)
+{
+	char *cp, *blobcopy;
+	size_t space;
+	int r, curve_nid;
+
+	/* Decode type */
+	cp = *cpp;
+	space = strcspn(cp, " \t");
+	if (space == strlen(cp))
+		return SSH_ERR_INVALID_FORMAT;
+	if (peek_type_nid(cp, space, &curve_nid) == KEY_UNSPEC)
+		return SSH_ERR_INVALID_FORMAT;
+
+	/* skip whitespace */
+	for (cp += space; *cp == ' ' || *cp == '\t'; cp++)
+		;
+	if (*cp == '\0')
+		return SSH_ERR_INVALID_FORMAT;
+
+	/* find end of keyblob and decode */
+	space = strcspn(cp, " \t");
+	if ((blobcopy = strndup(cp, space)) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	sshbuf_reset(blob);
+	r = sshbuf_b64tod(blob, blobcopy);
+	free(blobcopy);
+	if (r != 0)
+		return r;
+
+	/* skip whitespace and leave cp at start of comment */
+	for (cp += space; *cp == ' ' || *cp == '\t'; cp++)
+		;
+	*cpp = cp;
+	return 0;
+}
+
+/* Returns 0 if an mpint has a needless leading zero byte */
+static int
+peek_mpint_minimal(struct sshbuf *b)
+{
+	const u_char *d;
+	size_t len;
+
+	if (sshbuf_get_string_direct(b, &d, &len) != 0)
+		return 1; /* malformed; will not parse */
+	return len < 1 || d[0] != 0 || (len > 1 && (d[1] & 0x80) != 0);
+}
+
+/*
+ * Returns 0 if a plain key blob has a non-minimal encoding, i.e. RSA or
+ * DSA numbers with extra leading zeroes, that could still parse to the
+ * same key as a different, minimal blob.
+ */
+static int
+peek_blob_minimal(struct sshbuf *b, int type)
+{
+	int i;
+
+	switch (type) {
+	case KEY_RSA:
+		return peek_mpint_minimal(b) && peek_mpint_minimal(b);
+	case KEY_DSA:
+		for (i = 0; i < 4; i++) {
+			if (!peek_mpint_minimal(b))
+				return 0;
+		}
+		return 1;
+	case KEY_ECDSA:
+	case KEY_ECDSA_SK:
+		/* only uncompressed points are accepted */
+	case KEY_ED25519:
+	case KEY_ED25519_SK:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Cheaply checks whether the key blob "blob" may hold the same key as
+ * "want", which must have been serialised by this library. Certificates
+ * are compared as sshkey_equal() does, by their full blob. Returns 1 if
+ * the keys may be equal and need a full sshkey_equal() check after
+ * parsing, 0 if they cannot be.
+ */
+int
+sshkey_blob_may_equal(const struct sshbuf *blob, const struct sshbuf *want)
+{
+	struct sshbuf *b;
+	const u_char *tname, *wname;
+	size_t tlen, wlen;
+	int type, wtype, nid, ret;
+
+	if (sshbuf_len(blob) == sshbuf_len(want) &&
+	    sshbuf_cmp(blob, 0, sshbuf_ptr(want), sshbuf_len(want)) == 0)
+		return 1;
+	if (sshbuf_peek_string_direct(want, &wname, &wlen) != 0)
+		return 1;
+	if (sshbuf_peek_string_direct(blob, &tname, &tlen) != 0)
+		return 0; /* malformed; will not parse */
+	type = peek_type_nid((const char *)tname, tlen, &nid);
+	if (tlen != wlen || memcmp(tname, wname, wlen) != 0) {
+		/* a certificate may still carry the wanted public key */
+		wtype = peek_type_nid((const char *)wname, wlen, &nid);
+		return sshkey_type_is_cert(type) || sshkey_type_is_cert(wtype);
+	}
+	if (sshkey_type_is_cert(type))
+		return 0;
+	if ((b = sshbuf_from(sshbuf_ptr(blob) + 4 + tlen,
+	    sshbuf_len(blob) - 4 - tlen)) == NULL)
+		return 1;
+	ret = !peek_blob_minimal(b, type);
+	sshbuf_free(b);
+	return ret;
+}
+
 
 int
 sshkey_to_base64(const struct sshkey *key, char **b64p)
@@ -178,6 +178,9 @@ const char	*sshkey_cert_type(const struct sshkey *);
 int		 sshkey_format_text(const struct sshkey *, struct sshbuf *);
 int		 sshkey_write(const struct sshkey *, FILE *);
 int		 sshkey_read(struct sshkey *, char **);
+int		 sshkey_read_blob(struct sshbuf *, char **);
+int		 sshkey_blob_may_equal(const struct sshbuf *,
+    const struct sshbuf *);
 u_int		 sshkey_size(const struct sshkey *);
 
 int		 sshkey_generate(int type, u_int bits, struct sshkey **keyp);
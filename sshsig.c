@@ -715,10 +715,46 @@ sshsigopt_free(struct sshsigopt *opts)
 	free(opts);
 }
 
+/* Raw blobs of the keys an allowed_signers line must hold to match */
+struct allowed_key_want {
+	struct sshbuf *key;	/* the signing key */
+	struct sshbuf *ca;	/* its CA, if a certificate */
+	struct sshbuf *blob;	/* scratch */
+};
+
+static void
+allowed_key_want_init(struct allowed_key_want *want,
+    const struct sshkey *sign_key)
+{
+	int r;
+
+	memset(want, 0, sizeof(*want));
+	if ((want->key = sshbuf_new()) == NULL ||
+	    (want->blob = sshbuf_new()) == NULL)
+		fatal_f("sshbuf_new failed");
+	if ((r = sshkey_putb(sign_key, want->key)) != 0)
+		fatal_fr(r, "sshkey_putb");
+	if (sshkey_is_cert(sign_key)) {
+		if ((want->ca = sshbuf_new()) == NULL)
+			fatal_f("sshbuf_new failed");
+		if ((r = sshkey_putb(sign_key->cert->signature_key,
+		    want->ca)) != 0)
+			fatal_fr(r, "sshkey_putb CA");
+	}
+}
+
+static void
+allowed_key_want_free(struct allowed_key_want *want)
+{
+	sshbuf_free(want->key);
+	sshbuf_free(want->ca);
+	sshbuf_free(want->blob);
+}
+
 static int
 parse_principals_key_and_options(const char *path, u_long linenum, char *line,
-    const char *required_principal, char **principalsp, struct sshkey **keyp,
-    struct sshsigopt **sigoptsp)
+    const char *required_principal, const struct allowed_key_want *want,
+    char **principalsp, struct sshkey **keyp, struct sshsigopt **sigoptsp)
 {
 	char *opts = NULL, *tmp, *cp, *principals = NULL;
 	const char *reason = NULL;
@@ -763,6 +799,14 @@ parse_principals_key_and_options(const char *path, u_long linenum, char *line,
 		debug_f("%s:%lu: matched principal \"%s\"",
 		    path, linenum, required_principal);
 	}
+	/* Likewise if the key cannot match; skips parsing it */
+	if (want != NULL && sshkey_line_blob(cp, want->blob) == 0 &&
+	    !sshkey_blob_may_equal(want->blob, want->key) &&
+	    (want->ca == NULL ||
+	    !sshkey_blob_may_equal(want->blob, want->ca))) {
+		r = SSH_ERR_KEY_NOT_FOUND;
+		goto out;
+	}
 
 	if ((key = sshkey_new(KEY_UNSPEC)) == NULL) {
 		error_f("sshkey_new failed");
@@ -875,8 +919,9 @@ cert_filter_principals(const char *path, u_long linenum,
 
 static int
 check_allowed_keys_line(const char *path, u_long linenum, char *line,
-    const struct sshkey *sign_key, const char *principal,
-    const char *sig_namespace, uint64_t verify_time, char **principalsp)
+    const struct sshkey *sign_key, const struct allowed_key_want *want,
+    const char *principal, const char *sig_namespace, uint64_t verify_time,
+    char **principalsp)
 {
 	struct sshkey *found_key = NULL;
 	char *principals = NULL;
@@ -890,7 +935,7 @@ check_allowed_keys_line(const char *path, u_long linenum, char *line,
 
 	/* Parse the line */
 	if ((r = parse_principals_key_and_options(path, linenum, line,
-	    principal, &principals, &found_key, &sigopts)) != 0) {
+	    principal, want, &principals, &found_key, &sigopts)) != 0) {
 		/* error already logged */
 		goto done;
 	}
@@ -977,6 +1022,7 @@ sshsig_check_allowed_keys(const char *path, const struct sshkey *sign_key,
 	size_t linesize = 0;
 	u_long linenum = 0;
 	int r = SSH_ERR_INTERNAL_ERROR, oerrno;
+	struct allowed_key_want want;
 
 	/* Check key and principal against file */
 	if ((f = fopen(path, "r")) == NULL) {
@@ -987,10 +1033,11 @@ sshsig_check_allowed_keys(const char *path, const struct sshkey *sign_key,
 		return SSH_ERR_SYSTEM_ERROR;
 	}
 
+	allowed_key_want_init(&want, sign_key);
 	while (getline(&line, &linesize, f) != -1) {
 		linenum++;
 		r = check_allowed_keys_line(path, linenum, line, sign_key,
-		    principal, sig_namespace, verify_time, NULL);
+		    &want, principal, sig_namespace, verify_time, NULL);
 		free(line);
 		line = NULL;
 		linesize = 0;
@@ -999,6 +1046,7 @@ sshsig_check_allowed_keys(const char *path, const struct sshkey *sign_key,
 		else if (r == 0) {
 			/* success */
 			fclose(f);
+			allowed_key_want_free(&want);
 			return 0;
 		} else
 			break;
@@ -1006,6 +1054,7 @@ sshsig_check_allowed_keys(const char *path, const struct sshkey *sign_key,
 	/* Either we hit an error parsing or we simply didn't find the key */
 	fclose(f);
 	free(line);
+	allowed_key_want_free(&want);
 	return r == 0 ? SSH_ERR_KEY_NOT_FOUND : r;
 }
 
@@ -1018,6 +1067,7 @@ sshsig_find_principals(const char *path, const struct sshkey *sign_key,
 	size_t linesize = 0;
 	u_long linenum = 0;
 	int r = SSH_ERR_INTERNAL_ERROR, oerrno;
+	struct allowed_key_want want;
 
 	if ((f = fopen(path, "r")) == NULL) {
 		oerrno = errno;
@@ -1027,11 +1077,12 @@ sshsig_find_principals(const char *path, const struct sshkey *sign_key,
 		return SSH_ERR_SYSTEM_ERROR;
 	}
 
+	allowed_key_want_init(&want, sign_key);
 	r = SSH_ERR_KEY_NOT_FOUND;
 	while (getline(&line, &linesize, f) != -1) {
 		linenum++;
 		r = check_allowed_keys_line(path, linenum, line,
-		    sign_key, NULL, NULL, verify_time, principals);
+		    sign_key, &want, NULL, NULL, verify_time, principals);
 		free(line);
 		line = NULL;
 		linesize = 0;
@@ -1040,11 +1091,13 @@ sshsig_find_principals(const char *path, const struct sshkey *sign_key,
 		else if (r == 0) {
 			/* success */
 			fclose(f);
+			allowed_key_want_free(&want);
 			return 0;
 		} else
 			break;
 	}
 	free(line);
+	allowed_key_want_free(&want);
 	/* Either we hit an error parsing or we simply didn't find the key */
 	if (ferror(f) != 0) {
 		oerrno = errno;
@@ -1086,7 +1139,7 @@ sshsig_match_principals(const char *path, const char *principal,
 		linenum++;
 		/* Parse the line */
 		if ((r = parse_principals_key_and_options(path, linenum, line,
-		    principal, &found, NULL, NULL)) != 0) {
+		    principal, NULL, &found, NULL, NULL)) != 0) {
 			if (r == SSH_ERR_KEY_NOT_FOUND)
 				continue;
 			ret = r;
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2026 Pittsburgh Supercomputing Center. All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "includes.h"
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "atomicio.h"
+#include "log.h"
+#include "misc.h"
+#include "sshbuf.h"
+#include "ssherr.h"
+#include "timing.h"
+#include "xmalloc.h"
+
+#define TIMING_MAX_PHASES	64
+
+static struct timing_phase {
+	char *phase;
+	char *detail;
+	double start, end;	/* monotonic; end is < 0 while open */
+} phases[TIMING_MAX_PHASES];
+static u_int nphases;
+
+static double mono0, wall0;
+static char *report_spec, *report_host;
+static int reported;
+
+void
+timing_start(void)
+{
+	struct timeval tv;
+
+	mono0 = monotime_double();
+	gettimeofday(&tv, NULL);
+	wall0 = tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Returns an id to pass to timing_end(), or -1 if there is no room left */
+int
+timing_begin(const char *phase, const char *detail)
+{
+	struct timing_phase *p;
+
+	if (nphases >= TIMING_MAX_PHASES)
+		return -1;
+	p = &phases[nphases];
+	p->phase = xstrdup(phase);
+	p->detail = detail == NULL ? NULL : xstrdup(detail);
+	p->start = monotime_double();
+	p->end = -1;
+	return nphases++;
+}
+
+void
+timing_end(int id)
+{
+	if (id < 0 || (u_int)id >= nphases || phases[id].end >= 0)
+		return;
+	phases[id].end = monotime_double();
+}
+
+/* spec is "json:path" or "text:path", where a path of "-" is stderr */
+void
+timing_set_report(const char *spec, const char *host)
+{
+	free(report_spec);
+	free(report_host);
+	report_spec = spec == NULL ? NULL : xstrdup(spec);
+	report_host = xstrdup(host);
+}
+
+static int
+put_json_string(struct sshbuf *b, const char *s)
+{
+	int r;
+
+	if ((r = sshbuf_put_u8(b, '"')) != 0)
+		return r;
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			r = sshbuf_putf(b, "\\%c", *s);
+		else if ((u_char)*s < 0x20)
+			r = sshbuf_putf(b, "\\u%04x", (u_char)*s);
+		else
+			r = sshbuf_put_u8(b, *s);
+		if (r != 0)
+			return r;
+	}
+	return sshbuf_put_u8(b, '"');
+}
+
+static int
+format_json(struct sshbuf *b, int complete, double now)
+{
+	struct timing_phase *p;
+	u_int i;
+	int r;
+
+	if ((r = sshbuf_put(b, "{\"host\":", 8)) != 0 ||
+	    (r = put_json_string(b, report_host)) != 0 ||
+	    (r = sshbuf_putf(b, ",\"start\":%.6f,\"complete\":%s,"
+	    "\"total_ms\":%.3f,\"phases\":[", wall0,
+	    complete ? "true" : "false", (now - mono0) * 1000)) != 0)
+		return r;
+	for (i = 0; i < nphases; i++) {
+		p = &phases[i];
+		if ((r = sshbuf_putf(b, "%s{\"phase\":",
+		    i == 0 ? "" : ",")) != 0 ||
+		    (r = put_json_string(b, p->phase)) != 0)
+			return r;
+		if (p->detail != NULL &&
+		    ((r = sshbuf_put(b, ",\"detail\":", 10)) != 0 ||
+		    (r = put_json_string(b, p->detail)) != 0))
+			return r;
+		if ((r = sshbuf_putf(b, ",\"start_ms\":%.3f,\"ms\":",
+		    (p->start - mono0) * 1000)) != 0)
+			return r;
+		if (p->end < 0)
+			r = sshbuf_putf(b, "null}");
+		else
+			r = sshbuf_putf(b, "%.3f}", (p->end - p->start) * 1000);
+		if (r != 0)
+			return r;
+	}
+	return sshbuf_put(b, "]}\n", 3);
+}
+
+static int
+format_text(struct sshbuf *b, int complete, double now)
+{
+	struct timing_phase *p;
+	u_int i;
+	int r;
+
+	if ((r = sshbuf_putf(b, "Connection timing for %s%s: %.3f ms\n",
+	    report_host, complete ? "" : " (incomplete)",
+	    (now - mono0) * 1000)) != 0)
+		return r;
+	for (i = 0; i < nphases; i++) {
+		p = &phases[i];
+		if (p->end < 0)
+			r = sshbuf_putf(b, "  %10.3f %10s ms  %s%s%s\n",
+			    (p->start - mono0) * 1000, "-", p->phase,
+			    p->detail == NULL ? "" : " ",
+			    p->detail == NULL ? "" : p->detail);
+		else
+			r = sshbuf_putf(b, "  %10.3f %10.3f ms  %s%s%s\n",
+			    (p->start - mono0) * 1000,
+			    (p->end - p->start) * 1000, p->phase,
+			    p->detail == NULL ? "" : " ",
+			    p->detail == NULL ? "" : p->detail);
+		if (r != 0)
+			return r;
+	}
+	return 0;
+}
+
+/*
+ * Writes the report, if one was asked for and it hasn't been written
+ * already. complete is zero if ssh is giving up before the session was
+ * set up. Each report is appended with a single write(2), so several
+ * clients may share a file.
+ */
+void
+timing_report(int complete)
+{
+	struct sshbuf *b;
+	const char *path;
+	double now = monotime_double();
+	int r, fd, json;
+
+	if (report_spec == NULL || reported)
+		return;
+	reported = 1;
+	json = strncmp(report_spec, "json:", 5) == 0;
+	path = report_spec + 5;
+
+	if ((b = sshbuf_new()) == NULL)
+		fatal_f("sshbuf_new failed");
+	if ((r = json ? format_json(b, complete, now) :
+	    format_text(b, complete, now)) != 0)
+		fatal_fr(r, "format");
+	if (strcmp(path, "-") == 0)
+		fd = STDERR_FILENO;
+	else if ((fd = open(path, O_WRONLY|O_CREAT|O_APPEND, 0600)) == -1) {
+		error("TimingReport: open %s: %s", path, strerror(errno));
+		goto out;
+	}
+	if (atomicio(vwrite, fd, sshbuf_mutable_ptr(b),
+	    sshbuf_len(b)) != sshbuf_len(b))
+		error("TimingReport: write %s: %s", path, strerror(errno));
+	if (fd != STDERR_FILENO)
+		close(fd);
+ out:
+	sshbuf_free(b);
+}
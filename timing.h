@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2026 Pittsburgh Supercomputing Center. All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _TIMING_H
+#define _TIMING_H
+
+/*
+ * Where the time goes while ssh sets up a connection. Phases are spans
+ * of monotonic time, begun and ended around each step (configuration,
+ * name lookups, connecting, key exchange, host key checks, each
+ * authentication attempt and opening the session) and written out once
+ * as a summary if TimingReport is set.
+ */
+void	timing_start(void);
+int	timing_begin(const char *phase, const char *detail);
+void	timing_end(int);
+void	timing_set_report(const char *spec, const char *host);
+void	timing_report(int complete);
+
+#endif /* _TIMING_H */